@@ -0,0 +1,540 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "benchmark.hpp"
+
+// readybase:
+#include <FormulaOpenCLImageRD.hpp>
+#include <FormulaOpenCLMeshRD.hpp>
+#include <FullKernelOpenCLImageRD.hpp>
+#include <GrayScottImageRD.hpp>
+#include <GrayScottMeshRD.hpp>
+#include <MeshGenerators.hpp>
+#include <OpenCL_utils.hpp>
+#include <utils.hpp>
+
+// VTK:
+#include <vtkSmartPointer.h>
+#include <vtkUnstructuredGrid.h>
+#include <vtkXMLDataElement.h>
+
+// STL:
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+// stdlib:
+#include <float.h>
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// One entry in the benchmark matrix.
+struct BenchmarkCase
+{
+    string engine;                  ///< the class name of the implementation
+    bool is_mesh;
+    int x,y,z;                      ///< image dimensions, or for meshes x is the size passed to the mesh generator
+    string mesh_type;               ///< "triangular" or "bcc"
+    int n_chemicals;
+    string neighborhood_type,neighborhood_weight;   ///< empty for the defaults
+};
+
+/// The timings for one entry.
+struct BenchmarkResult
+{
+    BenchmarkResult() : dimensionality(0), n_cells(0), n_steps(0), run_seconds(0.0), setup_seconds(0.0),
+        kernel_build_seconds(-1.0), upload_seconds(-1.0), download_seconds(-1.0) {}
+
+    int dimensionality;
+    int n_cells;
+    int n_steps;
+    double run_seconds;
+    double setup_seconds;           ///< creating the system, including its first kernel build and upload
+    double kernel_build_seconds;    ///< -1 if not applicable; inferred, less the download time (see RunCase)
+    double upload_seconds;          ///< -1 if not applicable; inferred, less the download time (see RunCase)
+    double download_seconds;        ///< -1 if not applicable
+    string stencil;
+    string error;
+};
+
+static const int DATA_TYPE = VTK_FLOAT;
+static const int MAX_STEPS_PER_CASE = 1 << 20;
+
+// -------------------------------------------------------------------------------------------------------------
+
+static BenchmarkCase ImageCase(const string& engine,int x,int y,int z,int nc,
+                               const string& neighborhood_type="",const string& neighborhood_weight="")
+{
+    BenchmarkCase bc;
+    bc.engine = engine;
+    bc.is_mesh = false;
+    bc.x = x; bc.y = y; bc.z = z;
+    bc.n_chemicals = nc;
+    bc.neighborhood_type = neighborhood_type;
+    bc.neighborhood_weight = neighborhood_weight;
+    return bc;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static BenchmarkCase MeshCase(const string& engine,const string& mesh_type,int size,int nc)
+{
+    BenchmarkCase bc;
+    bc.engine = engine;
+    bc.is_mesh = true;
+    bc.x = size; bc.y = bc.z = 0;
+    bc.mesh_type = mesh_type;
+    bc.n_chemicals = nc;
+    return bc;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static string GetArenaDescription(const BenchmarkCase& bc)
+{
+    ostringstream oss;
+    if(bc.is_mesh) oss << bc.mesh_type << " " << bc.x;
+    else oss << bc.x << "x" << bc.y << "x" << bc.z;
+    return oss.str();
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static bool IsOpenCLEngine(const string& engine)
+{
+    return engine.find("OpenCL") != string::npos;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// A reaction-diffusion formula for any number of chemicals, each coupled to the next.
+static string MakeFormula(int nc)
+{
+    ostringstream oss;
+    for(int i=0;i<nc;i++)
+    {
+        string c = GetChemicalName(i);
+        string next = GetChemicalName((i+1)%nc);
+        oss << "delta_" << c << " = D * laplacian_" << c << " + k * (" << next << " - " << c << ");\n";
+    }
+    return oss.str();
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Gray-Scott as a full kernel, with a 7-point stencil and wrap-around (for any image size).
+static string MakeKernel()
+{
+    return
+        "__kernel void rd_compute(__global float* a_in,__global float* b_in,__global float* a_out,__global float* b_out)\n"
+        "{\n"
+        "    const int x = get_global_id(0);\n"
+        "    const int y = get_global_id(1);\n"
+        "    const int z = get_global_id(2);\n"
+        "    const int X = get_global_size(0);\n"
+        "    const int Y = get_global_size(1);\n"
+        "    const int Z = get_global_size(2);\n"
+        "    const int i_here = X*(Y*z + y) + x;\n"
+        "    const int i_left = X*(Y*z + y) + (x-1+X)%X;\n"
+        "    const int i_right = X*(Y*z + y) + (x+1)%X;\n"
+        "    const int i_up = X*(Y*z + (y-1+Y)%Y) + x;\n"
+        "    const int i_down = X*(Y*z + (y+1)%Y) + x;\n"
+        "    const int i_fore = X*(Y*((z-1+Z)%Z) + y) + x;\n"
+        "    const int i_back = X*(Y*((z+1)%Z) + y) + x;\n"
+        "    const float a = a_in[i_here];\n"
+        "    const float b = b_in[i_here];\n"
+        "    const float laplacian_a = a_in[i_left] + a_in[i_right] + a_in[i_up] + a_in[i_down] + a_in[i_fore] + a_in[i_back] - 6.0f*a;\n"
+        "    const float laplacian_b = b_in[i_left] + b_in[i_right] + b_in[i_up] + b_in[i_down] + b_in[i_fore] + b_in[i_back] - 6.0f*b;\n"
+        "    a_out[i_here] = a + 0.082f * laplacian_a - a*b*b + 0.035f*(1.0f-a);\n"
+        "    b_out[i_here] = b + 0.041f * laplacian_b + a*b*b - (0.035f+0.06f)*b;\n"
+        "}\n";
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void AddParameter(vtkXMLDataElement* rule,const string& name,float value)
+{
+    vtkSmartPointer<vtkXMLDataElement> param = vtkSmartPointer<vtkXMLDataElement>::New();
+    param->SetName("param");
+    param->SetAttribute("name",name.c_str());
+    string s = to_string(value);
+    param->SetCharacterData(s.c_str(),(int)s.length());
+    rule->AddNestedElement(param);
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Makes the RD element that a pattern file for this case would have.
+static vtkSmartPointer<vtkXMLDataElement> MakeRDElement(const BenchmarkCase& bc)
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = vtkSmartPointer<vtkXMLDataElement>::New();
+    rd->SetName("RD");
+    rd->SetIntAttribute("format_version",4);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = vtkSmartPointer<vtkXMLDataElement>::New();
+    rule->SetName("rule");
+    if(!bc.neighborhood_type.empty())
+        rule->SetAttribute("neighborhood_type",bc.neighborhood_type.c_str());
+    if(!bc.neighborhood_weight.empty())
+        rule->SetAttribute("neighborhood_weight",bc.neighborhood_weight.c_str());
+    AddParameter(rule,"timestep",1.0f);
+    if(bc.engine.find("GrayScott") != string::npos)
+    {
+        rule->SetAttribute("name","Gray-Scott");
+        rule->SetAttribute("type","inbuilt");
+        AddParameter(rule,"D_a",0.082f);
+        AddParameter(rule,"D_b",0.041f);
+        AddParameter(rule,"k",0.06f);
+        AddParameter(rule,"F",0.035f);
+    }
+    else if(bc.engine.find("FullKernel") != string::npos)
+    {
+        rule->SetAttribute("name","Benchmark kernel");
+        rule->SetAttribute("type","kernel");
+        vtkSmartPointer<vtkXMLDataElement> kernel = vtkSmartPointer<vtkXMLDataElement>::New();
+        kernel->SetName("kernel");
+        kernel->SetIntAttribute("number_of_chemicals",bc.n_chemicals);
+        kernel->SetIntAttribute("block_size_x",1);
+        kernel->SetIntAttribute("block_size_y",1);
+        kernel->SetIntAttribute("block_size_z",1);
+        string k = MakeKernel();
+        kernel->SetCharacterData(k.c_str(),(int)k.length());
+        rule->AddNestedElement(kernel);
+    }
+    else
+    {
+        rule->SetAttribute("name","Benchmark formula");
+        rule->SetAttribute("type","formula");
+        AddParameter(rule,"D",0.05f);
+        AddParameter(rule,"k",0.01f);
+        vtkSmartPointer<vtkXMLDataElement> formula = vtkSmartPointer<vtkXMLDataElement>::New();
+        formula->SetName("formula");
+        formula->SetIntAttribute("number_of_chemicals",bc.n_chemicals);
+        string f = MakeFormula(bc.n_chemicals);
+        formula->SetCharacterData(f.c_str(),(int)f.length());
+        rule->AddNestedElement(formula);
+    }
+    rd->AddNestedElement(rule);
+
+    // start from white noise, so that the values are representative
+    vtkSmartPointer<vtkXMLDataElement> ipg = vtkSmartPointer<vtkXMLDataElement>::New();
+    ipg->SetName("initial_pattern_generator");
+    for(int i=0;i<bc.n_chemicals;i++)
+    {
+        vtkSmartPointer<vtkXMLDataElement> overlay = vtkSmartPointer<vtkXMLDataElement>::New();
+        overlay->SetName("overlay");
+        overlay->SetAttribute("chemical",GetChemicalName(i).c_str());
+        vtkSmartPointer<vtkXMLDataElement> overwrite = vtkSmartPointer<vtkXMLDataElement>::New();
+        overwrite->SetName("overwrite");
+        overlay->AddNestedElement(overwrite);
+        vtkSmartPointer<vtkXMLDataElement> noise = vtkSmartPointer<vtkXMLDataElement>::New();
+        noise->SetName("white_noise");
+        noise->SetAttribute("low","0");
+        noise->SetAttribute("high","1");
+        overlay->AddNestedElement(noise);
+        vtkSmartPointer<vtkXMLDataElement> everywhere = vtkSmartPointer<vtkXMLDataElement>::New();
+        everywhere->SetName("everywhere");
+        overlay->AddNestedElement(everywhere);
+        ipg->AddNestedElement(overlay);
+    }
+    rd->AddNestedElement(ipg);
+
+    return rd;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static AbstractRD* CreateSystem(const BenchmarkCase& bc,int opencl_platform,int opencl_device)
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = MakeRDElement(bc);
+    bool warn_to_update;
+    if(!bc.is_mesh)
+    {
+        ImageRD *image_system;
+        if(bc.engine=="GrayScottImageRD")
+            image_system = new GrayScottImageRD();
+        else if(bc.engine=="FormulaOpenCLImageRD")
+            image_system = new FormulaOpenCLImageRD(opencl_platform,opencl_device,DATA_TYPE);
+        else if(bc.engine=="FullKernelOpenCLImageRD")
+            image_system = new FullKernelOpenCLImageRD(opencl_platform,opencl_device,DATA_TYPE);
+        else
+            throw runtime_error("CreateSystem : unknown engine: "+bc.engine);
+        try
+        {
+            image_system->InitializeFromXML(rd,warn_to_update);
+            image_system->SetDimensionsAndNumberOfChemicals(bc.x,bc.y,bc.z,bc.n_chemicals);
+        }
+        catch(...)
+        {
+            delete image_system;
+            throw;
+        }
+        return image_system;
+    }
+    else
+    {
+        vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
+        if(bc.mesh_type=="triangular")
+            MeshGenerators::GetTriangularMesh(bc.x,bc.x,mesh,bc.n_chemicals,DATA_TYPE);
+        else if(bc.mesh_type=="bcc")
+            MeshGenerators::GetBodyCentredCubicHoneycomb(bc.x,mesh,bc.n_chemicals,DATA_TYPE);
+        else
+            throw runtime_error("CreateSystem : unknown mesh type: "+bc.mesh_type);
+        MeshRD *mesh_system;
+        if(bc.engine=="GrayScottMeshRD")
+            mesh_system = new GrayScottMeshRD();
+        else if(bc.engine=="FormulaOpenCLMeshRD")
+            mesh_system = new FormulaOpenCLMeshRD(opencl_platform,opencl_device,DATA_TYPE);
+        else
+            throw runtime_error("CreateSystem : unknown engine: "+bc.engine);
+        try
+        {
+            mesh_system->InitializeFromXML(rd,warn_to_update);
+            mesh_system->CopyFromMesh(mesh);
+        }
+        catch(...)
+        {
+            delete mesh_system;
+            throw;
+        }
+        return mesh_system;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static BenchmarkResult RunCase(const BenchmarkCase& bc,int opencl_platform,int opencl_device,double min_seconds)
+{
+    BenchmarkResult result;
+    AbstractRD *system = NULL;
+    try
+    {
+        double time_before = get_time_in_seconds();
+        system = CreateSystem(bc,opencl_platform,opencl_device);
+        system->GenerateInitialPattern();
+        system->Update(1); // first run does any remaining setup, e.g. uploading the pattern
+        result.setup_seconds = get_time_in_seconds() - time_before;
+
+        result.dimensionality = system->GetArenaDimensionality();
+        result.n_cells = system->GetNumberOfCells();
+        if(system->GetRuleType()=="inbuilt")
+            result.stencil = "inbuilt";
+        else
+            result.stencil = system->GetNeighborhoodType() + "," + system->GetNeighborhoodWeight();
+
+        // keep doubling the number of steps until the run takes long enough to time reliably
+        for(result.n_steps=1;;result.n_steps*=2)
+        {
+            time_before = get_time_in_seconds();
+            system->Update(result.n_steps);
+            result.run_seconds = get_time_in_seconds() - time_before;
+            if(result.run_seconds >= min_seconds || result.n_steps >= MAX_STEPS_PER_CASE)
+                break;
+        }
+
+        if(IsOpenCLEngine(bc.engine))
+        {
+            // with no steps to take, an update only moves data (and builds the kernel if needed); every such update
+            // also reads the image back, so the upload and build times are inferred by taking off the download time
+            time_before = get_time_in_seconds();
+            system->Update(0);
+            result.download_seconds = get_time_in_seconds() - time_before;
+
+            system->GenerateInitialPattern(); // (makes the next update upload the data)
+            time_before = get_time_in_seconds();
+            system->Update(0);
+            result.upload_seconds = max(0.0, get_time_in_seconds() - time_before - result.download_seconds);
+
+            system->SetFormula(system->GetFormula()+" "); // (makes the next update rebuild the kernel)
+            time_before = get_time_in_seconds();
+            system->Update(0);
+            result.kernel_build_seconds = max(0.0, get_time_in_seconds() - time_before - result.download_seconds);
+        }
+    }
+    catch(const exception& e)
+    {
+        result.error = e.what();
+    }
+    catch(...)
+    {
+        result.error = "unknown error";
+    }
+    delete system;
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static string JSONString(const string& s)
+{
+    ostringstream oss;
+    oss << "\"";
+    for(size_t i=0;i<s.length();i++)
+    {
+        switch(s[i])
+        {
+            case '"':  oss << "\\\""; break;
+            case '\\': oss << "\\\\"; break;
+            case '\n': oss << "\\n"; break;
+            case '\r': oss << "\\r"; break;
+            case '\t': oss << "\\t"; break;
+            default:
+                if((unsigned char)s[i] < 0x20) oss << " ";
+                else oss << s[i];
+        }
+    }
+    oss << "\"";
+    return oss.str();
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static string JSONNumber(double value)
+{
+    if(value < 0.0) return "null"; // not applicable
+    if(value != value || value > DBL_MAX) return "null"; // (e.g. a rate from a run too quick to time)
+    ostringstream oss;
+    oss.precision(6);
+    oss << value;
+    return oss.str();
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void WriteResult(ostream& out,const BenchmarkCase& bc,const BenchmarkResult& result)
+{
+    out << "    {\n";
+    out << "      \"engine\": " << JSONString(bc.engine) << ",\n";
+    out << "      \"arena\": " << JSONString(GetArenaDescription(bc)) << ",\n";
+    out << "      \"chemicals\": " << bc.n_chemicals << ",\n";
+    if(!result.error.empty())
+    {
+        out << "      \"error\": " << JSONString(result.error) << "\n";
+        out << "    }";
+        return;
+    }
+    // effective bandwidth counts one read and one write of each chemical per cell update, the least that any
+    // implementation must do; stencil reads that hit the cache aren't counted
+    const double cell_updates = double(result.n_cells) * result.n_steps;
+    const double bytes = cell_updates * bc.n_chemicals * 2.0 * sizeof(float);
+    out << "      \"dimensionality\": " << result.dimensionality << ",\n";
+    out << "      \"stencil\": " << JSONString(result.stencil) << ",\n";
+    out << "      \"cells\": " << result.n_cells << ",\n";
+    out << "      \"steps\": " << result.n_steps << ",\n";
+    out << "      \"run_seconds\": " << JSONNumber(result.run_seconds) << ",\n";
+    out << "      \"cell_updates_per_second\": " << JSONNumber(cell_updates / result.run_seconds) << ",\n";
+    out << "      \"effective_GB_per_second\": " << JSONNumber(bytes / result.run_seconds / 1.0e9) << ",\n";
+    out << "      \"setup_seconds\": " << JSONNumber(result.setup_seconds) << ",\n";
+    out << "      \"kernel_build_seconds\": " << JSONNumber(result.kernel_build_seconds) << ",\n";
+    out << "      \"upload_seconds\": " << JSONNumber(result.upload_seconds) << ",\n";
+    out << "      \"download_seconds\": " << JSONNumber(result.download_seconds) << "\n";
+    out << "    }";
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+void Benchmark::RunAll(ostream& json_out,ostream& log,bool is_opencl_available,int opencl_platform,int opencl_device,
+                       double min_seconds_per_case)
+{
+    vector<BenchmarkCase> cases;
+
+    // CPU implementations
+    cases.push_back(ImageCase("GrayScottImageRD",4096,1,1,2));
+    cases.push_back(ImageCase("GrayScottImageRD",256,256,1,2));
+    cases.push_back(ImageCase("GrayScottImageRD",1024,1024,1,2));
+    cases.push_back(ImageCase("GrayScottImageRD",64,64,64,2));
+    cases.push_back(MeshCase("GrayScottMeshRD","triangular",100,2));
+    cases.push_back(MeshCase("GrayScottMeshRD","triangular",300,2));
+    cases.push_back(MeshCase("GrayScottMeshRD","bcc",10,2));
+    cases.push_back(MeshCase("GrayScottMeshRD","bcc",25,2));
+
+    if(is_opencl_available)
+    {
+        // each stencil that FormulaOpenCLImageRD supports, at two sizes
+        const int N_STENCILS = 7;
+        const int stencil_dims[N_STENCILS] = { 1, 2, 2, 2, 3, 3, 3 };
+        const char* stencil_type[N_STENCILS] = { "vertex", "edge", "vertex", "vertex", "face", "edge", "vertex" };
+        const char* stencil_weight[N_STENCILS] = { "laplacian", "laplacian", "laplacian", "equal", "laplacian", "laplacian", "laplacian" };
+        for(int i=0;i<N_STENCILS;i++)
+        {
+            switch(stencil_dims[i])
+            {
+                case 1:
+                    cases.push_back(ImageCase("FormulaOpenCLImageRD",4096,1,1,2,stencil_type[i],stencil_weight[i]));
+                    cases.push_back(ImageCase("FormulaOpenCLImageRD",1<<20,1,1,2,stencil_type[i],stencil_weight[i]));
+                    break;
+                case 2:
+                    cases.push_back(ImageCase("FormulaOpenCLImageRD",256,256,1,2,stencil_type[i],stencil_weight[i]));
+                    cases.push_back(ImageCase("FormulaOpenCLImageRD",1024,1024,1,2,stencil_type[i],stencil_weight[i]));
+                    break;
+                case 3:
+                    cases.push_back(ImageCase("FormulaOpenCLImageRD",64,64,64,2,stencil_type[i],stencil_weight[i]));
+                    cases.push_back(ImageCase("FormulaOpenCLImageRD",128,128,128,2,stencil_type[i],stencil_weight[i]));
+                    break;
+            }
+        }
+        // different numbers of chemicals
+        const int N_CHEMICAL_COUNTS = 3;
+        const int chemical_counts[N_CHEMICAL_COUNTS] = { 1, 4, 8 };
+        for(int i=0;i<N_CHEMICAL_COUNTS;i++)
+        {
+            cases.push_back(ImageCase("FormulaOpenCLImageRD",1024,1024,1,chemical_counts[i],"vertex","laplacian"));
+            cases.push_back(ImageCase("FormulaOpenCLImageRD",128,128,128,chemical_counts[i],"face","laplacian"));
+        }
+        cases.push_back(ImageCase("FullKernelOpenCLImageRD",1024,1024,1,2));
+        cases.push_back(ImageCase("FullKernelOpenCLImageRD",128,128,128,2));
+        cases.push_back(MeshCase("FormulaOpenCLMeshRD","triangular",100,2));
+        cases.push_back(MeshCase("FormulaOpenCLMeshRD","triangular",300,2));
+        cases.push_back(MeshCase("FormulaOpenCLMeshRD","bcc",10,2));
+        cases.push_back(MeshCase("FormulaOpenCLMeshRD","bcc",25,2));
+    }
+    else
+        log << "OpenCL not found, running only the CPU benchmarks.\n";
+
+    json_out << "{\n";
+    json_out << "  \"ready_version\": " << JSONString(STR(READY_VERSION)) << ",\n";
+    if(is_opencl_available)
+        json_out << "  \"opencl_device\": " << JSONString(OpenCL_utils::GetDeviceDescription(opencl_platform,opencl_device)) << ",\n";
+    json_out << "  \"min_seconds_per_case\": " << JSONNumber(min_seconds_per_case) << ",\n";
+    json_out << "  \"notes\": " << JSONString("kernel_build_seconds and upload_seconds are not measured directly but "
+        "inferred, by timing an update of 0 steps that does the upload or build and taking off download_seconds; "
+        "null means not applicable, or a rate from a run too quick to time") << ",\n";
+    json_out << "  \"cases\": [\n";
+    for(size_t i=0;i<cases.size();i++)
+    {
+        log << "[" << i+1 << "/" << cases.size() << "] " << cases[i].engine << " " << GetArenaDescription(cases[i])
+            << ", " << cases[i].n_chemicals << " chemicals";
+        if(!cases[i].neighborhood_type.empty())
+            log << ", " << cases[i].neighborhood_type << "," << cases[i].neighborhood_weight;
+        log << "... " << flush;
+        BenchmarkResult result = RunCase(cases[i],opencl_platform,opencl_device,min_seconds_per_case);
+        if(result.error.empty())
+            log << double(result.n_cells) * result.n_steps / result.run_seconds / 1.0e6 << " million cell updates per second\n";
+        else
+            log << "failed: " << result.error << "\n";
+        WriteResult(json_out,cases[i],result);
+        json_out << (i+1<cases.size() ? ",\n" : "\n") << flush;
+    }
+    json_out << "  ]\n";
+    json_out << "}\n";
+}
+
+// -------------------------------------------------------------------------------------------------------------
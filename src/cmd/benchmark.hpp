@@ -0,0 +1,39 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __BENCHMARK__
+#define __BENCHMARK__
+
+// STL:
+#include <iostream>
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// A fixed set of timing runs over the different RD implementations, for comparing machines and catching slowdowns.
+namespace Benchmark {
+
+    /// Runs every case, writing the results to json_out and progress messages to log.
+    /**
+     * Each case is run for at least min_seconds_per_case. The OpenCL cases are skipped if OpenCL isn't available.
+     * A case that fails is reported with an "error" entry, and the remaining cases still run.
+     */
+    void RunAll(std::ostream& json_out,std::ostream& log,bool is_opencl_available,int opencl_platform,int opencl_device,
+                double min_seconds_per_case);
+
+};
+
+#endif
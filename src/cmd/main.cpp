@@ -15,8 +15,17 @@
     You should have received a copy of the GNU General Public License
     along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
 
+// local:
+#include "benchmark.hpp"
+#ifdef USE_MPI
+    #include "mpi_run.hpp"
+#endif
+
 // STL:
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 using namespace std;
 
 // stdlib:
@@ -27,35 +36,177 @@ using namespace std;
 #include <Properties.hpp>
 #include <OpenCL_utils.hpp>
 #include <AbstractRD.hpp>
+#include <OpenCLImageRD.hpp>
+#include <utils.hpp>
 
 // -------------------------------------------------------------------------------------------------------------
 
 void InitializeDefaultRenderSettings(Properties &render_settings);
+void WriteStatistics(ostream& out,AbstractRD *system,bool write_header);
+string CheckForStop(AbstractRD *system,double max_change,double rms_change,double uniform_range);
 
 // -------------------------------------------------------------------------------------------------------------
 /*
         A demonstration of using Ready as a processing back-end.
 
-        Currently it just loads a file, runs it for 1000 timesteps and then saves out the result. If we actually want
-        this utility to do something useful then we can add more command-line options.
+        Currently it just loads a file, runs it for a number of timesteps (1000 unless --steps is given) and then 
+        saves out the result. If we actually want this utility to do something useful then we can add more 
+        command-line options.
+
+        With --max-change, --rms-change or --uniform it checks the pattern every N timesteps (--check-every, default 
+        100) and stops early once it has converged (no cell, or the root-mean-square of the cells, changes by more than 
+        the given amount on a step) or become uniform (the range of every chemical is within the given amount). The 
+        checks are done on the device for OpenCL implementations. With --flag-only the run continues to the end 
+        anyway. The reason and the timestep are saved in the output file as a run_outcome element.
+
+        With --statistics it also writes the minimum, maximum, mean, variance and a histogram of each chemical to a 
+        CSV file every N timesteps. OpenCL implementations compute these on the device.
+
+        With --probes it writes the values recorded by the probes defined in the pattern to a CSV file, one row per 
+        recording. OpenCL implementations gather these on the device and read them back in bulk.
+
+        With --slab-devices it splits an OpenCL image along z between the given devices of the platform, which 
+        exchange the planes at the edges of their slabs after each step. With --numa-slabs each device (or the default 
+        one) is further split by NUMA node.
+
+        With --mpi (in builds made with USE_MPI) it splits an image pattern between the ranks of an MPI job instead, 
+        e.g. mpiexec -n 4 rdy --mpi in.vti out.pvti, exchanging halos --halo cells deep (default 1) every that many 
+        timesteps. See mpi_run.hpp.
+
+        With --benchmark it instead runs a fixed set of timings over the different implementations, writing the 
+        results as JSON to the given file (or to stdout).
 */
 // -------------------------------------------------------------------------------------------------------------
 
 int main(int argc,char *argv[])
 {
-    if(argc!=3)
+    bool run_benchmark = (argc==2 || argc==3) && string(argv[1])=="--benchmark";
+    int n_steps = 1000;
+    int statistics_interval = 0;
+    string statistics_filename;
+    string probes_filename;
+    int check_interval = 100;
+    double max_change = 0.0, rms_change = 0.0, uniform_range = 0.0;
+    bool flag_only = false;
+    vector<int> slab_devices;
+    bool numa_slabs = false;
+    bool run_mpi = false;
+    int halo_depth = 1;
+    bool bad_option = false;
+    vector<string> filenames;
+    for(int i=1;i<argc && !run_benchmark;i++)
     {
-        cout << "A command-line utility to run Ready patterns without the GUI.\nUsage:   " << argv[0] << " <input_file> <output_file>\n";
+        const string arg(argv[i]);
+        const bool has_value = i+1<argc;
+        if(arg=="--steps" && has_value)
+            n_steps = atoi(argv[++i]);
+        else if(arg=="--statistics" && i+2<argc)
+        {
+            statistics_interval = atoi(argv[++i]);
+            statistics_filename = argv[++i];
+            bad_option |= statistics_interval<1;
+        }
+        else if(arg=="--probes" && has_value)
+            probes_filename = argv[++i];
+        else if(arg=="--check-every" && has_value)
+            check_interval = atoi(argv[++i]);
+        else if(arg=="--max-change" && has_value)
+            max_change = atof(argv[++i]);
+        else if(arg=="--rms-change" && has_value)
+            rms_change = atof(argv[++i]);
+        else if(arg=="--uniform" && has_value)
+            uniform_range = atof(argv[++i]);
+        else if(arg=="--flag-only")
+            flag_only = true;
+        else if(arg=="--slab-devices" && has_value)
+        {
+            // a comma-separated list of device indices
+            const string list(argv[++i]);
+            for(size_t start=0;start<list.length();)
+            {
+                size_t end = list.find(',',start);
+                if(end==string::npos) end = list.length();
+                slab_devices.push_back(atoi(list.substr(start,end-start).c_str()));
+                start = end+1;
+            }
+            bad_option |= slab_devices.empty();
+        }
+        else if(arg=="--numa-slabs")
+            numa_slabs = true;
+        else if(arg=="--mpi")
+            run_mpi = true;
+        else if(arg=="--halo" && has_value)
+            halo_depth = atoi(argv[++i]);
+        else if(arg.compare(0,2,"--")==0)
+            bad_option = true;
+        else
+            filenames.push_back(arg);
+    }
+    const bool check_for_stop = max_change>0.0 || rms_change>0.0 || uniform_range>0.0;
+    // the MPI runner only takes --steps and --halo
+    bad_option |= run_mpi && (statistics_interval>0 || !probes_filename.empty() || check_for_stop || flag_only || 
+        !slab_devices.empty() || numa_slabs);
+    if(!run_benchmark && (filenames.size()!=2 || bad_option || n_steps<0 || check_interval<1 || halo_depth<1))
+    {
+        cout << "A command-line utility to run Ready patterns without the GUI.\nUsage:   " << argv[0] 
+             << " [options] <input_file> <output_file>\n"
+             << "   or:   " << argv[0] << " --benchmark [<results_file.json>]\n"
+             << "Options:\n"
+             << "   --steps <n>                  the number of timesteps to run (default 1000)\n"
+             << "   --statistics <n> <file.csv>  write the statistics of each chemical every n timesteps\n"
+             << "   --probes <file.csv>          write the values recorded by the probes in the pattern\n"
+             << "   --max-change <x>             stop when no cell changes by more than x on a step\n"
+             << "   --rms-change <x>             stop when the root-mean-square change on a step is below x\n"
+             << "   --uniform <x>                stop when every chemical is within x of uniform\n"
+             << "   --check-every <n>            how often to check for stopping (default 100)\n"
+             << "   --flag-only                  record when the pattern converged but run all the timesteps\n"
+             << "   --slab-devices <i,j,...>     split an OpenCL image along z between these devices\n"
+             << "   --numa-slabs                 split each device (or the default one) by NUMA node too\n"
+             << "   --mpi                        split an image between the ranks of an MPI job (with --steps only)\n"
+             << "   --halo <n>                   the depth of the halos exchanged between MPI ranks (default 1)\n";
         return EXIT_FAILURE;
     }
 
+    int opencl_platform = 0; // TODO: command-line option
+    int opencl_device = 0; // TODO: command-line option
+
+    if(run_mpi)
+    {
+        Properties render_settings("render_settings");
+        InitializeDefaultRenderSettings(render_settings);
+        #ifdef USE_MPI
+            return MPIRun::Run(filenames[0],filenames[1],n_steps,halo_depth,opencl_platform,opencl_device,render_settings);
+        #else
+            cout << "Error:\nThis build of " << argv[0] << " doesn't support MPI. Rebuild with USE_MPI turned on.\n";
+            return EXIT_FAILURE;
+        #endif
+    }
+
     bool is_opencl_available = OpenCL_utils::IsOpenCLAvailable();
+    ostream& progress = (run_benchmark && argc==2) ? cerr : cout; // (keep stdout for the JSON)
     if(is_opencl_available)
-        cout << "OpenCL found.\n";
+        progress << "OpenCL found.\n";
     else
-        cout << "OpenCL not found.\n";
-    int opencl_platform = 0; // TODO: command-line option
-    int opencl_device = 0; // TODO: command-line option
+        progress << "OpenCL not found.\n";
+
+    if(run_benchmark)
+    {
+        const double min_seconds_per_case = 1.0;
+        if(argc==3)
+        {
+            ofstream out(argv[2]);
+            if(!out)
+            {
+                cout << "Error:\nFailed to open " << argv[2] << " for writing.\n";
+                return EXIT_FAILURE;
+            }
+            Benchmark::RunAll(out,cout,is_opencl_available,opencl_platform,opencl_device,min_seconds_per_case);
+            cout << "Results saved to " << argv[2] << "\n";
+        }
+        else
+            Benchmark::RunAll(cout,progress,is_opencl_available,opencl_platform,opencl_device,min_seconds_per_case);
+        return EXIT_SUCCESS;
+    }
 
     Properties render_settings("render_settings");
     InitializeDefaultRenderSettings(render_settings);
@@ -66,17 +217,74 @@ int main(int argc,char *argv[])
         // read the file
         cout << "Loading file...\n";
         bool warn_to_update;
-        system = SystemFactory::CreateFromFile(argv[1],is_opencl_available,opencl_platform,opencl_device,render_settings,warn_to_update);
+        system = SystemFactory::CreateFromFile(filenames[0].c_str(),is_opencl_available,opencl_platform,opencl_device,render_settings,warn_to_update);
         if(warn_to_update)
             cout << "This pattern was created with a newer version of Ready. You should update your copy.\n";
+        if(!slab_devices.empty() || numa_slabs)
+        {
+            OpenCLImageRD *image_system = dynamic_cast<OpenCLImageRD*>(system);
+            if(!image_system)
+                throw runtime_error("Only OpenCL image systems can be split into slabs.");
+            image_system->SetSlabDevices(slab_devices,numa_slabs);
+        }
 
         // do something with the file
-        cout << "Running the simulation for 1000 steps...\n";
-        system->Update(1000); // TODO: command-line option
+        cout << "Running the simulation for " << n_steps << " steps...\n";
+        ofstream statistics_out;
+        if(statistics_interval > 0)
+        {
+            statistics_out.open(statistics_filename.c_str());
+            if(!statistics_out)
+                throw runtime_error("Failed to open "+statistics_filename+" for writing.");
+            WriteStatistics(statistics_out,system,true);
+        }
+        ofstream probes_out;
+        if(!probes_filename.empty())
+        {
+            if(!system->HasProbes())
+                throw runtime_error("The pattern has no probes.");
+            probes_out.open(probes_filename.c_str());
+            if(!probes_out)
+                throw runtime_error("Failed to open "+probes_filename+" for writing.");
+        }
+        int steps_taken = 0;
+        while(steps_taken < n_steps)
+        {
+            // run until the next multiple of whichever interval comes first
+            int next = n_steps;
+            if(statistics_interval > 0)
+                next = min(next,(steps_taken/statistics_interval+1)*statistics_interval);
+            if(check_for_stop)
+                next = min(next,(steps_taken/check_interval+1)*check_interval);
+            system->Update(next - steps_taken);
+            if(probes_out.is_open())
+                system->WriteProbeRecords(probes_out,steps_taken==0); // (the columns are known after the first update)
+            steps_taken = next;
+
+            if(statistics_interval > 0 && steps_taken % statistics_interval == 0)
+                WriteStatistics(statistics_out,system,false);
+            if(check_for_stop && steps_taken % check_interval == 0 && system->GetRunOutcome().empty())
+            {
+                const string reason = CheckForStop(system,max_change,rms_change,uniform_range);
+                if(!reason.empty())
+                {
+                    system->SetRunOutcome(reason);
+                    cout << "The pattern is " << reason << " at timestep " << system->GetTimestepsTaken() << ".\n";
+                    if(!flag_only)
+                        break;
+                }
+            }
+        }
+        if(check_for_stop && system->GetRunOutcome().empty())
+            system->SetRunOutcome("step_limit");
+        if(statistics_interval > 0)
+            cout << "Statistics saved to " << statistics_filename << "\n";
+        if(probes_out.is_open())
+            cout << "Probe records saved to " << probes_filename << "\n";
 
         // save something out
         cout << "Saving file...\n";
-        system->SaveFile(argv[2],render_settings,false);
+        system->SaveFile(filenames[1].c_str(),render_settings,false);
     }
     catch(const exception& e)
     {
@@ -90,6 +298,61 @@ int main(int argc,char *argv[])
 
 // -------------------------------------------------------------------------------------------------------------
 
+void WriteStatistics(ostream& out,AbstractRD *system,bool write_header)
+{
+    const int N_BINS = 16;
+    if(write_header)
+    {
+        out << "timestep,chemical,minimum,maximum,mean,variance";
+        for(int b=0;b<N_BINS;b++)
+            out << ",bin_" << b;
+        out << "\n";
+    }
+    vector<AbstractRD::ChemicalStatistics> stats;
+    system->ComputeStatistics(stats,N_BINS);
+    for(int ic=0;ic<(int)stats.size();ic++)
+    {
+        out << system->GetTimestepsTaken() << "," << GetChemicalName(ic) << "," << stats[ic].minimum << "," 
+            << stats[ic].maximum << "," << stats[ic].mean << "," << stats[ic].variance;
+        for(int b=0;b<N_BINS;b++)
+            out << "," << stats[ic].histogram[b];
+        out << "\n";
+    }
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+string CheckForStop(AbstractRD *system,double max_change,double rms_change,double uniform_range)
+{
+    // returns the reason to stop, or the empty string to keep going; a threshold of 0 means not to test for it
+    if(uniform_range > 0.0)
+    {
+        vector<AbstractRD::ChemicalStatistics> stats;
+        system->ComputeStatistics(stats,0);
+        bool is_uniform = true;
+        for(int ic=0;ic<(int)stats.size();ic++)
+            if(stats[ic].maximum - stats[ic].minimum > uniform_range)
+                is_uniform = false;
+        if(is_uniform)
+            return "uniform";
+    }
+    if(max_change > 0.0 || rms_change > 0.0)
+    {
+        vector<double> max_changes,rms_changes;
+        if(!system->ComputeChangeOverLastStep(max_changes,rms_changes))
+            throw runtime_error("This implementation can't measure the change over a timestep, so can't test for convergence.");
+        bool has_converged = true;
+        for(int ic=0;ic<(int)max_changes.size();ic++)
+            if((max_change > 0.0 && max_changes[ic] > max_change) || (rms_change > 0.0 && rms_changes[ic] > rms_change))
+                has_converged = false;
+        if(has_converged)
+            return "converged";
+    }
+    return "";
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
 void InitializeDefaultRenderSettings(Properties &render_settings)
 {
     // TODO: code duplication here from frame.cpp, not sure how best to merge
@@ -115,6 +378,10 @@ void InitializeDefaultRenderSettings(Properties &render_settings)
     render_settings.AddProperty(Property("color_displacement_mapped_surface",true));
     render_settings.AddProperty(Property("use_image_interpolation",true));
     render_settings.AddProperty(Property("timesteps_per_render",100));
+    render_settings.AddProperty(Property("use_fast_display",false));
+    render_settings.AddProperty(Property("auto_range_color_scale",false));
+    render_settings.AddProperty(Property("show_space_time_plot",false));
+    render_settings.AddProperty(Property("space_time_plot_rows",256));
 }
 
 // -------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,442 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "mpi_run.hpp"
+
+// readybase:
+#include <SystemFactory.hpp>
+#include <AbstractRD.hpp>
+#include <ImageRD.hpp>
+#include <OpenCL_utils.hpp>
+#include <utils.hpp>
+
+// VTK:
+#include <vtkDoubleArray.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkSmartPointer.h>
+#include <vtkXMLImageDataWriter.h>
+
+// STL:
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+using namespace std;
+
+// stdlib:
+#include <stdlib.h>
+
+// MPI:
+#include <mpi.h>
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// The part of the arena held by this rank.
+struct Block
+{
+    int P[3];               ///< the number of ranks along each axis
+    int coords[3];          ///< the position of this rank in the grid of ranks
+    int start[3],size[3];   ///< the cells owned by this rank, in the coordinates of the whole arena
+    int below[3],above[3];  ///< the neighboring ranks along each axis, or MPI_PROC_NULL
+    int lo[3],hi[3];        ///< the depth of the halo on each side, 0 where there is no neighbor
+    int L[3];               ///< the size of the local image, including the halos
+    int halo_depth;
+};
+
+// -------------------------------------------------------------------------------------------------------------
+
+static size_t GetBoxSize(const int box[6])
+{
+    return size_t(box[1]-box[0]+1) * size_t(box[3]-box[2]+1) * size_t(box[5]-box[4]+1);
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static MPI_Comm MakeBlock(const int N[3],bool wrap,int halo_depth,Block& b)
+{
+    // only split the axes that have more than one cell
+    int n_ranks;
+    MPI_Comm_size(MPI_COMM_WORLD,&n_ranks);
+    int periods[3];
+    for(int d=0;d<3;d++)
+    {
+        b.P[d] = N[d]>1 ? 0 : 1;
+        periods[d] = (wrap && N[d]>1) ? 1 : 0;
+    }
+    MPI_Dims_create(n_ranks,3,b.P);
+    MPI_Comm cart;
+    MPI_Cart_create(MPI_COMM_WORLD,3,b.P,periods,1,&cart);
+    int rank;
+    MPI_Comm_rank(cart,&rank);
+    MPI_Cart_coords(cart,rank,3,b.coords);
+
+    b.halo_depth = halo_depth;
+    for(int d=0;d<3;d++)
+    {
+        b.start[d] = int( (long long)N[d] * b.coords[d] / b.P[d] );
+        b.size[d] = int( (long long)N[d] * (b.coords[d]+1) / b.P[d] ) - b.start[d];
+        MPI_Cart_shift(cart,d,1,&b.below[d],&b.above[d]);
+        b.lo[d] = (b.below[d]!=MPI_PROC_NULL) ? halo_depth : 0;
+        b.hi[d] = (b.above[d]!=MPI_PROC_NULL) ? halo_depth : 0;
+        if((b.lo[d] || b.hi[d]) && b.size[d] < halo_depth)
+        {
+            ostringstream oss;
+            oss << "MPIRun::MakeBlock : " << b.P[d] << " ranks along axis " << d << " leave fewer than " << halo_depth 
+                << " cells each, too few for the halo. Use fewer ranks or a shallower halo.";
+            throw runtime_error(oss.str());
+        }
+        b.L[d] = b.lo[d] + b.size[d] + b.hi[d];
+    }
+    return cart;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void GetOwnedBox(const Block& b,int box[6])
+{
+    // the cells owned by this rank, in the coordinates of the local image
+    for(int d=0;d<3;d++)
+    {
+        box[2*d] = b.lo[d];
+        box[2*d+1] = b.lo[d] + b.size[d] - 1;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void GetChemicalsInBox(const ImageRD* system,const int box[6],vector<double>& values)
+{
+    // the values of every chemical in the box, one after the other
+    values.clear();
+    vector<double> chemical_values;
+    for(int iC=0;iC<system->GetNumberOfChemicals();iC++)
+    {
+        system->GetRegionValues(iC,box,chemical_values);
+        values.insert(values.end(),chemical_values.begin(),chemical_values.end());
+    }
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void SetChemicalsInBox(ImageRD* system,const int box[6],const vector<double>& values)
+{
+    const size_t n_cells = GetBoxSize(box);
+    vector<double> chemical_values(n_cells);
+    for(int iC=0;iC<system->GetNumberOfChemicals();iC++)
+    {
+        copy(values.begin() + iC*n_cells,values.begin() + (iC+1)*n_cells,chemical_values.begin());
+        system->SetRegionValues(iC,box,chemical_values);
+        system->PaintRegionChanged(iC,box); // (so that OpenCL implementations write it to the device)
+    }
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void ExchangeHalos(ImageRD* system,MPI_Comm cart,const Block& b)
+{
+    // one axis at a time, so that the halos sent along later axes include the corners filled in along earlier ones
+    for(int d=0;d<3;d++)
+    {
+        if(!b.lo[d] && !b.hi[d])
+            continue;
+
+        // the boxes to send to the rank below and above, and to receive from them, across the whole local image
+        int send_box[2][6],recv_box[2][6];
+        for(int side=0;side<2;side++)
+        {
+            for(int e=0;e<3;e++)
+            {
+                send_box[side][2*e] = recv_box[side][2*e] = 0;
+                send_box[side][2*e+1] = recv_box[side][2*e+1] = b.L[e] - 1;
+            }
+        }
+        const int H = b.halo_depth;
+        send_box[0][2*d] = b.lo[d];
+        send_box[0][2*d+1] = b.lo[d] + H - 1;
+        send_box[1][2*d] = b.lo[d] + b.size[d] - H;
+        send_box[1][2*d+1] = b.lo[d] + b.size[d] - 1;
+        recv_box[0][2*d] = 0;
+        recv_box[0][2*d+1] = b.lo[d] - 1;
+        recv_box[1][2*d] = b.lo[d] + b.size[d];
+        recv_box[1][2*d+1] = b.L[d] - 1;
+        const int neighbor[2] = { b.below[d], b.above[d] };
+
+        // post the receives first, then the sends; a message going down is tagged 2d and one going up 2d+1
+        vector<double> send_values[2],recv_values[2];
+        vector<MPI_Request> requests;
+        for(int side=0;side<2;side++)
+        {
+            if(neighbor[side]==MPI_PROC_NULL)
+                continue;
+            recv_values[side].resize(system->GetNumberOfChemicals() * GetBoxSize(recv_box[side]));
+            MPI_Request request;
+            MPI_Irecv(&recv_values[side][0],(int)recv_values[side].size(),MPI_DOUBLE,neighbor[side],2*d+1-side,cart,&request);
+            requests.push_back(request);
+        }
+        for(int side=0;side<2;side++)
+        {
+            if(neighbor[side]==MPI_PROC_NULL)
+                continue;
+            GetChemicalsInBox(system,send_box[side],send_values[side]);
+            MPI_Request request;
+            MPI_Isend(&send_values[side][0],(int)send_values[side].size(),MPI_DOUBLE,neighbor[side],2*d+side,cart,&request);
+            requests.push_back(request);
+        }
+        MPI_Waitall((int)requests.size(),&requests[0],MPI_STATUSES_IGNORE);
+        for(int side=0;side<2;side++)
+            if(neighbor[side]!=MPI_PROC_NULL)
+                SetChemicalsInBox(system,recv_box[side],recv_values[side]);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void WriteBlock(const ImageRD* system,const Block& b,const string& filename)
+{
+    // write the owned cells as a piece of the whole arena, with one array for each chemical
+    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+    image->SetExtent(b.start[0],b.start[0]+b.size[0]-1,b.start[1],b.start[1]+b.size[1]-1,b.start[2],b.start[2]+b.size[2]-1);
+    int box[6];
+    GetOwnedBox(b,box);
+    vector<double> values;
+    for(int iC=0;iC<system->GetNumberOfChemicals();iC++)
+    {
+        system->GetRegionValues(iC,box,values);
+        vtkSmartPointer<vtkDoubleArray> array = vtkSmartPointer<vtkDoubleArray>::New();
+        array->SetName(GetChemicalName(iC).c_str());
+        array->SetNumberOfTuples((vtkIdType)values.size());
+        copy(values.begin(),values.end(),array->GetPointer(0));
+        image->GetPointData()->AddArray(array);
+    }
+    vtkSmartPointer<vtkXMLImageDataWriter> writer = vtkSmartPointer<vtkXMLImageDataWriter>::New();
+    writer->SetFileName(filename.c_str());
+    writer->SetByteOrderToLittleEndian();
+    #if VTK_MAJOR_VERSION >= 6
+        writer->SetInputData(image);
+    #else
+        writer->SetInput(image);
+    #endif
+    if(!writer->Write())
+        throw runtime_error("MPIRun::WriteBlock : failed to write "+filename);
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void WriteChunkedOutput(const ImageRD* system,const Block& b,MPI_Comm cart,const int N[3],const string& filename)
+{
+    // each rank writes its own piece as <name>_<rank>.vti, then rank 0 writes the .pvti that lists them
+    int rank,n_ranks;
+    MPI_Comm_rank(cart,&rank);
+    MPI_Comm_size(cart,&n_ranks);
+    const string base = filename.substr(0,filename.length()-5); // (without the .pvti)
+    ostringstream piece_filename;
+    piece_filename << base << "_" << rank << ".vti";
+    WriteBlock(system,b,piece_filename.str());
+
+    int extent[6];
+    for(int d=0;d<3;d++)
+    {
+        extent[2*d] = b.start[d];
+        extent[2*d+1] = b.start[d] + b.size[d] - 1;
+    }
+    vector<int> extents(6*n_ranks);
+    MPI_Gather(extent,6,MPI_INT,&extents[0],6,MPI_INT,0,cart);
+    if(rank!=0)
+        return;
+
+    const size_t slash = base.find_last_of("/\\");
+    const string piece_base = (slash==string::npos) ? base : base.substr(slash+1); // (the pieces are alongside the .pvti)
+    ofstream out(filename.c_str());
+    if(!out)
+        throw runtime_error("MPIRun::WriteChunkedOutput : failed to open "+filename+" for writing");
+    out << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"PImageData\" version=\"0.1\" byte_order=\"LittleEndian\">\n"
+        << "  <PImageData WholeExtent=\"0 " << N[0]-1 << " 0 " << N[1]-1 << " 0 " << N[2]-1 
+        << "\" GhostLevel=\"0\" Origin=\"0 0 0\" Spacing=\"1 1 1\">\n"
+        << "    <PPointData Scalars=\"" << GetChemicalName(0) << "\">\n";
+    for(int iC=0;iC<system->GetNumberOfChemicals();iC++)
+        out << "      <PDataArray type=\"Float64\" Name=\"" << GetChemicalName(iC) << "\"/>\n";
+    out << "    </PPointData>\n";
+    for(int r=0;r<n_ranks;r++)
+    {
+        out << "    <Piece Extent=\"";
+        for(int i=0;i<6;i++)
+            out << extents[6*r+i] << (i<5 ? " " : "");
+        out << "\" Source=\"" << piece_base << "_" << r << ".vti\"/>\n";
+    }
+    out << "  </PImageData>\n</VTKFile>\n";
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+static void GatherAndSave(const ImageRD* system,const Block& b,MPI_Comm cart,const string& input_filename,
+                          const string& output_filename,int opencl_platform,int opencl_device,Properties& render_settings)
+{
+    // every rank sends its owned cells to rank 0, which puts them into a fresh copy of the whole pattern and saves it
+    int rank,n_ranks;
+    MPI_Comm_rank(cart,&rank);
+    MPI_Comm_size(cart,&n_ranks);
+    int box[6],global_box[6];
+    GetOwnedBox(b,box);
+    for(int d=0;d<3;d++)
+    {
+        global_box[2*d] = b.start[d];
+        global_box[2*d+1] = b.start[d] + b.size[d] - 1;
+    }
+    vector<double> values;
+    GetChemicalsInBox(system,box,values);
+    if(rank!=0)
+    {
+        MPI_Send(global_box,6,MPI_INT,0,0,cart);
+        MPI_Send(&values[0],(int)values.size(),MPI_DOUBLE,0,1,cart);
+        return;
+    }
+
+    bool warn_to_update;
+    AbstractRD *loaded = SystemFactory::CreateFromFile(input_filename.c_str(),OpenCL_utils::IsOpenCLAvailable(),
+        opencl_platform,opencl_device,render_settings,warn_to_update);
+    ImageRD *whole = dynamic_cast<ImageRD*>(loaded);
+    try
+    {
+        SetChemicalsInBox(whole,global_box,values);
+        for(int r=1;r<n_ranks;r++)
+        {
+            int other_box[6];
+            MPI_Recv(other_box,6,MPI_INT,r,0,cart,MPI_STATUS_IGNORE);
+            values.resize(whole->GetNumberOfChemicals() * GetBoxSize(other_box));
+            MPI_Recv(&values[0],(int)values.size(),MPI_DOUBLE,r,1,cart,MPI_STATUS_IGNORE);
+            SetChemicalsInBox(whole,other_box,values);
+        }
+        whole->SaveFile(output_filename.c_str(),render_settings,false);
+    }
+    catch(...)
+    {
+        delete loaded;
+        throw;
+    }
+    delete loaded;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+int MPIRun::Run(const string& input_filename,const string& output_filename,int n_steps,int halo_depth,
+                int opencl_platform,int opencl_device,Properties& render_settings)
+{
+    MPI_Init(NULL,NULL);
+    int rank,n_ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    MPI_Comm_size(MPI_COMM_WORLD,&n_ranks);
+    ostringstream discarded;
+    ostream& log = (rank==0) ? cout : static_cast<ostream&>(discarded); // (only rank 0 reports progress)
+
+    AbstractRD *loaded = NULL;
+    try
+    {
+        // every rank reads the whole starting pattern, then keeps just its own block (if the initial pattern is random
+        // then each rank makes its own, which only changes the noise)
+        const bool is_opencl_available = OpenCL_utils::IsOpenCLAvailable();
+        log << "Loading file...\n";
+        bool warn_to_update;
+        loaded = SystemFactory::CreateFromFile(input_filename.c_str(),is_opencl_available,opencl_platform,opencl_device,
+            render_settings,warn_to_update);
+        if(warn_to_update)
+            log << "This pattern was created with a newer version of Ready. You should update your copy.\n";
+        ImageRD *system = dynamic_cast<ImageRD*>(loaded);
+        if(!system)
+            throw runtime_error("Only image systems can be split between MPI ranks.");
+        if(system->GetRuleType()=="kernel")
+            throw runtime_error("Full kernels can't be split between MPI ranks, since they may wrap around regardless of the wrap setting.");
+        if(system->HasProbes())
+            throw runtime_error("Probes aren't supported when splitting a pattern between MPI ranks.");
+        // the halos are only valid for halo_depth steps if each step reads no further than the next cell
+        if(system->UsesNeighborhoodMeans())
+            throw runtime_error("Neighborhood means can't be split between MPI ranks, since they read beyond the halos.");
+        if(system->GetNeighborhoodRange()>1)
+            throw runtime_error("Only neighborhoods of range 1 can be split between MPI ranks.");
+
+        const int N[3] = { (int)system->GetX(), (int)system->GetY(), (int)system->GetZ() };
+        Block b;
+        MPI_Comm cart = MakeBlock(N,system->GetWrap(),halo_depth,b);
+        int global_box[6],box[6];
+        GetOwnedBox(b,box);
+        for(int d=0;d<3;d++)
+        {
+            global_box[2*d] = b.start[d];
+            global_box[2*d+1] = b.start[d] + b.size[d] - 1;
+        }
+        vector<double> values;
+        GetChemicalsInBox(system,global_box,values);
+        system->SetDimensions(b.L[0],b.L[1],b.L[2]);
+        system->SetWrap(false); // (the halos take its place, and the edges of the arena keep their boundary)
+        system->BlankImage();
+        SetChemicalsInBox(system,box,values);
+        system->SetKeepCellsOnDevice(true); // (between the exchanges only the halos need to leave the device)
+
+        log << "Running the simulation for " << n_steps << " steps on " << n_ranks << " ranks (" << b.P[0] << "x" 
+            << b.P[1] << "x" << b.P[2] << ")...\n";
+        double compute_seconds = 0.0, exchange_seconds = 0.0;
+        MPI_Barrier(cart);
+        const double start_time = MPI_Wtime();
+        for(int steps_taken=0;steps_taken<n_steps;)
+        {
+            // the halos are deep enough for halo_depth steps before the cells we own see any stale values
+            double t = MPI_Wtime();
+            ExchangeHalos(system,cart,b);
+            exchange_seconds += MPI_Wtime() - t;
+            t = MPI_Wtime();
+            const int n = min(halo_depth,n_steps - steps_taken);
+            system->Update(n);
+            compute_seconds += MPI_Wtime() - t;
+            steps_taken += n;
+        }
+        MPI_Barrier(cart);
+        const double total_seconds = MPI_Wtime() - start_time;
+        double slowest[2], seconds[2] = { compute_seconds, exchange_seconds };
+        MPI_Reduce(seconds,slowest,2,MPI_DOUBLE,MPI_MAX,0,cart);
+        const double n_cells = double(N[0]) * N[1] * N[2];
+        log << "Took " << total_seconds << "s, " << (total_seconds>0.0 ? n_cells * n_steps / total_seconds / 1e6 : 0.0) 
+            << " million cell updates per second. The slowest ranks spent " << slowest[0] << "s computing and " 
+            << slowest[1] << "s exchanging halos.\n";
+
+        log << "Saving file...\n";
+        const string pvti = ".pvti";
+        if(output_filename.length() > pvti.length() && 
+           output_filename.compare(output_filename.length()-pvti.length(),pvti.length(),pvti)==0)
+            WriteChunkedOutput(system,b,cart,N,output_filename);
+        else
+            GatherAndSave(system,b,cart,input_filename,output_filename,opencl_platform,opencl_device,render_settings);
+        MPI_Comm_free(&cart);
+    }
+    catch(const exception& e)
+    {
+        // the other ranks may be waiting on this one, so take the whole job down
+        cout << "Error on rank " << rank << ":\n" << e.what() << "\n";
+        delete loaded;
+        MPI_Abort(MPI_COMM_WORLD,EXIT_FAILURE);
+        return EXIT_FAILURE;
+    }
+
+    delete loaded;
+    MPI_Finalize();
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,53 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __MPI_RUN__
+#define __MPI_RUN__
+
+// readybase:
+#include <Properties.hpp>
+
+// STL:
+#include <string>
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Runs an image pattern split between the ranks of an MPI job, for arenas too big for one machine.
+namespace MPIRun {
+
+    /// Runs the pattern in input_filename for n_steps and saves the result. Returns EXIT_SUCCESS or EXIT_FAILURE.
+    /**
+     * The arena is divided into blocks on a 3D grid of ranks (only along the axes that have more than one cell). Each
+     * rank runs its block with whichever implementation the pattern asks for (formula or inbuilt), padded with a halo
+     * that is halo_depth cells deep on each side that has a neighboring rank, or that wraps around. The halos are
+     * refreshed every halo_depth steps with non-blocking sends and receives to all the neighbors along an axis at once,
+     * one axis after another so that the corners are passed on too. So each step must read no further than the next
+     * cell: full kernels, probes, neighborhood means and neighborhoods of range more than 1 are refused.
+     *
+     * If output_filename ends in .pvti then each rank writes its own block to a separate .vti file alongside it, and
+     * rank 0 writes the .pvti that ties them together. Otherwise the blocks are gathered on rank 0 and saved as a
+     * normal Ready file.
+     *
+     * Rank 0 reports the time taken, split into computing and exchanging the halos, for measuring how it scales.
+     * Calls MPI_Init and MPI_Finalize itself.
+     */
+    int Run(const std::string& input_filename,const std::string& output_filename,int n_steps,int halo_depth,
+            int opencl_platform,int opencl_device,Properties& render_settings);
+
+};
+
+#endif
@@ -0,0 +1,506 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "FrameRecorder.hpp"
+
+// readybase:
+#include <utils.hpp>
+
+// VTK:
+#include <vtkCellArray.h>
+#include <vtkImageData.h>
+#include <vtkImageWriter.h>
+#include <vtkJPEGWriter.h>
+#include <vtkPNGWriter.h>
+#include <vtkPointData.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataNormals.h>
+#include <vtkQuadricDecimation.h>
+#include <vtkXMLPolyDataWriter.h>
+
+// STL:
+#include <fstream>
+#include <stdexcept>
+using namespace std;
+
+// stdlib:
+#include <signal.h>
+
+#ifdef _WIN32
+    #define popen _popen
+    #define pclose _pclose
+#endif
+
+// ---------------------------------------------------------------------
+
+static bool EndsWith(const string& s,const string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size()-suffix.size(),suffix.size(),suffix) == 0;
+}
+
+// ---------------------------------------------------------------------
+
+void WriteMesh(vtkPolyData* mesh,const string& filename,bool should_decimate,double target_reduction)
+{
+    if(!EndsWith(filename,"obj") && !EndsWith(filename,"vtp"))
+        throw runtime_error("WriteMesh : unsupported file type: "+filename);
+
+    vtkSmartPointer<vtkPolyData> source = mesh;
+    if (should_decimate)
+    {
+        vtkSmartPointer<vtkQuadricDecimation> dec = vtkSmartPointer<vtkQuadricDecimation>::New();
+        #if VTK_MAJOR_VERSION >= 6
+            dec->SetInputData(mesh);
+        #else
+            dec->SetInput(mesh);
+        #endif
+        dec->SetTargetReduction(target_reduction);
+        dec->Update();
+        source = dec->GetOutput();
+    }
+
+    vtkSmartPointer<vtkPolyDataNormals> normals = vtkSmartPointer<vtkPolyDataNormals>::New();
+    #if VTK_MAJOR_VERSION >= 6
+        normals->SetInputData(source);
+    #else
+        normals->SetInput(source);
+    #endif
+    normals->SplittingOff();
+    normals->Update();
+    vtkPolyData* pd = normals->GetOutput();
+
+    if(EndsWith(filename,"obj"))
+    {
+        ofstream out(filename.c_str());
+        if(!out)
+            throw runtime_error("WriteMesh : failed to open file for writing: "+filename);
+        out << "# Output from Ready - https://github.com/GollyGang/ready\n";
+        pd->BuildCells();
+        for(vtkIdType iPt=0;iPt<pd->GetNumberOfPoints();iPt++)
+            out << "v " << pd->GetPoint(iPt)[0] << " " << pd->GetPoint(iPt)[1] << " " << pd->GetPoint(iPt)[2] << "\n";
+        if(pd->GetPointData()->GetNormals())
+        {
+            for(vtkIdType iPt=0;iPt<pd->GetNumberOfPoints();iPt++)
+                out << "vn " << pd->GetPointData()->GetNormals()->GetTuple3(iPt)[0] << " "
+                    << pd->GetPointData()->GetNormals()->GetTuple3(iPt)[1] << " "
+                    << pd->GetPointData()->GetNormals()->GetTuple3(iPt)[2] << "\n";
+        }
+        vtkIdType npts,*pts;
+        for(vtkIdType iCell=0;iCell<pd->GetPolys()->GetNumberOfCells();iCell++)
+        {
+            pd->GetCellPoints(iCell,npts,pts);
+            out << "f";
+            if(pd->GetPointData()->GetNormals())
+            {
+                for(vtkIdType iPt=0;iPt<npts;iPt++)
+                    out << " " << pts[iPt]+1 << "//" << pts[iPt]+1; // (OBJ indices are 1-based)
+            }
+            else
+            {
+                for(vtkIdType iPt=0;iPt<npts;iPt++)
+                    out << " " << pts[iPt]+1; // (OBJ indices are 1-based)
+            }
+            out << "\n";
+        }
+    }
+    else
+    {
+        vtkSmartPointer<vtkXMLPolyDataWriter> writer = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
+        writer->SetFileName(filename.c_str());
+        #if VTK_MAJOR_VERSION >= 6
+            writer->SetInputData(pd);
+        #else
+            writer->SetInput(pd);
+        #endif
+        if(writer->Write() != 1)
+            throw runtime_error("WriteMesh : failed to write file: "+filename);
+    }
+}
+
+// =====================================================================
+
+/// A worker thread that takes jobs from a FrameRecorder until it is told to stop.
+class FrameRecorderThread : public wxThread
+{
+    public:
+
+        FrameRecorderThread(FrameRecorder* r) : wxThread(wxTHREAD_JOINABLE), recorder(r) {}
+
+    protected:
+
+        virtual ExitCode Entry()
+        {
+            this->recorder->WorkerLoop();
+            return 0;
+        }
+
+        FrameRecorder *recorder;
+};
+
+// =====================================================================
+
+FrameRecorder::FrameRecorder(int n_workers,int queue_capacity)
+    : ring(max(1,queue_capacity))
+    , i_first(0)
+    , n_queued(0)
+    , n_in_progress(0)
+    , n_written(0)
+    , is_stopping(false)
+    , not_empty(mutex)
+    , not_full(mutex)
+    , is_idle(mutex)
+    , time_spent_waiting(0.0)
+    , video_stream(NULL)
+    , video_stream_is_pipe(false)
+    #ifndef _WIN32
+    , previous_sigpipe_handler(SIG_DFL)
+    #endif
+    , video_fps(25)
+    , video_width(0)
+    , video_height(0)
+    , n_video_frames_added(0)
+    , i_next_video_frame(0)
+    , video_turn(video_mutex)
+{
+    this->time_started = get_time_in_seconds();
+    for(int i=0;i<n_workers;i++)
+    {
+        wxThread *worker = new FrameRecorderThread(this);
+        if(worker->Create() != wxTHREAD_NO_ERROR || worker->Run() != wxTHREAD_NO_ERROR)
+        {
+            delete worker;
+            break;
+        }
+        this->workers.push_back(worker);
+    }
+    // (if no workers could be started then Push() does the work itself)
+}
+
+// ---------------------------------------------------------------------
+
+FrameRecorder::~FrameRecorder()
+{
+    this->Finish();
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::OpenVideoStream(const string& filename_or_command,bool is_pipe,int frames_per_second)
+{
+    if(this->video_stream)
+        throw runtime_error("FrameRecorder::OpenVideoStream : stream is already open");
+    if(is_pipe)
+    {
+        #ifdef _WIN32
+            this->video_stream = popen(filename_or_command.c_str(),"wb");
+        #else
+            // if the encoder quits we want a failed write, not to be killed (until the pipe is closed again)
+            this->previous_sigpipe_handler = signal(SIGPIPE,SIG_IGN);
+            this->video_stream = popen(filename_or_command.c_str(),"w");
+            if(!this->video_stream)
+                signal(SIGPIPE,this->previous_sigpipe_handler);
+        #endif
+    }
+    else
+        this->video_stream = fopen(filename_or_command.c_str(),"wb");
+    if(!this->video_stream)
+        throw runtime_error("FrameRecorder::OpenVideoStream : failed to open: "+filename_or_command);
+    this->video_stream_is_pipe = is_pipe;
+    this->video_fps = max(1,frames_per_second);
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::AddImage(vtkSmartPointer<vtkImageData> image,const string& filename)
+{
+    Job job;
+    job.type = IMAGE_FILE;
+    job.image = image;
+    job.filename = filename;
+    this->Push(job);
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::AddVideoFrame(vtkSmartPointer<vtkImageData> image)
+{
+    if(!this->video_stream)
+        throw runtime_error("FrameRecorder::AddVideoFrame : no video stream open");
+    Job job;
+    job.type = VIDEO_FRAME;
+    job.image = image;
+    this->Push(job);
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::AddMesh(vtkSmartPointer<vtkPolyData> mesh,const string& filename,bool should_decimate,double target_reduction)
+{
+    Job job;
+    job.type = MESH_FILE;
+    job.mesh = mesh;
+    job.filename = filename;
+    job.should_decimate = should_decimate;
+    job.target_reduction = target_reduction;
+    this->Push(job);
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::Push(const Job& new_job)
+{
+    if(this->workers.empty())
+    {
+        // no threads available, do the work here
+        Job job = new_job;
+        if(job.type == VIDEO_FRAME)
+            job.video_frame_index = this->n_video_frames_added++;
+        this->Process(job);
+        this->n_written++;
+        return;
+    }
+
+    wxMutexLocker lock(this->mutex);
+    const int capacity = (int)this->ring.size();
+    if(this->n_queued == capacity)
+    {
+        // back-pressure: wait for a worker to take a job from the queue
+        double time_before = get_time_in_seconds();
+        while(this->n_queued == capacity)
+            this->not_full.Wait();
+        this->time_spent_waiting += get_time_in_seconds() - time_before;
+    }
+    Job& job = this->ring[(this->i_first + this->n_queued) % capacity];
+    job = new_job;
+    if(job.type == VIDEO_FRAME)
+        job.video_frame_index = this->n_video_frames_added++;
+    this->n_queued++;
+    this->not_empty.Signal();
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::WorkerLoop()
+{
+    for(;;)
+    {
+        Job job;
+        {
+            wxMutexLocker lock(this->mutex);
+            while(this->n_queued == 0 && !this->is_stopping)
+                this->not_empty.Wait();
+            if(this->n_queued == 0)
+                return; // we've been told to stop and there's nothing left to do
+            job = this->ring[this->i_first];
+            this->ring[this->i_first] = Job(); // the queue no longer needs the snapshot
+            this->i_first = (this->i_first + 1) % (int)this->ring.size();
+            this->n_queued--;
+            this->n_in_progress++;
+            this->not_full.Signal();
+        }
+
+        this->Process(job);
+        job = Job(); // release the snapshot before reporting that we're done
+
+        {
+            wxMutexLocker lock(this->mutex);
+            this->n_in_progress--;
+            this->n_written++;
+            if(this->n_queued == 0 && this->n_in_progress == 0)
+                this->is_idle.Broadcast();
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::Process(Job& job)
+{
+    try
+    {
+        switch(job.type)
+        {
+            case IMAGE_FILE:
+            {
+                vtkSmartPointer<vtkImageWriter> writer;
+                if(EndsWith(job.filename,".jpg")) writer = vtkSmartPointer<vtkJPEGWriter>::New();
+                else writer = vtkSmartPointer<vtkPNGWriter>::New();
+                #if VTK_MAJOR_VERSION >= 6
+                    writer->SetInputData(job.image);
+                #else
+                    writer->SetInput(job.image);
+                #endif
+                writer->SetFileName(job.filename.c_str());
+                writer->Write();
+                if(writer->GetErrorCode() != 0)
+                    throw runtime_error("failed to write "+job.filename);
+                break;
+            }
+            case VIDEO_FRAME:
+                this->WriteVideoFrame(job);
+                break;
+            case MESH_FILE:
+                WriteMesh(job.mesh,job.filename,job.should_decimate,job.target_reduction);
+                break;
+        }
+    }
+    catch(const exception& e)
+    {
+        wxMutexLocker lock(this->mutex);
+        if(this->error_message.empty())
+            this->error_message = e.what();
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::WriteVideoFrame(const Job& job)
+{
+    // convert to YUV 4:4:4 (BT.601 studio range), flipping vertically since VTK images start at the bottom
+    vtkImageData *image = job.image;
+    int dims[3];
+    image->GetDimensions(dims);
+    const int w = dims[0], h = dims[1];
+    const int nc = image->GetNumberOfScalarComponents();
+    vector<unsigned char> yuv(3 * w * h);
+    bool is_rgb = image->GetScalarType() == VTK_UNSIGNED_CHAR && nc >= 3;
+    if(is_rgb)
+    {
+        const unsigned char *rgb = static_cast<const unsigned char*>(image->GetScalarPointer());
+        for(int y=0;y<h;y++)
+        {
+            const unsigned char *src = rgb + (h-1-y) * w * nc;
+            unsigned char *Y = &yuv[y*w], *U = Y + w*h, *V = U + w*h;
+            for(int x=0;x<w;x++,src+=nc)
+            {
+                const int r = src[0], g = src[1], b = src[2];
+                Y[x] = (unsigned char)((( 66*r + 129*g +  25*b + 128) >> 8) + 16);
+                U[x] = (unsigned char)(((-38*r -  74*g + 112*b + 128) >> 8) + 128);
+                V[x] = (unsigned char)(((112*r -  94*g -  18*b + 128) >> 8) + 128);
+            }
+        }
+    }
+
+    // wait for our turn, so that frames are written in order
+    wxMutexLocker lock(this->video_mutex);
+    while(job.video_frame_index != this->i_next_video_frame)
+        this->video_turn.Wait();
+
+    bool ok = is_rgb;
+    if(ok)
+    {
+        if(this->video_width == 0)
+        {
+            // the first frame fixes the size of the video
+            this->video_width = w;
+            this->video_height = h;
+            ok = fprintf(this->video_stream,"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",w,h,this->video_fps) > 0;
+        }
+        ok = ok && fputs("FRAME\n",this->video_stream) >= 0;
+        // write the planes, cropping or padding with black if the frame size has changed
+        const unsigned char pad_value[3] = { 16, 128, 128 };
+        vector<unsigned char> row(this->video_width);
+        for(int plane=0;plane<3 && ok;plane++)
+        {
+            for(int y=0;y<this->video_height && ok;y++)
+            {
+                fill(row.begin(),row.end(),pad_value[plane]);
+                if(y < h)
+                    copy(&yuv[plane*w*h + y*w], &yuv[plane*w*h + y*w] + min(w,this->video_width), row.begin());
+                ok = fwrite(&row[0],1,row.size(),this->video_stream) == row.size();
+            }
+        }
+    }
+
+    // always hand over to the next frame, even if we failed, else the other workers would wait forever
+    this->i_next_video_frame++;
+    this->video_turn.Broadcast();
+
+    if(!is_rgb)
+        throw runtime_error("FrameRecorder::WriteVideoFrame : expected an RGB image");
+    if(!ok)
+        throw runtime_error("FrameRecorder::WriteVideoFrame : failed to write to the video stream");
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::Finish()
+{
+    if(!this->workers.empty())
+    {
+        {
+            wxMutexLocker lock(this->mutex);
+            while(this->n_queued > 0 || this->n_in_progress > 0)
+                this->is_idle.Wait();
+            this->is_stopping = true;
+            this->not_empty.Broadcast();
+        }
+        for(size_t i=0;i<this->workers.size();i++)
+        {
+            this->workers[i]->Wait();
+            delete this->workers[i];
+        }
+        this->workers.clear();
+    }
+    if(this->video_stream)
+    {
+        if(this->video_stream_is_pipe)
+        {
+            pclose(this->video_stream);
+            #ifndef _WIN32
+                signal(SIGPIPE,this->previous_sigpipe_handler);
+            #endif
+        }
+        else fclose(this->video_stream);
+        this->video_stream = NULL;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+int FrameRecorder::GetNumberOfQueuedFrames()
+{
+    wxMutexLocker lock(this->mutex);
+    return this->n_queued + this->n_in_progress;
+}
+
+// ---------------------------------------------------------------------
+
+int FrameRecorder::GetNumberOfFramesWritten()
+{
+    wxMutexLocker lock(this->mutex);
+    return this->n_written;
+}
+
+// ---------------------------------------------------------------------
+
+double FrameRecorder::GetWaitingPercentage()
+{
+    double elapsed = get_time_in_seconds() - this->time_started;
+    if(elapsed <= 0.0) return 0.0;
+    wxMutexLocker lock(this->mutex);
+    return 100.0 * this->time_spent_waiting / elapsed;
+}
+
+// ---------------------------------------------------------------------
+
+string FrameRecorder::GetError()
+{
+    wxMutexLocker lock(this->mutex);
+    return this->error_message;
+}
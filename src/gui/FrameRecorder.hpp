@@ -0,0 +1,135 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __FRAMERECORDER__
+#define __FRAMERECORDER__
+
+// wxWidgets:
+#include <wx/wxprec.h>
+#ifdef __BORLANDC__
+    #pragma hdrstop
+#endif
+#ifndef WX_PRECOMP
+    #include <wx/wx.h>
+#endif
+#include <wx/thread.h>
+
+// VTK:
+#include <vtkSmartPointer.h>
+class vtkImageData;
+class vtkPolyData;
+
+// STL:
+#include <string>
+#include <vector>
+
+// stdlib:
+#include <stdio.h>
+
+/// Writes a mesh to an .obj or .vtp file, optionally decimating it first. Throws on failure.
+void WriteMesh(vtkPolyData* mesh,const std::string& filename,bool should_decimate,double target_reduction);
+
+/// Writes recorded frames to disk on a pool of worker threads, so that the simulation doesn't have to wait.
+/**
+ * The GUI thread takes a snapshot of whatever is to be recorded (an image or a mesh) and hands it
+ * over; from then on the snapshot belongs to the recorder and mustn't be touched. Snapshots wait in
+ * a ring buffer of fixed size until a worker is free to encode and write them. If the ring buffer
+ * is full then the Add methods block until there is room, so the simulation slows to the speed of
+ * the disk rather than using unbounded memory. GetWaitingPercentage() reports how much this is
+ * happening.
+ *
+ * As well as separate image files, frames can be sent as a single raw video stream in YUV4MPEG2
+ * (.y4m) format, either to a file or to the standard input of an external encoder. The frames are
+ * converted in parallel but written in order.
+ */
+class FrameRecorder
+{
+    public:
+
+        FrameRecorder(int n_workers,int queue_capacity);
+        ~FrameRecorder(); ///< waits for any queued frames to be written
+
+        /// Send frames added with AddVideoFrame to a .y4m file, or (if is_pipe) to the input of a shell command.
+        void OpenVideoStream(const std::string& filename_or_command,bool is_pipe,int frames_per_second); // throws on failure
+
+        void AddImage(vtkSmartPointer<vtkImageData> image,const std::string& filename);   ///< writes a .png or .jpg
+        void AddVideoFrame(vtkSmartPointer<vtkImageData> image);                           ///< appends to the video stream
+        void AddMesh(vtkSmartPointer<vtkPolyData> mesh,const std::string& filename,bool should_decimate,double target_reduction);
+
+        /// Waits for all the queued frames to be written, then stops the workers and closes the video stream.
+        void Finish();
+
+        int GetNumberOfQueuedFrames();          ///< frames waiting or being written
+        int GetQueueCapacity() const { return (int)this->ring.size(); }
+        int GetNumberOfFramesWritten();
+        double GetWaitingPercentage();          ///< percentage of the time since starting that the caller spent blocked on a full queue
+        std::string GetError();                 ///< the first error reported by a worker, or empty
+
+        /// Called by the worker threads.
+        void WorkerLoop();
+
+    protected:
+
+        enum JobType { IMAGE_FILE, VIDEO_FRAME, MESH_FILE };
+
+        struct Job
+        {
+            Job() : type(IMAGE_FILE), should_decimate(false), target_reduction(0.0), video_frame_index(0) {}
+
+            JobType type;
+            vtkSmartPointer<vtkImageData> image;
+            vtkSmartPointer<vtkPolyData> mesh;
+            std::string filename;
+            bool should_decimate;
+            double target_reduction;
+            int video_frame_index;              ///< the order in which video frames must be written
+        };
+
+        void Push(const Job& job);
+        void Process(Job& job);
+        void WriteVideoFrame(const Job& job);
+
+    protected:
+
+        std::vector<Job> ring;
+        int i_first,n_queued,n_in_progress,n_written;
+        bool is_stopping;
+        wxMutex mutex;
+        wxCondition not_empty,not_full,is_idle;
+        std::vector<wxThread*> workers;
+
+        double time_started,time_spent_waiting;
+        std::string error_message;
+
+        // raw video output:
+        FILE *video_stream;
+        bool video_stream_is_pipe;
+        #ifndef _WIN32
+            void (*previous_sigpipe_handler)(int);  ///< restored when the pipe is closed
+        #endif
+        int video_fps,video_width,video_height;
+        int n_video_frames_added,i_next_video_frame;
+        wxMutex video_mutex;
+        wxCondition video_turn;
+
+    private: // deliberately not implemented, to prevent use
+
+        FrameRecorder(const FrameRecorder&);
+        void operator=(const FrameRecorder&);
+};
+
+#endif
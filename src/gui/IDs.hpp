@@ -48,6 +48,7 @@ namespace ID
         ImportImage,
         ExportImage,
         SaveCompact,
+        SaveProbeData,
 
         // edit menu
         Pointer,
@@ -53,6 +53,10 @@ const wxString block_size_label = _("Block size");
 const wxString number_of_cells_label = _("Number of cells");
 const wxString wrap_label = _("Toroidal wrap-around");
 const wxString data_type_label = _("Data type");
+const wxString half_storage_label = _("Half-precision storage");
+const wxString interleaved_label = _("Interleaved chemicals");
+const wxString activity_tolerance_label = _("Skip quiet tiles");
+const wxString refinement_label = _("Refine steep patches");
 const wxString neighborhood_type_label = _("Neighborhood");
 const wxString neighborhood_range_label = _("Neighborhood range");
 const wxString neighborhood_weight_label = _("Neighborhood weight");
@@ -438,6 +442,20 @@ void InfoPanel::Update(const AbstractRD* const system)
     contents += AppendRow(data_type_label,data_type_label,system->GetDataType()==VTK_DOUBLE?_("double"):_("float"),
         system->HasEditableDataType());
 
+    if(system->HasEditableHalfStorage())
+        contents += AppendRow(half_storage_label,half_storage_label,system->GetHalfStorage()?_("on"):_("off"),true);
+
+    if(system->HasEditableInterleavedChemicals())
+        contents += AppendRow(interleaved_label,interleaved_label,system->GetInterleavedChemicals()?_("on"):_("off"),true);
+
+    if(system->HasEditableActivityTolerance())
+        contents += AppendRow(activity_tolerance_label,activity_tolerance_label,system->GetActivityTolerance()>0.0f ?
+            wxString::Format(wxT("below %g"),system->GetActivityTolerance()) : _("off"),true);
+
+    if(system->HasEditableRefinementThreshold())
+        contents += AppendRow(refinement_label,refinement_label,system->GetRefinementThreshold()>0.0f ?
+            wxString::Format(wxT("above %g"),system->GetRefinementThreshold()) : _("off"),true);
+
     contents += _T("</table>");
 
     contents += wxT("<h5><center>");
@@ -859,6 +877,76 @@ void InfoPanel::ChangeDataType()
 
 // -----------------------------------------------------------------------------
 
+void InfoPanel::ChangeHalfStorage()
+{
+    AbstractRD* sys = frame->GetCurrentRDSystem();
+    sys->SetHalfStorage(!sys->GetHalfStorage());
+    this->Update(sys);
+}
+
+// -----------------------------------------------------------------------------
+
+void InfoPanel::ChangeInterleavedChemicals()
+{
+    AbstractRD* sys = frame->GetCurrentRDSystem();
+    sys->SetInterleavedChemicals(!sys->GetInterleavedChemicals());
+    this->Update(sys);
+}
+
+// -----------------------------------------------------------------------------
+
+void InfoPanel::ChangeActivityTolerance()
+{
+    AbstractRD* sys = frame->GetCurrentRDSystem();
+    float oldval = sys->GetActivityTolerance();
+    float newval;
+
+    // position dialog box to left of linkrect
+    wxPoint pos = ClientToScreen( wxPoint(html->linkrect.x, html->linkrect.y) );
+    int dlgwd = 300;
+    pos.x -= dlgwd + 20;
+
+    if ( GetFloat(_("Skip the tiles that change less than this per step (0 to compute every tile):"), _("Tolerance:"),
+                  oldval, &newval, pos, wxSize(dlgwd,wxDefaultCoord)) )
+    {
+        if (newval < 0.0f)
+            Warning(_("The tolerance can't be negative."));
+        else if (newval != oldval)
+        {
+            sys->SetActivityTolerance(newval);
+            this->Update(sys);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void InfoPanel::ChangeRefinementThreshold()
+{
+    AbstractRD* sys = frame->GetCurrentRDSystem();
+    float oldval = sys->GetRefinementThreshold();
+    float newval;
+
+    // position dialog box to left of linkrect
+    wxPoint pos = ClientToScreen( wxPoint(html->linkrect.x, html->linkrect.y) );
+    int dlgwd = 300;
+    pos.x -= dlgwd + 20;
+
+    if ( GetFloat(_("Refine the patches where neighboring cells differ by more than this (0 for no refinement):"), _("Threshold:"),
+                  oldval, &newval, pos, wxSize(dlgwd,wxDefaultCoord)) )
+    {
+        if (newval < 0.0f)
+            Warning(_("The threshold can't be negative."));
+        else if (newval != oldval)
+        {
+            sys->SetRefinementThreshold(newval);
+            this->Update(sys);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
 void InfoPanel::ChangeInfo(const wxString& label)
 {
     if ( label == rule_name_label ) {
@@ -885,6 +973,18 @@ void InfoPanel::ChangeInfo(const wxString& label)
     } else if ( label == data_type_label ) {
         ChangeDataType();
 
+    } else if ( label == half_storage_label ) {
+        ChangeHalfStorage();
+
+    } else if ( label == interleaved_label ) {
+        ChangeInterleavedChemicals();
+
+    } else if ( label == activity_tolerance_label ) {
+        ChangeActivityTolerance();
+
+    } else if ( label == refinement_label ) {
+        ChangeRefinementThreshold();
+
     } else if ( frame->GetRenderSettings().IsProperty(string(label.mb_str())) ) {
         ChangeRenderSetting(label);
 
@@ -92,6 +92,10 @@ class InfoPanel : public wxPanel
         void ChangeBlockSize();
         void ChangeWrapOption();
         void ChangeDataType();
+        void ChangeHalfStorage();
+        void ChangeInterleavedChemicals();
+        void ChangeActivityTolerance();
+        void ChangeRefinementThreshold();
         
         // event handlers
         void OnSmallerButton(wxCommandEvent& event);
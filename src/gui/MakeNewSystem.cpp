@@ -29,6 +29,7 @@ along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
 // wxWidgets:
 #include <wx/choicdlg.h>
 #include <wx/msgdlg.h>
+#include <wx/progdlg.h>
 #include <wx/utils.h>
 
 // VTK:
@@ -38,6 +39,16 @@ along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
 #include <vector>
 using namespace std;
 
+// ---------------------------------------------------------------------
+
+/// A MeshGenerators::ProgressCallback for a wxProgressDialog.
+void UpdateProgressDialog(double fraction_done, void* progress_dialog)
+{
+    static_cast<wxProgressDialog*>(progress_dialog)->Update((int)(fraction_done * 100));
+}
+
+// ---------------------------------------------------------------------
+
 AbstractRD* MakeNewImage1D(const bool is_opencl_available,const int opencl_platform,const int opencl_device,Properties& render_settings)
 {
     // perhaps at some point we will want this to be determined by the user
@@ -372,8 +383,8 @@ AbstractRD* MakeNewDelaunay2D(const bool is_opencl_available, const int opencl_p
 
     int npts;
     {
-        const int N_CHOICES = 5;
-        int choices[N_CHOICES] = { 1000,2000,5000,10000,20000 };
+        const int N_CHOICES = 7;
+        int choices[N_CHOICES] = { 1000,2000,5000,10000,20000,100000,500000 };
         wxString div_descriptions[N_CHOICES];
         for (int i = 0; i<N_CHOICES; i++)
             div_descriptions[i] = wxString::Format("%d cells", choices[i] * 2); // (rough approximation)
@@ -387,7 +398,10 @@ AbstractRD* MakeNewDelaunay2D(const bool is_opencl_available, const int opencl_p
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetRandomDelaunay2D(npts, mesh, 2, data_type);
+    {
+        wxProgressDialog progress(_("Making mesh"), _("Making the mesh..."), 100, NULL, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+        MeshGenerators::GetRandomDelaunay2D(npts, mesh, 2, data_type, UpdateProgressDialog, &progress);
+    }
     MeshRD *mesh_sys;
     if (is_opencl_available)
         mesh_sys = new FormulaOpenCLMeshRD(opencl_platform, opencl_device, data_type);
@@ -410,8 +424,8 @@ AbstractRD* MakeNewVoronoi2D(const bool is_opencl_available, const int opencl_pl
 
     int npts;
     {
-        const int N_CHOICES = 5;
-        int choices[N_CHOICES] = { 1000,2000,10000,20000,50000 };
+        const int N_CHOICES = 7;
+        int choices[N_CHOICES] = { 1000,2000,10000,20000,50000,200000,1000000 };
         wxString div_descriptions[N_CHOICES];
         for (int i = 0; i<N_CHOICES; i++)
             div_descriptions[i] = wxString::Format("%d cells", choices[i]);
@@ -425,7 +439,10 @@ AbstractRD* MakeNewVoronoi2D(const bool is_opencl_available, const int opencl_pl
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetRandomVoronoi2D(npts, mesh, 2, data_type);
+    {
+        wxProgressDialog progress(_("Making mesh"), _("Making the mesh..."), 100, NULL, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+        MeshGenerators::GetRandomVoronoi2D(npts, mesh, 2, data_type, UpdateProgressDialog, &progress);
+    }
     MeshRD *mesh_sys;
     if (is_opencl_available)
         mesh_sys = new FormulaOpenCLMeshRD(opencl_platform, opencl_device, data_type);
@@ -448,8 +465,8 @@ AbstractRD* MakeNewDelaunay3D(const bool is_opencl_available, const int opencl_p
 
     int npts;
     {
-        const int N_CHOICES = 5;
-        int choices[N_CHOICES] = { 500,1000,1500,2000,5000 };
+        const int N_CHOICES = 7;
+        int choices[N_CHOICES] = { 500,1000,1500,2000,5000,20000,100000 };
         wxString div_descriptions[N_CHOICES];
         for (int i = 0; i<N_CHOICES; i++)
             div_descriptions[i] = wxString::Format("%d points - approximately %d cells", choices[i], choices[i] * 6);
@@ -463,7 +480,10 @@ AbstractRD* MakeNewDelaunay3D(const bool is_opencl_available, const int opencl_p
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetRandomDelaunay3D(npts, mesh, 2, data_type);
+    {
+        wxProgressDialog progress(_("Making mesh"), _("Making the mesh..."), 100, NULL, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+        MeshGenerators::GetRandomDelaunay3D(npts, mesh, 2, data_type, UpdateProgressDialog, &progress);
+    }
     MeshRD *mesh_sys;
     if (is_opencl_available)
         mesh_sys = new FormulaOpenCLMeshRD(opencl_platform, opencl_device, data_type);
@@ -484,9 +504,9 @@ AbstractRD* MakeNewBodyCentredCubicHoneycomb(const bool is_opencl_available, con
 
     int side;
     {
-        const int N_CHOICES = 3;
-        int choices[N_CHOICES] = { 5,10,20 };
-        int cells[N_CHOICES] = { 189,1729,14859 };
+        const int N_CHOICES = 5;
+        int choices[N_CHOICES] = { 5,10,20,50,100 };
+        int cells[N_CHOICES] = { 189,1729,14859,242649,1970299 };
         wxString descriptions[N_CHOICES];
         for (int i = 0; i<N_CHOICES; i++)
             descriptions[i] = wxString::Format("%d cells", cells[i]);
@@ -500,7 +520,10 @@ AbstractRD* MakeNewBodyCentredCubicHoneycomb(const bool is_opencl_available, con
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetBodyCentredCubicHoneycomb(side, mesh, 2, data_type);
+    {
+        wxProgressDialog progress(_("Making mesh"), _("Making the mesh..."), 100, NULL, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+        MeshGenerators::GetBodyCentredCubicHoneycomb(side, mesh, 2, data_type, UpdateProgressDialog, &progress);
+    }
     MeshRD *mesh_sys;
     if (is_opencl_available)
         mesh_sys = new FormulaOpenCLMeshRD(opencl_platform, opencl_device, data_type);
@@ -510,7 +533,7 @@ AbstractRD* MakeNewBodyCentredCubicHoneycomb(const bool is_opencl_available, con
     render_settings.GetProperty("active_chemical").SetChemical("b");
     render_settings.GetProperty("slice_3D").SetBool(true);
     render_settings.GetProperty("slice_3D_axis").SetAxis("y");
-    render_settings.GetProperty("show_cell_edges").SetBool(true);
+    render_settings.GetProperty("show_cell_edges").SetBool(side<=20);
     render_settings.GetProperty("use_image_interpolation").SetBool(false);
     return mesh_sys;
 }
@@ -524,9 +547,9 @@ AbstractRD* MakeNewFaceCentredCubicHoneycomb(const bool is_opencl_available, con
 
     int side;
     {
-        const int N_CHOICES = 3;
-        int choices[N_CHOICES] = { 5,10,20 };
-        int cells[N_CHOICES] = { 500,4000,32000 };
+        const int N_CHOICES = 5;
+        int choices[N_CHOICES] = { 5,10,20,50,100 };
+        int cells[N_CHOICES] = { 500,4000,32000,500000,4000000 };
         wxString descriptions[N_CHOICES];
         for (int i = 0; i<N_CHOICES; i++)
             descriptions[i] = wxString::Format("%d cells", cells[i]);
@@ -540,7 +563,10 @@ AbstractRD* MakeNewFaceCentredCubicHoneycomb(const bool is_opencl_available, con
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetFaceCentredCubicHoneycomb(side, mesh, 2, data_type);
+    {
+        wxProgressDialog progress(_("Making mesh"), _("Making the mesh..."), 100, NULL, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+        MeshGenerators::GetFaceCentredCubicHoneycomb(side, mesh, 2, data_type, UpdateProgressDialog, &progress);
+    }
     MeshRD *mesh_sys;
     if (is_opencl_available)
         mesh_sys = new FormulaOpenCLMeshRD(opencl_platform, opencl_device, data_type);
@@ -550,7 +576,7 @@ AbstractRD* MakeNewFaceCentredCubicHoneycomb(const bool is_opencl_available, con
     render_settings.GetProperty("active_chemical").SetChemical("b");
     render_settings.GetProperty("slice_3D").SetBool(true);
     render_settings.GetProperty("slice_3D_axis").SetAxis("y");
-    render_settings.GetProperty("show_cell_edges").SetBool(true);
+    render_settings.GetProperty("show_cell_edges").SetBool(side<=20);
     render_settings.GetProperty("use_image_interpolation").SetBool(false);
     return mesh_sys;
 }
@@ -564,9 +590,9 @@ AbstractRD* MakeNewDiamondHoneycomb(const bool is_opencl_available, const int op
 
     int side;
     {
-        const int N_CHOICES = 3;
-        int choices[N_CHOICES] = { 5,10,20 };
-        int cells[N_CHOICES] = { 250,2000,16000 };
+        const int N_CHOICES = 5;
+        int choices[N_CHOICES] = { 5,10,20,50,100 };
+        int cells[N_CHOICES] = { 250,2000,16000,250000,2000000 };
         wxString descriptions[N_CHOICES];
         for (int i = 0; i<N_CHOICES; i++)
             descriptions[i] = wxString::Format("%d cells", cells[i]);
@@ -580,7 +606,10 @@ AbstractRD* MakeNewDiamondHoneycomb(const bool is_opencl_available, const int op
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetDiamondCells(side, mesh, 2, data_type);
+    {
+        wxProgressDialog progress(_("Making mesh"), _("Making the mesh..."), 100, NULL, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+        MeshGenerators::GetDiamondCells(side, mesh, 2, data_type, UpdateProgressDialog, &progress);
+    }
     MeshRD *mesh_sys;
     if (is_opencl_available)
         mesh_sys = new FormulaOpenCLMeshRD(opencl_platform, opencl_device, data_type);
@@ -590,7 +619,7 @@ AbstractRD* MakeNewDiamondHoneycomb(const bool is_opencl_available, const int op
     render_settings.GetProperty("active_chemical").SetChemical("b");
     render_settings.GetProperty("slice_3D").SetBool(true);
     render_settings.GetProperty("slice_3D_axis").SetAxis("y");
-    render_settings.GetProperty("show_cell_edges").SetBool(true);
+    render_settings.GetProperty("show_cell_edges").SetBool(side<=20);
     render_settings.GetProperty("use_image_interpolation").SetBool(false);
     return mesh_sys;
 }
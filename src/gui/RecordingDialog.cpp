@@ -82,10 +82,17 @@ RecordingDialog::RecordingDialog(wxWindow *parent,
         this->extension_combo = new wxComboBox(this,wxID_ANY,wxEmptyString,wxDefaultPosition,wxDefaultSize,0,NULL,wxCB_READONLY);
         this->extension_combo->AppendString(_(".png"));
         this->extension_combo->AppendString(_(".jpg"));
+        this->extension_combo->AppendString(_(".y4m"));
         this->extension_combo->SetSelection(0);
+        this->extension_combo->Bind(wxEVT_COMMAND_COMBOBOX_SELECTED,&RecordingDialog::OnExtensionChange,this);
         hbox2->Add(this->extension_combo,0,wxLEFT | wxRIGHT,0);
     }
 
+    wxStaticText* video_command_label = new wxStaticText(this, wxID_STATIC, _("Send .y4m video to this command instead of to a file: (optional)"));
+    this->video_command_edit = new wxTextCtrl(this,wxID_ANY);
+    this->video_command_edit->SetToolTip(_("e.g. ffmpeg -y -i - -vcodec libx264 video.mp4"));
+    this->video_command_edit->Enable(false);
+
     wxBoxSizer* hbox3 = new wxBoxSizer(wxHORIZONTAL);
     {
         this->should_decimate_check = new wxCheckBox(this, wxID_ANY, _("Reduce triangle count to"));
@@ -118,6 +125,9 @@ RecordingDialog::RecordingDialog(wxWindow *parent,
     vbox->AddSpacer(10);
     vbox->Add(filenames_label, 0, wxLEFT | wxRIGHT, 10);
     vbox->Add(hbox2, 0, wxEXPAND | wxLEFT | wxRIGHT, 10);
+    vbox->AddSpacer(10);
+    vbox->Add(video_command_label, 0, wxLEFT | wxRIGHT, 10);
+    vbox->Add(this->video_command_edit, 0, wxEXPAND | wxLEFT | wxRIGHT, 10);
     vbox->AddSpacer(12);
     vbox->Add(hbox3, 0, wxLEFT | wxRIGHT, 10);
     vbox->AddSpacer(12);
@@ -165,6 +175,9 @@ bool RecordingDialog::TransferDataFromWindow()
     this->recording_prefix = string(this->folder_edit->GetValue().mb_str()) + "/" + string(this->filename_prefix_edit->GetValue().mb_str());
     this->should_decimate = this->should_decimate_check->GetValue();
     this->target_reduction_edit->GetValue().ToDouble(&this->target_reduction);
+    this->video_command = string(this->video_command_edit->GetValue().mb_str());
+    if(this->recording_extension != ".y4m")
+        this->video_command.clear();
     // TODO: save other settings in prefs too, if wanted
     return true;
 }
@@ -194,10 +207,20 @@ void RecordingDialog::OnSourceSelectionChange(wxCommandEvent& event)
     {
         this->extension_combo->AppendString(_(".png"));
         this->extension_combo->AppendString(_(".jpg"));
+        if (this->source_combo->GetValue() != this->source_2D_data_all_chemicals)
+            this->extension_combo->AppendString(_(".y4m")); // (a single video stream can only hold one chemical)
         this->should_decimate_check->Enable(false);
         this->target_reduction_edit->Enable(false);
     }
     this->extension_combo->SetSelection(0);
+    this->video_command_edit->Enable(false);
+}
+
+// -----------------------------------------------------------------------------------------------
+
+void RecordingDialog::OnExtensionChange(wxCommandEvent& event)
+{
+    this->video_command_edit->Enable(this->extension_combo->GetValue() == _(".y4m"));
 }
 
 // -----------------------------------------------------------------------------------------------
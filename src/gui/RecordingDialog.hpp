@@ -45,11 +45,13 @@ class RecordingDialog : public wxDialog
         bool record_3D_surface;
         bool should_decimate;
         double target_reduction;
+        std::string video_command;      ///< if not empty, .y4m video is sent to this command instead of to a file
 
     protected:
 
         void OnSourceSelectionChange(wxCommandEvent& event);
         void OnChangeFolder(wxCommandEvent& event);
+        void OnExtensionChange(wxCommandEvent& event);
 
     protected:
 
@@ -64,6 +66,7 @@ class RecordingDialog : public wxDialog
         wxTextCtrl *filename_prefix_edit;
         wxCheckBox *should_decimate_check;
         wxTextCtrl *target_reduction_edit;
+        wxTextCtrl *video_command_edit;
 
     private:
 
@@ -27,6 +27,7 @@
 #include "vtk_pipeline.hpp"
 #include "dialogs.hpp"
 #include "RecordingDialog.hpp"
+#include "FrameRecorder.hpp"
 #include "ImportImageDialog.hpp"
 #include "MakeNewSystem.hpp"
 
@@ -60,12 +61,18 @@
 // STL:
 #include <string>
 #include <algorithm>
+#include <fstream>
 using namespace std;
 
+// stdlib:
+#include <float.h>
+#include <math.h>
+
 // VTK:
 #include <vtkBMPReader.h>
 #include <vtkCellArray.h>
 #include <vtkCellPicker.h>
+#include <vtkImageData.h>
 #include <vtkImageLuminance.h>
 #include <vtkImageReader2.h>
 #include <vtkImageResize.h>
@@ -76,14 +83,12 @@ using namespace std;
 #include <vtkPNGReader.h>
 #include <vtkPNGWriter.h>
 #include <vtkPointData.h>
-#include <vtkPolyDataNormals.h>
-#include <vtkQuadricDecimation.h>
+#include <vtkPolyData.h>
 #include <vtkRendererCollection.h>
 #include <vtkSmartPointer.h>
 #include <vtkUnstructuredGrid.h>
 #include <vtkWindowToImageFilter.h>
 #include <vtkXMLPolyDataReader.h>
-#include <vtkXMLPolyDataWriter.h>
 
 #ifdef __WXMAC__
     #include <Carbon/Carbon.h>  // for GetCurrentProcess, etc
@@ -134,6 +139,8 @@ BEGIN_EVENT_TABLE(MyFrame, wxFrame)
     EVT_MENU(ID::Screenshot, MyFrame::OnScreenshot)
     EVT_MENU(ID::RecordFrames, MyFrame::OnRecordFrames)
     EVT_UPDATE_UI(ID::RecordFrames, MyFrame::OnUpdateRecordFrames)
+    EVT_MENU(ID::SaveProbeData, MyFrame::OnSaveProbeData)
+    EVT_UPDATE_UI(ID::SaveProbeData, MyFrame::OnUpdateSaveProbeData)
     EVT_MENU(ID::AddMyPatterns, MyFrame::OnAddMyPatterns)
     EVT_MENU(wxID_PREFERENCES, MyFrame::OnPreferences)
     EVT_MENU(wxID_EXIT, MyFrame::OnQuit)
@@ -245,10 +252,12 @@ MyFrame::MyFrame(const wxString& title)
        fullscreen(false),
        render_settings("render_settings"),
        is_recording(false),
+       recorder(NULL),
        CurrentCursor(POINTER),
        current_paint_value(0.5f),
        left_mouse_is_down(false),
-       right_mouse_is_down(false)
+       right_mouse_is_down(false),
+       has_last_brush_point(false)
 {
     this->SetIcon(wxICON(appicon16));
     #ifdef __WXGTK__
@@ -310,6 +319,7 @@ MyFrame::MyFrame(const wxString& title)
 MyFrame::~MyFrame()
 {
     this->SaveSettings(); // save the current settings so it starts up the same next time
+    this->StopRecording();
     this->aui_mgr.UnInit();
     this->pVTKWindow->Delete();
     delete this->pencil_cursor;
@@ -342,6 +352,7 @@ void MyFrame::InitializeMenus()
         menu->AppendSeparator();
         menu->Append(ID::Screenshot, _("Save Screenshot...") + GetAccelerator(DO_SCREENSHOT), _("Save a screenshot of the current view"));
         menu->AppendCheckItem(ID::RecordFrames, _("Start Recording...") + GetAccelerator(DO_RECORDFRAMES), _("Record frames as images to disk"));
+        menu->Append(ID::SaveProbeData, _("Save Probe Data...") + GetAccelerator(DO_SAVEPROBES), _("Save the values recorded by the probes since the last save"));
         menu->AppendSeparator();
         menu->Append(ID::AddMyPatterns, _("Add My Patterns...") + GetAccelerator(DO_ADDPATTS), _("Add chosen folder to patterns pane"));
         #if !defined(__WXOSX_COCOA__)
@@ -1284,8 +1295,15 @@ void MyFrame::OnIdle(wxIdleEvent& event)
                 this->speed_data_available = true;
             }
 
+            if(this->render_settings.GetProperty("auto_range_color_scale").GetBool())
+                this->AutoRangeColorScale();
+
             if(this->is_recording)
+            {
                 this->RecordFrame();
+                if(!this->recorder->GetError().empty())
+                    this->StopRecording(); // (reports the error)
+            }
        
             this->pVTKWindow->Refresh(false);
             this->SetStatusBarText();
@@ -1325,6 +1343,14 @@ void MyFrame::SetStatusBarText()
             << wxString::Format(_T("%.1f"),this->percentage_spent_rendering)
             << _("% of time spent rendering )");
     }
+    if(this->is_recording && this->recorder)
+    {
+        txt << _("   Recording: frame ") << this->iRecordingFrame
+            << wxString::Format(_(", %d of %d queued"),this->recorder->GetNumberOfQueuedFrames(),this->recorder->GetQueueCapacity());
+        double waiting = this->recorder->GetWaitingPercentage();
+        if(waiting >= 1.0)
+            txt << wxString::Format(_(" ( %.0f%% of time waiting for disk )"),waiting);
+    }
     SetStatusText(txt);
 }
 
@@ -2043,6 +2069,7 @@ void MyFrame::UpdateMenuAccelerators()
         SetAccelerator(mbar, ID::SaveCompact,               DO_SAVECOMPACT);
         SetAccelerator(mbar, ID::Screenshot,                DO_SCREENSHOT);
         SetAccelerator(mbar, ID::RecordFrames,              DO_RECORDFRAMES);
+        SetAccelerator(mbar, ID::SaveProbeData,             DO_SAVEPROBES);
         SetAccelerator(mbar, ID::AddMyPatterns,             DO_ADDPATTS);
         
         // edit menu
@@ -2120,6 +2147,7 @@ void MyFrame::ProcessKey(int key, int modifiers)
         case DO_SAVECOMPACT:    cmdid = ID::SaveCompact; break;
         case DO_SCREENSHOT:     cmdid = ID::Screenshot; break;
         case DO_RECORDFRAMES:   cmdid = ID::RecordFrames; break;
+        case DO_SAVEPROBES:     cmdid = ID::SaveProbeData; break;
         case DO_ADDPATTS:       cmdid = ID::AddMyPatterns; break;
         case DO_PREFS:          cmdid = wxID_PREFERENCES; break;
         case DO_QUIT:           cmdid = wxID_EXIT; break;
@@ -2332,6 +2360,10 @@ void MyFrame::InitializeDefaultRenderSettings(Properties& props)
     props.AddProperty(Property("phase_plot_x_axis","chemical","a"));
     props.AddProperty(Property("phase_plot_y_axis","chemical","b"));
     props.AddProperty(Property("phase_plot_z_axis","chemical","c"));
+    props.AddProperty(Property("use_fast_display",false));
+    props.AddProperty(Property("auto_range_color_scale",false));
+    props.AddProperty(Property("show_space_time_plot",false));
+    props.AddProperty(Property("space_time_plot_rows",256));
     // TODO: allow user to change defaults
 }
 
@@ -2424,12 +2456,52 @@ void MyFrame::SetBlockSize(int x,int y,int z)
 
 // ---------------------------------------------------------------------
 
+void MyFrame::AutoRangeColorScale()
+{
+    // fit low and high to the chemicals being shown (OpenCL systems find the range on the device)
+    vector<AbstractRD::ChemicalStatistics> stats;
+    try
+    {
+        this->system->ComputeStatistics(stats,0);
+    }
+    catch(const exception& e)
+    {
+        this->render_settings.GetProperty("auto_range_color_scale").SetBool(false);
+        MonospaceMessageBox(_("Finding the range of values caused an error:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+        return;
+    }
+    const bool show_all = this->render_settings.GetProperty("show_multiple_chemicals").GetBool();
+    const int iActiveChemical = IndexFromChemicalName(this->render_settings.GetProperty("active_chemical").GetChemical());
+    double low = DBL_MAX, high = -DBL_MAX;
+    for(int ic=0;ic<(int)stats.size();ic++)
+    {
+        if(!show_all && ic!=iActiveChemical) continue;
+        low = min(low,stats[ic].minimum);
+        high = max(high,stats[ic].maximum);
+    }
+    if(!(high > low)) return; // (a flat pattern has no range to fit)
+
+    // rebuilding the pipeline is slow, so we only do it when the range has changed noticeably
+    Property& low_prop = this->render_settings.GetProperty("low");
+    Property& high_prop = this->render_settings.GetProperty("high");
+    const double tolerance = 0.01 * (high - low);
+    if(fabs(low - low_prop.GetFloat()) < tolerance && fabs(high - high_prop.GetFloat()) < tolerance) return;
+    low_prop.SetFloat((float)low);
+    high_prop.SetFloat((float)high);
+    InitializeVTKPipeline(this->pVTKWindow,this->system,this->render_settings,false);
+    this->UpdateInfoPane();
+}
+
+// ---------------------------------------------------------------------
+
 void MyFrame::RenderSettingsChanged()
 {
     // first do some range checking (not done in InfoPanel::ChangeRenderSetting)
     Property& prop = this->render_settings.GetProperty("timesteps_per_render");
     if (prop.GetInt() < 1) prop.SetInt(1);
     if (prop.GetInt() > MAX_TIMESTEPS_PER_RENDER) prop.SetInt(MAX_TIMESTEPS_PER_RENDER);
+    if (this->render_settings.GetProperty("auto_range_color_scale").GetBool())
+        this->AutoRangeColorScale();
     
     InitializeVTKPipeline(this->pVTKWindow,this->system,this->render_settings,false);
     this->UpdateWindows();
@@ -2633,6 +2705,15 @@ void MyFrame::MakeDefaultImageSystemFromMesh(vtkUnstructuredGrid* ug)
     if (outval_dlg.ShowModal() != wxID_OK) return;
     const float value_outside = outval_dlg.GetValue();
 
+    wxArrayString edge_choices;
+    edge_choices.Add(_("Sharp (each pixel is inside or outside)"));
+    edge_choices.Add(_("Smooth (pixels on the surface get in-between values)"));
+    wxSingleChoiceDialog aa_dlg(this, _("Select how to treat the pixels on the surface of the mesh:"), _("Select edge type"),
+        edge_choices);
+    aa_dlg.SetSelection(0);
+    if (aa_dlg.ShowModal() != wxID_OK) return;
+    const bool anti_alias = (aa_dlg.GetSelection() == 1);
+
     // at some point we would want the user to decide what data type to use in the image
     const int data_type = VTK_FLOAT;
 
@@ -2641,7 +2722,7 @@ void MyFrame::MakeDefaultImageSystemFromMesh(vtkUnstructuredGrid* ug)
         image_sys = new FormulaOpenCLImageRD(opencl_platform, opencl_device, data_type);
     else
         image_sys = new GrayScottImageRD();
-    image_sys->CopyFromMesh(ug, num_chemicals, target_chemical, largest_dimension, value_inside, value_outside);
+    image_sys->CopyFromMesh(ug, num_chemicals, target_chemical, largest_dimension, value_inside, value_outside, anti_alias);
     image_sys->CreateDefaultInitialPatternGenerator();
     this->SetCurrentRDSystem(image_sys);
 }
@@ -2692,73 +2773,22 @@ void MyFrame::OnExportMesh(wxCommandEvent& event)
 
 void MyFrame::SaveCurrentMesh(const wxString& mesh_filename, bool should_decimate, double targetReduction)
 {
-    vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
-    this->system->GetAsMesh(mesh,this->render_settings);
-
-    if (should_decimate)
+    if(!mesh_filename.EndsWith(_T("obj")) && !mesh_filename.EndsWith(_T("vtp")))
     {
-        vtkSmartPointer<vtkQuadricDecimation> dec = vtkSmartPointer<vtkQuadricDecimation>::New();
-        dec->SetInputData(mesh);
-        dec->SetTargetReduction(targetReduction);
-        dec->Update();
-        mesh->DeepCopy(dec->GetOutput());
+        wxMessageBox(_("Unsupported file type")); 
+        return; 
     }
 
-    vtkSmartPointer<vtkPolyDataNormals> normals = vtkSmartPointer<vtkPolyDataNormals>::New();
-    normals->SetInputData(mesh);
-    normals->SplittingOff();
-    normals->Update();
-    vtkPolyData* pd = normals->GetOutput();
-
-    if(mesh_filename.EndsWith(_T("obj")))
-    {
-        wxBusyCursor busy;
-        ofstream out(mesh_filename.mb_str());
-        out << "# Output from Ready - https://github.com/GollyGang/ready\n";
-        pd->BuildCells();
-        for(vtkIdType iPt=0;iPt<pd->GetNumberOfPoints();iPt++)
-            out << "v " << pd->GetPoint(iPt)[0] << " " << pd->GetPoint(iPt)[1] << " " << pd->GetPoint(iPt)[2] << "\n";
-        if(pd->GetPointData()->GetNormals())
-        {
-            for(vtkIdType iPt=0;iPt<pd->GetNumberOfPoints();iPt++)
-                out << "vn " << pd->GetPointData()->GetNormals()->GetTuple3(iPt)[0] << " " 
-                    << pd->GetPointData()->GetNormals()->GetTuple3(iPt)[1] << " " 
-                    << pd->GetPointData()->GetNormals()->GetTuple3(iPt)[2] << "\n";
-        }
-        vtkIdType npts,*pts;
-        for(vtkIdType iCell=0;iCell<pd->GetPolys()->GetNumberOfCells();iCell++)
-        {
-            pd->GetCellPoints(iCell,npts,pts);
-            out << "f";
-            if(pd->GetPointData()->GetNormals())
-            {
-                for(vtkIdType iPt=0;iPt<npts;iPt++)
-                    out << " " << pts[iPt]+1 << "//" << pts[iPt]+1; // (OBJ indices are 1-based)
-            }
-            else
-            {
-                for(vtkIdType iPt=0;iPt<npts;iPt++)
-                    out << " " << pts[iPt]+1; // (OBJ indices are 1-based)
-            }
-            out << "\n";
-        }
-    }
-    else if(mesh_filename.EndsWith(_T("vtp")))
+    wxBusyCursor busy;
+    vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+    this->system->GetAsMesh(mesh,this->render_settings);
+    try
     {
-        wxBusyCursor busy;
-        vtkSmartPointer<vtkXMLPolyDataWriter> writer = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
-        writer->SetFileName(mesh_filename.mb_str());
-        #if VTK_MAJOR_VERSION >= 6
-            writer->SetInputData(pd);
-        #else
-            writer->SetInput(pd);
-        #endif
-        writer->Write();
+        WriteMesh(mesh, string(mesh_filename.mb_str()), should_decimate, targetReduction);
     }
-    else
+    catch(const exception& e)
     {
-        wxMessageBox(_("Unsupported file type")); 
-        return; 
+        MonospaceMessageBox(_("Failed to save the mesh:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
     }
 }
 
@@ -2893,84 +2923,101 @@ void MyFrame::OnUpdateExportImage(wxUpdateUIEvent& event)
 
 // ---------------------------------------------------------------------
 
+void MyFrame::OnSaveProbeData(wxCommandEvent& event)
+{
+    wxString folder = screenshotdir;
+    wxString filename = wxFileSelector(_("Specify the probe data filename"),folder,_("Ready_probes.csv"),_T("csv"),
+        _("CSV files (*.csv)|*.csv"),wxFD_SAVE|wxFD_OVERWRITE_PROMPT);
+    if(filename.empty()) return; // user cancelled
+    wxFileName::SplitPath(filename,&folder,NULL,NULL);
+    screenshotdir = folder;
+
+    ofstream out(filename.mb_str());
+    if(!out)
+    {
+        wxMessageBox(_("Failed to open the file for writing"), _("Error"), wxOK | wxCENTER | wxICON_ERROR);
+        return;
+    }
+    // the records are forgotten once written, so the next save starts where this one ends
+    try
+    {
+        this->system->WriteProbeRecords(out,true);
+    }
+    catch(const exception& e)
+    {
+        MonospaceMessageBox(_("Saving the probe data caused an error:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::OnUpdateSaveProbeData(wxUpdateUIEvent& event)
+{
+    event.Enable(this->system->HasProbes());
+}
+
+// ---------------------------------------------------------------------
+
 void MyFrame::RecordFrame()
 {
+    // here we only take a snapshot of what is to be recorded, the recorder's worker threads do the writing
     ostringstream oss;
 
     if (this->record_3D_surface)
     {
         // save the 3D mesh
         oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
-        SaveCurrentMesh(wxString(oss.str().c_str()), this->recording_should_decimate, this->recording_target_reduction);
+        vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+        this->system->GetAsMesh(mesh, this->render_settings);
+        this->recorder->AddMesh(mesh, oss.str(), this->recording_should_decimate, this->recording_target_reduction);
     } 
-    else
+    else if (this->record_data_image && this->record_all_chemicals)
     {
-        vtkSmartPointer<vtkImageWriter> writer;
-        if (this->recording_extension == _T(".png")) writer = vtkSmartPointer<vtkPNGWriter>::New();
-        else if (this->recording_extension == _T(".jpg")) writer = vtkSmartPointer<vtkJPEGWriter>::New();
-
-        // store the currently active chemical, in the case of multi-reagent output it needs to be restored later.
+        // store the currently active chemical, it needs to be restored later.
         std::string remember_chemical = this->render_settings.GetProperty("active_chemical").GetChemical();
 
+        int num_chems = this->system->GetNumberOfChemicals();
+        for (int chemical_number = 0; chemical_number < num_chems; chemical_number++)
+        {
+            // make modified name for chemicals.
+            oss.str("");
+            oss.clear();
+            std::string chemical_name = GetChemicalName(chemical_number);
+            oss << this->recording_prefix << chemical_name << "_" << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
+
+            this->render_settings.GetProperty("active_chemical").SetChemical(chemical_name);
+
+            vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+            this->system->GetAs2DImage(image, this->render_settings);
+            this->recorder->AddImage(image, oss.str());
+        }
+
+        // restore the stored active chemical so that the user still sees what they usually see in the viewport.
+        this->render_settings.GetProperty("active_chemical").SetChemical(remember_chemical);
+    }
+    else
+    {
+        vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
         if (this->record_data_image) // take the 2D data (2D system or 2D slice)
         {
-            if (this->record_all_chemicals)
-            {
-                int num_chems = this->system->GetNumberOfChemicals();
-                for (int chemical_number = 0; chemical_number < num_chems; chemical_number++)
-                {
-                    // make modified name for chemicals.
-                    oss.str("");
-                    oss.clear();
-                    std::string chemical_name = GetChemicalName(chemical_number);
-                    oss << this->recording_prefix << chemical_name << "_" << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
-
-                    this->render_settings.GetProperty("active_chemical").SetChemical(GetChemicalName(chemical_number));
-
-                    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
-                    this->system->GetAs2DImage(image, this->render_settings);
-                    #if VTK_MAJOR_VERSION >= 6
-                      writer->SetInputData(image);
-                    #else
-                      writer->SetInput(image);
-                    #endif
-                    if (chemical_number < num_chems - 1) //write all but the last one as it will get written by the code below.
-                    {
-                        writer->SetFileName(oss.str().c_str());
-                        writer->Write();
-                        if (this->recording_extension == _T(".png")) writer = vtkSmartPointer<vtkPNGWriter>::New();
-                        else if (this->recording_extension == _T(".jpg")) writer = vtkSmartPointer<vtkJPEGWriter>::New();
-                    }
-                }
-            }
-            else
-            {
-                oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
-                vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
-                this->system->GetAs2DImage(image, this->render_settings);
-                #if VTK_MAJOR_VERSION >= 6
-                  writer->SetInputData(image);
-                #else
-                  writer->SetInput(image);
-                #endif
-            }
+            this->system->GetAs2DImage(image, this->render_settings);
         }
         else // take a screenshot of the current view
         {
-            oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
             vtkSmartPointer<vtkWindowToImageFilter> screenshot = vtkSmartPointer<vtkWindowToImageFilter>::New();
             screenshot->SetInput(this->pVTKWindow->GetRenderWindow());
-            writer->SetInputConnection(screenshot->GetOutputPort());
+            screenshot->Update();
+            image->DeepCopy(screenshot->GetOutput());
         }
 
-        writer->SetFileName(oss.str().c_str());
-        writer->Write();
-
-        if (this->record_all_chemicals)
+        if (this->recording_extension == ".y4m")
         {
-            // restore the stored active chemical so that the user still sees what they usually see in the viewport.
-            // only do this in the case of record_all_chemicals (ie when it has potentially changed), ere it may cause wasted cycles?.
-            this->render_settings.GetProperty("active_chemical").SetChemical(remember_chemical);
+            this->recorder->AddVideoFrame(image);
+        }
+        else
+        {
+            oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
+            this->recorder->AddImage(image, oss.str());
         }
     }
     
@@ -2979,11 +3026,31 @@ void MyFrame::RecordFrame()
 
 // ---------------------------------------------------------------------
 
+void MyFrame::StopRecording()
+{
+    this->is_recording = false;
+    if (!this->recorder) return;
+
+    string error;
+    {
+        wxBusyCursor busy;
+        this->recorder->Finish(); // wait for the queued frames to be written
+        error = this->recorder->GetError();
+    }
+    delete this->recorder;
+    this->recorder = NULL;
+    if (!error.empty())
+        MonospaceMessageBox(_("An error occurred when recording:\n\n")+wxString(error.c_str(),wxConvUTF8),_("Error"),wxART_ERROR);
+}
+
+// ---------------------------------------------------------------------
+
 void MyFrame::OnRecordFrames(wxCommandEvent &event)
 {
     if (this->is_recording)
     {
-        this->is_recording = false;
+        this->StopRecording();
+        this->SetStatusBarText();
         return;
     }
 
@@ -3004,6 +3071,27 @@ void MyFrame::OnRecordFrames(wxCommandEvent &event)
     this->recording_should_decimate = dlg.should_decimate;
     this->recording_target_reduction = 1.0 - dlg.target_reduction / 100.0; // convert from target percentage to proportion reduction
 
+    // leave one core for the simulation
+    int n_workers = max(1, wxThread::GetCPUCount() - 1);
+    this->recorder = new FrameRecorder(n_workers, n_workers * RECORDING_QUEUE_FRAMES_PER_WORKER);
+    if (this->recording_extension == ".y4m")
+    {
+        try
+        {
+            if (dlg.video_command.empty())
+                this->recorder->OpenVideoStream(this->recording_prefix + this->recording_extension, false, 25);
+            else
+                this->recorder->OpenVideoStream(dlg.video_command, true, 25);
+        }
+        catch(const exception& e)
+        {
+            delete this->recorder;
+            this->recorder = NULL;
+            MonospaceMessageBox(_("Failed to start recording:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+            return;
+        }
+    }
+
     this->iRecordingFrame = 0;
     this->is_recording = true;
 }
@@ -3127,6 +3215,7 @@ void MyFrame::OnUpdateSelectPickerTool(wxUpdateUIEvent& event)
 void MyFrame::LeftMouseDown(int x, int y)
 {
     this->left_mouse_is_down = true;
+    this->has_last_brush_point = false;
 
     vtkSmartPointer<vtkCellPicker> picker = vtkSmartPointer<vtkCellPicker>::New();
     picker->SetTolerance(0.000001);
@@ -3155,6 +3244,8 @@ void MyFrame::LeftMouseDown(int x, int y)
             {
                 this->system->SetValuesInRadius(p[0],p[1],p[2],this->brush_sizes[current_brush_size],
                     this->current_paint_value,this->render_settings);
+                copy(p,p+3,this->last_brush_point);
+                this->has_last_brush_point = true;
                 this->pVTKWindow->Refresh();
             }
             break;
@@ -3243,8 +3334,12 @@ void MyFrame::MouseMove(int x, int y)
             break;
             case BRUSH:
             {
-                this->system->SetValuesInRadius(p[0],p[1],p[2],this->brush_sizes[current_brush_size],
+                // paint the whole stroke since the last position, in case the mouse moved more than the brush size
+                const double *q = this->has_last_brush_point ? this->last_brush_point : p;
+                this->system->SetValuesAlongLine(q[0],q[1],q[2],p[0],p[1],p[2],this->brush_sizes[current_brush_size],
                     this->current_paint_value,this->render_settings);
+                copy(p,p+3,this->last_brush_point);
+                this->has_last_brush_point = true;
                 this->pVTKWindow->Refresh();
             }
             break;
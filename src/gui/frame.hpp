@@ -30,6 +30,7 @@ class PatternsPanel;
 class InfoPanel;
 class HelpPanel;
 class wxVTKRenderWindowInteractor;
+class FrameRecorder;
 #include "InteractorStylePainter.hpp"
 
 // readybase
@@ -104,6 +105,8 @@ class MyFrame : public wxFrame, public IPaintHandler
         void OnUpdateImportImage(wxUpdateUIEvent& event);
         void OnExportImage(wxCommandEvent& event);
         void OnUpdateExportImage(wxUpdateUIEvent& event);
+        void OnSaveProbeData(wxCommandEvent& event);
+        void OnUpdateSaveProbeData(wxUpdateUIEvent& event);
         void OnQuit(wxCommandEvent& event);
 
         // Open Recent submenu
@@ -207,6 +210,9 @@ class MyFrame : public wxFrame, public IPaintHandler
         void UpdateToolbars();
         void SetStatusBarText();
         void RecordFrame();
+        void StopRecording();
+        /// Sets low and high to the range of the chemicals being shown.
+        void AutoRangeColorScale();
 
         bool LoadMesh(const wxString& filename, vtkUnstructuredGrid* ug);
         void MakeDefaultImageSystemFromMesh(vtkUnstructuredGrid* ug);
@@ -256,6 +262,8 @@ class MyFrame : public wxFrame, public IPaintHandler
         std::string recording_prefix,recording_extension;
         int iRecordingFrame;
         float recording_target_reduction;
+        FrameRecorder *recorder; // writes the frames to disk on worker threads
+        static const int RECORDING_QUEUE_FRAMES_PER_WORKER = 2;
 
         static const int MAX_TIMESTEPS_PER_RENDER = 1e8;
 
@@ -272,6 +280,8 @@ class MyFrame : public wxFrame, public IPaintHandler
         wxString icons_folder;
         bool erasing;
         static const float brush_sizes[3];
+        double last_brush_point[3]; ///< where the brush was last painted, so a stroke can be painted from there
+        bool has_last_brush_point;  ///< false until the brush has been painted since the left button went down
 
         DECLARE_EVENT_TABLE()
 };
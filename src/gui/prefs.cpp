@@ -328,6 +328,7 @@ const char* GetActionName(action_id action)
         case DO_SAVECOMPACT:    return "Save Compact...";
         case DO_SCREENSHOT:     return "Save Screenshot...";
         case DO_RECORDFRAMES:   return "Start Recording...";
+        case DO_SAVEPROBES:     return "Save Probe Data...";
         case DO_ADDPATTS:       return "Add My Patterns...";
         case DO_PREFS:          return "Preferences...";
         case DO_QUIT:           return "Quit Ready";
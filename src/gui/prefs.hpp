@@ -118,6 +118,7 @@ typedef enum
     DO_RUNSTOP,                  // run/stop
     DO_SAVE,                     // save pattern...
     DO_SAVECOMPACT,              // save compact...
+    DO_SAVEPROBES,               // save probe data...
     DO_SCREENSHOT,               // save screenshot...
     DO_BRUSH,                    // select brush tool
     DO_PICKER,                   // select color picker tool
@@ -17,23 +17,40 @@
 
 // local:
 #include "AbstractRD.hpp"
+#include "CellMemory.hpp"
 #include "overlays.hpp"
 
 // STL:
+#include <algorithm>
+#include <stdexcept>
+#include <ostream>
 using namespace std;
 
+// stdlib:
+#include <float.h>
+
 // SSE:
 #include <xmmintrin.h>
 
+// VTK:
+#include <vtkMultiThreader.h>
+#include <vtkType.h>
+
 // ---------------------------------------------------------------------
 
 AbstractRD::AbstractRD(int data_type)
 {
     this->timesteps_taken = 0;
+    this->run_outcome_timestep = 0;
+    this->need_resolve_probes = true;
     this->need_reload_formula = true;
     this->is_modified = false;
     this->wrap = true;
     this->InternalSetDataType(data_type);
+    this->half_storage = false;
+    this->interleaved_chemicals = false;
+    this->activity_tolerance = 0.0f;
+    this->refinement_threshold = 0.0f;
 
     this->neighborhood_type = VERTEX_NEIGHBORS;
     this->neighborhood_range = 1;
@@ -237,6 +254,32 @@ void AbstractRD::InitializeFromXML(vtkXMLDataElement* rd, bool& warn_to_update)
         throw runtime_error("Unrecognized neighborhood_weight");
     else this->neighborhood_weight_type = this->recognized_neighborhood_weight_identifiers[s];
 
+    // storage precision (the data type is set by the image or mesh)
+    s = rule->GetAttribute("storage");
+    if(!s || string(s)=="full") this->half_storage = false;
+    else if(string(s)=="half" && this->HasEditableHalfStorage()) this->half_storage = true;
+    else throw runtime_error("Unsupported storage");
+
+    // layout of the chemicals
+    s = rule->GetAttribute("layout");
+    if(!s || string(s)=="separate") this->interleaved_chemicals = false;
+    else if(string(s)=="interleaved" && this->HasEditableInterleavedChemicals()) this->interleaved_chemicals = true;
+    else throw runtime_error("Unsupported layout");
+
+    // activity tracking
+    s = rule->GetAttribute("activity_tolerance");
+    if(!s) this->activity_tolerance = 0.0f;
+    else if(!from_string(s,f) || f<0.0f) throw runtime_error("Failed to read activity_tolerance");
+    else if(f>0.0f && !this->HasEditableActivityTolerance()) throw runtime_error("Unsupported activity_tolerance");
+    else this->activity_tolerance = f;
+
+    // refinement
+    s = rule->GetAttribute("refinement_threshold");
+    if(!s) this->refinement_threshold = 0.0f;
+    else if(!from_string(s,f) || f<0.0f) throw runtime_error("Failed to read refinement_threshold");
+    else if(f>0.0f && !this->HasEditableRefinementThreshold()) throw runtime_error("Unsupported refinement_threshold");
+    else this->refinement_threshold = f;
+
     // parameters:
     this->DeleteAllParameters();
     for(int i=0;i<rule->GetNumberOfNestedElements();i++)
@@ -259,6 +302,10 @@ void AbstractRD::InitializeFromXML(vtkXMLDataElement* rd, bool& warn_to_update)
 
     // initial_pattern_generator:
     this->initial_pattern_generator.ReadFromXML(rd->FindNestedElementWithName("initial_pattern_generator"));
+
+    // probes:
+    this->probe_set.ReadFromXML(rd->FindNestedElementWithName("probes"));
+    this->need_resolve_probes = true;
 }
 
 // ---------------------------------------------------------------------
@@ -289,6 +336,14 @@ vtkSmartPointer<vtkXMLDataElement> AbstractRD::GetAsXML(bool generate_initial_pa
     rule->SetAttribute("neighborhood_type",this->canonical_neighborhood_type_identifiers.find(this->neighborhood_type)->second.c_str());
     rule->SetIntAttribute("neighborhood_range",this->neighborhood_range);
     rule->SetAttribute("neighborhood_weight",this->canonical_neighborhood_weight_identifiers.find(this->neighborhood_weight_type)->second.c_str());
+    if(this->half_storage)
+        rule->SetAttribute("storage","half");
+    if(this->interleaved_chemicals)
+        rule->SetAttribute("layout","interleaved");
+    if(this->activity_tolerance > 0.0f)
+        rule->SetFloatAttribute("activity_tolerance",this->activity_tolerance);
+    if(this->refinement_threshold > 0.0f)
+        rule->SetFloatAttribute("refinement_threshold",this->refinement_threshold);
     for(int i=0;i<this->GetNumberOfParameters();i++)    // parameters
     {
         vtkSmartPointer<vtkXMLDataElement> param = vtkSmartPointer<vtkXMLDataElement>::New();
@@ -302,11 +357,126 @@ vtkSmartPointer<vtkXMLDataElement> AbstractRD::GetAsXML(bool generate_initial_pa
 
     rd->AddNestedElement(initial_pattern_generator.GetAsXML(generate_initial_pattern_when_loading));
 
+    if(!this->probe_set.IsEmpty())
+        rd->AddNestedElement(this->probe_set.GetAsXML());
+
+    if(!this->run_outcome.empty())
+    {
+        vtkSmartPointer<vtkXMLDataElement> outcome = vtkSmartPointer<vtkXMLDataElement>::New();
+        outcome->SetName("run_outcome");
+        outcome->SetAttribute("reason",this->run_outcome.c_str());
+        outcome->SetIntAttribute("timestep",this->run_outcome_timestep);
+        outcome->SetIntAttribute("timesteps_taken",this->timesteps_taken);
+        rd->AddNestedElement(outcome);
+    }
+
     return rd;
 }
 
 // ---------------------------------------------------------------------
 
+void AbstractRD::SetRunOutcome(const std::string& reason)
+{
+    this->run_outcome = reason;
+    this->run_outcome_timestep = this->timesteps_taken;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::InternalUpdateAndRecordProbes(int n_steps)
+{
+    if(!this->HasProbes() || this->RecordsProbesOnDevice())
+    {
+        this->InternalUpdate(n_steps);
+        this->timesteps_taken += n_steps;
+        return;
+    }
+
+    // run in stretches that end where the probes are due
+    const int interval = this->probe_set.GetInterval();
+    while(n_steps>0)
+    {
+        const int n = min(n_steps,interval - this->timesteps_taken % interval);
+        this->InternalUpdate(n);
+        this->timesteps_taken += n;
+        n_steps -= n;
+        if(this->timesteps_taken % interval == 0)
+            this->RecordProbesFromHost();
+    }
+}
+
+// ---------------------------------------------------------------------
+
+bool AbstractRD::ResolveProbesIfNeeded()
+{
+    if(!this->need_resolve_probes) return false;
+
+    vector<double> positions;
+    vector<string> column_names;
+    this->probe_set.GetSamples(positions,this->probe_chemicals,column_names);
+    for(size_t i=0;i<this->probe_chemicals.size();i++)
+        if(this->probe_chemicals[i] >= this->GetNumberOfChemicals())
+            throw runtime_error("Probe "+column_names[i]+" records a chemical that is not present");
+    this->FindCellsAtPositions(positions,this->probe_cells);
+
+    if(column_names != this->probe_column_names)
+    {
+        this->probe_column_names = column_names;
+        this->probe_record_timesteps.clear();
+        this->probe_record_values.clear();
+    }
+    this->need_resolve_probes = false;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::RecordProbesFromHost()
+{
+    this->ResolveProbesIfNeeded();
+    this->probe_record_timesteps.push_back(this->timesteps_taken);
+    for(size_t i=0;i<this->probe_cells.size();i++)
+        this->probe_record_values.push_back(this->GetCellValue(this->probe_chemicals[i],this->probe_cells[i]));
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::TakeProbeRecords(vector<string>& column_names,vector<int>& timesteps,vector<double>& values)
+{
+    column_names = this->probe_column_names;
+    timesteps.swap(this->probe_record_timesteps);
+    values.swap(this->probe_record_values);
+    this->probe_record_timesteps.clear();
+    this->probe_record_values.clear();
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::WriteProbeRecords(ostream& out,bool write_header)
+{
+    vector<string> column_names;
+    vector<int> timesteps;
+    vector<double> values;
+    this->TakeProbeRecords(column_names,timesteps,values);
+    if(write_header)
+    {
+        out << "timestep";
+        for(size_t i=0;i<column_names.size();i++)
+            out << "," << column_names[i];
+        out << "\n";
+    }
+    const size_t NS = column_names.size();
+    for(size_t r=0;r<timesteps.size();r++)
+    {
+        out << timesteps[r];
+        for(size_t i=0;i<NS;i++)
+            out << "," << values[r*NS+i];
+        out << "\n";
+    }
+}
+
+// ---------------------------------------------------------------------
+
 void AbstractRD::CreateDefaultInitialPatternGenerator()
 {
     this->initial_pattern_generator.CreateDefaultInitialPatternGenerator(this->GetNumberOfChemicals());
@@ -373,18 +543,101 @@ void AbstractRD::Redo()
 
 // ---------------------------------------------------------------------
 
-void AbstractRD::StorePaintAction(int iChemical,int iCell,float old_val)
+/// Returns whether a run of at least 3 changed cells to be given the same value starts at i.
+static bool StartsRepeat(const vector<double>& to_store,const vector<double>& current,size_t i)
+{
+    if(i+2>=to_store.size()) return false;
+    for(size_t j=i;j<i+3;j++)
+        if(to_store[j]==current[j] || to_store[j]!=to_store[i])
+            return false;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+/* static */ void AbstractRD::EncodePaintAction(PaintAction& pa,const vector<double>& to_store,const vector<double>& current)
+{
+    pa.runs.clear();
+    pa.values.clear();
+    const size_t n = to_store.size();
+    size_t i = 0;
+    while(i<n)
+    {
+        PaintAction::Run run;
+        size_t j = i;
+        if(to_store[i]==current[i])
+        {
+            while(j<n && to_store[j]==current[j]) j++;
+            run.type = PaintAction::UNCHANGED;
+        }
+        else if(StartsRepeat(to_store,current,i))
+        {
+            while(j<n && to_store[j]!=current[j] && to_store[j]==to_store[i]) j++;
+            run.type = PaintAction::REPEAT;
+            pa.values.push_back(to_store[i]);
+        }
+        else
+        {
+            do
+                pa.values.push_back(to_store[j++]);
+            while(j<n && to_store[j]!=current[j] && !StartsRepeat(to_store,current,j));
+            run.type = PaintAction::LITERAL;
+        }
+        run.length = (unsigned int)(j-i);
+        pa.runs.push_back(run);
+        i = j;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::FlipPaintAction(PaintAction& pa)
+{
+    // swap the stored values with those in the cells
+    vector<double> current,flipped;
+    this->GetRegionValues(pa.iChemical,pa.box,current);
+    flipped = current;
+    size_t i = 0, iValue = 0;
+    for(size_t iRun=0;iRun<pa.runs.size();iRun++)
+    {
+        const PaintAction::Run& run = pa.runs[iRun];
+        switch(run.type)
+        {
+            case PaintAction::UNCHANGED:
+                break;
+            case PaintAction::REPEAT:
+                fill(flipped.begin()+i,flipped.begin()+i+run.length,pa.values[iValue++]);
+                break;
+            case PaintAction::LITERAL:
+                copy(pa.values.begin()+iValue,pa.values.begin()+iValue+run.length,flipped.begin()+i);
+                iValue += run.length;
+                break;
+        }
+        i += run.length;
+    }
+    this->SetRegionValues(pa.iChemical,pa.box,flipped);
+    EncodePaintAction(pa,current,flipped);
+    pa.done = !pa.done;
+    this->PaintRegionChanged(pa.iChemical,pa.box);
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::StorePaintAction(int iChemical,const int box[6],const vector<double>& old_values,const vector<double>& new_values)
 {
-    // forget all stored undone actions
-    while(!this->undo_stack.empty() && !this->undo_stack.back().done)
-        this->undo_stack.pop_back();
     // add the new paint action
     PaintAction pa;
-    pa.iCell = iCell;
     pa.iChemical = iChemical;
-    pa.val = old_val; // (the cell itself stores the new val, we just need the old one)
+    for(int i=0;i<6;i++)
+        pa.box[i] = box[i];
+    EncodePaintAction(pa,old_values,new_values); // (the cells themselves store the new values, we just need the old ones)
     pa.done = true;
     pa.last_of_group = false;
+    if(pa.values.empty())
+        return; // nothing changed
+    // forget all stored undone actions
+    while(!this->undo_stack.empty() && !this->undo_stack.back().done)
+        this->undo_stack.pop_back();
     this->undo_stack.push_back(pa);
 }
 
@@ -427,6 +680,38 @@ void AbstractRD::SetDataType(int type)
 
 // ---------------------------------------------------------------------
 
+void AbstractRD::SetHalfStorage(bool b)
+{
+    this->half_storage = b;
+    this->need_reload_formula = true;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::SetInterleavedChemicals(bool b)
+{
+    this->interleaved_chemicals = b;
+    this->need_reload_formula = true;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::SetActivityTolerance(float tol)
+{
+    this->activity_tolerance = tol;
+    this->need_reload_formula = true;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::SetRefinementThreshold(float threshold)
+{
+    this->refinement_threshold = threshold;
+    this->need_reload_formula = true;
+}
+
+// ---------------------------------------------------------------------
+
 void AbstractRD::InternalSetDataType(int type)
 {
     switch( type ) {
@@ -447,3 +732,155 @@ void AbstractRD::InternalSetDataType(int type)
 
 // ---------------------------------------------------------------------
 
+
+/// The work shared between the threads of ComputeStatisticsOfValues, with a slot for the results of each thread.
+struct StatisticsJob
+{
+    const void* values;
+    size_t n;
+    int data_type;
+    int n_bins;
+    bool is_histogram_pass; ///< on the first pass we find the moments, on the second the histogram (which needs the range)
+    double low,high;
+    vector<double> minimum,maximum,count,mean,m2;
+    vector<vector<int> > histograms;
+};
+
+// ---------------------------------------------------------------------
+
+/// Merges the count, mean and sum of squared deviations of a second set of values into those of the first (Chan et al.).
+static void CombineMoments(double& count,double& mean,double& m2,double count_b,double mean_b,double m2_b)
+{
+    const double n = count + count_b;
+    if(n == 0.0) return;
+    const double d = mean_b - mean;
+    mean += d * count_b / n;
+    m2 += m2_b + d * d * count * count_b / n;
+    count = n;
+}
+
+// ---------------------------------------------------------------------
+
+template <typename T>
+static void SummarizeValues(const T* values,size_t n,double& minimum,double& maximum,double& count,double& mean,double& m2)
+{
+    // we take short chunks with two simple passes over each, and combine them, which keeps the sums accurate
+    const size_t CHUNK = 1024;
+    for(size_t start=0;start<n;start+=CHUNK)
+    {
+        const T* v = values + start;
+        const size_t len = min(CHUNK,n - start);
+        T chunk_min = v[0], chunk_max = v[0];
+        double sum = 0.0;
+        for(size_t i=0;i<len;i++)
+        {
+            chunk_min = v[i] < chunk_min ? v[i] : chunk_min;
+            chunk_max = v[i] > chunk_max ? v[i] : chunk_max;
+            sum += v[i];
+        }
+        const double chunk_mean = sum / len;
+        double chunk_m2 = 0.0;
+        for(size_t i=0;i<len;i++)
+        {
+            const double d = v[i] - chunk_mean;
+            chunk_m2 += d * d;
+        }
+        minimum = min(minimum,(double)chunk_min);
+        maximum = max(maximum,(double)chunk_max);
+        CombineMoments(count,mean,m2,(double)len,chunk_mean,chunk_m2);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+template <typename T>
+static void CountValues(const T* values,size_t n,double low,double high,vector<int>& histogram)
+{
+    const int n_bins = (int)histogram.size();
+    const double scale = high > low ? n_bins / (high - low) : 0.0;
+    for(size_t i=0;i<n;i++)
+    {
+        const double x = (values[i] - low) * scale;
+        histogram[ x > 0.0 ? min((int)x,n_bins-1) : 0 ]++;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+static VTK_THREAD_RETURN_TYPE ComputeStatisticsThread(void *arg)
+{
+    vtkMultiThreader::ThreadInfo *info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+    StatisticsJob *job = static_cast<StatisticsJob*>(info->UserData);
+    const int t = info->ThreadID;
+    // each thread takes a contiguous range of the values, the one it first touched (see CellMemory)
+    CellMemory::ThreadPin pin(t);
+    const size_t first = CellMemory::GetThreadRangeStart(job->n,t,info->NumberOfThreads);
+    const size_t n = CellMemory::GetThreadRangeStart(job->n,t+1,info->NumberOfThreads) - first;
+    if(job->data_type == VTK_DOUBLE)
+    {
+        const double *values = static_cast<const double*>(job->values) + first;
+        if(job->is_histogram_pass)
+            CountValues(values,n,job->low,job->high,job->histograms[t]);
+        else
+            SummarizeValues(values,n,job->minimum[t],job->maximum[t],job->count[t],job->mean[t],job->m2[t]);
+    }
+    else
+    {
+        const float *values = static_cast<const float*>(job->values) + first;
+        if(job->is_histogram_pass)
+            CountValues(values,n,job->low,job->high,job->histograms[t]);
+        else
+            SummarizeValues(values,n,job->minimum[t],job->maximum[t],job->count[t],job->mean[t],job->m2[t]);
+    }
+    return VTK_THREAD_RETURN_VALUE;
+}
+
+// ---------------------------------------------------------------------
+
+/* static */ void AbstractRD::ComputeStatisticsOfValues(const void* values,size_t n,int data_type,int n_bins,ChemicalStatistics& stats)
+{
+    stats.minimum = stats.maximum = stats.mean = stats.variance = 0.0;
+    stats.histogram.assign(max(0,n_bins),0);
+    if(n == 0) return;
+
+    vtkSmartPointer<vtkMultiThreader> threader = vtkSmartPointer<vtkMultiThreader>::New();
+    const int n_threads = CellMemory::GetNumberOfThreads(n);
+    threader->SetNumberOfThreads(n_threads);
+
+    StatisticsJob job;
+    job.values = values;
+    job.n = n;
+    job.data_type = data_type;
+    job.n_bins = n_bins;
+    job.is_histogram_pass = false;
+    job.minimum.assign(n_threads,DBL_MAX);
+    job.maximum.assign(n_threads,-DBL_MAX);
+    job.count.assign(n_threads,0.0);
+    job.mean.assign(n_threads,0.0);
+    job.m2.assign(n_threads,0.0);
+    threader->SetSingleMethod(ComputeStatisticsThread,&job);
+    threader->SingleMethodExecute();
+
+    double count = 0.0, m2 = 0.0;
+    stats.minimum = DBL_MAX;
+    stats.maximum = -DBL_MAX;
+    for(int t=0;t<n_threads;t++)
+    {
+        stats.minimum = min(stats.minimum,job.minimum[t]);
+        stats.maximum = max(stats.maximum,job.maximum[t]);
+        CombineMoments(count,stats.mean,m2,job.count[t],job.mean[t],job.m2[t]);
+    }
+    stats.variance = m2 / count;
+
+    if(n_bins <= 0) return;
+    job.is_histogram_pass = true;
+    job.low = stats.minimum;
+    job.high = stats.maximum;
+    job.histograms.assign(n_threads,vector<int>(n_bins,0));
+    threader->SingleMethodExecute();
+    for(int t=0;t<n_threads;t++)
+        for(int b=0;b<n_bins;b++)
+            stats.histogram[b] += job.histograms[t][b];
+}
+
+// ---------------------------------------------------------------------
@@ -20,6 +20,7 @@
 
 // local:
 #include "InitialPatternGenerator.hpp"
+#include "ProbeSet.hpp"
 class Overlay;
 class Properties;
 
@@ -34,6 +35,7 @@ class vtkImageData;
 #include <string>
 #include <vector>
 #include <map>
+#include <iosfwd>
 
 /// Abstract base class for all reaction-diffusion systems.
 class AbstractRD
@@ -82,6 +84,34 @@ class AbstractRD
         
         virtual int GetNumberOfCells() const =0;
 
+        /// Summary statistics of the values of one chemical over all the cells.
+        struct ChemicalStatistics
+        {
+            double minimum,maximum,mean,variance;
+            std::vector<int> histogram; ///< the number of cells in each of equal bins from minimum to maximum
+        };
+
+        /// Computes the statistics of each chemical, with a histogram of n_bins (none if 0).
+        /** OpenCL implementations do this on the device, reading back only a few values for each chemical. */
+        virtual void ComputeStatistics(std::vector<ChemicalStatistics>& stats,int n_bins) =0;
+
+        /// Computes the largest change of any cell, and the root-mean-square change, of each chemical over the last timestep.
+        /** Returns false if this isn't available, e.g. before the first step or for implementations that don't keep the previous values. */
+        virtual bool ComputeChangeOverLastStep(std::vector<double>& max_change,std::vector<double>& rms_change) { return false; }
+
+        /// Records why a run ended or what it reached (e.g. "converged"), at the current timestep, to be saved with the pattern.
+        void SetRunOutcome(const std::string& reason);
+        std::string GetRunOutcome() const { return this->run_outcome; }
+        int GetRunOutcomeTimestep() const { return this->run_outcome_timestep; }
+
+        /// Returns whether the pattern defines probes, whose values are recorded as the system runs.
+        bool HasProbes() const { return !this->probe_set.IsEmpty(); }
+        /// Moves the probe records taken so far into values, with one row of column_names.size() values for each entry in timesteps.
+        /** OpenCL implementations gather the probes on the device and only read them back when asked or when their buffer is full. */
+        virtual void TakeProbeRecords(std::vector<std::string>& column_names,std::vector<int>& timesteps,std::vector<double>& values);
+        /// Writes the probe records taken so far as comma-separated values, one row per timestep, and forgets them.
+        void WriteProbeRecords(std::ostream& out,bool write_header);
+
         // most implementations have parameters that can be edited and changed 
         // (will cause errors if they don't match the inbuilt names, the formula or the kernel)
         int GetNumberOfParameters() const;
@@ -152,6 +182,10 @@ class AbstractRD
         virtual void SetValue(float x,float y,float z,float val,const Properties& render_settings) =0;
         /// Set the value of all cells within radius r of a given location. The radius is expressed as a proportion of the diagonal of the bounding box.
         virtual void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings) =0;
+        /// Set the value of all cells within radius r of the line from (x0,y0,z0) to (x1,y1,z1), e.g. for a brush stroke between two
+        /// mouse positions. By default only the end of the line is painted.
+        virtual void SetValuesAlongLine(float x0,float y0,float z0,float x1,float y1,float z1,float r,float val,
+            const Properties& render_settings) { this->SetValuesInRadius(x1,y1,z1,r,val,render_settings); }
 
         bool CanUndo() const; ///< Returns true if there is anything to undo.
         bool CanRedo() const; ///< Returns true if there is anything to redo.
@@ -172,6 +206,42 @@ class AbstractRD
         /// Change the data type used for storing values (VTK_FLOAT or VTK_DOUBLE)
         void SetDataType(int type);
 
+        /// Returns whether this system can keep its values as 16-bit halves between steps (e.g. FormulaOpenCLImageRD)
+        virtual bool HasEditableHalfStorage() const { return false; }
+
+        /// Returns true if the values are kept as 16-bit halves between steps, halving the memory used. The computation still uses the data type.
+        bool GetHalfStorage() const { return this->half_storage; }
+
+        /// Change whether the values are kept as 16-bit halves between steps
+        virtual void SetHalfStorage(bool b);
+
+        /// Returns whether this system can keep all its chemicals together in one buffer (e.g. FormulaOpenCLImageRD)
+        virtual bool HasEditableInterleavedChemicals() const { return false; }
+
+        /// Returns true if the chemicals of each cell (or block of cells) are kept next to each other, rather than each chemical separately.
+        bool GetInterleavedChemicals() const { return this->interleaved_chemicals; }
+
+        /// Change whether the chemicals are interleaved
+        virtual void SetInterleavedChemicals(bool b);
+
+        /// Returns whether this system can skip the parts of the arena that aren't changing (e.g. FormulaOpenCLImageRD)
+        virtual bool HasEditableActivityTolerance() const { return false; }
+
+        /// Returns the change per step below which a tile of cells counts as quiet and is skipped, or 0 if every cell is always computed.
+        float GetActivityTolerance() const { return this->activity_tolerance; }
+
+        /// Change the activity tolerance (0 to turn off activity tracking)
+        virtual void SetActivityTolerance(float tol);
+
+        /// Returns whether this system can compute the steep parts of the arena on a finer grid (e.g. FormulaOpenCLImageRD)
+        virtual bool HasEditableRefinementThreshold() const { return false; }
+
+        /// Returns the difference between neighboring cells above which the area is refined, or 0 if refinement is off.
+        float GetRefinementThreshold() const { return this->refinement_threshold; }
+
+        /// Change the refinement threshold (0 to turn off refinement)
+        virtual void SetRefinementThreshold(float threshold);
+
     protected: // typedefs
 
         enum TNeighborhood { VERTEX_NEIGHBORS, EDGE_NEIGHBORS, FACE_NEIGHBORS };
@@ -199,13 +269,27 @@ class AbstractRD
         size_t data_type_size;
         std::string data_type_string;
         std::string data_type_suffix;
+        bool half_storage;      ///< if true then OpenCL buffers hold halves, converted to and from the data type in the kernel
+        bool interleaved_chemicals; ///< if true then one OpenCL buffer holds all the chemicals (the host still has one array each)
+        float activity_tolerance;   ///< if non-zero then tiles whose cells and neighbors change less than this on a step are skipped (and stay frozen while they drift slower than this)
+        float refinement_threshold; ///< if non-zero then patches where neighboring cells differ by more than this get a finer grid
 
         InitialPatternGenerator initial_pattern_generator;
 
+        ProbeSet probe_set;
+        bool need_resolve_probes;                       ///< if true then the probes must be found in the arena again
+        std::vector<int> probe_cells,probe_chemicals;   ///< the cell and chemical of each column of the probe records
+        std::vector<std::string> probe_column_names;
+        std::vector<int> probe_record_timesteps;
+        std::vector<double> probe_record_values;        ///< one row for each entry in probe_record_timesteps
+
         std::vector<std::pair<std::string,float> > parameters;
 
         int timesteps_taken;
 
+        std::string run_outcome;    ///< if not empty, why the run ended or what it reached (not read back from files)
+        int run_outcome_timestep;   ///< the timestep at which the run outcome was recorded
+
         std::string formula;
         bool need_reload_formula;
 
@@ -214,11 +298,22 @@ class AbstractRD
 
         bool wrap; ///< should the data wrap-around or have a boundary?
 
-        /// We only allow undo for paint actions.
+        /// We only allow undo for paint actions. Each one holds the values that a box of cells of one chemical had before it was painted.
+        /**
+         * The values are stored as runs: cells that the painting didn't change are skipped, and repeated values are stored once.
+         * Undoing or redoing the action swaps the stored values with those in the cells, so it can be flipped back and forth.
+         */
         struct PaintAction {
-            int iChemical,iCell;
+            enum RunType { UNCHANGED, REPEAT, LITERAL };
+            struct Run {
+                unsigned int type : 2;
+                unsigned int length : 30;
+            };
+            int iChemical;
+            int box[6];                 ///< the cells affected, as x_min,x_max,y_min,y_max,z_min,z_max (inclusive)
+            std::vector<Run> runs;      ///< covers the box in x-fastest order
+            std::vector<double> values; ///< one for each REPEAT run, length for each LITERAL run
             bool done,last_of_group;
-            float val; // value to paint to undo/redo this action
         };
         std::vector<PaintAction> undo_stack;
 
@@ -237,8 +332,38 @@ class AbstractRD
         /// Advance the RD system by n timesteps.
         virtual void InternalUpdate(int n_steps)=0;
 
-        virtual void FlipPaintAction(PaintAction& cca) =0; ///< Undo/redo this paint action.
-        void StorePaintAction(int iChemical,int iCell,float old_val); ///< Implementations call this when performing undo-able paint actions.
+        /// Calls InternalUpdate and advances timesteps_taken, stopping to record the probes from the host when they are due.
+        void InternalUpdateAndRecordProbes(int n_steps);
+
+        /// Implementations that gather the probes themselves during InternalUpdate return true.
+        virtual bool RecordsProbesOnDevice() const { return false; }
+        /// Finds the cell of each probe sample point, if the probes or the arena have changed. Returns true if they were found again.
+        /** If the columns are different to before then the existing records are dropped. */
+        bool ResolveProbesIfNeeded();
+        /// Appends a record of the probes to probe_record_values, reading them from the host data.
+        void RecordProbesFromHost();
+        /// Finds the cell at each of the given proportional positions (0-1 within the bounds of the arena, as xyz triples).
+        virtual void FindCellsAtPositions(const std::vector<double>& positions,std::vector<int>& cells) =0;
+        /// Returns the value of one cell of one chemical, from the host data.
+        virtual double GetCellValue(int iChemical,int iCell) const =0;
+
+        void FlipPaintAction(PaintAction& pa); ///< Undo/redo this paint action.
+        /// Implementations call this when performing undo-able paint actions, with the values of the box from before and after.
+        /// (They should also call PaintRegionChanged.)
+        void StorePaintAction(int iChemical,const int box[6],const std::vector<double>& old_values,const std::vector<double>& new_values);
+
+        /// Copies the values of a box of cells for one chemical, in x-fastest order. For meshes the box is a range of cell indices.
+        virtual void GetRegionValues(int iChemical,const int box[6],std::vector<double>& values) const =0;
+        virtual void SetRegionValues(int iChemical,const int box[6],const std::vector<double>& values) =0;
+
+        /// Called after a box of cells has been painted, or restored by undo or redo.
+        virtual void PaintRegionChanged(int iChemical,const int box[6]) =0;
+
+        /// Stores in pa the values of to_store that differ from those in current.
+        static void EncodePaintAction(PaintAction& pa,const std::vector<double>& to_store,const std::vector<double>& current);
+
+        /// Computes the statistics of n values of the data type (VTK_FLOAT or VTK_DOUBLE), splitting them between several threads.
+        static void ComputeStatisticsOfValues(const void* values,size_t n,int data_type,int n_bins,ChemicalStatistics& stats);
 
     private: // functions
 
@@ -0,0 +1,482 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "BlockContourFilter.hpp"
+
+// VTK:
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkImageData.h>
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#if VTK_MAJOR_VERSION >= 6
+    #include <vtkMarchingCubesTriangleCases.h>
+#else
+    #include <vtkMarchingCubesCases.h>
+#endif
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// stdlib:
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+
+// --------------------------------------------------------------------------------
+
+vtkStandardNewMacro(BlockContourFilter);
+
+// the corners of a cube and the edges between them, in the order used by vtkMarchingCubesTriangleCases
+static const int CORNER_OFFSETS[8][3] = { {0,0,0},{1,0,0},{1,1,0},{0,1,0},{0,0,1},{1,0,1},{1,1,1},{0,1,1} };
+static const int EDGE_CORNERS[12][2] = { {0,1},{1,2},{3,2},{0,3},{4,5},{5,6},{7,6},{4,7},{0,4},{1,5},{3,7},{2,6} };
+
+// --------------------------------------------------------------------------------
+
+BlockContourFilter::BlockContourFilter()
+    : value(0.25)
+    , generate_cubes(false)
+    , block_size(32)
+    , number_of_threads(0)
+    , need_reextract_all(true)
+    , n_blocks_extracted(0)
+    , input_data(NULL)
+    , input_data_type(VTK_FLOAT)
+{
+    this->SetNumberOfInputPorts(1);
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        this->block_dims[xyz] = 0;
+        this->image_dims[xyz] = 0;
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+void BlockContourFilter::SetValue(double v)
+{
+    if(v==this->value) return;
+    this->value = v;
+    this->need_reextract_all = true;
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+void BlockContourFilter::SetGenerateCubes(bool b)
+{
+    if(b==this->generate_cubes) return;
+    this->generate_cubes = b;
+    this->need_reextract_all = true;
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+void BlockContourFilter::SetBlockSize(int n)
+{
+    n = max(2,n);
+    if(n==this->block_size) return;
+    this->block_size = n;
+    this->blocks.clear(); // will be reallocated on the next execution
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+void BlockContourFilter::SetNumberOfThreads(int n)
+{
+    this->number_of_threads = max(0,n);
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+int BlockContourFilter::FillInputPortInformation(int port, vtkInformation* info)
+{
+    info->Set(vtkAlgorithm::INPUT_REQUIRED_DATA_TYPE(), "vtkImageData");
+    return 1;
+}
+
+// --------------------------------------------------------------------------------
+
+void BlockContourFilter::AllocateBlocks(const int *dims)
+{
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        this->image_dims[xyz] = dims[xyz];
+        this->block_dims[xyz] = (dims[xyz] + this->block_size - 1) / this->block_size;
+    }
+    this->blocks.clear();
+    this->blocks.resize(this->block_dims[0]*this->block_dims[1]*this->block_dims[2]);
+    for(int bz=0;bz<this->block_dims[2];bz++)
+    {
+        for(int by=0;by<this->block_dims[1];by++)
+        {
+            for(int bx=0;bx<this->block_dims[0];bx++)
+            {
+                Block& block = this->blocks[ ( bz*this->block_dims[1] + by )*this->block_dims[0] + bx ];
+                const int b[3] = { bx, by, bz };
+                for(int xyz=0;xyz<3;xyz++)
+                {
+                    block.start[xyz] = b[xyz] * this->block_size;
+                    block.end[xyz] = min( dims[xyz], block.start[xyz] + this->block_size );
+                }
+                block.is_valid = false;
+                block.n_polys = 0;
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+int BlockContourFilter::RequestData(vtkInformation* request, vtkInformationVector** inputVector, vtkInformationVector* outputVector)
+{
+    vtkImageData *input = vtkImageData::SafeDownCast( inputVector[0]->GetInformationObject(0)->Get(vtkDataObject::DATA_OBJECT()) );
+    vtkPolyData *output = vtkPolyData::SafeDownCast( outputVector->GetInformationObject(0)->Get(vtkDataObject::DATA_OBJECT()) );
+    if(!input || !output) return 0;
+
+    this->input_data_type = input->GetScalarType();
+    if(this->input_data_type != VTK_FLOAT && this->input_data_type != VTK_DOUBLE)
+        throw runtime_error("BlockContourFilter::RequestData : unsupported data type");
+    this->input_data = input->GetScalarPointer();
+    input->GetOrigin(this->origin);
+    input->GetSpacing(this->spacing);
+
+    int dims[3];
+    input->GetDimensions(dims);
+    if(this->blocks.empty() || dims[0]!=this->image_dims[0] || dims[1]!=this->image_dims[1] || dims[2]!=this->image_dims[2])
+        this->AllocateBlocks(dims);
+    if(this->need_reextract_all)
+    {
+        for(size_t i=0;i<this->blocks.size();i++)
+            this->blocks[i].is_valid = false;
+        this->need_reextract_all = false;
+    }
+
+    // bring each block up to date, in parallel
+    vtkSmartPointer<vtkMultiThreader> threader = vtkSmartPointer<vtkMultiThreader>::New();
+    if(this->number_of_threads > 0)
+        threader->SetNumberOfThreads( min( this->number_of_threads, (int)VTK_MAX_THREADS ) );
+    threader->SetNumberOfThreads( max( 1, min( threader->GetNumberOfThreads(), (int)this->blocks.size() ) ) );
+    for(int i=0;i<threader->GetNumberOfThreads();i++)
+        this->n_blocks_extracted_by_thread[i] = 0;
+    threader->SetSingleMethod(BlockContourFilter::ThreadedExecute, this);
+    threader->SingleMethodExecute();
+    this->n_blocks_extracted = 0;
+    for(int i=0;i<threader->GetNumberOfThreads();i++)
+        this->n_blocks_extracted += this->n_blocks_extracted_by_thread[i];
+
+    // gather the cached surfaces of all the blocks into the output
+    vtkIdType n_points = 0, n_polys = 0, n_cell_entries = 0;
+    for(size_t i=0;i<this->blocks.size();i++)
+    {
+        n_points += (vtkIdType)this->blocks[i].points.size() / 3;
+        n_polys += this->blocks[i].n_polys;
+        n_cell_entries += (vtkIdType)this->blocks[i].polys.size();
+    }
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetDataTypeToFloat();
+    points->SetNumberOfPoints(n_points);
+    vtkSmartPointer<vtkFloatArray> normals = vtkSmartPointer<vtkFloatArray>::New();
+    normals->SetName("Normals");
+    normals->SetNumberOfComponents(3);
+    normals->SetNumberOfTuples(n_points);
+    vtkSmartPointer<vtkIdTypeArray> cell_entries = vtkSmartPointer<vtkIdTypeArray>::New();
+    cell_entries->SetNumberOfValues(n_cell_entries);
+    float *pPoints = static_cast<float*>(points->GetData()->GetVoidPointer(0));
+    float *pNormals = normals->GetPointer(0);
+    vtkIdType *pCells = cell_entries->GetPointer(0);
+    vtkIdType first_point = 0;
+    for(size_t i=0;i<this->blocks.size();i++)
+    {
+        const Block& block = this->blocks[i];
+        copy(block.points.begin(),block.points.end(),pPoints);
+        pPoints += block.points.size();
+        copy(block.normals.begin(),block.normals.end(),pNormals);
+        pNormals += block.normals.size();
+        for(size_t j=0;j<block.polys.size();)
+        {
+            const vtkIdType n = block.polys[j++];
+            *pCells++ = n;
+            for(vtkIdType k=0;k<n;k++)
+                *pCells++ = first_point + block.polys[j++];
+        }
+        first_point += (vtkIdType)block.points.size() / 3;
+    }
+    vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+    polys->SetCells(n_polys, cell_entries);
+
+    output->SetPoints(points);
+    output->GetPointData()->SetNormals(normals);
+    output->SetPolys(polys);
+
+    this->input_data = NULL;
+    return 1;
+}
+
+// --------------------------------------------------------------------------------
+
+/* static */ VTK_THREAD_RETURN_TYPE BlockContourFilter::ThreadedExecute(void *arg)
+{
+    vtkMultiThreader::ThreadInfo *info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+    BlockContourFilter *self = static_cast<BlockContourFilter*>(info->UserData);
+    // blocks are dealt out in turn, so that each thread gets a share of the busy regions
+    for(size_t i=info->ThreadID;i<self->blocks.size();i+=info->NumberOfThreads)
+    {
+        if(self->UpdateBlock(self->blocks[i]))
+            self->n_blocks_extracted_by_thread[info->ThreadID]++;
+    }
+    return VTK_THREAD_RETURN_VALUE;
+}
+
+// --------------------------------------------------------------------------------
+
+bool BlockContourFilter::UpdateBlock(Block& block) const
+{
+    float min_value,max_value;
+    unsigned int checksum;
+    if(this->input_data_type == VTK_DOUBLE)
+        this->SummarizeBlock(static_cast<const double*>(this->input_data),min_value,max_value,checksum,block);
+    else
+        this->SummarizeBlock(static_cast<const float*>(this->input_data),min_value,max_value,checksum,block);
+
+    if(block.is_valid && checksum==block.checksum && min_value==block.min_value && max_value==block.max_value)
+        return false; // nothing has changed in or around this block
+
+    block.min_value = min_value;
+    block.max_value = max_value;
+    block.checksum = checksum;
+    block.is_valid = true;
+    block.points.clear();
+    block.normals.clear();
+    block.polys.clear();
+    block.n_polys = 0;
+
+    // skip the block if it can't contain any of the surface
+    if(max_value < this->value)
+        return false;
+    if(!this->generate_cubes && min_value >= this->value)
+        return false;
+
+    if(this->input_data_type == VTK_DOUBLE)
+    {
+        if(this->generate_cubes)
+            this->ExtractCubes(static_cast<const double*>(this->input_data),block);
+        else
+            this->ExtractContour(static_cast<const double*>(this->input_data),block);
+    }
+    else
+    {
+        if(this->generate_cubes)
+            this->ExtractCubes(static_cast<const float*>(this->input_data),block);
+        else
+            this->ExtractContour(static_cast<const float*>(this->input_data),block);
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+template<typename T> void BlockContourFilter::SummarizeBlock(const T* data,float& min_value,float& max_value,
+    unsigned int& checksum,const Block& block) const
+{
+    // the cubes need the pixel either side of the block; the contour needs the next pixel beyond its end for its last
+    // cubes, and the one after that for the central-difference normals at their far corners
+    const int beyond_end = this->generate_cubes ? 1 : 2;
+    int lo[3],hi[3];
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        lo[xyz] = max( 0, block.start[xyz] - 1 );
+        hi[xyz] = min( this->image_dims[xyz], block.end[xyz] + beyond_end );
+    }
+    min_value = FLT_MAX;
+    max_value = -FLT_MAX;
+    checksum = 2166136261u; // FNV-1a
+    const int X = this->image_dims[0], Y = this->image_dims[1];
+    for(int z=lo[2];z<hi[2];z++)
+    {
+        for(int y=lo[1];y<hi[1];y++)
+        {
+            const T *row = data + ( (size_t)z*Y + y )*X;
+            for(int x=lo[0];x<hi[0];x++)
+            {
+                const float val = static_cast<float>(row[x]);
+                min_value = min(min_value,val);
+                max_value = max(max_value,val);
+                const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&row[x]);
+                for(size_t b=0;b<sizeof(T);b++)
+                    checksum = ( checksum ^ bytes[b] ) * 16777619u;
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+template<typename T> void BlockContourFilter::ExtractContour(const T* data,Block& block) const
+{
+    const int X = this->image_dims[0], Y = this->image_dims[1], Z = this->image_dims[2];
+    const size_t XY = (size_t)X*Y;
+
+    // the cubes of this block have their lowest corner on one of its pixels, and their highest corner inside the image
+    int cell_end[3];
+    for(int xyz=0;xyz<3;xyz++)
+        cell_end[xyz] = min( block.end[xyz], this->image_dims[xyz]-1 );
+    const int nx = cell_end[0] - block.start[0] + 1, ny = cell_end[1] - block.start[1] + 1;
+    const int nz = cell_end[2] - block.start[2] + 1;
+    if(nx<2 || ny<2 || nz<2) return;
+
+    // each edge of the local grid gets at most one vertex, which is shared by the cubes around it
+    vector<vtkIdType> edge_vertex( 3 * (size_t)nx * ny * nz, -1 );
+
+    vtkMarchingCubesTriangleCases *triangle_cases = vtkMarchingCubesTriangleCases::GetCases();
+    int corner[8][3];
+    float s[8];
+    for(int z=block.start[2];z<cell_end[2];z++)
+    {
+        for(int y=block.start[1];y<cell_end[1];y++)
+        {
+            for(int x=block.start[0];x<cell_end[0];x++)
+            {
+                int case_index = 0;
+                for(int c=0;c<8;c++)
+                {
+                    corner[c][0] = x + CORNER_OFFSETS[c][0];
+                    corner[c][1] = y + CORNER_OFFSETS[c][1];
+                    corner[c][2] = z + CORNER_OFFSETS[c][2];
+                    s[c] = static_cast<float>( data[ corner[c][2]*XY + (size_t)corner[c][1]*X + corner[c][0] ] );
+                    if(s[c] >= this->value)
+                        case_index |= 1 << c;
+                }
+                if(case_index==0 || case_index==255)
+                    continue;
+
+                const int *edges = triangle_cases[case_index].edges;
+                for(;edges[0]>-1;edges+=3)
+                {
+                    block.polys.push_back(3);
+                    for(int iv=0;iv<3;iv++)
+                    {
+                        const int ca = EDGE_CORNERS[edges[iv]][0], cb = EDGE_CORNERS[edges[iv]][1];
+                        int axis = 0;
+                        while(corner[ca][axis]==corner[cb][axis]) axis++;
+                        const size_t iEdge = 3 * ( ( (size_t)( corner[ca][2] - block.start[2] ) * ny
+                            + ( corner[ca][1] - block.start[1] ) ) * nx + ( corner[ca][0] - block.start[0] ) ) + axis;
+                        if(edge_vertex[iEdge] < 0)
+                        {
+                            edge_vertex[iEdge] = (vtkIdType)block.points.size() / 3;
+                            const float t = ( this->value - s[ca] ) / ( s[cb] - s[ca] );
+                            float g[2][3];
+                            for(int e=0;e<2;e++)
+                            {
+                                // the normal points down the gradient, estimated by central differences where possible
+                                const int *p = corner[e==0?ca:cb];
+                                const int dims[3] = { X, Y, Z };
+                                const size_t stride[3] = { 1, (size_t)X, XY };
+                                const size_t i = p[2]*XY + (size_t)p[1]*X + p[0];
+                                for(int xyz=0;xyz<3;xyz++)
+                                {
+                                    const size_t i0 = p[xyz]>0 ? i-stride[xyz] : i;
+                                    const size_t i1 = p[xyz]<dims[xyz]-1 ? i+stride[xyz] : i;
+                                    const float span = (i1-i0) / stride[xyz] * this->spacing[xyz];
+                                    g[e][xyz] = span>0 ? static_cast<float>( data[i0] - data[i1] ) / span : 0.0f;
+                                }
+                            }
+                            float n[3];
+                            for(int xyz=0;xyz<3;xyz++)
+                            {
+                                const float a = static_cast<float>(corner[ca][xyz]), b = static_cast<float>(corner[cb][xyz]);
+                                block.points.push_back( static_cast<float>( this->origin[xyz] + ( a + t*(b-a) ) * this->spacing[xyz] ) );
+                                n[xyz] = g[0][xyz] + t * ( g[1][xyz] - g[0][xyz] );
+                            }
+                            const float len = sqrt( n[0]*n[0] + n[1]*n[1] + n[2]*n[2] );
+                            for(int xyz=0;xyz<3;xyz++)
+                                block.normals.push_back( len>0 ? n[xyz]/len : 0.0f );
+                        }
+                        block.polys.push_back( edge_vertex[iEdge] );
+                    }
+                    block.n_polys++;
+                }
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+template<typename T> void BlockContourFilter::ExtractCubes(const T* data,Block& block) const
+{
+    const int X = this->image_dims[0], Y = this->image_dims[1];
+    const size_t XY = (size_t)X*Y;
+    const size_t stride[3] = { 1, (size_t)X, XY };
+    for(int z=block.start[2];z<block.end[2];z++)
+    {
+        for(int y=block.start[1];y<block.end[1];y++)
+        {
+            for(int x=block.start[0];x<block.end[0];x++)
+            {
+                const int p[3] = { x, y, z };
+                const size_t i = z*XY + (size_t)y*X + x;
+                if(data[i] < this->value)
+                    continue;
+                for(int axis=0;axis<3;axis++)
+                {
+                    for(int dir=-1;dir<=1;dir+=2)
+                    {
+                        // add a face on this side if there is no solid neighbor there
+                        const int q = p[axis] + dir;
+                        if(q>=0 && q<this->image_dims[axis] && data[ i + dir*(ptrdiff_t)stride[axis] ] >= this->value)
+                            continue;
+                        // the face corners go anticlockwise when seen from outside
+                        const int u = (axis+1)%3, w = (axis+2)%3;
+                        const float corners_uw[4][2] = { {-0.5f,-0.5f}, {0.5f,-0.5f}, {0.5f,0.5f}, {-0.5f,0.5f} };
+                        const vtkIdType first = (vtkIdType)block.points.size() / 3;
+                        block.polys.push_back(4);
+                        for(int c=0;c<4;c++)
+                        {
+                            const int cc = dir>0 ? c : 3-c;
+                            float pos[3];
+                            pos[axis] = p[axis] + 0.5f*dir;
+                            pos[u] = p[u] + corners_uw[cc][0];
+                            pos[w] = p[w] + corners_uw[cc][1];
+                            for(int xyz=0;xyz<3;xyz++)
+                            {
+                                block.points.push_back( static_cast<float>( this->origin[xyz] + pos[xyz] * this->spacing[xyz] ) );
+                                block.normals.push_back( xyz==axis ? (float)dir : 0.0f );
+                            }
+                            block.polys.push_back( first + c );
+                        }
+                        block.n_polys++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------
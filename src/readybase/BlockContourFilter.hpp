@@ -0,0 +1,116 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __BLOCKCONTOURFILTER__
+#define __BLOCKCONTOURFILTER__
+
+// VTK:
+#include <vtkPolyDataAlgorithm.h>
+#include <vtkMultiThreader.h>
+
+// STL:
+#include <vector>
+
+/// Extracts the surface of a 3D image at a given level, working on blocks of the volume in parallel.
+/**
+ * Each block remembers the value range and a checksum of the pixels it last saw, so on the next
+ * execution a block is only re-extracted if its pixels changed. Blocks whose range doesn't
+ * include the contour level are skipped without being visited.
+ *
+ * The surface is either a marching-cubes contour through the pixel centres, or (with
+ * GenerateCubes on) the outer faces of the pixels that are at or above the level, Minecraft-style.
+ * Pixel i is taken to be centred at i (in image coordinates), so cubes span [i-0.5,i+0.5].
+ */
+class BlockContourFilter : public vtkPolyDataAlgorithm
+{
+    public:
+
+        vtkTypeMacro(BlockContourFilter, vtkPolyDataAlgorithm);
+        static BlockContourFilter* New();
+
+        void SetValue(double v);
+        double GetValue() const { return this->value; }
+
+        void SetGenerateCubes(bool b);
+        bool GetGenerateCubes() const { return this->generate_cubes; }
+
+        void SetBlockSize(int n);                ///< edge length of the blocks, in pixels
+        void SetNumberOfThreads(int n);          ///< 0 means use all the cores available
+
+        int GetNumberOfBlocks() const { return (int)this->blocks.size(); }
+        int GetNumberOfBlocksExtracted() const { return this->n_blocks_extracted; }  ///< in the last execution
+
+    protected:
+
+        BlockContourFilter();
+
+        virtual int FillInputPortInformation(int port, vtkInformation* info);
+        virtual int RequestData(vtkInformation* request, vtkInformationVector** inputVector, vtkInformationVector* outputVector);
+
+    protected:
+
+        /// The cached surface for one block of the image.
+        struct Block
+        {
+            int start[3],end[3];            ///< the pixels this block is responsible for, end is exclusive
+            float min_value,max_value;      ///< over the pixels that affect the block, including a 1-pixel border
+            unsigned int checksum;          ///< of those same pixels
+            bool is_valid;                  ///< false if the cached surface needs to be rebuilt
+            std::vector<float> points;      ///< xyz
+            std::vector<float> normals;     ///< xyz
+            std::vector<vtkIdType> polys;   ///< n,id0,..,idn-1 in the layout used by vtkCellArray, ids local to the block
+            int n_polys;
+        };
+
+        void AllocateBlocks(const int *dims);
+
+        /// Brings the cached surface of this block up to date, returns true if it had to be re-extracted.
+        bool UpdateBlock(Block& block) const;
+
+        template<typename T> void SummarizeBlock(const T* data,float& min_value,float& max_value,unsigned int& checksum,const Block& block) const;
+        template<typename T> void ExtractContour(const T* data,Block& block) const;
+        template<typename T> void ExtractCubes(const T* data,Block& block) const;
+
+        static VTK_THREAD_RETURN_TYPE ThreadedExecute(void *arg);
+
+    protected:
+
+        double value;
+        bool generate_cubes;
+        int block_size;
+        int number_of_threads;
+
+        std::vector<Block> blocks;
+        int block_dims[3];              ///< number of blocks in each direction
+        int image_dims[3];              ///< image dimensions that the blocks were made for
+        bool need_reextract_all;        ///< set when the parameters change
+
+        int n_blocks_extracted;
+
+        // used only while executing:
+        const void *input_data;
+        int input_data_type;
+        double origin[3],spacing[3];
+        int n_blocks_extracted_by_thread[VTK_MAX_THREADS];
+
+    private: // deliberately not implemented, to prevent use
+
+        BlockContourFilter(const BlockContourFilter&);
+        void operator=(const BlockContourFilter&);
+};
+
+#endif
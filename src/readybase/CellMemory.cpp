@@ -0,0 +1,183 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "CellMemory.hpp"
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// stdlib:
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sys/mman.h>
+#endif
+
+// VTK:
+#include <vtkDataArray.h>
+#include <vtkDoubleArray.h>
+#include <vtkFloatArray.h>
+#include <vtkMultiThreader.h>
+#include <vtkSmartPointer.h>
+
+// ---------------------------------------------------------------------
+
+/// The work shared between the threads of Allocate.
+struct FirstTouchJob
+{
+    char* target;
+    const char* source;     ///< or NULL to zero the target
+    size_t n_values;
+    size_t value_size;
+};
+
+// ---------------------------------------------------------------------
+
+int CellMemory::GetNumberOfThreads(size_t n)
+{
+    // small arrays aren't worth the threads
+    const size_t MIN_VALUES_PER_THREAD = 65536;
+    const size_t n_cores = (size_t)vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+    return (int)max((size_t)1,min(n_cores,n / MIN_VALUES_PER_THREAD));
+}
+
+// ---------------------------------------------------------------------
+
+static VTK_THREAD_RETURN_TYPE FirstTouchThread(void *arg)
+{
+    vtkMultiThreader::ThreadInfo *info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+    const FirstTouchJob *job = static_cast<const FirstTouchJob*>(info->UserData);
+    CellMemory::ThreadPin pin(info->ThreadID);
+    const size_t first = CellMemory::GetThreadRangeStart(job->n_values,info->ThreadID,info->NumberOfThreads);
+    const size_t last = CellMemory::GetThreadRangeStart(job->n_values,info->ThreadID+1,info->NumberOfThreads);
+    char *target = job->target + first * job->value_size;
+    const size_t n_bytes = (last - first) * job->value_size;
+    if(job->source)
+        memcpy(target,job->source + first * job->value_size,n_bytes);
+    else
+        memset(target,0,n_bytes);
+    return VTK_THREAD_RETURN_VALUE;
+}
+
+// ---------------------------------------------------------------------
+
+static void* AllocateAligned(size_t n_bytes)
+{
+    // returns memory that VTK can release with free(), or NULL if we can't make any
+    #if VTK_MAJOR_VERSION >= 6 && !defined(_WIN32)
+        const size_t CACHE_LINE = 64;
+        const size_t HUGE_PAGE = 2*1024*1024;
+        const size_t alignment = n_bytes >= HUGE_PAGE ? HUGE_PAGE : CACHE_LINE;
+        void *memory = NULL;
+        if(posix_memalign(&memory,alignment,n_bytes)!=0)
+            return NULL;
+        #if defined(__linux__) && defined(MADV_HUGEPAGE)
+            if(alignment==HUGE_PAGE)
+                madvise(memory,n_bytes,MADV_HUGEPAGE); // (just advice, so we carry on if it is refused)
+        #endif
+        return memory;
+    #else
+        // (before VTK 6 an array would free it with delete[], and on Windows aligned memory needs _aligned_free)
+        return NULL;
+    #endif
+}
+
+// ---------------------------------------------------------------------
+
+void CellMemory::Allocate(vtkDataArray* array,vtkIdType n_values,const void* values)
+{
+    if(array->GetNumberOfComponents()!=1)
+        throw runtime_error("CellMemory::Allocate : expected an array with one component");
+    const size_t value_size = (size_t)array->GetDataTypeSize();
+    const bool is_real = array->GetDataType()==VTK_FLOAT || array->GetDataType()==VTK_DOUBLE;
+    void *memory = is_real ? AllocateAligned((size_t)n_values * value_size) : NULL;
+    if(memory)
+    {
+        // the array takes over the memory, and will free it
+        #if VTK_MAJOR_VERSION >= 6
+            if(array->GetDataType()==VTK_DOUBLE)
+                vtkDoubleArray::SafeDownCast(array)->SetArray(static_cast<double*>(memory),n_values,0,
+                    vtkDoubleArray::VTK_DATA_ARRAY_FREE);
+            else
+                vtkFloatArray::SafeDownCast(array)->SetArray(static_cast<float*>(memory),n_values,0,
+                    vtkFloatArray::VTK_DATA_ARRAY_FREE);
+        #endif
+    }
+    else
+    {
+        // let VTK allocate it as usual; the pages are still placed by whichever thread first writes to them below
+        array->SetNumberOfValues(n_values);
+        memory = array->GetVoidPointer(0);
+        if(!memory && n_values > 0)
+            throw runtime_error("CellMemory::Allocate : failed to allocate memory - too big?");
+    }
+
+    FirstTouchJob job;
+    job.target = static_cast<char*>(memory);
+    job.source = static_cast<const char*>(values);
+    job.n_values = (size_t)n_values;
+    job.value_size = value_size;
+    vtkSmartPointer<vtkMultiThreader> threader = vtkSmartPointer<vtkMultiThreader>::New();
+    threader->SetNumberOfThreads(GetNumberOfThreads(job.n_values));
+    threader->SetSingleMethod(FirstTouchThread,&job);
+    threader->SingleMethodExecute();
+    array->Modified();
+}
+
+// ---------------------------------------------------------------------
+
+CellMemory::ThreadPin::ThreadPin(int iThread)
+{
+    #ifdef __linux__
+        this->is_pinned = false;
+        if(pthread_getaffinity_np(pthread_self(),sizeof(cpu_set_t),&this->previous_cores)!=0)
+            return;
+        // take the iThread'th of the cores we may use, wrapping around if there are more threads than cores
+        const int n_cores = CPU_COUNT(&this->previous_cores);
+        if(n_cores < 2)
+            return;
+        int n_to_skip = iThread % n_cores;
+        for(int core=0;core<CPU_SETSIZE;core++)
+        {
+            if(!CPU_ISSET(core,&this->previous_cores) || n_to_skip-- > 0)
+                continue;
+            cpu_set_t cores;
+            CPU_ZERO(&cores);
+            CPU_SET(core,&cores);
+            this->is_pinned = pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cores)==0;
+            break;
+        }
+    #else
+        (void)iThread;
+    #endif
+}
+
+// ---------------------------------------------------------------------
+
+CellMemory::ThreadPin::~ThreadPin()
+{
+    #ifdef __linux__
+        if(this->is_pinned)
+            pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&this->previous_cores);
+    #endif
+}
+
+// ---------------------------------------------------------------------
@@ -0,0 +1,67 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __CELLMEMORY__
+#define __CELLMEMORY__
+
+// stdlib:
+#include <stddef.h>
+#ifdef __linux__
+    #include <sched.h>
+#endif
+
+// VTK:
+#include <vtkType.h>
+class vtkDataArray;
+
+/// Memory for the values of the cells on the CPU, laid out for the threads that work on it.
+/**
+ * On a machine with several NUMA nodes each page of memory lives on the node of the core that first touched it. So
+ * the values are split into contiguous ranges, one for each thread, in the same way as the threaded loops over them
+ * (see GetNumberOfThreads and GetThreadRangeStart), and each range is first written by its own thread, pinned to the
+ * same core as it will be when it works on the range later. The memory is aligned to a cache line, or for big arrays
+ * to a huge page (and on Linux backed by transparent huge pages), and handed to VTK with SetArray, so the array can
+ * be used like any other and VTK frees it.
+ */
+namespace CellMemory
+{
+    /// Returns the number of threads to split n values between, so that each thread has a worthwhile share.
+    int GetNumberOfThreads(size_t n);
+
+    /// Returns the first of the values of thread iThread, when n values are split between n_threads.
+    inline size_t GetThreadRangeStart(size_t n,int iThread,int n_threads) { return n * iThread / n_threads; }
+
+    /// Gives the array (with one component) n_values of new memory, zeroed or else copied from values. Throws on failure.
+    void Allocate(vtkDataArray* array,vtkIdType n_values,const void* values=NULL);
+
+    /// Pins the calling thread to a core for as long as this object exists, the same core for the same iThread.
+    /** The core is picked from those that the thread may already use. Only on Linux; elsewhere it does nothing. */
+    class ThreadPin
+    {
+        public:
+            explicit ThreadPin(int iThread);
+            ~ThreadPin();
+
+        private:
+            #ifdef __linux__
+                cpu_set_t previous_cores;   ///< restored afterwards, since thread 0 is the caller's own thread
+                bool is_pinned;
+            #endif
+    };
+}
+
+#endif
@@ -47,6 +47,43 @@ delta_b = D_b * laplacian_b + a*b*b - (F+K)*b;");
 // -------------------------------------------------------------------------
 
 std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string formula) const
+{
+    return this->AssembleKernelSource(formula,this->wrap,1.0,false);
+}
+
+// -------------------------------------------------------------------------
+
+std::string FormulaOpenCLImageRD::AssembleRefinedKernelSource() const
+{
+    // the patches are computed side by side in one image, so they mustn't wrap around
+    return this->AssembleKernelSource(this->formula,false,1.0/PatchRefinement::RATIO,false);
+}
+
+// -------------------------------------------------------------------------
+
+std::string FormulaOpenCLImageRD::AssembleSlabKernelSource() const
+{
+    return this->AssembleKernelSource(this->formula,this->wrap,1.0,true);
+}
+
+// -------------------------------------------------------------------------
+
+/// Returns the kernel code for the planes either side of index_z.
+static string GetZNeighborSource(const string& indent,bool wrap,bool slab)
+{
+    if(slab)
+        return indent + "const int zm1 = index_z-1; // (the planes either side of a slab are halo planes, so there is always a neighbor)\n" +
+               indent + "const int zp1 = index_z+1;\n";
+    if(wrap)
+        return indent + "const int zm1 = (index_z-1+Z) & (Z-1);\n" +
+               indent + "const int zp1 = (index_z+1) & (Z-1);\n";
+    return indent + "const int zm1 = max(0,index_z-1);\n" +
+           indent + "const int zp1 = min(Z-1,index_z+1);\n";
+}
+
+// -------------------------------------------------------------------------
+
+std::string FormulaOpenCLImageRD::AssembleKernelSource(const std::string& formula,bool wrap,double cell_size,bool slab) const
 {
     const string indent = "    ";
     const int NC = this->GetNumberOfChemicals();
@@ -63,27 +100,95 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
     #error \"Double precision floating point not supported on this OpenCL device. Choose another or contact the Ready team.\"\n\
 #endif\n\n";
     }
+    const vector<int> sat_chemicals = cell_size == 1.0 ? this->FindChemicalsWithMeans(formula) : vector<int>();
+    if(!sat_chemicals.empty())
+        kernel_source << this->GetSummedAreaTableSource(sat_chemicals,wrap) << "\n";
     // output the function definition
     kernel_source << "__kernel void rd_compute(";
-    for(int i=0;i<NC;i++)
-        kernel_source << "__global " << this->data_type_string << "4 *" << GetChemicalName(i) << "_in,";
-    for(int i=0;i<NC;i++)
+    const string buffer_type = this->half_storage ? "half" : this->data_type_string + "4"; // halves are converted as they are loaded and stored
+    if(this->interleaved_chemicals)
+        kernel_source << "__global " << buffer_type << " *chemicals_in,__global " << buffer_type << " *chemicals_out";
+    else
+    {
+        for(int i=0;i<NC;i++)
+            kernel_source << "__global " << buffer_type << " *" << GetChemicalName(i) << "_in,";
+        for(int i=0;i<NC;i++)
+        {
+            kernel_source << "__global " << buffer_type << " *" << GetChemicalName(i) << "_out";
+            if(i<NC-1)
+                kernel_source << ",";
+        }
+    }
+    const string real4 = this->data_type_string + "4";
+    for(size_t i=0;i<this->auxiliary_buffers.size();i++)
     {
-        kernel_source << "__global " << this->data_type_string << "4 *" << GetChemicalName(i) << "_out";
-        if(i<NC-1)
-            kernel_source << ",";
+        const string& name = this->auxiliary_buffers[i].name;
+        if(this->auxiliary_buffers[i].double_buffered)
+            kernel_source << ",__global " << real4 << " *" << name << "_in,__global " << real4 << " *" << name << "_out";
+        else
+            kernel_source << ",__global " << real4 << " *" << name << "_inout";
     }
+    for(size_t i=0;i<sat_chemicals.size();i++)
+        kernel_source << ",__global const long *sat_" << GetChemicalName(sat_chemicals[i]);
+    const bool track_activity = this->activity_tolerance > 0.0f && cell_size == 1.0;
+    if(track_activity)
+        kernel_source << ",__global const int *worklist,__global const int *counts,__global int *changed,const int parity";
     // output the first part of the body
-    kernel_source << ")\n{\n" <<
-        indent << "const int index_x = get_global_id(0);\n" << 
-        indent << "const int index_y = get_global_id(1);\n" <<
-        indent << "const int index_z = get_global_id(2);\n" <<
+    kernel_source << ")\n{\n";
+    if(track_activity)
+    {
+        // each work group computes the tile in the worklist at its position, if there is one
+        kernel_source <<
+            indent << "const int n_tiles = get_num_groups(0)*get_num_groups(1)*get_num_groups(2);\n" <<
+            indent << "const int group = get_num_groups(0)*(get_num_groups(1)*get_group_id(2) + get_group_id(1)) + get_group_id(0);\n" <<
+            indent << "if(group >= counts[parity]) return;\n" <<
+            indent << "const int entry = worklist[group];\n" <<
+            indent << "const int tile = entry < 0 ? -entry-1 : entry; // (a negative entry is a quiet tile that only needs copying)\n" <<
+            indent << "const int index_x = (tile % get_num_groups(0)) * get_local_size(0) + get_local_id(0);\n" <<
+            indent << "const int index_y = ((tile / get_num_groups(0)) % get_num_groups(1)) * get_local_size(1) + get_local_id(1);\n" <<
+            indent << "const int index_z = (tile / (get_num_groups(0)*get_num_groups(1))) * get_local_size(2) + get_local_id(2);\n";
+    }
+    else
+        kernel_source <<
+            indent << "const int index_x = get_global_id(0);\n" << 
+            indent << "const int index_y = get_global_id(1);\n" <<
+            indent << "const int index_z = get_global_id(2);\n";
+    kernel_source <<
         indent << "const int X = get_global_size(0);\n" <<
         indent << "const int Y = get_global_size(1);\n" <<
         indent << "const int Z = get_global_size(2);\n" <<
         indent << "const int index_here = X*(Y*index_z + index_y) + index_x;\n\n";
+    for(size_t i=0;i<sat_chemicals.size();i++)
+    {
+        // the neighborhood means of each cell of the block, from the summed-area table
+        const string chem = GetChemicalName(sat_chemicals[i]);
+        const string args = "(sat_" + chem + ",4*X,Y,4*index_x,index_y,";
+        kernel_source <<
+            "#define box_mean_" << chem << "(r) rd_box_mean" << args << "(r))\n" <<
+            "#define disc_mean_" << chem << "(r) rd_disc_mean" << args << "(r))\n" <<
+            "#define annulus_mean_" << chem << "(r_inner,r_outer) rd_annulus_mean" << args << "(r_inner),(r_outer))\n";
+    }
+    if(!sat_chemicals.empty())
+        kernel_source << "\n";
     for(int i=0;i<NC;i++)
-        kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(i) << " = " << GetChemicalName(i) << "_in[index_here];\n"; // "float4 a = a_in[index_here];"
+        kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(i) << " = " << this->LoadBlock(i,"index_here") << ";\n"; // "float4 a = a_in[index_here];"
+    for(size_t i=0;i<this->auxiliary_buffers.size();i++)
+    {
+        // the formula reads and assigns the auxiliary values of this block like ordinary variables
+        const string& name = this->auxiliary_buffers[i].name;
+        kernel_source << indent << real4 << " " << name << " = " << name << (this->auxiliary_buffers[i].double_buffered ? "_in" : "_inout") << "[index_here];\n";
+    }
+    if(track_activity)
+    {
+        // bring the other buffers up to date with the quiet tiles, without computing them
+        kernel_source << indent << "if(entry < 0)\n" << indent << "{\n";
+        for(size_t i=0;i<this->auxiliary_buffers.size();i++)
+            if(this->auxiliary_buffers[i].double_buffered)
+                kernel_source << indent << indent << this->auxiliary_buffers[i].name << "_out[index_here] = " << this->auxiliary_buffers[i].name << ";\n";
+        for(int iC=0;iC<NC;iC++)
+            kernel_source << indent << indent << this->StoreBlock(iC,"index_here",GetChemicalName(iC)) << "\n";
+        kernel_source << indent << indent << "return;\n" << indent << "}\n";
+    }
     if(this->neighborhood_type==FACE_NEIGHBORS && this->GetArenaDimensionality()==3 && this->neighborhood_range==1) // neighborhood_weight not relevant
     {
         const int NDIRS = 6;
@@ -91,22 +196,19 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         // output the Laplacian part of the body
         kernel_source << "\n" << indent << "// compute the Laplacians of each chemical\n";
         kernel_source << indent << "// 3D 7-point stencil: [ [ 0,0,0; 0,1,0; 0,0,0 ], [0,1,0; 1,-6,1; 0,1,0 ], [ 0,0,0; 0,1,0; 0,0,0 ] ]\n";
-        if(this->wrap)
+        if(wrap)
             kernel_source <<
                 indent << "const int xm1 = (index_x-1+X) & (X-1); // wrap (assumes X is a power of 2)\n" <<
                 indent << "const int xp1 = (index_x+1) & (X-1);\n" << 
                 indent << "const int ym1 = (index_y-1+Y) & (Y-1);\n" <<
-                indent << "const int yp1 = (index_y+1) & (Y-1);\n" <<
-                indent << "const int zm1 = (index_z-1+Z) & (Z-1);\n" <<
-                indent << "const int zp1 = (index_z+1) & (Z-1);\n";
+                indent << "const int yp1 = (index_y+1) & (Y-1);\n";
         else
             kernel_source <<
                 indent << "const int xm1 = max(0,index_x-1);\n" <<
                 indent << "const int ym1 = max(0,index_y-1);\n" <<
-                indent << "const int zm1 = max(0,index_z-1);\n" <<
                 indent << "const int xp1 = min(X-1,index_x+1);\n" <<
-                indent << "const int yp1 = min(Y-1,index_y+1);\n" <<
-                indent << "const int zp1 = min(Z-1,index_z+1);\n";
+                indent << "const int yp1 = min(Y-1,index_y+1);\n";
+        kernel_source << GetZNeighborSource(indent,wrap,slab);
         kernel_source <<
             indent << "const int index_left =  X*(Y*index_z + index_y) + xm1;\n" <<
             indent << "const int index_right = X*(Y*index_z + index_y) + xp1;\n" <<
@@ -116,7 +218,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
             indent << "const int index_back =  X*(Y*zp1 + index_y) + index_x;\n";
         for(int iC=0;iC<NC;iC++)
             for(int iDir=0;iDir<NDIRS;iDir++)
-                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << GetChemicalName(iC) << "_in[index_" << dir[iDir] << "];\n";
+                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << this->LoadBlock(iC,"index_"+dir[iDir]) << ";\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K0 = -6.0" << this->data_type_suffix << "; // center weight\n";
         for(int iC=0;iC<NC;iC++)
         {
@@ -141,7 +243,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         // output the Laplacian part of the body
         kernel_source << "\n" << indent << "// compute the Laplacians of each chemical\n";
         kernel_source << indent << "// 2D 5-point stencil: [ 0,1,0; 1,-4,1; 0,1,0 ]\n";
-        if(this->wrap)
+        if(wrap)
             kernel_source <<
                 indent << "const int xm1 = (index_x-1+X) & (X-1); // wrap (assumes X is a power of 2)\n" <<
                 indent << "const int xp1 = (index_x+1) & (X-1);\n" <<
@@ -160,7 +262,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
             indent << "const int index_down =  X*(Y*index_z + yp1) + index_x;";
         for(int iC=0;iC<NC;iC++)
             for(int iDir=0;iDir<NDIRS;iDir++)
-                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << GetChemicalName(iC) << "_in[index_" << dir[iDir] << "];\n";
+                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << this->LoadBlock(iC,"index_"+dir[iDir]) << ";\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K0 = -4.0" << this->data_type_suffix << "; // center weight\n";
         for(int iC=0;iC<NC;iC++)
         {
@@ -185,7 +287,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         // output the Laplacian part of the body
         kernel_source << "\n" << indent << "// compute the Laplacians of each chemical\n";
         kernel_source << indent << "// 1D 3-point stencil: [ 1,-2,1 ]\n";
-        if(this->wrap)
+        if(wrap)
             kernel_source <<
                 indent << "const int xm1 = (index_x-1+X) & (X-1); // wrap (assumes X is a power of 2)\n" <<
                 indent << "const int xp1 = (index_x+1) & (X-1);\n";
@@ -198,7 +300,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
             indent << "const int index_right = X*(Y*index_z + index_y) + xp1;\n";
         for(int iC=0;iC<NC;iC++)
             for(int iDir=0;iDir<NDIRS;iDir++)
-                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << GetChemicalName(iC) << "_in[index_" << dir[iDir] << "];\n";
+                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << this->LoadBlock(iC,"index_"+dir[iDir]) << ";\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K0 = -2.0" << this->data_type_suffix << "; // center weight\n";
         for(int iC=0;iC<NC;iC++)
         {
@@ -217,7 +319,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         // output the Laplacian part of the body
         kernel_source << "\n" << indent << "// compute the Laplacians of each chemical\n";
         kernel_source << indent << "// 2D standard 9-point stencil: [ 1,4,1; 4,-20,4; 1,4,1 ] / 6\n";
-        if(this->wrap)
+        if(wrap)
             kernel_source <<
                 indent << "const int xm1 = (index_x-1+X) & (X-1); // wrap (assumes X is a power of 2)\n" <<
                 indent << "const int xp1 = (index_x+1) & (X-1);\n" <<
@@ -240,7 +342,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
             indent << "const int index_nw = X*(Y*index_z + ym1) + xm1;\n";
         for(int iC=0;iC<NC;iC++)
             for(int iDir=0;iDir<NDIRS;iDir++)
-                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << GetChemicalName(iC) << "_in[index_" << dir[iDir] << "];\n";
+                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << this->LoadBlock(iC,"index_"+dir[iDir]) << ";\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K0 = -20.0" << this->data_type_suffix << "/6.0" << this->data_type_suffix << "; // center weight\n";
         kernel_source << indent << "const " << this->data_type_string << " _K1 = 4.0" << this->data_type_suffix << "/6.0" << this->data_type_suffix << "; // edge-neighbors\n";
         kernel_source << indent << "const " << this->data_type_string << " _K2 = 1.0" << this->data_type_suffix << "/6.0" << this->data_type_suffix << "; // vertex-neighbors\n";
@@ -272,7 +374,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         // output the Laplacian part of the body
         kernel_source << "\n" << indent << "// compute the Laplacians of each chemical\n";
         kernel_source << indent << "// 2D equal-weighted 9-point stencil: [ 1,1,1; 1,-8,1; 1,1,1 ] / 2\n";
-        if(this->wrap)
+        if(wrap)
             kernel_source <<
                 indent << "const int xm1 = (index_x-1+X) & (X-1); // wrap (assumes X is a power of 2)\n" <<
                 indent << "const int xp1 = (index_x+1) & (X-1);\n" <<
@@ -295,7 +397,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
             indent << "const int index_nw = X*(Y*index_z + ym1) + xm1;\n";
         for(int iC=0;iC<NC;iC++)
             for(int iDir=0;iDir<NDIRS;iDir++)
-                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << GetChemicalName(iC) << "_in[index_" << dir[iDir] << "];\n";
+                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << this->LoadBlock(iC,"index_"+dir[iDir]) << ";\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K0 = -4.0" << this->data_type_suffix << "; // center weight\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K1 = 1.0" << this->data_type_suffix << "/2.0" << this->data_type_suffix << "; // edge-neighbors\n";
         for(int iC=0;iC<NC;iC++)
@@ -325,22 +427,19 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         // output the Laplacian part of the body
         kernel_source << "\n" << indent << "// compute the Laplacians of each chemical\n";
         kernel_source << indent << "// 3D 19-point stencil: [ [ 0,1,0; 1,2,1; 0,1,0 ], [ 1,2,1; 2,-24,2; 1,2,1 ], [ 0,1,0; 1,2,1; 0,1,0 ] ] / 6\n";
-        if(this->wrap)
+        if(wrap)
             kernel_source <<
                 indent << "const int xm1 = (index_x-1+X) & (X-1); // wrap (assumes X is a power of 2)\n" <<
                 indent << "const int xp1 = (index_x+1) & (X-1);\n" <<
                 indent << "const int ym1 = (index_y-1+Y) & (Y-1);\n" <<
-                indent << "const int yp1 = (index_y+1) & (Y-1);\n" <<
-                indent << "const int zm1 = (index_z-1+Z) & (Z-1);\n" <<
-                indent << "const int zp1 = (index_z+1) & (Z-1);\n";
+                indent << "const int yp1 = (index_y+1) & (Y-1);\n";
         else
             kernel_source <<
                 indent << "const int xm1 = max(0,index_x-1);\n" <<
                 indent << "const int ym1 = max(0,index_y-1);\n" <<
-                indent << "const int zm1 = max(0,index_z-1);\n" <<
                 indent << "const int xp1 = min(X-1,index_x+1);\n" <<
-                indent << "const int yp1 = min(Y-1,index_y+1);\n" <<
-                indent << "const int zp1 = min(Z-1,index_z+1);\n";
+                indent << "const int yp1 = min(Y-1,index_y+1);\n";
+        kernel_source << GetZNeighborSource(indent,wrap,slab);
         kernel_source <<
             indent << "const int index_n =  X*(Y*index_z + ym1) + index_x;\n" <<
             indent << "const int index_ne = X*(Y*index_z + ym1) + xp1;\n" <<
@@ -362,7 +461,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
             indent << "const int index_uw =  X*(Y*zp1 + index_y) + xm1;\n";
         for(int iC=0;iC<NC;iC++)
             for(int iDir=0;iDir<NDIRS;iDir++)
-                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << GetChemicalName(iC) << "_in[index_" << dir[iDir] << "];\n";
+                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << this->LoadBlock(iC,"index_"+dir[iDir]) << ";\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K0 = -24.0" << this->data_type_suffix << "/6.0" << this->data_type_suffix << "; // center weight\n";
         kernel_source << indent << "const " << this->data_type_string << " _K1 = 2.0" << this->data_type_suffix << "/6.0" << this->data_type_suffix << "; // face-neighbors\n";
         kernel_source << indent << "const " << this->data_type_string << " _K2 = 1.0" << this->data_type_suffix << "/6.0" << this->data_type_suffix << "; // edge-neighbors\n";
@@ -422,22 +521,19 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         // output the Laplacian part of the body
         kernel_source << "\n" << indent << "// compute the Laplacians of each chemical\n";
         kernel_source << indent << "// 3D 27-point stencil: [ [ 2,3,2; 3,6,3; 2,3,2 ], [ 3,6,3; 6,-88,6; 3,6,3 ], [ 2,3,2; 3,6,3; 2,3,2 ] ] / 26\n";
-        if(this->wrap)
+        if(wrap)
             kernel_source <<
                 indent << "const int xm1 = (index_x-1+X) & (X-1); // wrap (assumes X is a power of 2)\n" <<
                 indent << "const int xp1 = (index_x+1) & (X-1);\n" <<
                 indent << "const int ym1 = (index_y-1+Y) & (Y-1);\n" <<
-                indent << "const int yp1 = (index_y+1) & (Y-1);\n" <<
-                indent << "const int zm1 = (index_z-1+Z) & (Z-1);\n" <<
-                indent << "const int zp1 = (index_z+1) & (Z-1);\n";
+                indent << "const int yp1 = (index_y+1) & (Y-1);\n";
         else
             kernel_source <<
                 indent << "const int xm1 = max(0,index_x-1);\n" <<
                 indent << "const int ym1 = max(0,index_y-1);\n" <<
-                indent << "const int zm1 = max(0,index_z-1);\n" <<
                 indent << "const int xp1 = min(X-1,index_x+1);\n" <<
-                indent << "const int yp1 = min(Y-1,index_y+1);\n" <<
-                indent << "const int zp1 = min(Z-1,index_z+1);\n";
+                indent << "const int yp1 = min(Y-1,index_y+1);\n";
+        kernel_source << GetZNeighborSource(indent,wrap,slab);
         kernel_source <<
             indent << "const int index_n =  X*(Y*index_z + ym1) + index_x;\n" <<
             indent << "const int index_ne = X*(Y*index_z + ym1) + xp1;\n" <<
@@ -467,7 +563,7 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
             indent << "const int index_unw = X*(Y*zp1 + ym1) + xm1;\n";
         for(int iC=0;iC<NC;iC++)
             for(int iDir=0;iDir<NDIRS;iDir++)
-                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << GetChemicalName(iC) << "_in[index_" << dir[iDir] << "];\n";
+                kernel_source << indent << this->data_type_string << "4 " << GetChemicalName(iC) << "_" << dir[iDir] << " = " << this->LoadBlock(iC,"index_"+dir[iDir]) << ";\n";
         kernel_source << indent << "const " << this->data_type_string << "4 _K0 = -88.0" << this->data_type_suffix << "/26.0" << this->data_type_suffix << "; // center weight\n";
         kernel_source << indent << "const " << this->data_type_string << " _K1 = 6.0" << this->data_type_suffix << "/26.0" << this->data_type_suffix << "; // face-neighbors\n";
         kernel_source << indent << "const " << this->data_type_string << " _K2 = 3.0" << this->data_type_suffix << "/26.0" << this->data_type_suffix << "; // edge-neighbors\n";
@@ -538,6 +634,13 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
         oss << "weights=" << this->canonical_neighborhood_weight_identifiers.find(this->neighborhood_weight_type)->second;
         throw runtime_error(oss.str().c_str());
     }
+    if(cell_size != 1.0)
+    {
+        // the stencils above assume cells of unit size
+        kernel_source << "\n";
+        for(int iC=0;iC<NC;iC++)
+            kernel_source << indent << "laplacian_" << GetChemicalName(iC) << " *= " << 1.0/(cell_size*cell_size) << this->data_type_suffix << ";\n";
+    }
     kernel_source << "\n";
     for(int iC=0;iC<NC;iC++)
         kernel_source << indent << this->data_type_string << "4 delta_" << GetChemicalName(iC) << " = 0.0" << this->data_type_suffix << ";\n";
@@ -545,6 +648,8 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
     // the parameters (assume all float for now)
     for(int i=0;i<(int)this->parameters.size();i++)
         kernel_source << indent << this->data_type_string << "4 " << this->parameters[i].first << " = " << this->parameters[i].second << this->data_type_suffix << ";\n";
+    if(cell_size != 1.0)
+        kernel_source << indent << "timestep *= " << cell_size*cell_size << this->data_type_suffix << "; // (keeps diffusion stable on the smaller cells)\n";
     kernel_source << "\n";
     // the formula
     istringstream iss(formula);
@@ -556,14 +661,85 @@ std::string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(std::string fo
     }
     // the last part of the kernel
     kernel_source << "\n";
+    if(track_activity)
+    {
+        // report whether this tile changed by more than the tolerance
+        ostringstream tolerance;
+        tolerance << scientific << setprecision(6) << this->activity_tolerance << this->data_type_suffix;
+        kernel_source << indent << "if(";
+        for(int iC=0;iC<NC;iC++)
+            kernel_source << (iC>0?" || ":"") << "any(fabs(timestep * delta_" << GetChemicalName(iC) << ") > " << tolerance.str() << ")";
+        kernel_source << ")\n" << indent << indent << "atomic_or(&changed[parity*n_tiles + tile],3);\n" <<
+            indent << "else if(get_local_id(0)==0 && get_local_id(1)==0 && get_local_id(2)==0)\n" <<
+            indent << indent << "atomic_or(&changed[parity*n_tiles + tile],1); // (computed, so the other buffer is now behind)\n";
+    }
+    for(size_t i=0;i<this->auxiliary_buffers.size();i++)
+    {
+        const string& name = this->auxiliary_buffers[i].name;
+        kernel_source << indent << name << (this->auxiliary_buffers[i].double_buffered ? "_out" : "_inout") << "[index_here] = " << name << ";\n";
+    }
     for(int iC=0;iC<NC;iC++)
-        kernel_source << indent << GetChemicalName(iC) << "_out[index_here] = " << GetChemicalName(iC) << " + timestep * delta_" << GetChemicalName(iC) << ";\n";
+        kernel_source << indent << this->StoreBlock(iC,"index_here",GetChemicalName(iC) + " + timestep * delta_" + GetChemicalName(iC)) << "\n";
     kernel_source << "}\n";
+    if(track_activity)
+        kernel_source << OpenCLImageRD::GetActivityKernelSource();
     return kernel_source.str();
 }
 
 // -------------------------------------------------------------------------
 
+std::vector<int> FormulaOpenCLImageRD::FindChemicalsWithMeans(const std::string& formula) const
+{
+    vector<int> chemicals;
+    for(int iC=0;iC<this->GetNumberOfChemicals();iC++)
+    {
+        const string chem = GetChemicalName(iC);
+        if(formula.find("box_mean_"+chem+"(") != string::npos || formula.find("disc_mean_"+chem+"(") != string::npos
+            || formula.find("annulus_mean_"+chem+"(") != string::npos)
+            chemicals.push_back(iC);
+    }
+    return chemicals;
+}
+
+// -------------------------------------------------------------------------
+
+std::string FormulaOpenCLImageRD::LoadBlock(int iChemical,const std::string& index) const
+{
+    string buffer = GetChemicalName(iChemical) + "_in";
+    string i = index;
+    if(this->interleaved_chemicals)
+    {
+        // the chemicals take turns, one block each
+        buffer = "chemicals_in";
+        i = index + "*" + to_string(this->GetNumberOfChemicals()) + "+" + to_string(iChemical);
+    }
+    if(!this->half_storage)
+        return buffer + "[" + i + "]";
+    else if(this->data_type == VTK_DOUBLE)
+        return "convert_double4(vload_half4(" + i + "," + buffer + "))";
+    else
+        return "vload_half4(" + i + "," + buffer + ")";
+}
+
+// -------------------------------------------------------------------------
+
+std::string FormulaOpenCLImageRD::StoreBlock(int iChemical,const std::string& index,const std::string& value) const
+{
+    string buffer = GetChemicalName(iChemical) + "_out";
+    string i = index;
+    if(this->interleaved_chemicals)
+    {
+        buffer = "chemicals_out";
+        i = index + "*" + to_string(this->GetNumberOfChemicals()) + "+" + to_string(iChemical);
+    }
+    if(!this->half_storage)
+        return buffer + "[" + i + "] = " + value + ";";
+    else
+        return "vstore_half4(" + value + "," + i + "," + buffer + ");";
+}
+
+// -------------------------------------------------------------------------
+
 void FormulaOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_to_update)
 {
     OpenCLImageRD::InitializeFromXML(rd,warn_to_update);
@@ -37,6 +37,8 @@ class FormulaOpenCLImageRD : public OpenCLImageRD
         virtual int GetBlockSizeX() const { return 4; } // we use float4 in a 4x1x1 block
 
         virtual std::string AssembleKernelSourceFromFormula(std::string formula) const;
+        virtual std::string AssembleRefinedKernelSource() const;
+        virtual std::string AssembleSlabKernelSource() const;
 
         // we override the parameter access functions because changing the parameters requires rewriting the kernel
         virtual void AddParameter(const std::string& name,float val);
@@ -48,4 +50,23 @@ class FormulaOpenCLImageRD : public OpenCLImageRD
         virtual bool HasEditableWrapOption() const { return true; }
         virtual void SetWrap(bool w);
         virtual bool HasEditableDataType() const { return true; }
+        virtual bool HasEditableHalfStorage() const { return true; }
+        virtual bool HasEditableInterleavedChemicals() const { return true; }
+        virtual bool HasEditableActivityTolerance() const { return true; }
+        virtual bool HasEditableRefinementThreshold() const { return true; }
+
+    protected:
+
+        /// Returns the kernel source for cells of the given size (1 for the image, smaller for refined patches).
+        /** If slab then the kernel is for one slab of a SlabDecomposition, whose neighbors along z are in its halo planes. */
+        std::string AssembleKernelSource(const std::string& formula,bool wrap,double cell_size,bool slab) const;
+
+        /// Returns the chemicals that the formula takes neighborhood means of, e.g. with box_mean_a(r).
+        std::vector<int> FindChemicalsWithMeans(const std::string& formula) const;
+        virtual std::vector<int> GetSummedAreaTableChemicals() const { return this->FindChemicalsWithMeans(this->formula); }
+
+        /// Returns the kernel code that loads the block at index from a chemical's input buffer, e.g. "a_in[index_here]".
+        std::string LoadBlock(int iChemical,const std::string& index) const;
+        /// Returns the kernel statement that stores value as the block at index of a chemical's output buffer.
+        std::string StoreBlock(int iChemical,const std::string& index,const std::string& value) const;
 };
@@ -65,24 +65,30 @@ std::string FormulaOpenCLMeshRD::AssembleKernelSourceFromFormula(std::string f)
     }
     // output the function definition
     kernel_source << "__kernel void rd_compute(";
-    for(int i=0;i<NC;i++)
-        kernel_source << "__global " << this->data_type_string << " *" << GetChemicalName(i) << "_in,";
-    for(int i=0;i<NC;i++)
-        kernel_source << "__global " << this->data_type_string << " *" << GetChemicalName(i) << "_out,";
+    const string buffer_type = this->half_storage ? "half" : this->data_type_string; // halves are converted as they are loaded and stored
+    if(this->interleaved_chemicals)
+        kernel_source << "__global " << buffer_type << " *chemicals_in,__global " << buffer_type << " *chemicals_out,";
+    else
+    {
+        for(int i=0;i<NC;i++)
+            kernel_source << "__global " << buffer_type << " *" << GetChemicalName(i) << "_in,";
+        for(int i=0;i<NC;i++)
+            kernel_source << "__global " << buffer_type << " *" << GetChemicalName(i) << "_out,";
+    }
     kernel_source << "__global int* neighbor_indices,__global float* neighbor_weights,const int max_neighbors)\n";
     // output the body
     kernel_source << "{\n";
     kernel_source << indent << "const int index_x = get_global_id(0);\n";
     for(int i=0;i<NC;i++)
-        kernel_source << indent << this->data_type_string << " " << GetChemicalName(i) << " = " << GetChemicalName(i) << "_in[index_x];\n";
+        kernel_source << indent << this->data_type_string << " " << GetChemicalName(i) << " = " << this->LoadValue(i,"index_x") << ";\n";
     // compute the laplacians
     for(int i=0;i<NC;i++)
         kernel_source << indent << this->data_type_string << " laplacian_" << GetChemicalName(i) << " = 0.0" << this->data_type_suffix << ";\n";
     kernel_source << indent << "int _offset = index_x * max_neighbors;\n";
     kernel_source << indent << "for(int _i=0;_i<max_neighbors;_i++)\n" << indent << "{\n";
     for(int i=0;i<NC;i++)
-        kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " << GetChemicalName(i) 
-                      << "_in[neighbor_indices[_offset+_i]] * neighbor_weights[_offset+_i];\n";
+        kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " 
+                      << this->LoadValue(i,"neighbor_indices[_offset+_i]") << " * neighbor_weights[_offset+_i];\n";
     kernel_source << indent << "}\n";
     for(int i=0;i<NC;i++)
         kernel_source << indent << "laplacian_" << GetChemicalName(i) << " -= " << GetChemicalName(i) << ";\n";
@@ -100,13 +106,48 @@ std::string FormulaOpenCLMeshRD::AssembleKernelSourceFromFormula(std::string f)
     kernel_source << f << "\n";
     kernel_source << "\n";
     for(int i=0;i<NC;i++)
-        kernel_source << indent << GetChemicalName(i) << "_out[index_x] = " << GetChemicalName(i) << " + timestep * delta_" << GetChemicalName(i) << ";\n";
+        kernel_source << indent << this->StoreValue(i,"index_x",GetChemicalName(i) + " + timestep * delta_" + GetChemicalName(i)) << "\n";
     kernel_source << "}\n";
     return kernel_source.str();
 }
 
 // -------------------------------------------------------------------------
 
+std::string FormulaOpenCLMeshRD::LoadValue(int iChemical,const std::string& index) const
+{
+    string buffer = GetChemicalName(iChemical) + "_in";
+    string i = index;
+    if(this->interleaved_chemicals)
+    {
+        // the chemicals of each cell are next to each other
+        buffer = "chemicals_in";
+        i = index + "*" + to_string(this->GetNumberOfChemicals()) + "+" + to_string(iChemical);
+    }
+    if(this->half_storage)
+        return "vload_half(" + i + "," + buffer + ")"; // (a float, which is promoted if the data type is double)
+    else
+        return buffer + "[" + i + "]";
+}
+
+// -------------------------------------------------------------------------
+
+std::string FormulaOpenCLMeshRD::StoreValue(int iChemical,const std::string& index,const std::string& value) const
+{
+    string buffer = GetChemicalName(iChemical) + "_out";
+    string i = index;
+    if(this->interleaved_chemicals)
+    {
+        buffer = "chemicals_out";
+        i = index + "*" + to_string(this->GetNumberOfChemicals()) + "+" + to_string(iChemical);
+    }
+    if(this->half_storage)
+        return "vstore_half(" + value + "," + i + "," + buffer + ");";
+    else
+        return buffer + "[" + i + "] = " + value + ";";
+}
+
+// -------------------------------------------------------------------------
+
 void FormulaOpenCLMeshRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_to_update)
 {
     OpenCLMeshRD::InitializeFromXML(rd,warn_to_update);
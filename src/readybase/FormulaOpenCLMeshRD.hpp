@@ -40,4 +40,13 @@ class FormulaOpenCLMeshRD : public OpenCLMeshRD
         virtual void SetParameterValue(int iParam,float val);
 
         virtual bool HasEditableDataType() const { return true; }
+        virtual bool HasEditableHalfStorage() const { return true; }
+        virtual bool HasEditableInterleavedChemicals() const { return true; }
+
+    protected:
+
+        /// Returns the kernel code that loads the value at index from a chemical's input buffer, e.g. "a_in[index_x]".
+        std::string LoadValue(int iChemical,const std::string& index) const;
+        /// Returns the kernel statement that stores value at index of a chemical's output buffer.
+        std::string StoreValue(int iChemical,const std::string& index,const std::string& value) const;
 };
@@ -18,14 +18,22 @@
 // local:
 #include "FullKernelOpenCLImageRD.hpp"
 #include "utils.hpp"
+#include "OpenCL_utils.hpp"
+using namespace OpenCL_utils;
 
 // STL:
 #include <string>
+#include <sstream>
+#include <algorithm>
 using namespace std;
 
+// stdlib:
+#include <ctype.h>
+
 // VTK:
 #include <vtkXMLUtilities.h>
 #include <vtkImageData.h>
+#include <vtkMath.h>
 
 // ---------------------------------------------------------------------------------------------------------
 
@@ -59,16 +67,65 @@ FullKernelOpenCLImageRD::FullKernelOpenCLImageRD(const OpenCLImageRD& source)
     this->SetRuleName(source.GetRuleName());
     this->SetDescription(source.GetDescription());
 
-    this->initial_pattern_generator.ReadFromXML(source.GetAsXML(false)->FindNestedElementWithName("initial_pattern_generator"));
+    vtkSmartPointer<vtkXMLDataElement> source_xml = source.GetAsXML(false);
+    this->initial_pattern_generator.ReadFromXML(source_xml->FindNestedElementWithName("initial_pattern_generator"));
+    this->ReadAuxiliaryBuffersFromXML(source_xml->FindNestedElementWithName("rule")); // (the kernel takes them as arguments)
+    this->probe_set.ReadFromXML(source_xml->FindNestedElementWithName("probes"));
 
     // TODO: copy starting pattern?
 }
 
 // ---------------------------------------------------------------------------------------------------------
 
+FullKernelOpenCLImageRD::~FullKernelOpenCLImageRD()
+{
+    this->ReleasePipeline();
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+void FullKernelOpenCLImageRD::ReleasePipeline()
+{
+    for(size_t i=0;i<this->pass_kernels.size();i++)
+        clReleaseKernel(this->pass_kernels[i]);
+    this->pass_kernels.clear();
+    for(size_t i=0;i<this->scratch_mem.size();i++)
+        clReleaseMemObject(this->scratch_mem[i]);
+    this->scratch_mem.clear();
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
 string FullKernelOpenCLImageRD::AssembleKernelSourceFromFormula(std::string formula) const
 {
-    return formula; // here the formula is a full OpenCL kernel
+    // here the formula is a full OpenCL kernel, to which we add the neighborhood mean functions if it uses them
+    const vector<int> sat_chemicals = this->FindSummedAreaTableArguments(formula);
+    if(!sat_chemicals.empty())
+        return this->GetSummedAreaTableSource(sat_chemicals,this->wrap) + "\n" + formula;
+    return formula;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+std::vector<int> FullKernelOpenCLImageRD::FindSummedAreaTableArguments(const std::string& kernel) const
+{
+    vector<int> chemicals;
+    for(int iC=0;iC<this->GetNumberOfChemicals();iC++)
+    {
+        // look for sat_a as a whole word
+        const string name = "sat_" + GetChemicalName(iC);
+        for(size_t pos = kernel.find(name); pos != string::npos; pos = kernel.find(name,pos+1))
+        {
+            const size_t end = pos + name.length();
+            if( (pos==0 || !(isalnum(kernel[pos-1]) || kernel[pos-1]=='_'))
+                && (end==kernel.length() || !(isalnum(kernel[end]) || kernel[end]=='_')) )
+            {
+                chemicals.push_back(iC);
+                break;
+            }
+        }
+    }
+    return chemicals;
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -91,6 +148,67 @@ void FullKernelOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &war
     // number_of_chemicals:
     read_required_attribute(xml_kernel,"number_of_chemicals",this->n_chemicals);
 
+    // pipeline: (optional)
+    this->passes.clear();
+    this->scratch_buffers.clear();
+    vtkSmartPointer<vtkXMLDataElement> xml_pipeline = rule->FindNestedElementWithName("pipeline");
+    if(xml_pipeline)
+    {
+        for(int i=0;i<xml_pipeline->GetNumberOfNestedElements();i++)
+        {
+            vtkXMLDataElement *node = xml_pipeline->GetNestedElement(i);
+            if(string(node->GetName())=="buffer")
+            {
+                ScratchBuffer buffer;
+                read_required_attribute(node,"name",buffer.name);
+                read_required_attribute(node,"values_per_cell",buffer.values_per_cell);
+                buffer.downsample = 1;
+                if(node->GetAttribute("downsample"))
+                    read_required_attribute(node,"downsample",buffer.downsample);
+                if(buffer.values_per_cell<1 || buffer.downsample<1)
+                    throw runtime_error("pipeline buffer "+buffer.name+" : values_per_cell and downsample must be at least 1");
+                this->scratch_buffers.push_back(buffer);
+            }
+            else if(string(node->GetName())=="pass")
+            {
+                KernelPass pass;
+                read_required_attribute(node,"kernel",pass.kernel_name);
+                string arguments;
+                read_required_attribute(node,"arguments",arguments);
+                istringstream iss(arguments);
+                string arg;
+                while(iss >> arg)
+                    pass.arguments.push_back(arg);
+                pass.downsample = 1;
+                if(node->GetAttribute("downsample"))
+                    read_required_attribute(node,"downsample",pass.downsample);
+                if(pass.downsample<1)
+                    throw runtime_error("pipeline pass "+pass.kernel_name+" : downsample must be at least 1");
+                this->passes.push_back(pass);
+            }
+            else
+                throw runtime_error("pipeline : unexpected element: "+string(node->GetName()));
+        }
+        // check the argument names now rather than when running
+        const vector<string> auxiliary_names = this->GetAuxiliaryArgumentNames();
+        for(size_t ip=0;ip<this->passes.size();ip++)
+        {
+            for(size_t ia=0;ia<this->passes[ip].arguments.size();ia++)
+            {
+                const string& arg = this->passes[ip].arguments[ia];
+                bool found = false;
+                for(int ic=0;ic<this->n_chemicals && !found;ic++)
+                    found = ( arg==GetChemicalName(ic)+"_in" || arg==GetChemicalName(ic)+"_out" || arg=="sat_"+GetChemicalName(ic) );
+                for(size_t ib=0;ib<this->scratch_buffers.size() && !found;ib++)
+                    found = ( arg==this->scratch_buffers[ib].name );
+                found = found || find(auxiliary_names.begin(),auxiliary_names.end(),arg) != auxiliary_names.end();
+                if(!found)
+                    throw runtime_error("pipeline pass "+this->passes[ip].kernel_name+" : unknown argument: "+arg);
+            }
+        }
+    }
+    this->need_reload_formula = true;
+
     // do this last, because it requires everything else to be set up first
     this->TestFormula(formula); // will throw on error but won't set
     this->SetFormula(formula); // will set but won't throw
@@ -116,7 +234,166 @@ vtkSmartPointer<vtkXMLDataElement> FullKernelOpenCLImageRD::GetAsXML(bool genera
 	kernel->SetCharacterData(f.c_str(), (int)f.length());
     rule->AddNestedElement(kernel);
 
+    if(!this->passes.empty())
+    {
+        vtkSmartPointer<vtkXMLDataElement> pipeline = vtkSmartPointer<vtkXMLDataElement>::New();
+        pipeline->SetName("pipeline");
+        for(size_t ib=0;ib<this->scratch_buffers.size();ib++)
+        {
+            vtkSmartPointer<vtkXMLDataElement> buffer = vtkSmartPointer<vtkXMLDataElement>::New();
+            buffer->SetName("buffer");
+            buffer->SetAttribute("name",this->scratch_buffers[ib].name.c_str());
+            buffer->SetIntAttribute("values_per_cell",this->scratch_buffers[ib].values_per_cell);
+            if(this->scratch_buffers[ib].downsample != 1)
+                buffer->SetIntAttribute("downsample",this->scratch_buffers[ib].downsample);
+            pipeline->AddNestedElement(buffer);
+        }
+        for(size_t ip=0;ip<this->passes.size();ip++)
+        {
+            vtkSmartPointer<vtkXMLDataElement> pass = vtkSmartPointer<vtkXMLDataElement>::New();
+            pass->SetName("pass");
+            pass->SetAttribute("kernel",this->passes[ip].kernel_name.c_str());
+            string arguments;
+            for(size_t ia=0;ia<this->passes[ip].arguments.size();ia++)
+                arguments += (ia>0?" ":"") + this->passes[ip].arguments[ia];
+            pass->SetAttribute("arguments",arguments.c_str());
+            if(this->passes[ip].downsample != 1)
+                pass->SetIntAttribute("downsample",this->passes[ip].downsample);
+            pipeline->AddNestedElement(pass);
+        }
+        rule->AddNestedElement(pipeline);
+    }
+
     return rd;
 }
 
 // ---------------------------------------------------------------------------------------------------------
+
+cl_mem FullKernelOpenCLImageRD::GetPassArgument(const string& name) const
+{
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+    {
+        if(name==GetChemicalName(ic)+"_in")
+            return this->buffers[this->iCurrentBuffer][ic];
+        if(name==GetChemicalName(ic)+"_out")
+            return this->buffers[1-this->iCurrentBuffer][ic];
+    }
+    for(size_t i=0;i<this->sat_chemicals.size();i++)
+        if(name=="sat_"+GetChemicalName(this->sat_chemicals[i]))
+            return this->sat_buffers[i];
+    for(size_t ib=0;ib<this->scratch_buffers.size();ib++)
+        if(name==this->scratch_buffers[ib].name)
+            return this->scratch_mem[ib];
+    const vector<string> auxiliary_names = this->GetAuxiliaryArgumentNames();
+    const vector<cl_mem> auxiliary_buffers = this->GetAuxiliaryArgumentBuffers();
+    for(size_t i=0;i<auxiliary_names.size();i++)
+        if(name==auxiliary_names[i])
+            return auxiliary_buffers[i];
+    throw runtime_error("FullKernelOpenCLImageRD::GetPassArgument : unknown argument: "+name);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+void FullKernelOpenCLImageRD::ReloadKernelIfNeeded()
+{
+    if(!this->need_reload_formula) return;
+
+    this->ReleasePipeline();
+    if(this->passes.empty())
+    {
+        OpenCLImageRD::ReloadKernelIfNeeded();
+        return;
+    }
+
+    if(this->interleaved_chemicals || this->activity_tolerance > 0.0f || this->refinement_threshold > 0.0f)
+        throw runtime_error("FullKernelOpenCLImageRD::ReloadKernelIfNeeded : a pipeline needs separate chemicals, "
+            "no activity tolerance and no refinement");
+
+    this->BuildProgram();
+
+    // create a kernel for each pass (the same kernel may appear in several passes)
+    cl_int ret;
+    for(size_t ip=0;ip<this->passes.size();ip++)
+    {
+        this->pass_kernels.push_back(clCreateKernel(this->program,this->passes[ip].kernel_name.c_str(),&ret));
+        throwOnError(ret,("FullKernelOpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed for "+this->passes[ip].kernel_name+": ").c_str());
+
+        // each pass sets exactly the listed arguments, so they must match the kernel's (else it would only fail at launch)
+        cl_uint n_args;
+        ret = clGetKernelInfo(this->pass_kernels[ip],CL_KERNEL_NUM_ARGS,sizeof(n_args),&n_args,NULL);
+        throwOnError(ret,"FullKernelOpenCLImageRD::ReloadKernelIfNeeded : clGetKernelInfo failed: ");
+        if(n_args != this->passes[ip].arguments.size())
+        {
+            ostringstream oss;
+            oss << "FullKernelOpenCLImageRD::ReloadKernelIfNeeded : pipeline pass " << ip+1 << " gives " << this->passes[ip].arguments.size()
+                << " arguments but kernel " << this->passes[ip].kernel_name << " takes " << n_args;
+            throw runtime_error(oss.str());
+        }
+    }
+
+    this->global_range[0] = max(1,vtkMath::Round(this->GetX()) / this->GetBlockSizeX());
+    this->global_range[1] = max(1,vtkMath::Round(this->GetY()) / this->GetBlockSizeY());
+    this->global_range[2] = max(1,vtkMath::Round(this->GetZ()) / this->GetBlockSizeZ());
+
+    // create the scratch buffers (their contents are left to the kernels)
+    for(size_t ib=0;ib<this->scratch_buffers.size();ib++)
+    {
+        const int ds = this->scratch_buffers[ib].downsample;
+        const size_t n_cells = (size_t)( (this->GetX()+ds-1)/ds ) * ( (this->GetY()+ds-1)/ds ) * ( (this->GetZ()+ds-1)/ds );
+        const size_t size = n_cells * this->scratch_buffers[ib].values_per_cell * this->data_type_size;
+        this->scratch_mem.push_back(clCreateBuffer(this->context,CL_MEM_READ_WRITE,size,NULL,&ret));
+        throwOnError(ret,("FullKernelOpenCLImageRD::ReloadKernelIfNeeded : buffer creation failed for "+this->scratch_buffers[ib].name+": ").c_str());
+    }
+
+    this->CreateSummedAreaTables();
+
+    this->need_reload_formula = false;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+void FullKernelOpenCLImageRD::InternalUpdate(int n_steps)
+{
+    if(this->passes.empty() || this->IsSplitIntoSlabs())
+    {
+        OpenCLImageRD::InternalUpdate(n_steps); // (which reports that full kernels can't be split into slabs)
+        return;
+    }
+
+    this->ReloadContextIfNeeded();
+    this->ReloadKernelIfNeeded();
+    this->WriteToOpenCLBuffersIfNeeded();
+    this->SetProbesOnDeviceIfNeeded();
+    this->SetSpaceTimeHistoryOnDeviceIfNeeded();
+
+    // the command queue is in-order, so each pass sees the results of the one before without the host waiting
+    cl_int ret;
+    for(int it=0;it<n_steps;it++)
+    {
+        this->ComputeSummedAreaTables();
+        for(size_t ip=0;ip<this->passes.size();ip++)
+        {
+            const KernelPass& pass = this->passes[ip];
+            for(size_t ia=0;ia<pass.arguments.size();ia++)
+            {
+                cl_mem buffer = this->GetPassArgument(pass.arguments[ia]);
+                ret = clSetKernelArg(this->pass_kernels[ip], (cl_uint)ia, sizeof(cl_mem), &buffer);
+                throwOnError(ret,"FullKernelOpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
+            }
+            size_t range[3];
+            for(int i=0;i<3;i++)
+                range[i] = max((size_t)1,(this->global_range[i]+pass.downsample-1)/pass.downsample);
+            ret = clEnqueueNDRangeKernel(this->command_queue,this->pass_kernels[ip], 3, NULL, range, NULL, 0, NULL, NULL);
+            throwOnError(ret,"FullKernelOpenCLImageRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
+        }
+        this->iCurrentBuffer = 1 - this->iCurrentBuffer;
+        if(this->HasProbes() && (this->timesteps_taken+it+1) % this->probe_set.GetInterval() == 0)
+            this->GatherProbesOnDevice(this->timesteps_taken+it+1,this->probe_record_timesteps,this->probe_record_values);
+        if(this->space_time_rows > 0)
+            this->RecordSpaceTimeRowOnDevice();
+    }
+
+    this->ReadFromOpenCLBuffers();
+}
+
+// ---------------------------------------------------------------------------------------------------------
@@ -18,6 +18,10 @@
 // local:
 #include "OpenCLImageRD.hpp"
 
+// STL:
+#include <string>
+#include <vector>
+
 /// An RD system that uses an OpenCL program.
 /** An N-dimensional (1D,2D,3D) OpenCL RD implementations with n chemicals
   * specified as a full OpenCL kernel, for maximum flexibility */
@@ -27,6 +31,7 @@ class FullKernelOpenCLImageRD : public OpenCLImageRD
 
         FullKernelOpenCLImageRD(int opencl_platform,int opencl_device,int data_type);
         FullKernelOpenCLImageRD(const OpenCLImageRD& source); // copy construct from another
+        virtual ~FullKernelOpenCLImageRD();
 
         virtual void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update);
         virtual vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const;
@@ -45,7 +50,45 @@ class FullKernelOpenCLImageRD : public OpenCLImageRD
         
         virtual bool HasEditableDataType() const { return false; }
 
+protected:
+
+        /// Builds every kernel of the pipeline, if there is one, and makes its scratch buffers.
+        virtual void ReloadKernelIfNeeded();
+
+        /// Enqueues the passes of the pipeline in order for each timestep, with no waiting on the host in between.
+        virtual void InternalUpdate(int n_steps);
+
+        void ReleasePipeline();
+
+        /// Returns the buffer that a pass argument names: a_in, a_out, ..., sat_a, ..., a scratch buffer or an auxiliary buffer. Throws if unknown.
+        cl_mem GetPassArgument(const std::string& name) const;
+
+        /// Returns the chemicals whose summed-area tables the kernel takes as arguments: sat_a, etc.
+        std::vector<int> FindSummedAreaTableArguments(const std::string& kernel) const;
+        virtual std::vector<int> GetSummedAreaTableChemicals() const { return this->FindSummedAreaTableArguments(this->formula); }
+
 protected:
     
         int block_size[3];
+
+        /// One kernel launch in the pipeline of a timestep.
+        struct KernelPass
+        {
+            std::string kernel_name;
+            std::vector<std::string> arguments;    ///< the buffers to pass, in order
+            int downsample;                         ///< the pass runs over the image shrunk by this factor along each axis
+        };
+
+        /// A buffer on the device for passing values between the kernels of the pipeline.
+        struct ScratchBuffer
+        {
+            std::string name;
+            int values_per_cell;
+            int downsample;                         ///< the buffer covers the image shrunk by this factor along each axis
+        };
+
+        std::vector<KernelPass> passes;             ///< run in this order each timestep; if empty then just rd_compute is run
+        std::vector<ScratchBuffer> scratch_buffers;
+        std::vector<cl_kernel> pass_kernels;
+        std::vector<cl_mem> scratch_mem;
 };
@@ -50,7 +50,9 @@ FullKernelOpenCLMeshRD::FullKernelOpenCLMeshRD(const OpenCLMeshRD& source)
     this->SetRuleName(source.GetRuleName());
     this->SetDescription(source.GetDescription());
 
-    this->initial_pattern_generator.ReadFromXML(source.GetAsXML(false)->FindNestedElementWithName("initial_pattern_generator"));
+    vtkSmartPointer<vtkXMLDataElement> source_xml = source.GetAsXML(false);
+    this->initial_pattern_generator.ReadFromXML(source_xml->FindNestedElementWithName("initial_pattern_generator"));
+    this->probe_set.ReadFromXML(source_xml->FindNestedElementWithName("probes"));
 
     // TODO: copy starting pattern?
 }
@@ -17,7 +17,10 @@
 
 // local:
 #include "ImageRD.hpp"
+#include "BlockContourFilter.hpp"
+#include "CellMemory.hpp"
 #include "IO_XML.hpp"
+#include "MeshVoxelizer.hpp"
 #include "overlays.hpp"
 #include "Properties.hpp"
 #include "scene_items.hpp"
@@ -40,7 +43,6 @@ using namespace std;
 #include <vtkCaptionActor2D.h>
 #include <vtkCellData.h>
 #include <vtkCellDataToPointData.h>
-#include <vtkContourFilter.h>
 #include <vtkCubeAxesActor2D.h>
 #include <vtkCubeSource.h>
 #include <vtkCutter.h>
@@ -56,7 +58,6 @@ using namespace std;
 #include <vtkImageMapper.h>
 #include <vtkImageMirrorPad.h>
 #include <vtkImageReslice.h>
-#include <vtkImageStencil.h>
 #include <vtkImageThreshold.h>
 #include <vtkImageToStructuredPoints.h>
 #include <vtkImageWrapPad.h>
@@ -72,7 +73,6 @@ using namespace std;
 #include <vtkPointSource.h>
 #include <vtkPolyDataMapper.h>
 #include <vtkPolyDataNormals.h>
-#include <vtkPolyDataToImageStencil.h>
 #include <vtkProperty.h>
 #include <vtkProperty2D.h>
 #include <vtkRearrangeFields.h>
@@ -84,9 +84,9 @@ using namespace std;
 #include <vtkTextActor.h>
 #include <vtkTextProperty.h>
 #include <vtkTextureMapToPlane.h>
-#include <vtkThreshold.h>
 #include <vtkTransform.h>
 #include <vtkTransformFilter.h>
+#include <vtkTriangleFilter.h>
 #include <vtkUnstructuredGrid.h>
 #include <vtkVertexGlyphFilter.h>
 #include <vtkWarpScalar.h>
@@ -105,6 +105,11 @@ ImageRD::ImageRD(int data_type)
     this->starting_pattern = vtkImageData::New();
     this->assign_attribute_filter = NULL;
     this->rearrange_fields_filter = NULL;
+    this->iDisplayedChemical = -1;
+    this->space_time_rows = 0;
+    this->space_time_chemical = 0;
+    this->space_time_next_row = 0;
+    this->space_time_n_rows = 0;
 }
 
 // ---------------------------------------------------------------------
@@ -140,6 +145,16 @@ int ImageRD::GetArenaDimensionality() const
 
 // ---------------------------------------------------------------------
 
+bool ImageRD::IsShowingMultipleChemicals(const Properties& render_settings) const
+{
+    if(!render_settings.GetProperty("show_multiple_chemicals").GetBool())
+        return false;
+    // the fast display of a 2D image only draws the active chemical
+    return !(render_settings.GetProperty("use_fast_display").GetBool() && this->GetArenaDimensionality()==2);
+}
+
+// ---------------------------------------------------------------------
+
 float ImageRD::GetX() const
 {
     return this->images.front()->GetDimensions()[0];
@@ -239,47 +254,55 @@ void ImageRD::CopyFromMesh(
     const size_t target_chemical,
     const size_t largest_dimension,
     const float value_inside,
-    const float value_outside)
+    const float value_outside,
+    const bool anti_alias)
 {
     // decide the size of the image
     mesh->ComputeBounds();
     double bounds[6];
     mesh->GetBounds(bounds);
     const double mesh_size[3] = { bounds[1] - bounds[0], bounds[3] - bounds[2], bounds[5] - bounds[4] };
-    const float max_mesh_size = std::max(mesh_size[0], std::max(mesh_size[1], mesh_size[2]));
-    const float scale = (largest_dimension-1) / max_mesh_size;
+    const double max_mesh_size = std::max(mesh_size[0], std::max(mesh_size[1], mesh_size[2]));
+    if(max_mesh_size <= 0.0)
+        throw runtime_error("ImageRD::CopyFromMesh : mesh has zero size");
+    const double scale = (largest_dimension-1) / max_mesh_size;
+    const int block_size[3] = { this->GetBlockSizeX(), this->GetBlockSizeY(), this->GetBlockSizeZ() };
     int image_size[3];
     for(size_t xyz = 0; xyz < 3; ++xyz)
     {
-        image_size[xyz] = 1;
-        while( image_size[xyz] < mesh_size[xyz] * scale )
+        image_size[xyz] = 1 + (int)ceil(mesh_size[xyz] * scale - 1e-6); // exactly big enough
+        image_size[xyz] = block_size[xyz] * ((image_size[xyz] + block_size[xyz] - 1) / block_size[xyz]);
+        if(this->GetRuleType()=="formula")
         {
-            image_size[xyz] <<= 1;
+            // for wrap-around in OpenCL the formula rules require all the dimensions to be powers of 2
+            int power_of_2 = 1;
+            while(power_of_2 < image_size[xyz])
+                power_of_2 <<= 1;
+            image_size[xyz] = power_of_2;
         }
     }
     AllocateImages(image_size[0], image_size[1], image_size[2], num_chemicals, this->GetDataType());
     BlankImage(value_outside);
 
-    // write data into the image
+    // get the surface of the mesh in the coordinates of the image, with each pixel centered on its index
     vtkSmartPointer<vtkTransform> transform = vtkSmartPointer<vtkTransform>::New();
     transform->PostMultiply();
     transform->Translate(-(bounds[0] + bounds[1]) / 2.0, -(bounds[2] + bounds[3]) / 2.0, -(bounds[4] + bounds[5]) / 2.0); // center at origin
     transform->Scale(scale, scale, scale);
-    transform->Translate(image_size[0] / 2, image_size[1] / 2, image_size[2] / 2); // center in volume
+    transform->Translate((image_size[0] - 1) / 2.0, (image_size[1] - 1) / 2.0, (image_size[2] - 1) / 2.0); // center in volume
     vtkSmartPointer<vtkTransformFilter> transform_filter = vtkSmartPointer<vtkTransformFilter>::New();
     transform_filter->SetTransform(transform);
     transform_filter->SetInputData(mesh);
     vtkSmartPointer<vtkGeometryFilter> get_surface = vtkSmartPointer<vtkGeometryFilter>::New();
     get_surface->SetInputConnection(transform_filter->GetOutputPort());
-    vtkSmartPointer<vtkPolyDataToImageStencil> pol2stenc = vtkSmartPointer<vtkPolyDataToImageStencil>::New();
-    pol2stenc->SetInputConnection(get_surface->GetOutputPort());
-    vtkSmartPointer<vtkImageStencil> imgstenc = vtkSmartPointer<vtkImageStencil>::New();
-    imgstenc->SetInputData(this->images[target_chemical]);
-    imgstenc->SetStencilConnection(pol2stenc->GetOutputPort());
-    imgstenc->ReverseStencilOn();
-    imgstenc->SetBackgroundValue(value_inside);
-    imgstenc->Update();
-    this->images[target_chemical]->DeepCopy(imgstenc->GetOutput());
+    vtkSmartPointer<vtkTriangleFilter> triangulate = vtkSmartPointer<vtkTriangleFilter>::New();
+    triangulate->SetInputConnection(get_surface->GetOutputPort());
+    triangulate->Update();
+
+    // write the inside of the surface straight into the target chemical
+    MeshVoxelizer voxelizer(triangulate->GetOutput(), anti_alias);
+    voxelizer.Voxelize(this->images[target_chemical], value_inside, value_outside);
+    this->images[target_chemical]->Modified();
 }
 
 // ---------------------------------------------------------------------
@@ -293,6 +316,8 @@ void ImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
         this->images[i] = AllocateVTKImage(x,y,z,data_type);
     this->is_modified = true;
     this->undo_stack.clear();
+    this->need_resolve_probes = true;
+    this->SetSpaceTimeHistory(0,0); // (the pipeline will start it again if it is wanted)
 }
 
 // ---------------------------------------------------------------------
@@ -303,13 +328,17 @@ void ImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
     assert(im);
     #if VTK_MAJOR_VERSION >= 6
         im->SetDimensions(x,y,z);
-        im->AllocateScalars(data_type,1);
     #else
         im->SetNumberOfScalarComponents(1);
         im->SetScalarType(data_type);
         im->SetDimensions(x,y,z);
-        im->AllocateScalars();
     #endif
+    // (rather than AllocateScalars, so that the memory is spread over the NUMA nodes as the threads will use it)
+    vtkSmartPointer<vtkDataArray> scalars = vtkSmartPointer<vtkDataArray>::Take(vtkDataArray::CreateDataArray(data_type));
+    scalars->SetNumberOfComponents(1);
+    CellMemory::Allocate(scalars,vtkIdType(x)*y*z);
+    scalars->SetName("ImageScalars"); // (as AllocateScalars would, since the render pipeline looks the array up by name)
+    im->GetPointData()->SetScalars(scalars);
     if(im->GetDimensions()[0]!=x || im->GetDimensions()[1]!=y || im->GetDimensions()[2]!=z)
         throw runtime_error("ImageRD::AllocateVTKImage : Failed to allocate image data - dimensions too big?");
     return im;
@@ -354,6 +383,7 @@ void ImageRD::GenerateInitialPattern()
     for(int i=0;i<(int)this->images.size();i++)
         this->images[i]->Modified();
     this->timesteps_taken = 0;
+    this->ResetSpaceTimeHistory();
 }
 
 // ---------------------------------------------------------------------
@@ -367,6 +397,7 @@ void ImageRD::BlankImage(float value)
     }
     this->timesteps_taken = 0;
     this->undo_stack.clear();
+    this->ResetSpaceTimeHistory();
 }
 
 // ---------------------------------------------------------------------
@@ -374,9 +405,19 @@ void ImageRD::BlankImage(float value)
 void ImageRD::Update(int n_steps)
 {
     this->undo_stack.clear();
-    this->InternalUpdate(n_steps);
-
-    this->timesteps_taken += n_steps;
+    if(this->space_time_rows > 0 && !this->RecordsSpaceTimeOnDevice())
+    {
+        // the image only holds the latest step, so we take them one at a time
+        for(int it=0;it<n_steps;it++)
+        {
+            this->InternalUpdateAndRecordProbes(1);
+            this->RecordSpaceTimeRowFromHost();
+        }
+    }
+    else
+        this->InternalUpdateAndRecordProbes(n_steps);
+    if(this->space_time_rows > 0)
+        this->UpdateSpaceTimeImage();
 
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
         this->images[ic]->Modified();
@@ -397,6 +438,14 @@ void ImageRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties&
 {
     this->rearrange_fields_filter = NULL;
     this->assign_attribute_filter = NULL;
+    this->iDisplayedChemical = -1;
+
+    // only 1D arenas have a space-time plot
+    if(this->GetArenaDimensionality()==1 && render_settings.GetProperty("show_space_time_plot").GetBool())
+        this->SetSpaceTimeHistory(render_settings.GetProperty("space_time_plot_rows").GetInt(),
+            IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical()));
+    else
+        this->SetSpaceTimeHistory(0,0);
 
     switch(this->GetArenaDimensionality())
     {
@@ -509,6 +558,39 @@ void ImageRD::InitializeVTKPipeline_1D(vtkRenderer* pRenderer,const Properties&
         }
     }
 
+    // add the space-time plot below the strips, the oldest step at the top
+    if(this->space_time_rows > 0)
+    {
+        vtkSmartPointer<vtkImageMapToColors> image_mapper = vtkSmartPointer<vtkImageMapToColors>::New();
+        image_mapper->SetLookupTable(lut);
+        #if VTK_MAJOR_VERSION >= 6
+            image_mapper->SetInputData(this->space_time_image);
+        #else
+            image_mapper->SetInput(this->space_time_image);
+        #endif
+
+        const float image_height = this->GetX() / this->image_ratio1D;
+        const float plot_top = this->image_top1D - image_height * 2.0f * (iLastChem - iFirstChem);
+        vtkSmartPointer<vtkPlaneSource> plane = vtkSmartPointer<vtkPlaneSource>::New();
+        plane->SetOrigin(0,plot_top-this->GetX(),0);
+        plane->SetPoint1(this->GetX(),plot_top-this->GetX(),0);
+        plane->SetPoint2(0,plot_top,0);
+
+        vtkSmartPointer<vtkTexture> texture = vtkSmartPointer<vtkTexture>::New();
+        texture->SetInputConnection(image_mapper->GetOutputPort());
+        if(use_image_interpolation)
+            texture->InterpolateOn();
+        vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+        mapper->SetInputConnection(plane->GetOutputPort());
+
+        vtkSmartPointer<vtkActor> actor = vtkSmartPointer<vtkActor>::New();
+        actor->SetMapper(mapper);
+        actor->SetTexture(texture);
+        actor->GetProperty()->LightingOff();
+        actor->PickableOff();
+        pRenderer->AddActor(actor);
+    }
+
     // also add a scalar bar to show how the colors correspond to values
     if(show_color_scale)
     {
@@ -585,7 +667,7 @@ void ImageRD::InitializeVTKPipeline_2D(vtkRenderer* pRenderer,const Properties&
     bool use_wireframe = render_settings.GetProperty("use_wireframe").GetBool();
     float surface_r,surface_g,surface_b;
     render_settings.GetProperty("surface_color").GetColor(surface_r,surface_g,surface_b);
-    bool show_multiple_chemicals = render_settings.GetProperty("show_multiple_chemicals").GetBool();
+    bool show_multiple_chemicals = this->IsShowingMultipleChemicals(render_settings);
     bool show_displacement_mapped_surface = render_settings.GetProperty("show_displacement_mapped_surface").GetBool();
     bool show_color_scale = render_settings.GetProperty("show_color_scale").GetBool();
     bool color_displacement_mapped_surface = render_settings.GetProperty("color_displacement_mapped_surface").GetBool();
@@ -595,6 +677,16 @@ void ImageRD::InitializeVTKPipeline_2D(vtkRenderer* pRenderer,const Properties&
     int iPhasePlotX = IndexFromChemicalName(render_settings.GetProperty("phase_plot_x_axis").GetChemical());
     int iPhasePlotY = IndexFromChemicalName(render_settings.GetProperty("phase_plot_y_axis").GetChemical());
     int iPhasePlotZ = IndexFromChemicalName(render_settings.GetProperty("phase_plot_z_axis").GetChemical());
+    bool use_fast_display = render_settings.GetProperty("use_fast_display").GetBool();
+
+    if(use_fast_display)
+    {
+        // only the active chemical is shown, as a flat color-mapped texture - nothing else needs the other chemicals
+        // (IsShowingMultipleChemicals already says so)
+        show_displacement_mapped_surface = false;
+        show_phase_plot = false;
+        this->iDisplayedChemical = iActiveChemical;
+    }
     
     float scaling = vertical_scale_2D / (high-low); // vertical_scale gives the height of the graph in worldspace units
 
@@ -633,7 +725,20 @@ void ImageRD::InitializeVTKPipeline_2D(vtkRenderer* pRenderer,const Properties&
         plane->SetPoint2(0,this->GetY(),0);
 
         vtkSmartPointer<vtkTexture> texture = vtkSmartPointer<vtkTexture>::New();
-        texture->SetInputConnection(image_mapper->GetOutputPort());
+        if(use_fast_display)
+        {
+            // hand the float image straight to the texture, which maps it through the lookup table as it
+            // is loaded onto the graphics card - no RGB image is made and no filter is re-executed each frame
+            #if VTK_MAJOR_VERSION >= 6
+                texture->SetInputData(this->GetImage(iChem));
+            #else
+                texture->SetInput(this->GetImage(iChem));
+            #endif
+            texture->SetLookupTable(lut);
+            texture->MapColorScalarsThroughLookupTableOn();
+        }
+        else
+            texture->SetInputConnection(image_mapper->GetOutputPort());
         if(use_image_interpolation)
             texture->InterpolateOn();
         vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
@@ -821,74 +926,23 @@ void ImageRD::InitializeVTKPipeline_3D(vtkRenderer* pRenderer,const Properties&
     vtkImageData *image = this->GetImage(iActiveChemical);
     int *extent = image->GetExtent();
 
-    // we first convert the image from point data to cell data, to match the users expectations
-
-    vtkSmartPointer<vtkImageWrapPad> pad = vtkSmartPointer<vtkImageWrapPad>::New();
+    // turns the 3d grid of sampled values into a polygon mesh for rendering, by making a surface that
+    // contours the volume at a specified level, or (if not interpolating) as cubes, Minecraft-style
+    // - blocks of the volume are worked on in parallel and only re-extracted if their values changed
+    vtkSmartPointer<BlockContourFilter> surface = vtkSmartPointer<BlockContourFilter>::New();
     #if VTK_MAJOR_VERSION >= 6
-        pad->SetInputData(image);
+        surface->SetInputData(image);
     #else
-        pad->SetInput(image);
+        surface->SetInput(image);
     #endif
-    pad->SetOutputWholeExtent(extent[0],extent[1]+1,extent[2],extent[3]+1,extent[4],extent[5]+1);
-
-    // move the pixel values (stored in the point data) to cell data
-    vtkSmartPointer<vtkRearrangeFields> prearrange_fields = vtkSmartPointer<vtkRearrangeFields>::New();
-    #if VTK_MAJOR_VERSION >= 6
-        prearrange_fields->SetInputData(image);
-    #else
-        prearrange_fields->SetInput(image);
-    #endif
-    prearrange_fields->AddOperation(vtkRearrangeFields::MOVE,vtkDataSetAttributes::SCALARS,
-        vtkRearrangeFields::POINT_DATA,vtkRearrangeFields::CELL_DATA);
-
-    // get the image scalars name from the first array
-    prearrange_fields->Update();
-    const char *scalars_array_name = prearrange_fields->GetOutput()->GetCellData()->GetArray(0)->GetName();
-
-    // mark the new cell data array as the active attribute
-    vtkSmartPointer<vtkAssignAttribute> assign_attribute = vtkSmartPointer<vtkAssignAttribute>::New();
-    assign_attribute->SetInputConnection(prearrange_fields->GetOutputPort());
-    assign_attribute->Assign(scalars_array_name, vtkDataSetAttributes::SCALARS, vtkAssignAttribute::CELL_DATA);
-
-    // save the filters so we can perform a manual update step on the pipeline in Update() (TODO: work out how to do this properly)
-    this->rearrange_fields_filter = prearrange_fields;
-    this->assign_attribute_filter = assign_attribute;
-
-    vtkSmartPointer<vtkMergeFilter> merge_datasets = vtkSmartPointer<vtkMergeFilter>::New();
-    merge_datasets->SetGeometryConnection(pad->GetOutputPort());
-    merge_datasets->SetScalarsConnection(assign_attribute->GetOutputPort());
-
-    vtkSmartPointer<vtkCellDataToPointData> to_point_data = vtkSmartPointer<vtkCellDataToPointData>::New(); // (only used if needed)
-    to_point_data->SetInputConnection(merge_datasets->GetOutputPort());
-
-    if(use_image_interpolation)
-    {
-        // turns the 3d grid of sampled values into a polygon mesh for rendering,
-        // by making a surface that contours the volume at a specified level    
-        vtkSmartPointer<vtkContourFilter> surface = vtkSmartPointer<vtkContourFilter>::New();
-        surface->SetInputConnection(to_point_data->GetOutputPort());
-        surface->SetValue(0,contour_level);
-        mapper->SetInputConnection(surface->GetOutputPort());
-        mapper->ScalarVisibilityOff();
-    }
-    else
-    {
-        // render as cubes, Minecraft-style
-        vtkSmartPointer<vtkThreshold> threshold = vtkSmartPointer<vtkThreshold>::New();
-        threshold->SetInputConnection(merge_datasets->GetOutputPort());
-        threshold->SetInputArrayToProcess(0, 0, 0,
-            vtkDataObject::FIELD_ASSOCIATION_CELLS,
-            vtkDataSetAttributes::SCALARS);
-        threshold->ThresholdByUpper(contour_level);
-
-        vtkSmartPointer<vtkGeometryFilter> geometry = vtkSmartPointer<vtkGeometryFilter>::New();
-        geometry->SetInputConnection(threshold->GetOutputPort());
-
-        mapper->SetInputConnection(geometry->GetOutputPort());
-    }
+    surface->SetValue(contour_level);
+    surface->SetGenerateCubes(!use_image_interpolation);
+    mapper->SetInputConnection(surface->GetOutputPort());
+    mapper->ScalarVisibilityOff();
 
     vtkSmartPointer<vtkActor> actor = vtkSmartPointer<vtkActor>::New();
     actor->SetMapper(mapper);
+    actor->SetPosition(0.5,0.5,0.5); // the surface is made with pixels centered on integer coordinates
     actor->GetProperty()->SetColor(surface_r,surface_g,surface_b);  
     actor->GetProperty()->SetAmbient(0.1);
     actor->GetProperty()->SetDiffuse(0.5);
@@ -948,6 +1002,47 @@ void ImageRD::InitializeVTKPipeline_3D(vtkRenderer* pRenderer,const Properties&
 	// add a 2D slice too
     if(slice_3D)
     {
+        // the slice is cut from the image converted from point data to cell data, to match the users expectations
+        // (the surface works on the image directly, so when there is no slice this part isn't needed at all)
+
+        vtkSmartPointer<vtkImageWrapPad> pad = vtkSmartPointer<vtkImageWrapPad>::New();
+        #if VTK_MAJOR_VERSION >= 6
+            pad->SetInputData(image);
+        #else
+            pad->SetInput(image);
+        #endif
+        pad->SetOutputWholeExtent(extent[0],extent[1]+1,extent[2],extent[3]+1,extent[4],extent[5]+1);
+
+        // move the pixel values (stored in the point data) to cell data
+        vtkSmartPointer<vtkRearrangeFields> prearrange_fields = vtkSmartPointer<vtkRearrangeFields>::New();
+        #if VTK_MAJOR_VERSION >= 6
+            prearrange_fields->SetInputData(image);
+        #else
+            prearrange_fields->SetInput(image);
+        #endif
+        prearrange_fields->AddOperation(vtkRearrangeFields::MOVE,vtkDataSetAttributes::SCALARS,
+            vtkRearrangeFields::POINT_DATA,vtkRearrangeFields::CELL_DATA);
+
+        // get the image scalars name from the first array
+        prearrange_fields->Update();
+        const char *scalars_array_name = prearrange_fields->GetOutput()->GetCellData()->GetArray(0)->GetName();
+
+        // mark the new cell data array as the active attribute
+        vtkSmartPointer<vtkAssignAttribute> assign_attribute = vtkSmartPointer<vtkAssignAttribute>::New();
+        assign_attribute->SetInputConnection(prearrange_fields->GetOutputPort());
+        assign_attribute->Assign(scalars_array_name, vtkDataSetAttributes::SCALARS, vtkAssignAttribute::CELL_DATA);
+
+        // save the filters so we can perform a manual update step on the pipeline in Update() (TODO: work out how to do this properly)
+        this->rearrange_fields_filter = prearrange_fields;
+        this->assign_attribute_filter = assign_attribute;
+
+        vtkSmartPointer<vtkMergeFilter> merge_datasets = vtkSmartPointer<vtkMergeFilter>::New();
+        merge_datasets->SetGeometryConnection(pad->GetOutputPort());
+        merge_datasets->SetScalarsConnection(assign_attribute->GetOutputPort());
+
+        vtkSmartPointer<vtkCellDataToPointData> to_point_data = vtkSmartPointer<vtkCellDataToPointData>::New(); // (only used if needed)
+        to_point_data->SetInputConnection(merge_datasets->GetOutputPort());
+
         vtkSmartPointer<vtkPlane> plane = vtkSmartPointer<vtkPlane>::New();
         double *bounds = image->GetBounds();
         plane->SetOrigin(slice_3D_position*(bounds[1]-bounds[0])+bounds[0],
@@ -1241,6 +1336,15 @@ int ImageRD::GetNumberOfCells() const
 
 // ---------------------------------------------------------------------
 
+void ImageRD::ComputeStatistics(vector<ChemicalStatistics>& stats,int n_bins)
+{
+    stats.resize(this->GetNumberOfChemicals());
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+        ComputeStatisticsOfValues(this->images[ic]->GetScalarPointer(),this->GetNumberOfCells(),this->data_type,n_bins,stats[ic]);
+}
+
+// ---------------------------------------------------------------------
+
 void ImageRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) const
 {
     bool use_image_interpolation = render_settings.GetProperty("use_image_interpolation").GetBool();
@@ -1292,55 +1396,20 @@ void ImageRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) con
             }
             break;
         case 3:
-            if(use_image_interpolation)
             {
-                // turns the 3d grid of sampled values into a polygon mesh for rendering,
-                // by making a surface that contours the volume at a specified level    
-                vtkSmartPointer<vtkContourFilter> surface = vtkSmartPointer<vtkContourFilter>::New();
+                // turns the 3d grid of sampled values into a polygon mesh, by making a surface that
+                // contours the volume at a specified level, or (if not interpolating) as cubes, Minecraft-style
+                vtkSmartPointer<BlockContourFilter> surface = vtkSmartPointer<BlockContourFilter>::New();
                 #if VTK_MAJOR_VERSION >= 6
                     surface->SetInputData(this->GetImage(iActiveChemical));
                 #else
                     surface->SetInput(this->GetImage(iActiveChemical));
                 #endif
-                surface->SetValue(0, contour_level);
+                surface->SetValue(contour_level);
+                surface->SetGenerateCubes(!use_image_interpolation);
                 surface->Update();
                 out->DeepCopy(surface->GetOutput());
             }
-            else
-            {
-                // render as cubes, Minecraft-style
-                vtkImageData *image = this->GetImage(iActiveChemical);
-                int *extent = image->GetExtent();
-
-                vtkSmartPointer<vtkImageWrapPad> pad = vtkSmartPointer<vtkImageWrapPad>::New();
-                #if VTK_MAJOR_VERSION >= 6
-                    pad->SetInputData(image);
-                #else
-                    pad->SetInput(image);
-                #endif
-                pad->SetOutputWholeExtent(extent[0],extent[1]+1,extent[2],extent[3]+1,extent[4],extent[5]+1);
-                pad->Update();
-                pad->GetOutput()->GetCellData()->SetScalars(image->GetPointData()->GetScalars()); // a non-pipelined operation
-
-                vtkSmartPointer<vtkThreshold> threshold = vtkSmartPointer<vtkThreshold>::New();
-                threshold->SetInputConnection(pad->GetOutputPort());
-                threshold->SetInputArrayToProcess(0, 0, 0,
-                    vtkDataObject::FIELD_ASSOCIATION_CELLS,
-                    vtkDataSetAttributes::SCALARS);
-                threshold->ThresholdByUpper(contour_level);
-
-                vtkSmartPointer<vtkTransform> transform = vtkSmartPointer<vtkTransform>::New();
-                transform->Translate (-.5, -.5, -.5);
-                vtkSmartPointer<vtkTransformFilter> transformModel = vtkSmartPointer<vtkTransformFilter>::New();
-                transformModel->SetTransform(transform);
-                transformModel->SetInputConnection(threshold->GetOutputPort());
-
-                vtkSmartPointer<vtkGeometryFilter> geometry = vtkSmartPointer<vtkGeometryFilter>::New();
-                geometry->SetInputConnection(transformModel->GetOutputPort());
-                geometry->Update();
-
-                out->DeepCopy(geometry->GetOutput());
-            }
             break;
     }
 }
@@ -1485,6 +1554,102 @@ void ImageRD::SetFrom2DImage(int iChemical, vtkImageData *im)
 
 // --------------------------------------------------------------------------------
 
+void ImageRD::FindCellsAtPositions(const vector<double>& positions,vector<int>& cells)
+{
+    const int X = this->images.front()->GetDimensions()[0];
+    const int Y = this->images.front()->GetDimensions()[1];
+    const int Z = this->images.front()->GetDimensions()[2];
+    const int dims[3] = { X, Y, Z };
+    cells.resize(positions.size()/3);
+    for(size_t i=0;i<cells.size();i++)
+    {
+        int p[3];
+        for(int j=0;j<3;j++)
+            p[j] = min(dims[j]-1,max(0,int(floor(positions[i*3+j]*dims[j]))));
+        cells[i] = X*(Y*p[2] + p[1]) + p[0];
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+double ImageRD::GetCellValue(int iChemical,int iCell) const
+{
+    return this->GetImage(iChemical)->GetPointData()->GetScalars()->GetComponent(iCell,0);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::SetSpaceTimeHistory(int n_rows,int iChemical)
+{
+    n_rows = max(0,n_rows);
+    iChemical = min(this->GetNumberOfChemicals()-1,max(0,iChemical));
+    const int N = this->GetNumberOfCells();
+    if(n_rows==this->space_time_rows && iChemical==this->space_time_chemical && this->space_time_ring.size()==size_t(n_rows*N))
+        return;
+
+    this->space_time_rows = n_rows;
+    this->space_time_chemical = iChemical;
+    if(n_rows==0)
+    {
+        this->space_time_ring.clear();
+        this->space_time_image = NULL;
+        this->space_time_next_row = this->space_time_n_rows = 0;
+        return;
+    }
+    this->space_time_ring.assign(size_t(n_rows)*N,0.0);
+    this->space_time_image = vtkSmartPointer<vtkImageData>::Take(AllocateVTKImage(N,n_rows,1,this->data_type));
+    this->ResetSpaceTimeHistory();
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::ResetSpaceTimeHistory()
+{
+    this->space_time_next_row = 0;
+    this->space_time_n_rows = 0;
+    if(this->space_time_image)
+    {
+        this->space_time_image->GetPointData()->GetScalars()->FillComponent(0,0.0);
+        this->space_time_image->Modified();
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::RecordSpaceTimeRowFromHost()
+{
+    vtkDataArray *values = this->GetImage(this->space_time_chemical)->GetPointData()->GetScalars();
+    const int N = this->GetNumberOfCells();
+    double *row = &this->space_time_ring[size_t(this->space_time_next_row)*N];
+    for(int i=0;i<N;i++)
+        row[i] = values->GetComponent(i,0);
+    this->space_time_next_row = (this->space_time_next_row+1) % this->space_time_rows;
+    this->space_time_n_rows = min(this->space_time_rows,this->space_time_n_rows+1);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::UpdateSpaceTimeImage()
+{
+    this->ReadSpaceTimeRing();
+
+    // the oldest row goes at the top (the highest y), so that time runs down the plot
+    const int N = this->GetNumberOfCells();
+    const int R = this->space_time_rows;
+    const int first = (this->space_time_next_row - this->space_time_n_rows + R) % R;
+    vtkDataArray *pixels = this->space_time_image->GetPointData()->GetScalars();
+    for(int k=0;k<this->space_time_n_rows;k++)
+    {
+        const double *row = &this->space_time_ring[size_t((first+k)%R)*N];
+        const vtkIdType offset = vtkIdType(R-1-k)*N;
+        for(int i=0;i<N;i++)
+            pixels->SetComponent(offset+i,0,row[i]);
+    }
+    this->space_time_image->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
 float ImageRD::GetValue(float x,float y,float z,const Properties& render_settings)
 {
     const int X = this->images.front()->GetDimensions()[0];
@@ -1493,7 +1658,7 @@ float ImageRD::GetValue(float x,float y,float z,const Properties& render_setting
 
     // which chemical was clicked-on?
     float offset_x = 0.0f;
-    bool show_multiple_chemicals = render_settings.GetProperty("show_multiple_chemicals").GetBool();
+    bool show_multiple_chemicals = this->IsShowingMultipleChemicals(render_settings);
     int iChemical;
     if(show_multiple_chemicals && this->GetArenaDimensionality()==1)
     {
@@ -1536,7 +1701,7 @@ void ImageRD::SetValue(float x,float y,float z,float val,const Properties& rende
 
     // which chemical was clicked-on?
     float offset_x = 0.0f;
-    bool show_multiple_chemicals = render_settings.GetProperty("show_multiple_chemicals").GetBool();
+    bool show_multiple_chemicals = this->IsShowingMultipleChemicals(render_settings);
     int iChemical;
     if(show_multiple_chemicals && this->GetArenaDimensionality()==1)
     {
@@ -1566,37 +1731,45 @@ void ImageRD::SetValue(float x,float y,float z,float val,const Properties& rende
     iy = min(Y-1,max(0,iy));
     iz = min(Z-1,max(0,iz));
 
-    float old_val = this->GetImage(iChemical)->GetScalarComponentAsFloat(ix,iy,iz,0);
-    int ijk[3] = { ix, iy, iz };
-    vtkIdType iCell = this->GetImage(iChemical)->ComputeCellId(ijk);
-    this->StorePaintAction(iChemical,iCell,old_val);
-    this->GetImage(iChemical)->SetScalarComponentFromFloat(ix,iy,iz,0,val);
-    this->images[iChemical]->Modified();
+    const int box[6] = { ix, ix, iy, iy, iz, iz };
+    vector<double> old_values, new_values(1,val);
+    this->GetRegionValues(iChemical,box,old_values);
+    this->SetRegionValues(iChemical,box,new_values);
+    this->StorePaintAction(iChemical,box,old_values,new_values);
+    this->PaintRegionChanged(iChemical,box);
 }
 
 // --------------------------------------------------------------------------------
 
 void ImageRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
+{
+    this->SetValuesAlongLine(x,y,z,x,y,z,r,val,render_settings);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::SetValuesAlongLine(float x0,float y0,float z0,float x1,float y1,float z1,float r,float val,
+    const Properties& render_settings)
 {
     const int X = this->images.front()->GetDimensions()[0];
     const int Y = this->images.front()->GetDimensions()[1];
     const int Z = this->images.front()->GetDimensions()[2];
 
-    // which chemical was clicked-on?
+    // which chemical was clicked-on? (the one under the end of the line)
     float offset_x = 0.0f;
-    bool show_multiple_chemicals = render_settings.GetProperty("show_multiple_chemicals").GetBool();
+    bool show_multiple_chemicals = this->IsShowingMultipleChemicals(render_settings);
     int iChemical;
     if(show_multiple_chemicals && this->GetArenaDimensionality()==1)
     {
         // detect which chemical was drawn on from the click position
         const double image_height = X / this->image_ratio1D;
-        iChemical = int(floor((- y + this->image_top1D + image_height)/(image_height*2))); 
+        iChemical = int(floor((- y1 + this->image_top1D + image_height)/(image_height*2))); 
         iChemical = min(this->GetNumberOfChemicals()-1,max(0,iChemical)); // clamp to allowed range (just in case)
     }
     else if(show_multiple_chemicals && this->GetArenaDimensionality()==2)
     {
         // detect which chemical was drawn on from the click position
-        iChemical = int(floor((x+this->xgap/2)/(X+this->xgap))); 
+        iChemical = int(floor((x1+this->xgap/2)/(X+this->xgap))); 
         iChemical = min(this->GetNumberOfChemicals()-1,max(0,iChemical)); // clamp to allowed range (just in case)
         offset_x = iChemical * (X+this->xgap);
     }
@@ -1609,44 +1782,143 @@ void ImageRD::SetValuesInRadius(float x,float y,float z,float r,float val,const
     double *dataset_bbox = this->images.front()->GetBounds();
     r *= hypot3(dataset_bbox[1]-dataset_bbox[0],dataset_bbox[3]-dataset_bbox[2],dataset_bbox[5]-dataset_bbox[4]);
 
-    int ix,iy,iz;
-    ix = int(floor(x-offset_x));
-    iy = int(floor(y));
-    iz = int(floor(z));
-    ix = min(X-1,max(0,ix));
-    iy = min(Y-1,max(0,iy));
-    iz = min(Z-1,max(0,iz));
+    // stamp the brush along the line, at most half its radius apart (and at least a cell), so that a fast stroke leaves no gaps
+    const float from[3] = { x0-offset_x, y0, z0 };
+    const float to[3] = { x1-offset_x, y1, z1 };
+    const int dims[3] = { X, Y, Z };
+    const float length = hypot3(to[0]-from[0],to[1]-from[1],to[2]-from[2]);
+    const int n_steps = int(ceil(length / max(1.0f,r/2)));
+    vector<int> centers;
+    for(int i=0;i<=n_steps;i++)
+    {
+        const float t = n_steps ? float(i)/n_steps : 1.0f;
+        int center[3];
+        for(int xyz=0;xyz<3;xyz++)
+            center[xyz] = min(dims[xyz]-1,max(0,int(floor(from[xyz] + t * (to[xyz] - from[xyz])))));
+        if(centers.empty() || !equal(center,center+3,centers.end()-3))
+            centers.insert(centers.end(),center,center+3);
+    }
 
-    for(int tz=max(0,int(iz-r));tz<=min(Z-1,int(iz+r));tz++)
+    // paint the stamps in runs whose box stays within a few stamps' worth of cells, so that a long diagonal stroke
+    // stores (and reads back) about the cells under the brush, rather than the whole box around the line
+    size_t max_box_cells = 4;
+    for(int xyz=0;xyz<3;xyz++)
+        max_box_cells *= min(dims[xyz],2*int(r)+1);
+    size_t start = 0;
+    while(start < centers.size())
     {
-        for(int ty=max(0,int(iy-r));ty<=min(Y-1,int(iy+r));ty++)
+        int box[6];
+        this->GetSpheresBox(vector<int>(centers.begin()+start,centers.begin()+start+3),r,box);
+        size_t end = start + 3;
+        for(;end<centers.size();end+=3)
         {
-            for(int tx=max(0,int(ix-r));tx<=min(X-1,int(ix+r));tx++)
+            int stamp_box[6];
+            this->GetSpheresBox(vector<int>(centers.begin()+end,centers.begin()+end+3),r,stamp_box);
+            int joined[6];
+            for(int xyz=0;xyz<3;xyz++)
             {
-                if(hypot3(ix-tx,iy-ty,iz-tz)<r)
-                {
-                    float old_val = this->GetImage(iChemical)->GetScalarComponentAsFloat(tx,ty,tz,0);
-                    int ijk[3] = { tx, ty, tz };
-                    vtkIdType iCell = this->GetImage(iChemical)->ComputeCellId(ijk);
-                    this->StorePaintAction(iChemical,iCell,old_val);
-                    this->GetImage(iChemical)->SetScalarComponentFromFloat(tx,ty,tz,0,val);
-                }
+                joined[xyz*2] = min(box[xyz*2],stamp_box[xyz*2]);
+                joined[xyz*2+1] = max(box[xyz*2+1],stamp_box[xyz*2+1]);
             }
+            if(size_t(joined[1]-joined[0]+1) * size_t(joined[3]-joined[2]+1) * size_t(joined[5]-joined[4]+1) > max_box_cells)
+                break;
+            copy(joined,joined+6,box);
+        }
+        this->PaintSpheres(iChemical,vector<int>(centers.begin()+start,centers.begin()+end),r,val);
+        start = end;
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::PaintSpheres(int iChemical,const vector<int>& centers,float r,float val)
+{
+    int box[6];
+    this->GetSpheresBox(centers,r,box);
+    vector<double> old_values, new_values;
+    this->GetRegionValues(iChemical,box,old_values);
+    new_values = old_values;
+    const float r2 = r*r;
+    size_t i = 0;
+    for(int tz=box[4];tz<=box[5];tz++)
+        for(int ty=box[2];ty<=box[3];ty++)
+            for(int tx=box[0];tx<=box[1];tx++,i++)
+                if(IsInAnySphere(centers,r2,tx,ty,tz))
+                    new_values[i] = val;
+    this->SetRegionValues(iChemical,box,new_values);
+    this->StorePaintAction(iChemical,box,old_values,new_values);
+    this->PaintRegionChanged(iChemical,box);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::GetSpheresBox(const vector<int>& centers,float r,int box[6]) const
+{
+    const int *dims = this->images.front()->GetDimensions();
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        box[xyz*2] = dims[xyz]-1;
+        box[xyz*2+1] = 0;
+        for(size_t i=xyz;i<centers.size();i+=3)
+        {
+            box[xyz*2] = min(box[xyz*2],max(0,int(centers[i]-r)));
+            box[xyz*2+1] = max(box[xyz*2+1],min(dims[xyz]-1,int(centers[i]+r)));
         }
     }
-    this->images[iChemical]->Modified();
 }
 
 // --------------------------------------------------------------------------------
 
-void ImageRD::FlipPaintAction(PaintAction& cca)
+/// Copies the values of a box of cells out of the image data, one row at a time.
+template<typename T> static void GetRegion(const T* data,const int dims[3],const int box[6],double* values)
 {
-    float *pCell = static_cast<float*>(this->GetImage(cca.iChemical)->GetScalarPointer()) + cca.iCell;
-    float old_val = *pCell;
-    *pCell = cca.val;
-    cca.val = old_val;
-    cca.done = !cca.done;
-    this->images[cca.iChemical]->Modified();
+    const int row_length = box[1] - box[0] + 1;
+    for(int z=box[4];z<=box[5];z++)
+        for(int y=box[2];y<=box[3];y++,values+=row_length)
+            copy(data + dims[0] * (y + dims[1] * z) + box[0], data + dims[0] * (y + dims[1] * z) + box[0] + row_length, values);
 }
 
 // --------------------------------------------------------------------------------
+
+/// Copies the values of a box of cells into the image data, one row at a time.
+template<typename T> static void SetRegion(T* data,const int dims[3],const int box[6],const double* values)
+{
+    const int row_length = box[1] - box[0] + 1;
+    for(int z=box[4];z<=box[5];z++)
+        for(int y=box[2];y<=box[3];y++,values+=row_length)
+            copy(values, values + row_length, data + dims[0] * (y + dims[1] * z) + box[0]);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::GetRegionValues(int iChemical,const int box[6],vector<double>& values) const
+{
+    vtkImageData *image = this->GetImage(iChemical);
+    values.resize((box[1]-box[0]+1) * (box[3]-box[2]+1) * (box[5]-box[4]+1));
+    if(image->GetScalarType()==VTK_DOUBLE)
+        GetRegion(static_cast<double*>(image->GetScalarPointer()),image->GetDimensions(),box,&values[0]);
+    else
+        GetRegion(static_cast<float*>(image->GetScalarPointer()),image->GetDimensions(),box,&values[0]);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::SetRegionValues(int iChemical,const int box[6],const vector<double>& values)
+{
+    vtkImageData *image = this->GetImage(iChemical);
+    if(image->GetScalarType()==VTK_DOUBLE)
+        SetRegion(static_cast<double*>(image->GetScalarPointer()),image->GetDimensions(),box,&values[0]);
+    else
+        SetRegion(static_cast<float*>(image->GetScalarPointer()),image->GetDimensions(),box,&values[0]);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::PaintRegionChanged(int iChemical,const int box[6])
+{
+    this->images[iChemical]->Modified();
+    this->is_modified = true;
+}
+
+// --------------------------------------------------------------------------------
+
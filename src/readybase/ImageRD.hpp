@@ -49,6 +49,8 @@ class ImageRD : public AbstractRD
         
         virtual int GetNumberOfCells() const;
 
+        virtual void ComputeStatistics(std::vector<ChemicalStatistics>& stats,int n_bins);
+
         virtual void SetNumberOfChemicals(int n);
 
         virtual void GenerateInitialPattern();
@@ -61,7 +63,12 @@ class ImageRD : public AbstractRD
             const size_t target_chemical,
             const size_t largest_dimension,
             const float value_inside,
-            const float value_outside);
+            const float value_outside,
+            const bool anti_alias);  ///< if anti_alias, pixels on the surface get the fraction of their volume that is inside
+        // (public here, unlike in AbstractRD, so that the cells of a box {x0,x1,y0,y1,z0,z1} can be passed to another process)
+        virtual void GetRegionValues(int iChemical,const int box[6],std::vector<double>& values) const;
+        virtual void SetRegionValues(int iChemical,const int box[6],const std::vector<double>& values);
+        virtual void PaintRegionChanged(int iChemical,const int box[6]);
         virtual void SaveStartingPattern();
         virtual void RestoreStartingPattern();
 
@@ -74,10 +81,18 @@ class ImageRD : public AbstractRD
         virtual void GetAs2DImage(vtkImageData *out,const Properties& render_settings) const;
         virtual void SetFrom2DImage(int iChemical, vtkImageData *im);
         virtual bool Is2DImageAvailable() const { return true; }
+        /// Returns true if a step reads the neighborhood means of a chemical, so a cell sees further than its stencil.
+        virtual bool UsesNeighborhoodMeans() const { return false; }
+        /// For implementations that run on a device: if b then the cells are left there after each update, instead of
+        /// the whole image being read back, until something needs them. GetRegionValues and SetRegionValues (followed by
+        /// PaintRegionChanged) then move just the cells of their box, e.g. for exchanging halos between MPI ranks.
+        virtual void SetKeepCellsOnDevice(bool b) {}
 
         virtual float GetValue(float x,float y,float z,const Properties& render_settings);
         virtual void SetValue(float x,float y,float z,float val,const Properties& render_settings);
         virtual void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings);
+        virtual void SetValuesAlongLine(float x0,float y0,float z0,float x1,float y1,float z1,float r,float val,
+            const Properties& render_settings);
 
     protected:
 
@@ -90,6 +105,16 @@ class ImageRD : public AbstractRD
         double image_top1D;        /// topmost location of the 1D image strips
         double image_ratio1D;     /// proportions of the 1D image strips
 
+        int iDisplayedChemical;   /// if not -1 then this is the only chemical being rendered (see use_fast_display)
+
+        // the recent history of a 1D arena, for the space-time plot (see show_space_time_plot)
+        int space_time_rows;            ///< the number of steps kept, or 0 if none are
+        int space_time_chemical;        ///< the chemical whose history is kept
+        int space_time_next_row;        ///< the row of the ring that the next step goes in
+        int space_time_n_rows;          ///< the number of rows of the ring that have been filled
+        std::vector<double> space_time_ring;            ///< the kept steps, one row of all the cells for each
+        vtkSmartPointer<vtkImageData> space_time_image; ///< the kept steps in order, the oldest at the top, for rendering
+
     protected:
 
         vtkImageData* GetImage(int iChemical) const;
@@ -103,7 +128,40 @@ class ImageRD : public AbstractRD
 
         virtual int GetArenaDimensionality() const;
 
-        virtual void FlipPaintAction(PaintAction& cca);
+        /// Returns whether the chemicals are drawn side by side, for the rendering and for finding which one was clicked.
+        bool IsShowingMultipleChemicals(const Properties& render_settings) const;
+
+        virtual void FindCellsAtPositions(const std::vector<double>& positions,std::vector<int>& cells);
+        virtual double GetCellValue(int iChemical,int iCell) const;
+
+        /// Starts keeping the last n_rows steps of a chemical (or stops, if 0), unless that is already being done.
+        void SetSpaceTimeHistory(int n_rows,int iChemical);
+        /// Forgets the steps kept so far, e.g. when the pattern is replaced.
+        void ResetSpaceTimeHistory();
+        /// Implementations that copy each step into the history themselves during InternalUpdate return true.
+        virtual bool RecordsSpaceTimeOnDevice() const { return false; }
+        /// Copies the current values of the chemical into the next row of the ring, from the image.
+        void RecordSpaceTimeRowFromHost();
+        /// Brings space_time_ring up to date, for implementations that keep it elsewhere.
+        virtual void ReadSpaceTimeRing() {}
+        /// Copies the ring into space_time_image, in order.
+        void UpdateSpaceTimeImage();
+
+        /// Sets the cells of a chemical within radius r (in cells) of any of the center cells (x,y,z triples), as one undo-able action.
+        virtual void PaintSpheres(int iChemical,const std::vector<int>& centers,float r,float val);
+        void GetSpheresBox(const std::vector<int>& centers,float r,int box[6]) const; ///< the cells that PaintSpheres might change
+
+        /// The test used by PaintSpheres, in a form that the OpenCL brush kernel can match exactly.
+        static bool IsInAnySphere(const std::vector<int>& centers,float r2,int x,int y,int z)
+        {
+            for(size_t i=0;i<centers.size();i+=3)
+            {
+                const int dx = x - centers[i], dy = y - centers[i+1], dz = z - centers[i+2];
+                if((float)(dx*dx + dy*dy + dz*dz) < r2)
+                    return true;
+            }
+            return false;
+        }
 
         // some saved handles into the pipeline, for manual updated to workaround a named arrays problem
         vtkAssignAttribute *assign_attribute_filter;
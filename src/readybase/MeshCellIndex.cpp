@@ -0,0 +1,370 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "MeshCellIndex.hpp"
+
+// VTK:
+#include <vtkCellArray.h>
+#include <vtkGenericCell.h>
+#include <vtkPoints.h>
+#include <vtkSmartPointer.h>
+#include <vtkUnstructuredGrid.h>
+
+// STL:
+#include <algorithm>
+using namespace std;
+
+// stdlib:
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+// --------------------------------------------------------------------------------
+
+MeshCellIndex::MeshCellIndex()
+{
+    this->Clear();
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshCellIndex::Clear()
+{
+    this->mesh = NULL;
+    this->built_geometry_time = 0;
+    this->built_number_of_cells = 0;
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        this->origin[xyz] = 0.0;
+        this->bucket_size[xyz] = 1.0;
+        this->dims[xyz] = 1;
+    }
+    this->max_radius = 0.0;
+    this->max_points_per_cell = 0;
+    this->bucket_start.assign(2,0);
+    this->cell_id.clear();
+    this->cx.clear();
+    this->cy.clear();
+    this->cz.clear();
+    this->radius.clear();
+    this->point_start.assign(1,0);
+    this->px.clear();
+    this->py.clear();
+    this->pz.clear();
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshCellIndex::BuildIfNeeded(vtkUnstructuredGrid* mesh)
+{
+    const vtkIdType n_cells = mesh->GetNumberOfCells();
+    const unsigned long geometry_time = n_cells ? max( mesh->GetPoints()->GetMTime(), mesh->GetCells()->GetMTime() ) : 0;
+    if(mesh==this->mesh && n_cells==this->built_number_of_cells && geometry_time==this->built_geometry_time)
+        return;
+
+    this->Clear();
+    this->mesh = mesh;
+    this->built_number_of_cells = n_cells;
+    this->built_geometry_time = geometry_time;
+    if(n_cells==0)
+        return;
+
+    // find the centroid and radius of each cell
+    vector<double> centroids(3*n_cells),radii(n_cells);
+    double bounds[6] = { DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX };
+    vtkIdType npts,*pts;
+    vtkIdType n_cell_points = 0;
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+    {
+        mesh->GetCellPoints(iCell,npts,pts);
+        double *c = &centroids[3*iCell];
+        c[0] = c[1] = c[2] = 0.0;
+        for(vtkIdType iPt=0;iPt<npts;iPt++)
+        {
+            const double *p = mesh->GetPoint(pts[iPt]);
+            for(int xyz=0;xyz<3;xyz++)
+                c[xyz] += p[xyz] / npts;
+        }
+        double r2 = 0.0;
+        for(vtkIdType iPt=0;iPt<npts;iPt++)
+        {
+            const double *p = mesh->GetPoint(pts[iPt]);
+            r2 = max(r2, (p[0]-c[0])*(p[0]-c[0]) + (p[1]-c[1])*(p[1]-c[1]) + (p[2]-c[2])*(p[2]-c[2]));
+        }
+        radii[iCell] = sqrt(r2);
+        this->max_radius = max(this->max_radius,radii[iCell]);
+        this->max_points_per_cell = max(this->max_points_per_cell,int(npts));
+        n_cell_points += npts;
+        for(int xyz=0;xyz<3;xyz++)
+        {
+            bounds[xyz*2] = min(bounds[xyz*2],c[xyz]);
+            bounds[xyz*2+1] = max(bounds[xyz*2+1],c[xyz]);
+        }
+    }
+
+    // choose the grid, aiming for about two cells per bucket
+    const int MAX_DIM = 1024;
+    double extent[3],max_extent = 0.0;
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        extent[xyz] = bounds[xyz*2+1] - bounds[xyz*2];
+        max_extent = max(max_extent,extent[xyz]);
+    }
+    int n_active = 0;
+    double volume = 1.0;
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        if(extent[xyz] > 1e-9 * max_extent)
+        {
+            n_active++;
+            volume *= extent[xyz];
+        }
+    }
+    const double side = n_active ? pow(volume / max(1.0,n_cells/2.0), 1.0/n_active) : 1.0;
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        this->origin[xyz] = bounds[xyz*2];
+        if(n_active && extent[xyz] > 1e-9 * max_extent)
+        {
+            this->dims[xyz] = max(1,min(MAX_DIM,int(ceil(extent[xyz]/side))));
+            this->bucket_size[xyz] = extent[xyz] / this->dims[xyz];
+        }
+    }
+
+    // sort the cells into buckets
+    const int n_buckets = this->dims[0] * this->dims[1] * this->dims[2];
+    vector<int> cell_bucket(n_cells);
+    this->bucket_start.assign(n_buckets+1,0);
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+    {
+        int b[3];
+        this->GetBucket(&centroids[3*iCell],b);
+        cell_bucket[iCell] = b[0] + this->dims[0] * (b[1] + this->dims[1] * b[2]);
+        this->bucket_start[cell_bucket[iCell]+1]++;
+    }
+    for(int iBucket=0;iBucket<n_buckets;iBucket++)
+        this->bucket_start[iBucket+1] += this->bucket_start[iBucket];
+    vector<int> next_entry(this->bucket_start.begin(),this->bucket_start.end()-1);
+    this->cell_id.resize(n_cells);
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+        this->cell_id[next_entry[cell_bucket[iCell]]++] = int(iCell);
+
+    // fill the entries in bucket order
+    this->cx.resize(n_cells);
+    this->cy.resize(n_cells);
+    this->cz.resize(n_cells);
+    this->radius.resize(n_cells);
+    this->point_start.resize(n_cells+1);
+    this->px.resize(n_cell_points);
+    this->py.resize(n_cell_points);
+    this->pz.resize(n_cell_points);
+    int iPoint = 0;
+    for(vtkIdType i=0;i<n_cells;i++)
+    {
+        const int iCell = this->cell_id[i];
+        this->cx[i] = centroids[3*iCell];
+        this->cy[i] = centroids[3*iCell+1];
+        this->cz[i] = centroids[3*iCell+2];
+        this->radius[i] = radii[iCell];
+        this->point_start[i] = iPoint;
+        mesh->GetCellPoints(iCell,npts,pts);
+        for(vtkIdType iPt=0;iPt<npts;iPt++,iPoint++)
+        {
+            const double *p = mesh->GetPoint(pts[iPt]);
+            this->px[iPoint] = p[0];
+            this->py[iPoint] = p[1];
+            this->pz[iPoint] = p[2];
+        }
+    }
+    this->point_start[n_cells] = iPoint;
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshCellIndex::GetBucket(const double p[3],int b[3]) const
+{
+    for(int xyz=0;xyz<3;xyz++)
+        b[xyz] = max(0,min(this->dims[xyz]-1,int(floor((p[xyz] - this->origin[xyz]) / this->bucket_size[xyz]))));
+}
+
+// --------------------------------------------------------------------------------
+
+vtkIdType MeshCellIndex::FindClosestCell(const double p[3]) const
+{
+    vtkSmartPointer<vtkGenericCell> cell = vtkSmartPointer<vtkGenericCell>::New();
+    vector<double> weights;
+    return this->FindClosestCell(p,cell,weights);
+}
+
+// --------------------------------------------------------------------------------
+
+vtkIdType MeshCellIndex::FindClosestCell(const double p[3],vtkGenericCell* cell,vector<double>& weights) const
+{
+    if(this->cell_id.empty())
+        return -1;
+
+    weights.resize(this->max_points_per_cell);
+    double min_side = DBL_MAX; // the smallest bucket size along an axis that has more than one
+    int max_ring = 0;
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        if(this->dims[xyz]>1)
+            min_side = min(min_side,this->bucket_size[xyz]);
+        max_ring = max(max_ring,this->dims[xyz]-1);
+    }
+
+    // search rings of buckets around p, until no closer cell can be found
+    int b0[3];
+    this->GetBucket(p,b0);
+    vtkIdType best_cell = -1;
+    double best_dist2 = DBL_MAX;
+    for(int k=0;k<=max_ring;k++)
+    {
+        if(best_cell>=0 && k>1)
+        {
+            const double lower_bound = (k-1) * min_side - this->max_radius;
+            if(lower_bound > 0.0 && lower_bound*lower_bound > best_dist2)
+                break;
+        }
+        for(int z=max(0,b0[2]-k);z<=min(this->dims[2]-1,b0[2]+k);z++)
+        {
+            for(int y=max(0,b0[1]-k);y<=min(this->dims[1]-1,b0[1]+k);y++)
+            {
+                // on the top and bottom faces of the ring we take every x, else just the two ends
+                const bool is_face = abs(z-b0[2])==k || abs(y-b0[1])==k;
+                for(int x=max(0,b0[0]-k);x<=min(this->dims[0]-1,b0[0]+k);x++)
+                {
+                    if(!is_face && abs(x-b0[0])!=k)
+                    {
+                        if(x<b0[0]+k)
+                            x = b0[0]+k-1; // jump to the far end
+                        continue;
+                    }
+                    const int iBucket = x + this->dims[0] * (y + this->dims[1] * z);
+                    for(int i=this->bucket_start[iBucket];i<this->bucket_start[iBucket+1];i++)
+                    {
+                        // skip cells that can't be closer than the best so far
+                        const double dc = sqrt((p[0]-this->cx[i])*(p[0]-this->cx[i]) + (p[1]-this->cy[i])*(p[1]-this->cy[i])
+                            + (p[2]-this->cz[i])*(p[2]-this->cz[i])) - this->radius[i];
+                        if(dc > 0.0 && dc*dc > best_dist2)
+                            continue;
+                        double x_copy[3] = { p[0], p[1], p[2] }, closest[3], pcoords[3], dist2;
+                        int subId;
+                        this->mesh->GetCell(this->cell_id[i],cell);
+                        if(cell->EvaluatePosition(x_copy,closest,subId,pcoords,dist2,&weights[0]) < 0)
+                            continue; // numerical failure
+                        if(dist2 < best_dist2 || (dist2==best_dist2 && this->cell_id[i]<best_cell))
+                        {
+                            best_dist2 = dist2;
+                            best_cell = this->cell_id[i];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return best_cell;
+}
+
+// --------------------------------------------------------------------------------
+
+struct FindClosestCellsJob
+{
+    const MeshCellIndex *index;
+    const double *points;
+    int n;
+    vtkIdType *cells;
+};
+
+// --------------------------------------------------------------------------------
+
+void MeshCellIndex::FindClosestCells(const double* points,int n,vtkIdType* cells) const
+{
+    if(n<=0)
+        return;
+    FindClosestCellsJob job = { this, points, n, cells };
+    vtkSmartPointer<vtkMultiThreader> threader = vtkSmartPointer<vtkMultiThreader>::New();
+    threader->SetNumberOfThreads(max(1,min(threader->GetGlobalDefaultNumberOfThreads(),n)));
+    threader->SetSingleMethod(MeshCellIndex::ThreadedFindClosestCells, &job);
+    threader->SingleMethodExecute();
+}
+
+// --------------------------------------------------------------------------------
+
+/* static */ VTK_THREAD_RETURN_TYPE MeshCellIndex::ThreadedFindClosestCells(void *arg)
+{
+    vtkMultiThreader::ThreadInfo *info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+    const FindClosestCellsJob *job = static_cast<FindClosestCellsJob*>(info->UserData);
+    vtkSmartPointer<vtkGenericCell> cell = vtkSmartPointer<vtkGenericCell>::New();
+    vector<double> weights;
+    for(int i=info->ThreadID;i<job->n;i+=info->NumberOfThreads)
+        job->cells[i] = job->index->FindClosestCell(&job->points[3*i],cell,weights);
+    return VTK_THREAD_RETURN_VALUE;
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshCellIndex::FindCellsWithinRadius(const double* centers,int n,double r,vector<int>& cells) const
+{
+    cells.clear();
+    if(this->cell_id.empty())
+        return;
+
+    const double reach = r + this->max_radius;
+    const double r2 = r*r;
+    for(int iCenter=0;iCenter<n;iCenter++)
+    {
+        const double *c = &centers[3*iCenter];
+        const double lo[3] = { c[0]-reach, c[1]-reach, c[2]-reach };
+        const double hi[3] = { c[0]+reach, c[1]+reach, c[2]+reach };
+        int b_lo[3],b_hi[3];
+        this->GetBucket(lo,b_lo);
+        this->GetBucket(hi,b_hi);
+        for(int z=b_lo[2];z<=b_hi[2];z++)
+        {
+            for(int y=b_lo[1];y<=b_hi[1];y++)
+            {
+                for(int x=b_lo[0];x<=b_hi[0];x++)
+                {
+                    const int iBucket = x + this->dims[0] * (y + this->dims[1] * z);
+                    for(int i=this->bucket_start[iBucket];i<this->bucket_start[iBucket+1];i++)
+                    {
+                        const double limit = r + this->radius[i];
+                        if((c[0]-this->cx[i])*(c[0]-this->cx[i]) + (c[1]-this->cy[i])*(c[1]-this->cy[i])
+                            + (c[2]-this->cz[i])*(c[2]-this->cz[i]) >= limit*limit)
+                            continue;
+                        // include the cell if any of its points are inside
+                        for(int j=this->point_start[i];j<this->point_start[i+1];j++)
+                        {
+                            if((c[0]-this->px[j])*(c[0]-this->px[j]) + (c[1]-this->py[j])*(c[1]-this->py[j])
+                                + (c[2]-this->pz[j])*(c[2]-this->pz[j]) < r2)
+                            {
+                                cells.push_back(this->cell_id[i]);
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    sort(cells.begin(),cells.end());
+    cells.erase(unique(cells.begin(),cells.end()),cells.end());
+}
+
+// --------------------------------------------------------------------------------
@@ -0,0 +1,91 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __MESHCELLINDEX__
+#define __MESHCELLINDEX__
+
+// VTK:
+#include <vtkMultiThreader.h>
+#include <vtkType.h>
+class vtkGenericCell;
+class vtkUnstructuredGrid;
+
+// STL:
+#include <vector>
+
+/// Finds the cells of a mesh near a location, for probing and painting.
+/**
+ * The cells are put into the buckets of a uniform grid by their centroids, with about two cells
+ * to a bucket. Each cell's entry holds its centroid, its radius (the distance from the centroid to
+ * its furthest point) and its points, stored as separate arrays in bucket order, so a query reads
+ * contiguous memory. The index is rebuilt when the geometry of the mesh changes.
+ */
+class MeshCellIndex
+{
+    public:
+
+        MeshCellIndex();
+
+        /// Builds the index for this mesh, unless it was already built for the same geometry.
+        void BuildIfNeeded(vtkUnstructuredGrid* mesh);
+        void Clear();
+
+        /// Returns the cell closest to p (a cell containing p, if there is one), or -1 if there are no cells.
+        vtkIdType FindClosestCell(const double p[3]) const;
+        /// Finds the closest cell to each of n points (given as xyz triples), in parallel.
+        void FindClosestCells(const double* points,int n,vtkIdType* cells) const;
+
+        /// Finds the cells with any of their points within r of any of the n centers (given as xyz triples).
+        /** The cells are returned in increasing order, each one once. */
+        void FindCellsWithinRadius(const double* centers,int n,double r,std::vector<int>& cells) const;
+
+    protected:
+
+        /// Returns the closest cell to p, using the given scratch space.
+        vtkIdType FindClosestCell(const double p[3],vtkGenericCell* cell,std::vector<double>& weights) const;
+
+        void GetBucket(const double p[3],int b[3]) const;
+
+        static VTK_THREAD_RETURN_TYPE ThreadedFindClosestCells(void *arg);
+
+    protected:
+
+        vtkUnstructuredGrid *mesh;              ///< not owned
+        unsigned long built_geometry_time;      ///< the MTime of the mesh geometry when the index was built
+        vtkIdType built_number_of_cells;
+
+        double origin[3],bucket_size[3];
+        int dims[3];
+        double max_radius;                      ///< the largest radius of any cell
+        int max_points_per_cell;
+
+        std::vector<int> bucket_start;          ///< the entries in bucket b are from bucket_start[b] to bucket_start[b+1]-1
+
+        // one entry for each cell, in bucket order:
+        std::vector<int> cell_id;
+        std::vector<double> cx,cy,cz;           ///< centroids
+        std::vector<double> radius;
+        std::vector<int> point_start;           ///< the points of entry i are from point_start[i] to point_start[i+1]-1
+        std::vector<double> px,py,pz;
+
+    private: // deliberately not implemented, to prevent use
+
+        MeshCellIndex(const MeshCellIndex&);
+        void operator=(const MeshCellIndex&);
+};
+
+#endif
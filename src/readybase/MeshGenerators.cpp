@@ -20,30 +20,36 @@
 #include "utils.hpp"
 
 // VTK:
-#include <vtkAppendFilter.h>
 #include <vtkCellArray.h>
 #include <vtkCellData.h>
 #include <vtkCleanPolyData.h>
+#include <vtkCommand.h>
 #include <vtkDelaunay2D.h>
 #include <vtkDelaunay3D.h>
+#include <vtkFieldData.h>
 #include <vtkGenericCell.h>
+#include <vtkIdTypeArray.h>
+#include <vtkIntArray.h>
 #include <vtkLinearSubdivisionFilter.h>
 #include <vtkMath.h>
+#include <vtkMultiThreader.h>
 #include <vtkPlatonicSolidSource.h>
-#include <vtkPointLocator.h>
-#include <vtkPointSource.h>
 #include <vtkSmartPointer.h>
 #include <vtkTransform.h>
 #include <vtkTransformPolyDataFilter.h>
 #include <vtkTriangle.h>
+#include <vtkUnsignedCharArray.h>
 #include <vtkUnstructuredGrid.h>
 
 // STL:
+#include <algorithm>
+#include <map>
 #include <vector>
 using namespace std;
 
 // stdlib:
 #define _USE_MATH_DEFINES
+#include <float.h>
 #include <math.h>
 
 // ---------------------------------------------------------------------
@@ -506,29 +512,257 @@ void MeshGenerators::GetPenroseTiling(int n_subdivisions,int type,vtkUnstructure
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetRandomDelaunay2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+/// Scatters random points with no two closer together than min_distance, using Bridson's algorithm.
+/**
+ * The points fill the box from the origin to size, or the ellipsoid inside it, and are in the xy plane if size[2] is
+ * zero. Each new point is tried around an existing one, so the points come out in a spatially coherent order. This
+ * helps the Delaunay filters, which look for where to put each new point by walking from where they put the last.
+ */
+class PoissonDiskSampler
 {
-    // make a 2D mesh by delaunay triangulation on a point cloud
-    float side = sqrt((float)n_points); // spread enough for <pixel> access
-    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    public:
+
+        PoissonDiskSampler(const double size[3],bool in_ellipsoid,double min_distance);
+
+        void GetPoints(vtkPoints *pts,MeshGenerators::ProgressCallback progress,void *progress_data,
+            int expected_n_points,double progress_to);
+
+        /// Returns the min_distance that gives about n_points in the given area (2D) or volume (3D).
+        static double GetSpacing(int n_points,double area_or_volume,int dims);
+
+    protected:
+
+        bool IsInside(const double p[3]) const;
+        bool IsClear(const double p[3]) const;
+        void Add(const double p[3]);
+        size_t GetGridIndex(const double p[3]) const;
+
+    protected:
+
+        static const int MAX_TRIES = 12; ///< how many new points to try around each point before giving up on it
+
+        double size[3];
+        bool in_ellipsoid;
+        double min_distance;
+        int dims;
+
+        double cell_size;            ///< small enough that each grid cell holds at most one point
+        int grid_size[3];
+        vector<vtkIdType> grid;      ///< the point in each grid cell, or -1
+        vector<double> coords;       ///< x,y,z of each point so far
+        vector<vtkIdType> active;    ///< the points that might still have room for a new point near them
+};
+
+// ---------------------------------------------------------------------
+
+PoissonDiskSampler::PoissonDiskSampler(const double size[3],bool in_ellipsoid,double min_distance)
+    : in_ellipsoid(in_ellipsoid)
+    , min_distance(min_distance)
+{
+    this->dims = (size[2]>0.0) ? 3 : 2;
+    this->cell_size = min_distance / sqrt((double)this->dims);
+    for(int i=0;i<3;i++)
+    {
+        this->size[i] = size[i];
+        this->grid_size[i] = (i<this->dims) ? max(1,(int)ceil(size[i] / this->cell_size)) : 1;
+    }
+    this->grid.assign((size_t)this->grid_size[0] * this->grid_size[1] * this->grid_size[2],-1);
+}
+
+// ---------------------------------------------------------------------
+
+/* static */ double PoissonDiskSampler::GetSpacing(int n_points,double area_or_volume,int dims)
+{
+    // Bridson's algorithm fills about this fraction of space with non-overlapping balls of diameter min_distance
+    const double packing_fraction = (dims==2) ? 0.47 : 0.29;
+    const double ball_volume = (dims==2) ? M_PI / 4.0 : M_PI / 6.0;
+    return pow( packing_fraction * area_or_volume / ( ball_volume * max(1,n_points) ), 1.0 / dims );
+}
+
+// ---------------------------------------------------------------------
+
+size_t PoissonDiskSampler::GetGridIndex(const double p[3]) const
+{
+    int c[3] = { 0, 0, 0 };
+    for(int i=0;i<this->dims;i++)
+        c[i] = min( this->grid_size[i]-1, (int)( p[i] / this->cell_size ) );
+    return c[0] + this->grid_size[0] * ( c[1] + (size_t)this->grid_size[1] * c[2] );
+}
+
+// ---------------------------------------------------------------------
+
+bool PoissonDiskSampler::IsInside(const double p[3]) const
+{
+    double e = 0.0;
+    for(int i=0;i<this->dims;i++)
+    {
+        if(p[i]<0.0 || p[i]>=this->size[i])
+            return false;
+        e += pow( 2.0 * p[i] / this->size[i] - 1.0, 2.0 );
+    }
+    return !this->in_ellipsoid || e <= 1.0;
+}
+
+// ---------------------------------------------------------------------
+
+bool PoissonDiskSampler::IsClear(const double p[3]) const
+{
+    // any point closer than min_distance must be within two grid cells of this one
+    int lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+    for(int i=0;i<this->dims;i++)
+    {
+        const int c = min( this->grid_size[i]-1, (int)( p[i] / this->cell_size ) );
+        lo[i] = max( 0, c-2 );
+        hi[i] = min( this->grid_size[i]-1, c+2 );
+    }
+    const double r2 = this->min_distance * this->min_distance;
+    for(int z=lo[2];z<=hi[2];z++)
+    {
+        for(int y=lo[1];y<=hi[1];y++)
+        {
+            for(int x=lo[0];x<=hi[0];x++)
+            {
+                const vtkIdType iOther = this->grid[ x + this->grid_size[0] * ( y + (size_t)this->grid_size[1] * z ) ];
+                if(iOther>=0 && vtkMath::Distance2BetweenPoints(p,&this->coords[iOther*3]) < r2)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+void PoissonDiskSampler::Add(const double p[3])
+{
+    const vtkIdType iPoint = (vtkIdType)this->coords.size() / 3;
+    this->grid[this->GetGridIndex(p)] = iPoint;
+    this->coords.insert(this->coords.end(),p,p+3);
+    this->active.push_back(iPoint);
+}
+
+// ---------------------------------------------------------------------
+
+void PoissonDiskSampler::GetPoints(vtkPoints *pts,MeshGenerators::ProgressCallback progress,void *progress_data,
+    int expected_n_points,double progress_to)
+{
+    // start in the middle
+    double p[3] = { 0, 0, 0 };
+    for(int i=0;i<this->dims;i++)
+        p[i] = this->size[i] / 2.0;
+    this->Add(p);
+
+    while(!this->active.empty())
+    {
+        const size_t iActive = min( this->active.size()-1, (size_t)( vtkMath::Random() * this->active.size() ) );
+        double q[3];
+        for(int i=0;i<3;i++)
+            q[i] = this->coords[ this->active[iActive] * 3 + i ];
+        bool found = false;
+        for(int iTry=0;iTry<MAX_TRIES && !found;iTry++)
+        {
+            // try somewhere between min_distance and twice that from the active point
+            double dir[3] = { 0, 0, 0 }, len2;
+            do {
+                for(int i=0;i<this->dims;i++)
+                    dir[i] = vtkMath::Random(-1.0,1.0);
+                len2 = dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2];
+            } while(len2 > 1.0 || len2 < 1e-6);
+            const double r = this->min_distance * ( 1.0 + vtkMath::Random() ) / sqrt(len2);
+            for(int i=0;i<3;i++)
+                p[i] = q[i] + dir[i] * r;
+            if(this->IsInside(p) && this->IsClear(p))
+            {
+                this->Add(p);
+                found = true;
+            }
+        }
+        if(!found)
+        {
+            // nothing fits around this point any more
+            this->active[iActive] = this->active.back();
+            this->active.pop_back();
+        }
+        const vtkIdType n_points = (vtkIdType)this->coords.size() / 3;
+        if(progress && found && n_points % 10000 == 0)
+            progress( progress_to * min( 1.0, n_points / (double)max(1,expected_n_points) ), progress_data );
+    }
+
+    const vtkIdType n_points = (vtkIdType)this->coords.size() / 3;
     pts->SetNumberOfPoints(n_points);
-    vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
-    for(vtkIdType i=0;i<(vtkIdType)n_points;i++)
+    for(vtkIdType i=0;i<n_points;i++)
+        pts->SetPoint(i,&this->coords[i*3]);
+}
+
+// ---------------------------------------------------------------------
+
+/// Passes the progress events of a VTK filter on to a MeshGenerators::ProgressCallback, mapped onto part of the range.
+class ProgressForwarder : public vtkCommand
+{
+    public:
+
+        static ProgressForwarder* New() { return new ProgressForwarder; }
+
+        void Set(MeshGenerators::ProgressCallback progress,void *progress_data,double from,double to)
+        {
+            this->progress = progress;
+            this->progress_data = progress_data;
+            this->from = from;
+            this->to = to;
+        }
+
+        virtual void Execute(vtkObject *caller,unsigned long event_id,void *call_data)
+        {
+            if(this->progress && event_id == vtkCommand::ProgressEvent)
+                this->progress( this->from + ( this->to - this->from ) * *static_cast<double*>(call_data), this->progress_data );
+        }
+
+    protected:
+
+        ProgressForwarder() : progress(NULL), progress_data(NULL), from(0.0), to(1.0) {}
+
+        MeshGenerators::ProgressCallback progress;
+        void *progress_data;
+        double from,to;
+};
+
+// ---------------------------------------------------------------------
+
+/// Runs the algorithm, reporting its progress as from..to of the whole.
+void UpdateWithProgress(vtkAlgorithm *algorithm,MeshGenerators::ProgressCallback progress,void *progress_data,double from,double to)
+{
+    vtkSmartPointer<ProgressForwarder> forwarder = vtkSmartPointer<ProgressForwarder>::New();
+    forwarder->Set(progress,progress_data,from,to);
+    if(progress)
+        algorithm->AddObserver(vtkCommand::ProgressEvent,forwarder);
+    algorithm->Update();
+    if(progress)
     {
-        pts->SetPoint(i,vtkMath::Random()*side,vtkMath::Random()*side,0);
-        cells->InsertNextCell(1);
-        cells->InsertCellPoint(i);
+        algorithm->RemoveObserver(forwarder);
+        progress(to,progress_data);
     }
+}
+
+// ---------------------------------------------------------------------
+
+void MeshGenerators::GetRandomDelaunay2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+    ProgressCallback progress,void* progress_data)
+{
+    // make a 2D mesh by delaunay triangulation on a point cloud
+    const double side = sqrt((double)n_points); // spread enough for <pixel> access
+    const double size[3] = { side, side, 0.0 };
+    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    PoissonDiskSampler sampler(size,false,PoissonDiskSampler::GetSpacing(n_points,side*side,2));
+    sampler.GetPoints(pts,progress,progress_data,n_points,0.2);
     vtkSmartPointer<vtkPolyData> poly = vtkSmartPointer<vtkPolyData>::New();
     poly->SetPoints(pts);
-    poly->SetPolys(cells);
     vtkSmartPointer<vtkDelaunay2D> del = vtkSmartPointer<vtkDelaunay2D>::New();
     #if VTK_MAJOR_VERSION >= 6
         del->SetInputData(poly);
     #else
         del->SetInput(poly);
     #endif
-    del->Update();
+    UpdateWithProgress(del,progress,progress_data,0.2,1.0);
     mesh->SetPoints(del->GetOutput()->GetPoints());
     mesh->SetCells(VTK_POLYGON,del->GetOutput()->GetPolys());
 
@@ -546,7 +780,8 @@ void MeshGenerators::GetRandomDelaunay2D(int n_points,vtkUnstructuredGrid *mesh,
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+    ProgressCallback progress,void* progress_data)
 {
     // make a 2D mesh of voronoi cells from a point cloud
 
@@ -554,24 +789,18 @@ void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,i
     double side = sqrt((double)n_points); // spread enough for <pixel> access
     // first make a delaunay triangular mesh
     {
+        const double size[3] = { side, side, 0.0 };
         vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
-        pts->SetNumberOfPoints(n_points);
-        vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
-        for(vtkIdType i=0;i<(vtkIdType)n_points;i++)
-        {
-            pts->SetPoint(i,vtkMath::Random()*side,vtkMath::Random()*side,0);
-            cells->InsertNextCell(1);
-            cells->InsertCellPoint(i);
-        }
+        PoissonDiskSampler sampler(size,false,PoissonDiskSampler::GetSpacing(n_points,side*side,2));
+        sampler.GetPoints(pts,progress,progress_data,n_points,0.1);
         old_poly->SetPoints(pts);
-        old_poly->SetPolys(cells);
         vtkSmartPointer<vtkDelaunay2D> del = vtkSmartPointer<vtkDelaunay2D>::New();
         #if VTK_MAJOR_VERSION >= 6
             del->SetInputData(old_poly);
         #else
             del->SetInput(old_poly);
         #endif
-        del->Update();
+        UpdateWithProgress(del,progress,progress_data,0.1,0.6);
         old_poly->DeepCopy(del->GetOutput());
         old_poly->BuildLinks();
     }
@@ -600,6 +829,8 @@ void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,i
     vtkSmartPointer<vtkIdList> cell_ids = vtkSmartPointer<vtkIdList>::New();
     for(vtkIdType i=0;i<old_poly->GetNumberOfPoints();i++)
     {
+        if(progress && i%10000==0)
+            progress(0.6+0.4*i/old_poly->GetNumberOfPoints(),progress_data);
         old_poly->GetPointCells(i,cell_ids);
         if(cell_ids->GetNumberOfIds()<=2) continue;
         // collect the points
@@ -677,22 +908,26 @@ void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,i
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+void MeshGenerators::GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+    ProgressCallback progress,void* progress_data)
 {
     // TODO: we could make any number of shapes here but we need a more general mechanism, 
     // e.g. input a closed surface, scatter points inside, tetrahedralize
 
     // make a tetrahedral mesh by delaunay tetrahedralization on a point cloud
-    vtkSmartPointer<vtkPointSource> pts = vtkSmartPointer<vtkPointSource>::New();
-    pts->SetNumberOfPoints(n_points);
-    vtkSmartPointer<vtkTransform> transform = vtkSmartPointer<vtkTransform>::New();
-    transform->Scale(200,100,100); // just to make it a bit more interesting we stretch the points in one direction
-    vtkSmartPointer<vtkTransformPolyDataFilter> trans = vtkSmartPointer<vtkTransformPolyDataFilter>::New();
-    trans->SetTransform(transform);
-    trans->SetInputConnection(pts->GetOutputPort());
+    const double size[3] = { 200, 100, 100 }; // just to make it a bit more interesting we stretch the points in one direction
+    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    PoissonDiskSampler sampler(size,true,PoissonDiskSampler::GetSpacing(n_points,M_PI*size[0]*size[1]*size[2]/6.0,3));
+    sampler.GetPoints(pts,progress,progress_data,n_points,0.2);
+    vtkSmartPointer<vtkPolyData> poly = vtkSmartPointer<vtkPolyData>::New();
+    poly->SetPoints(pts);
     vtkSmartPointer<vtkDelaunay3D> del = vtkSmartPointer<vtkDelaunay3D>::New();
-    del->SetInputConnection(trans->GetOutputPort());
-    del->Update();
+    #if VTK_MAJOR_VERSION >= 6
+        del->SetInputData(poly);
+    #else
+        del->SetInput(poly);
+    #endif
+    UpdateWithProgress(del,progress,progress_data,0.2,1.0);
     mesh->DeepCopy(del->GetOutput());
 
     // allocate the chemicals arrays
@@ -709,123 +944,565 @@ void MeshGenerators::GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid *mesh,
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetBodyCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type)
+/// A honeycomb of identical polyhedra placed on a lattice, built directly into the arrays of a vtkUnstructuredGrid in parallel.
+/**
+ * Cell (x,y,z) has its vertices at GetCellPoint(x,y,z,i), in the same order for every cell. The cells sharing a vertex
+ * are found once, by comparing a cell with the cells around it in the lattice, for each of the 4x4x4 residue classes of
+ * (x,y,z). After that everything is closed-form: a point belongs to the first of the cells that share it, each cell
+ * counts the points it owns, and a prefix sum gives every point its id. The cells are then written in parallel, along
+ * with their vertex, edge and face neighbors (see MeshGenerators::VERTEX_NEIGHBORS_ARRAY).
+ */
+class LatticeHoneycomb
 {
-    // a truncated octahedron
-    const double coords[24][3] = { 
-        {0,1,2}, {0,-1,2}, {0,1,-2}, {0,-1,-2},   // 0,1,2,3
-        {0,2,1}, {0,-2,1}, {0,2,-1}, {0,-2,-1},   // 4,5,6,7
-        {1,0,2}, {-1,0,2}, {1,0,-2}, {-1,0,-2},   // 8,9,10,11
-        {1,2,0}, {-1,2,0}, {1,-2,0}, {-1,-2,0},   // 12,13,14,15
-        {2,0,1}, {-2,0,1}, {2,0,-1}, {-2,0,-1},   // 16,17,18,19
-        {2,1,0}, {-2,1,0}, {2,-1,0}, {-2,-1,0} }; // 20,21,22,23
-    const int hex_faces[8][6] = { 
-        {0,8,16,20,12,4}, {2,6,12,20,18,10}, 
-        {1,5,14,22,16,8}, {3,10,18,22,14,7}, 
-        {0,4,13,21,17,9}, {2,11,19,21,13,6},
-        {1,9,17,23,15,5}, {3,7,15,23,19,11} }; // xyz positive or negative: +++, ++-, +-+, +--, -++, -+-, --+, ---
-    const int square_faces[6][4] = { 
-        {16,22,18,20}, {17,21,19,23}, {4,12,6,13},
-        {5,15,7,14}, {0,9,1,8}, {2,10,3,11} }; // x=2, x=-2, y=2, y=-2, z=2, z=-2
-
-    // stack them in a grid, merging duplicated vertices
-    vtkSmartPointer<vtkAppendFilter> append = vtkSmartPointer<vtkAppendFilter>::New();
-    append->MergePointsOn();
-    for(int z=0;z<side*2-1;z++)
+    public:
+
+        LatticeHoneycomb(int nx,int ny,int nz,int num_vertices,const vector<vector<int> >& faces);
+        virtual ~LatticeHoneycomb() {}
+
+        void Build(vtkUnstructuredGrid *mesh,MeshGenerators::ProgressCallback progress,void *progress_data);
+
+    protected:
+
+        /// Returns the position of vertex i of cell (x,y,z). Must be defined for all x,y,z >= 0, not just those in the mesh.
+        virtual void GetCellPoint(int x,int y,int z,int i,double p[3]) const = 0;
+        /// Returns whether cell (x,y,z) is part of the mesh, for 0 <= x < nx etc.
+        virtual bool HasCell(int x,int y,int z) const { return true; }
+
+    protected:
+
+        static const int PERIOD = 4; ///< the lattices here repeat themselves every 4 cells along each axis, or sooner
+        static const int RANGE = 2;  ///< cells sharing a vertex are at most this many steps apart along each axis
+
+        struct SharedVertex
+        {
+            int dx,dy,dz; ///< where the other cell is
+            int i;        ///< the index of the vertex in the other cell
+        };
+
+        struct Neighbor
+        {
+            int dx,dy,dz;
+            int face; ///< which of our faces the neighbor is across, or -1 if it only shares edges or vertices
+            bool shares_edge;
+        };
+
+        int GetResidueClass(int x,int y,int z) const { return (x%PERIOD) + PERIOD * ( (y%PERIOD) + PERIOD * (z%PERIOD) ); }
+        vtkIdType GetBoxIndex(int x,int y,int z) const { return x + this->nx * ( y + (vtkIdType)this->ny * z ); }
+        bool IsInBox(int x,int y,int z) const { return x>=0 && x<this->nx && y>=0 && y<this->ny && z>=0 && z<this->nz; }
+
+        void FindSharedVertices();
+        void CountOwnedPoints(int z);
+        void WriteCells(int z);
+        void RunOverLayers(void (LatticeHoneycomb::*method)(int),double progress_from,double progress_to,
+            MeshGenerators::ProgressCallback progress,void *progress_data);
+        static VTK_THREAD_RETURN_TYPE ThreadedRunOverLayers(void *arg);
+
+    protected:
+
+        int nx,ny,nz;
+        int num_vertices;
+        vector<vector<int> > faces;
+        int face_stream_size; ///< how many entries each cell takes in the polyhedron face stream
+
+        vector<vector<vector<SharedVertex> > > shared_vertices; ///< for each residue class and vertex, the other cells that have it
+        vector<vector<Neighbor> > neighbors;                   ///< for each residue class, the cells that share at least a vertex
+        int max_vertex_neighbors,max_edge_neighbors;
+
+        vector<int> cell_ids;                 ///< for each position in the box, the id of the cell there, or -1
+        vector<unsigned int> owned_points;    ///< for each cell, a bit set for each vertex that it owns
+        vector<vtkIdType> first_point_id;     ///< for each cell, the id of the first point it owns
+
+        // the output arrays, while they are being filled
+        float *points;
+        vtkIdType *cell_points,*cell_faces;
+        int *vertex_neighbors,*edge_neighbors,*face_neighbors;
+
+        // which layers to work on next, in RunOverLayers
+        void (LatticeHoneycomb::*layer_method)(int);
+        int z_from,z_to;
+};
+
+// ---------------------------------------------------------------------
+
+LatticeHoneycomb::LatticeHoneycomb(int nx,int ny,int nz,int num_vertices,const vector<vector<int> >& faces)
+    : nx(nx), ny(ny), nz(nz)
+    , num_vertices(num_vertices)
+    , faces(faces)
+    , max_vertex_neighbors(0)
+    , max_edge_neighbors(0)
+    , points(NULL)
+    , cell_points(NULL)
+    , cell_faces(NULL)
+    , vertex_neighbors(NULL)
+    , edge_neighbors(NULL)
+    , face_neighbors(NULL)
+    , layer_method(NULL)
+    , z_from(0)
+    , z_to(0)
+{
+    if(num_vertices > 31)
+        throw runtime_error("LatticeHoneycomb::LatticeHoneycomb : too many vertices");
+    this->face_stream_size = 1;
+    for(size_t iF=0;iF<faces.size();iF++)
+        this->face_stream_size += 1 + (int)faces[iF].size();
+}
+
+// ---------------------------------------------------------------------
+
+void LatticeHoneycomb::FindSharedVertices()
+{
+    const int num_classes = PERIOD * PERIOD * PERIOD;
+    this->shared_vertices.assign(num_classes,vector<vector<SharedVertex> >(this->num_vertices));
+    this->neighbors.assign(num_classes,vector<Neighbor>());
+    this->max_vertex_neighbors = this->max_edge_neighbors = 0;
+    vector<vector<double> > p1(this->num_vertices,vector<double>(3)),p2(p1);
+    for(int iClass=0;iClass<num_classes;iClass++)
     {
-        for(int y=0;y<side-z%2;y++)
+        // a cell of this class well inside the lattice, so that all the cells around it are valid
+        const int x = PERIOD + iClass % PERIOD;
+        const int y = PERIOD + ( iClass / PERIOD ) % PERIOD;
+        const int z = PERIOD + iClass / ( PERIOD * PERIOD );
+        for(int i=0;i<this->num_vertices;i++)
+            this->GetCellPoint(x,y,z,i,&p1[i][0]);
+        int n_edge_neighbors = 0;
+        for(int dz=-RANGE;dz<=RANGE;dz++)
         {
-            for(int x=0;x<side-z%2;x++)
+            for(int dy=-RANGE;dy<=RANGE;dy++)
             {
-                vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
-                vector<vtkIdType> pointIds,faceStream;
-                vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-                for(int i=0;i<24;i++) 
-                    pointIds.push_back(points->InsertNextPoint( coords[i][0]+x*4+(z%2)*2, 
-                        coords[i][1]+y*4+(z%2)*2, coords[i][2]+z*2)); // body-centred
-                for(int i=0;i<8;i++) {
-                    faceStream.push_back(6);
-                    for(int j=0;j<6;j++)
-                        faceStream.push_back(hex_faces[i][j]);
-                }
-                for(int i=0;i<6;i++) {
-                    faceStream.push_back(4);
-                    for(int j=0;j<4;j++)
-                        faceStream.push_back(square_faces[i][j]);
+                for(int dx=-RANGE;dx<=RANGE;dx++)
+                {
+                    if(dx==0 && dy==0 && dz==0) continue;
+                    for(int i=0;i<this->num_vertices;i++)
+                        this->GetCellPoint(x+dx,y+dy,z+dz,i,&p2[i][0]);
+                    vector<bool> is_shared(this->num_vertices,false);
+                    bool any_shared = false;
+                    for(int i=0;i<this->num_vertices;i++)
+                    {
+                        for(int j=0;j<this->num_vertices;j++)
+                        {
+                            if(vtkMath::Distance2BetweenPoints(&p1[i][0],&p2[j][0]) < 1e-12)
+                            {
+                                SharedVertex sv = { dx, dy, dz, j };
+                                this->shared_vertices[iClass][i].push_back(sv);
+                                is_shared[i] = any_shared = true;
+                            }
+                        }
+                    }
+                    if(!any_shared) continue;
+                    Neighbor nbor = { dx, dy, dz, -1, false };
+                    for(size_t iF=0;iF<this->faces.size();iF++)
+                    {
+                        bool all_shared = true;
+                        for(size_t j=0;j<this->faces[iF].size();j++)
+                        {
+                            all_shared = all_shared && is_shared[ this->faces[iF][j] ];
+                            if(is_shared[ this->faces[iF][j] ] && is_shared[ this->faces[iF][(j+1)%this->faces[iF].size()] ])
+                                nbor.shares_edge = true;
+                        }
+                        if(all_shared)
+                            nbor.face = (int)iF;
+                    }
+                    this->neighbors[iClass].push_back(nbor);
+                    if(nbor.shares_edge) n_edge_neighbors++;
                 }
-                ug->InsertNextCell(VTK_POLYHEDRON,24,&pointIds.front(),14,&faceStream.front());
-                ug->SetPoints(points);
-                #if VTK_MAJOR_VERSION >= 6
-                    append->AddInputData(ug);
-                #else
-                    append->AddInput(ug);
-                #endif
             }
         }
+        this->max_vertex_neighbors = max(this->max_vertex_neighbors,(int)this->neighbors[iClass].size());
+        this->max_edge_neighbors = max(this->max_edge_neighbors,n_edge_neighbors);
     }
-    append->Update();
-    mesh->DeepCopy(append->GetOutput());
+}
 
-    // allocate the chemicals arrays
-    for(int iChem=0;iChem<n_chems;iChem++)
+// ---------------------------------------------------------------------
+
+void LatticeHoneycomb::CountOwnedPoints(int z)
+{
+    for(int y=0;y<this->ny;y++)
     {
-        vtkSmartPointer<vtkDataArray> scalars = vtkSmartPointer<vtkDataArray>::Take( vtkDataArray::CreateDataArray( data_type ) );        
-        scalars->SetNumberOfComponents(1);
-        scalars->SetNumberOfTuples(mesh->GetNumberOfCells());
-        scalars->SetName(GetChemicalName(iChem).c_str());
-        scalars->FillComponent(0,0.0f);
-        mesh->GetCellData()->AddArray(scalars);
+        for(int x=0;x<this->nx;x++)
+        {
+            const int iCell = this->cell_ids[this->GetBoxIndex(x,y,z)];
+            if(iCell<0) continue;
+            const vector<vector<SharedVertex> >& shared = this->shared_vertices[this->GetResidueClass(x,y,z)];
+            unsigned int owned = 0;
+            for(int i=0;i<this->num_vertices;i++)
+            {
+                // a point belongs to the first of the cells that have it
+                bool is_owned = true;
+                for(size_t j=0;j<shared[i].size() && is_owned;j++)
+                {
+                    const SharedVertex& sv = shared[i][j];
+                    if(this->IsInBox(x+sv.dx,y+sv.dy,z+sv.dz) && this->cell_ids[this->GetBoxIndex(x+sv.dx,y+sv.dy,z+sv.dz)] >= 0 
+                        && this->cell_ids[this->GetBoxIndex(x+sv.dx,y+sv.dy,z+sv.dz)] < iCell)
+                        is_owned = false;
+                }
+                if(is_owned)
+                    owned |= 1u << i;
+            }
+            this->owned_points[iCell] = owned;
+        }
     }
 }
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetFaceCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type)
+/// Returns the number of bits set in b below bit i.
+int CountBitsBelow(unsigned int b,int i)
 {
-    // a rhombic dodecahedron
-    const double coords[14][3] = { 
-        {-2,0,0},{2,0,0},{0,-2,0},{0,2,0},{0,0,-2},{0,0,2}, // 0,1,2,3,4,5,
-        {-1,-1,-1},{-1,-1,1},{-1,1,-1},{-1,1,1}, // 6,7,8,9
-        {1,-1,-1},{1,-1,1},{1,1,-1},{1,1,1} // 10,11,12,13
-    };
-    const int faces[12][4] = { 
-        {0,7,5,9},{9,5,13,3},{13,5,11,1},{5,7,2,11},
-        {0,6,2,7},{0,9,3,8},{0,8,4,6},{2,6,4,10},
-        {3,12,4,8},{1,10,4,12},{1,11,2,10},{1,12,3,13}
-    };
-
-    // stack them in a grid, merging duplicated vertices
-    vtkSmartPointer<vtkAppendFilter> append = vtkSmartPointer<vtkAppendFilter>::New();
-    append->MergePointsOn();
-    for(int z=0;z<side*2;z++)
+    int n = 0;
+    for(b &= (1u << i) - 1; b; b &= b - 1) n++;
+    return n;
+}
+
+// ---------------------------------------------------------------------
+
+void LatticeHoneycomb::WriteCells(int z)
+{
+    vector<vtkIdType> point_ids(this->num_vertices);
+    double p[3];
+    for(int y=0;y<this->ny;y++)
     {
-        for(int y=0;y<side;y++)
+        for(int x=0;x<this->nx;x++)
         {
-            for(int x=0;x<side*2;x++)
+            const int iCell = this->cell_ids[this->GetBoxIndex(x,y,z)];
+            if(iCell<0) continue;
+            const int iClass = this->GetResidueClass(x,y,z);
+            // work out the point ids, and write the points that this cell owns
+            for(int i=0;i<this->num_vertices;i++)
             {
-                vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
-                vector<vtkIdType> pointIds,faceStream;
-                vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-                for(int i=0;i<14;i++) 
-                    pointIds.push_back(points->InsertNextPoint( coords[i][0]+x*2+(z%2)*2, 
-                        coords[i][1]+y*4+(x%2)*2, coords[i][2]+z*2)); // face-centred
-                for(int i=0;i<12;i++) {
-                    faceStream.push_back(4);
-                    for(int j=0;j<4;j++)
-                        faceStream.push_back(faces[i][j]);
+                int iOwner = iCell;
+                int iOwnerVertex = i;
+                for(size_t j=0;j<this->shared_vertices[iClass][i].size();j++)
+                {
+                    const SharedVertex& sv = this->shared_vertices[iClass][i][j];
+                    if(!this->IsInBox(x+sv.dx,y+sv.dy,z+sv.dz)) continue;
+                    const int iOther = this->cell_ids[this->GetBoxIndex(x+sv.dx,y+sv.dy,z+sv.dz)];
+                    if(iOther >= 0 && iOther < iOwner)
+                    {
+                        iOwner = iOther;
+                        iOwnerVertex = sv.i;
+                    }
+                }
+                point_ids[i] = this->first_point_id[iOwner] + CountBitsBelow(this->owned_points[iOwner],iOwnerVertex);
+                if(iOwner == iCell)
+                {
+                    this->GetCellPoint(x,y,z,i,p);
+                    for(int xyz=0;xyz<3;xyz++)
+                        this->points[ point_ids[i]*3 + xyz ] = (float)p[xyz];
                 }
-                ug->InsertNextCell(VTK_POLYHEDRON,14,&pointIds.front(),12,&faceStream.front());
-                ug->SetPoints(points);
-                #if VTK_MAJOR_VERSION >= 6
-                    append->AddInputData(ug);
-                #else
-                    append->AddInput(ug);
-                #endif
             }
+            // write the cell, in the layout that vtkUnstructuredGrid::SetCells expects
+            vtkIdType *pts = this->cell_points + (vtkIdType)iCell * ( 1 + this->num_vertices );
+            *pts++ = this->num_vertices;
+            for(int i=0;i<this->num_vertices;i++)
+                *pts++ = point_ids[i];
+            vtkIdType *face_stream = this->cell_faces + (vtkIdType)iCell * this->face_stream_size;
+            *face_stream++ = (vtkIdType)this->faces.size();
+            for(size_t iF=0;iF<this->faces.size();iF++)
+            {
+                *face_stream++ = (vtkIdType)this->faces[iF].size();
+                for(size_t j=0;j<this->faces[iF].size();j++)
+                    *face_stream++ = point_ids[ this->faces[iF][j] ];
+            }
+            // write the neighbors
+            int *vertex_nbors = this->vertex_neighbors + (vtkIdType)iCell * this->max_vertex_neighbors;
+            int *edge_nbors = this->edge_neighbors + (vtkIdType)iCell * this->max_edge_neighbors;
+            int *face_nbors = this->face_neighbors + (vtkIdType)iCell * this->faces.size();
+            int n_vertex_nbors = 0, n_edge_nbors = 0;
+            for(size_t iF=0;iF<this->faces.size();iF++)
+                face_nbors[iF] = -1;
+            for(size_t j=0;j<this->neighbors[iClass].size();j++)
+            {
+                const Neighbor& nbor = this->neighbors[iClass][j];
+                if(!this->IsInBox(x+nbor.dx,y+nbor.dy,z+nbor.dz)) continue;
+                const int iOther = this->cell_ids[this->GetBoxIndex(x+nbor.dx,y+nbor.dy,z+nbor.dz)];
+                if(iOther < 0) continue;
+                vertex_nbors[n_vertex_nbors++] = iOther;
+                if(nbor.shares_edge)
+                    edge_nbors[n_edge_nbors++] = iOther;
+                if(nbor.face >= 0)
+                    face_nbors[nbor.face] = iOther;
+            }
+            for(;n_vertex_nbors<this->max_vertex_neighbors;n_vertex_nbors++)
+                vertex_nbors[n_vertex_nbors] = -1;
+            for(;n_edge_nbors<this->max_edge_neighbors;n_edge_nbors++)
+                edge_nbors[n_edge_nbors] = -1;
         }
     }
-    append->Update();
-    mesh->DeepCopy(append->GetOutput());
+}
+
+// ---------------------------------------------------------------------
+
+/* static */ VTK_THREAD_RETURN_TYPE LatticeHoneycomb::ThreadedRunOverLayers(void *arg)
+{
+    vtkMultiThreader::ThreadInfo *info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+    LatticeHoneycomb *self = static_cast<LatticeHoneycomb*>(info->UserData);
+    for(int z=self->z_from+info->ThreadID;z<self->z_to;z+=info->NumberOfThreads)
+        (self->*(self->layer_method))(z);
+    return VTK_THREAD_RETURN_VALUE;
+}
+
+// ---------------------------------------------------------------------
+
+void LatticeHoneycomb::RunOverLayers(void (LatticeHoneycomb::*method)(int),double progress_from,double progress_to,
+    MeshGenerators::ProgressCallback progress,void *progress_data)
+{
+    // the layers are done in batches, so that we can report progress from this thread in between
+    const int N_BATCHES = 20;
+    vtkSmartPointer<vtkMultiThreader> threader = vtkSmartPointer<vtkMultiThreader>::New();
+    this->layer_method = method;
+    for(int iBatch=0;iBatch<N_BATCHES;iBatch++)
+    {
+        this->z_from = this->nz * iBatch / N_BATCHES;
+        this->z_to = this->nz * ( iBatch + 1 ) / N_BATCHES;
+        if(this->z_to <= this->z_from) continue;
+        threader->SetNumberOfThreads( max( 1, min( vtkMultiThreader::GetGlobalDefaultNumberOfThreads(), this->z_to - this->z_from ) ) );
+        threader->SetSingleMethod(LatticeHoneycomb::ThreadedRunOverLayers, this);
+        threader->SingleMethodExecute();
+        if(progress)
+            progress(progress_from + ( progress_to - progress_from ) * ( iBatch + 1 ) / N_BATCHES, progress_data);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void LatticeHoneycomb::Build(vtkUnstructuredGrid *mesh,MeshGenerators::ProgressCallback progress,void *progress_data)
+{
+    this->FindSharedVertices();
+
+    // number the cells
+    this->cell_ids.assign((size_t)this->nx * this->ny * this->nz,-1);
+    int n_cells = 0;
+    for(int z=0;z<this->nz;z++)
+        for(int y=0;y<this->ny;y++)
+            for(int x=0;x<this->nx;x++)
+                if(this->HasCell(x,y,z))
+                    this->cell_ids[this->GetBoxIndex(x,y,z)] = n_cells++;
+
+    // number the points
+    this->owned_points.resize(n_cells);
+    this->RunOverLayers(&LatticeHoneycomb::CountOwnedPoints,0.0,0.3,progress,progress_data);
+    this->first_point_id.resize(n_cells);
+    vtkIdType n_points = 0;
+    for(int iCell=0;iCell<n_cells;iCell++)
+    {
+        this->first_point_id[iCell] = n_points;
+        n_points += CountBitsBelow(this->owned_points[iCell],this->num_vertices);
+    }
+
+    // allocate the output arrays and fill them in
+    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    pts->SetDataTypeToFloat();
+    pts->SetNumberOfPoints(n_points);
+    this->points = static_cast<float*>(pts->GetVoidPointer(0));
+    vtkSmartPointer<vtkIdTypeArray> cell_points_array = vtkSmartPointer<vtkIdTypeArray>::New();
+    cell_points_array->SetNumberOfValues((vtkIdType)n_cells * ( 1 + this->num_vertices ));
+    this->cell_points = cell_points_array->GetPointer(0);
+    vtkSmartPointer<vtkIdTypeArray> faces_array = vtkSmartPointer<vtkIdTypeArray>::New();
+    faces_array->SetNumberOfValues((vtkIdType)n_cells * this->face_stream_size);
+    this->cell_faces = faces_array->GetPointer(0);
+    vtkSmartPointer<vtkIntArray> vertex_neighbors_array = vtkSmartPointer<vtkIntArray>::New();
+    vertex_neighbors_array->SetName(MeshGenerators::VERTEX_NEIGHBORS_ARRAY);
+    vertex_neighbors_array->SetNumberOfComponents(max(1,this->max_vertex_neighbors));
+    vertex_neighbors_array->SetNumberOfTuples(n_cells);
+    this->vertex_neighbors = vertex_neighbors_array->GetPointer(0);
+    if(this->max_vertex_neighbors==0) // (then WriteCells leaves the single component alone)
+        fill(this->vertex_neighbors,this->vertex_neighbors + n_cells,-1);
+    vtkSmartPointer<vtkIntArray> edge_neighbors_array = vtkSmartPointer<vtkIntArray>::New();
+    edge_neighbors_array->SetName(MeshGenerators::EDGE_NEIGHBORS_ARRAY);
+    edge_neighbors_array->SetNumberOfComponents(max(1,this->max_edge_neighbors));
+    edge_neighbors_array->SetNumberOfTuples(n_cells);
+    this->edge_neighbors = edge_neighbors_array->GetPointer(0);
+    if(this->max_edge_neighbors==0)
+        fill(this->edge_neighbors,this->edge_neighbors + n_cells,-1);
+    vtkSmartPointer<vtkIntArray> face_neighbors_array = vtkSmartPointer<vtkIntArray>::New();
+    face_neighbors_array->SetName(MeshGenerators::FACE_NEIGHBORS_ARRAY);
+    face_neighbors_array->SetNumberOfComponents((int)this->faces.size());
+    face_neighbors_array->SetNumberOfTuples(n_cells);
+    this->face_neighbors = face_neighbors_array->GetPointer(0);
+    this->RunOverLayers(&LatticeHoneycomb::WriteCells,0.3,1.0,progress,progress_data);
+
+    // hand the arrays over to the mesh
+    vtkSmartPointer<vtkUnsignedCharArray> cell_types = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    cell_types->SetNumberOfValues(n_cells);
+    vtkSmartPointer<vtkIdTypeArray> cell_locations = vtkSmartPointer<vtkIdTypeArray>::New();
+    cell_locations->SetNumberOfValues(n_cells);
+    vtkSmartPointer<vtkIdTypeArray> face_locations = vtkSmartPointer<vtkIdTypeArray>::New();
+    face_locations->SetNumberOfValues(n_cells);
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+    {
+        cell_types->SetValue(iCell,VTK_POLYHEDRON);
+        cell_locations->SetValue(iCell,iCell * ( 1 + this->num_vertices ));
+        face_locations->SetValue(iCell,iCell * this->face_stream_size);
+    }
+    vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
+    cells->SetCells(n_cells,cell_points_array);
+    mesh->Initialize();
+    mesh->SetPoints(pts);
+    mesh->SetCells(cell_types,cell_locations,cells,face_locations,faces_array);
+    mesh->GetFieldData()->AddArray(vertex_neighbors_array);
+    mesh->GetFieldData()->AddArray(edge_neighbors_array);
+    mesh->GetFieldData()->AddArray(face_neighbors_array);
+    this->points = NULL;
+    this->cell_points = this->cell_faces = NULL;
+    this->vertex_neighbors = this->edge_neighbors = this->face_neighbors = NULL;
+}
+
+// ---------------------------------------------------------------------
+
+/// Truncated octahedra, body-centred: a layer of side x side cells, then a layer of side-1 x side-1 in the gaps, and so on.
+class BodyCentredCubicHoneycomb : public LatticeHoneycomb
+{
+    public:
+
+        BodyCentredCubicHoneycomb(int side) : LatticeHoneycomb(side,side,side*2-1,24,GetFaces()), side(side) {}
+
+    protected:
+
+        static vector<vector<int> > GetFaces()
+        {
+            const int hex_faces[8][6] = { 
+                {0,8,16,20,12,4}, {2,6,12,20,18,10}, 
+                {1,5,14,22,16,8}, {3,10,18,22,14,7}, 
+                {0,4,13,21,17,9}, {2,11,19,21,13,6},
+                {1,9,17,23,15,5}, {3,7,15,23,19,11} }; // xyz positive or negative: +++, ++-, +-+, +--, -++, -+-, --+, ---
+            const int square_faces[6][4] = { 
+                {16,22,18,20}, {17,21,19,23}, {4,12,6,13},
+                {5,15,7,14}, {0,9,1,8}, {2,10,3,11} }; // x=2, x=-2, y=2, y=-2, z=2, z=-2
+            vector<vector<int> > faces;
+            for(int i=0;i<8;i++)
+                faces.push_back(vector<int>(hex_faces[i],hex_faces[i]+6));
+            for(int i=0;i<6;i++)
+                faces.push_back(vector<int>(square_faces[i],square_faces[i]+4));
+            return faces;
+        }
+
+        virtual void GetCellPoint(int x,int y,int z,int i,double p[3]) const
+        {
+            const double coords[24][3] = { 
+                {0,1,2}, {0,-1,2}, {0,1,-2}, {0,-1,-2},   // 0,1,2,3
+                {0,2,1}, {0,-2,1}, {0,2,-1}, {0,-2,-1},   // 4,5,6,7
+                {1,0,2}, {-1,0,2}, {1,0,-2}, {-1,0,-2},   // 8,9,10,11
+                {1,2,0}, {-1,2,0}, {1,-2,0}, {-1,-2,0},   // 12,13,14,15
+                {2,0,1}, {-2,0,1}, {2,0,-1}, {-2,0,-1},   // 16,17,18,19
+                {2,1,0}, {-2,1,0}, {2,-1,0}, {-2,-1,0} }; // 20,21,22,23
+            p[0] = coords[i][0] + x*4 + (z%2)*2; // body-centred
+            p[1] = coords[i][1] + y*4 + (z%2)*2;
+            p[2] = coords[i][2] + z*2;
+        }
+
+        virtual bool HasCell(int x,int y,int z) const { return x < this->side - z%2 && y < this->side - z%2; }
+
+    protected:
+
+        int side;
+};
+
+// ---------------------------------------------------------------------
+
+/// Rhombic dodecahedra, face-centred.
+class FaceCentredCubicHoneycomb : public LatticeHoneycomb
+{
+    public:
+
+        FaceCentredCubicHoneycomb(int side) : LatticeHoneycomb(side*2,side,side*2,14,GetFaces()) {}
+
+    protected:
+
+        static vector<vector<int> > GetFaces()
+        {
+            const int faces[12][4] = { 
+                {0,7,5,9},{9,5,13,3},{13,5,11,1},{5,7,2,11},
+                {0,6,2,7},{0,9,3,8},{0,8,4,6},{2,6,4,10},
+                {3,12,4,8},{1,10,4,12},{1,11,2,10},{1,12,3,13}
+            };
+            vector<vector<int> > face_list;
+            for(int i=0;i<12;i++)
+                face_list.push_back(vector<int>(faces[i],faces[i]+4));
+            return face_list;
+        }
+
+        virtual void GetCellPoint(int x,int y,int z,int i,double p[3]) const
+        {
+            const double coords[14][3] = { 
+                {-2,0,0},{2,0,0},{0,-2,0},{0,2,0},{0,0,-2},{0,0,2}, // 0,1,2,3,4,5,
+                {-1,-1,-1},{-1,-1,1},{-1,1,-1},{-1,1,1}, // 6,7,8,9
+                {1,-1,-1},{1,-1,1},{1,1,-1},{1,1,1} // 10,11,12,13
+            };
+            p[0] = coords[i][0] + x*2 + (z%2)*2; // face-centred
+            p[1] = coords[i][1] + y*4 + (x%2)*2;
+            p[2] = coords[i][2] + z*2;
+        }
+};
+
+// ---------------------------------------------------------------------
+
+/// Triakis truncated tetrahedra, the Voronoi cells of the carbon atoms in a diamond lattice.
+class DiamondHoneycomb : public LatticeHoneycomb
+{
+    public:
+
+        DiamondHoneycomb(int side) : LatticeHoneycomb(side,side,side*2,16,GetFaces()) {}
+
+    protected:
+
+        static vector<vector<int> > GetFaces()
+        {
+            const int hex_faces[4][6] = { {4,5,8,9,13,12}, {5,4,14,15,11,10}, {6,7,15,14,12,13}, {7,6,9,8,10,11} };
+            const int tri_faces[12][3] = { {0,12,14},{0,14,4},{0,4,12}, {1,10,8},{1,8,5},{1,5,10},
+                {2,9,6},{2,6,13},{2,13,9}, {3,7,11},{3,11,15},{3,15,7} };
+            vector<vector<int> > faces;
+            for(int i=0;i<4;i++)
+                faces.push_back(vector<int>(hex_faces[i],hex_faces[i]+6));
+            for(int i=0;i<12;i++)
+                faces.push_back(vector<int>(tri_faces[i],tri_faces[i]+3));
+            return faces;
+        }
+
+        virtual void GetCellPoint(int x,int y,int z,int i,double p[3]) const
+        {
+            // a triakis truncated tetrahedron: 16 points, 4 hexagonal faces, 12 triangular faces
+            const double RR2 = 1.0 / sqrt(2.0); // reciprocal of root 2
+            const double third = 1.0 / 3.0;
+            const double coords[16][3] = { 
+                //{-1,0,-RR2}, {1,0,-RR2}, {0,-1,RR2}, {0,1,RR2},          // (tips of the original tetrahedron)
+                {-2*third,0,-2*third*RR2}, {2*third,0,-2*third*RR2},       // 0, 1
+                {0,-2*third,2*third*RR2}, {0,2*third,2*third*RR2},         // 2, 3 (centroids of the snipped-off tetrahedra)
+                {-third,0,-RR2}, {third,0,-RR2},                           // 4, 5
+                {0,-third,RR2}, {0,third,RR2},                             // 6, 7
+                {2*third,-third,-third*RR2},  {third,-2*third,third*RR2},  // 8, 9
+                {2*third,third,-third*RR2},   {third,2*third,third*RR2},   // 10, 11
+                {-2*third,-third,-third*RR2}, {-third,-2*third,third*RR2}, // 12, 13
+                {-2*third,third,-third*RR2},  {-third,2*third,third*RR2}   // 14, 15
+            };
+            const double offset[3] = { x*(1+third), y*(1+third), (z/2)*RR2*(1+third) + (z%2)*2*third*RR2 };
+            double mx=0.0,my=0.0;
+            if((z/2)%2)
+            {
+                mx = 2*third;
+                my = -2*third;
+            }
+            if(z%2)
+            {
+                p[0] = coords[i][0] + offset[0] + mx;
+                p[1] = coords[i][1] + offset[1] + my;
+            }
+            else
+            {
+                // rotated a quarter turn
+                p[0] = -coords[i][1] + offset[0] + mx;
+                p[1] = coords[i][0] + offset[1] + 2*third + my;
+            }
+            p[2] = coords[i][2] + offset[2];
+        }
+};
+
+// ---------------------------------------------------------------------
+
+void MeshGenerators::GetBodyCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type,
+    ProgressCallback progress,void* progress_data)
+{
+    BodyCentredCubicHoneycomb honeycomb(side);
+    honeycomb.Build(mesh,progress,progress_data);
 
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
@@ -841,78 +1518,31 @@ void MeshGenerators::GetFaceCentredCubicHoneycomb(int side,vtkUnstructuredGrid*
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetDiamondCells(int side,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+void MeshGenerators::GetFaceCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type,
+    ProgressCallback progress,void* progress_data)
 {
-    // a triakis truncated tetrahedron: 16 points, 4 hexagonal faces, 12 triangular faces
-    const double RR2 = 1.0 / sqrt(2.0); // reciprocal of root 2
-    const double third = 1.0 / 3.0;
-    const double coords[16][3] = { 
-        //{-1,0,-RR2}, {1,0,-RR2}, {0,-1,RR2}, {0,1,RR2},          // (tips of the original tetrahedron)
-        {-2*third,0,-2*third*RR2}, {2*third,0,-2*third*RR2},       // 0, 1
-        {0,-2*third,2*third*RR2}, {0,2*third,2*third*RR2},         // 2, 3 (centroids of the snipped-off tetrahedra)
-        {-third,0,-RR2}, {third,0,-RR2},                           // 4, 5
-        {0,-third,RR2}, {0,third,RR2},                             // 6, 7
-        {2*third,-third,-third*RR2},  {third,-2*third,third*RR2},  // 8, 9
-        {2*third,third,-third*RR2},   {third,2*third,third*RR2},   // 10, 11
-        {-2*third,-third,-third*RR2}, {-third,-2*third,third*RR2}, // 12, 13
-        {-2*third,third,-third*RR2},  {-third,2*third,third*RR2}   // 14, 15
-    };
-    const int hex_faces[4][6] = { {4,5,8,9,13,12}, {5,4,14,15,11,10}, {6,7,15,14,12,13}, {7,6,9,8,10,11} };
-    const int tri_faces[12][3] = { {0,12,14},{0,14,4},{0,4,12}, {1,10,8},{1,8,5},{1,5,10},
-        {2,9,6},{2,6,13},{2,13,9}, {3,7,11},{3,11,15},{3,15,7} };
-
-    // stack them in a grid, merging duplicated vertices
-    vtkSmartPointer<vtkAppendFilter> append = vtkSmartPointer<vtkAppendFilter>::New();
-    append->MergePointsOn();
-
-    for(int x=0;x<side;x++)
+    FaceCentredCubicHoneycomb honeycomb(side);
+    honeycomb.Build(mesh,progress,progress_data);
+
+    // allocate the chemicals arrays
+    for(int iChem=0;iChem<n_chems;iChem++)
     {
-        for(int y=0;y<side;y++)
-        {
-            for(int z=0;z<side*2;z++)
-            {
-                vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
-                vector<vtkIdType> pointIds,faceStream;
-                vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-                for(int i=0;i<16;i++) 
-                {
-                    double offset[3] = { x*(1+third), y*(1+third), (z/2)*RR2*(1+third) + (z%2)*2*third*RR2 };
-                    double mx=0.0,my=0.0;
-                    if((z/2)%2)
-                    {
-                        mx = 2*third;
-                        my = -2*third;
-                    }
-                    if(z%2)
-                        pointIds.push_back(points->InsertNextPoint( coords[i][0] + offset[0] + mx, coords[i][1] + offset[1] + my, coords[i][2] + offset[2] ));
-                    else
-                        pointIds.push_back(points->InsertNextPoint( -coords[i][1] + offset[1] + mx, coords[i][0] + offset[0] + 2*third + my, coords[i][2] + offset[2] ));
-                }
-                for(int i=0;i<4;i++) 
-                {
-                    faceStream.push_back(6);
-                    for(int j=0;j<6;j++)
-                        faceStream.push_back(hex_faces[i][j]);
-                }
-                for(int i=0;i<12;i++) 
-                {
-                    faceStream.push_back(3);
-                    for(int j=0;j<3;j++)
-                        faceStream.push_back(tri_faces[i][j]);
-                }
-                ug->InsertNextCell(VTK_POLYHEDRON,16,&pointIds.front(),16,&faceStream.front());
-                ug->SetPoints(points);
-                #if VTK_MAJOR_VERSION >= 6
-                    append->AddInputData(ug);
-                #else
-                    append->AddInput(ug);
-                #endif
-            }
-        }
+        vtkSmartPointer<vtkDataArray> scalars = vtkSmartPointer<vtkDataArray>::Take( vtkDataArray::CreateDataArray( data_type ) );        
+        scalars->SetNumberOfComponents(1);
+        scalars->SetNumberOfTuples(mesh->GetNumberOfCells());
+        scalars->SetName(GetChemicalName(iChem).c_str());
+        scalars->FillComponent(0,0.0f);
+        mesh->GetCellData()->AddArray(scalars);
     }
+}
 
-    append->Update();
-    mesh->DeepCopy(append->GetOutput());
+// ---------------------------------------------------------------------
+
+void MeshGenerators::GetDiamondCells(int side,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+    ProgressCallback progress,void* progress_data)
+{
+    DiamondHoneycomb honeycomb(side);
+    honeycomb.Build(mesh,progress,progress_data);
 
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
@@ -959,13 +1589,211 @@ void GetInversionCircleForPlaneTiling( double edge_length, int schlafli1, int sc
 
 // ---------------------------------------------------------------------
 
+/// Finds points that have already been seen, by rounding their coordinates onto a fine grid and keying a map on the result.
+/**
+ * The cells of a hyperbolic tiling shrink towards the edge of the Poincare ball, so a fixed spacing would merge distinct
+ * points there. Instead each point p is first moved to p / (1 - |p|^2/ball_radius^2), which stretches the cells back to
+ * about the size they have at the center, so the spacing is relative to the local size of the cells.
+ */
+class PointGridMap
+{
+    public:
+
+        PointGridMap(double spacing,double ball_radius) : spacing(spacing), ball_radius2(ball_radius*ball_radius) {}
+
+        /// Returns the id of a point within about spacing (relative to the size of the cells around it) of p, or -1 if there isn't one.
+        vtkIdType Find(const double p[3]) const
+        {
+            // p might lie next to a grid boundary, so we also look in the neighboring grid cells
+            const GridKey k = this->GetKey(p);
+            for(int dx=-1;dx<=1;dx++)
+                for(int dy=-1;dy<=1;dy++)
+                    for(int dz=-1;dz<=1;dz++)
+                    {
+                        const GridKey k2 = { k.x+dx, k.y+dy, k.z+dz };
+                        map<GridKey,vtkIdType>::const_iterator it = this->ids.find(k2);
+                        if(it != this->ids.end())
+                            return it->second;
+                    }
+            return -1;
+        }
+
+        void Insert(const double p[3],vtkIdType id) { this->ids[this->GetKey(p)] = id; }
+
+    protected:
+
+        struct GridKey
+        {
+            double x,y,z; // integral values
+            bool operator<(const GridKey& b) const
+            {
+                if(this->x != b.x) return this->x < b.x;
+                if(this->y != b.y) return this->y < b.y;
+                return this->z < b.z;
+            }
+        };
+
+        GridKey GetKey(const double p[3]) const
+        {
+            const double r2 = p[0]*p[0] + p[1]*p[1] + p[2]*p[2];
+            const double s = 1.0 / ( max( 1.0 - r2 / this->ball_radius2, DBL_MIN ) * this->spacing );
+            const GridKey k = { floor(p[0]*s), floor(p[1]*s), floor(p[2]*s) };
+            return k;
+        }
+
+    protected:
+
+        double spacing;
+        double ball_radius2;
+        map<GridKey,vtkIdType> ids;
+};
+
+// ---------------------------------------------------------------------
+
+/// Adds a cell with the given vertices to mesh, merging its points with any already there. Returns the cell id.
+vtkIdType InsertHyperbolicCell(const vector<vector<double> >& coords,const vector<vector<int> >& faces,int cell_type,
+    PointGridMap& found_points,vtkUnstructuredGrid *mesh)
+{
+    const int num_vertices = (int)coords.size();
+    vector<vtkIdType> pointIds( num_vertices );
+    for(int iV = 0; iV < num_vertices; ++iV ) {
+        pointIds[iV] = found_points.Find( &coords[iV][0] );
+        if( pointIds[iV] < 0 ) {
+            pointIds[iV] = mesh->GetPoints()->InsertNextPoint( &coords[iV][0] );
+            found_points.Insert( &coords[iV][0], pointIds[iV] );
+        }
+    }
+    if( cell_type != VTK_POLYHEDRON )
+        return mesh->InsertNextCell( cell_type, num_vertices, &pointIds.front() );
+    vector<vtkIdType> faceStream;
+    for(size_t iF = 0; iF < faces.size(); ++iF )
+    {
+        faceStream.push_back( (vtkIdType)faces[iF].size() );
+        for(size_t j = 0; j < faces[iF].size(); ++j )
+            faceStream.push_back( pointIds[ faces[iF][j] ] );
+    }
+    return mesh->InsertNextCell( VTK_POLYHEDRON, num_vertices, &pointIds.front(), (vtkIdType)faces.size(), &faceStream.front() );
+}
+
+// ---------------------------------------------------------------------
+
+void GetCentroid(const vector<vector<double> >& coords,double centroid[3])
+{
+    centroid[0] = centroid[1] = centroid[2] = 0.0;
+    for(size_t iV = 0; iV < coords.size(); ++iV )
+        for(int xyz = 0; xyz < 3; ++xyz )
+            centroid[xyz] += coords[iV][xyz] / coords.size();
+}
+
+// ---------------------------------------------------------------------
+
+/// Fills mesh with the cells of a hyperbolic tiling, made by reflecting the central cell in the mirror spheres of its faces.
+/**
+ * Face i of the central cell lies on sphere i. A cell is made from the central cell by a list of reflections, applied
+ * from last to first. Its neighbor across face i is made by the same list with i appended, so the cells can be found
+ * breadth-first, expanding only the cells found at the previous level. A cell reached by more than one route is
+ * recognized by its centroid. This finds the same cells as trying every list of up to num_levels reflections, but in
+ * time proportional to the number of cells.
+ *
+ * Points shared between cells are merged as the cells are added. For each cell and face, the cell across that face
+ * (or -1) is written to face_neighbors, since it is known here without having to search the mesh topology.
+ */
+void AddHyperbolicCells(const vector<vector<double> >& vertex_coords,const vector<vector<int> >& faces,
+    const vector<vector<double> >& sphere_centers,double R,int num_levels,int cell_type,double tolerance,
+    vtkUnstructuredGrid *mesh,vector<int>& face_neighbors)
+{
+    const int num_vertices = (int)vertex_coords.size();
+    const int num_faces = (int)faces.size();
+
+    // the neighbors of the central cell
+    vector<vector<vector<double> > > reflected_coords(num_faces,vertex_coords);
+    for(int iF = 0; iF < num_faces; ++iF )
+        for(int iV = 0; iV < num_vertices; ++iV )
+            sphereInversion( &vertex_coords[iV][0], sphere_centers[iF], R, &reflected_coords[iF][iV][0] );
+
+    mesh->Initialize();
+    mesh->Allocate();
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    mesh->SetPoints(points);
+    // the mirror spheres are orthogonal to the boundary of the ball, so its radius comes from any one of them
+    const double d2 = sphere_centers[0][0]*sphere_centers[0][0] + sphere_centers[0][1]*sphere_centers[0][1]
+        + sphere_centers[0][2]*sphere_centers[0][2];
+    const double ball_radius = d2 > R*R ? sqrt( d2 - R*R ) : DBL_MAX;
+    PointGridMap found_points( tolerance, ball_radius );
+    PointGridMap found_centroids( tolerance, ball_radius );
+
+    vector<vector<int> > sphere_lists; // for each cell, the reflections that make it from the central cell
+    vector<int> parents; // for each cell, the cell it was found from
+    double centroid[3];
+
+    // start with the central cell
+    InsertHyperbolicCell( vertex_coords, faces, cell_type, found_points, mesh );
+    GetCentroid( vertex_coords, centroid );
+    found_centroids.Insert( centroid, 0 );
+    sphere_lists.push_back( vector<int>() );
+    parents.push_back( -1 );
+    face_neighbors.assign( num_faces, -1 );
+
+    vector<vector<double> > coords;
+    size_t iLevelStart = 0;
+    for( int iLevel = 0; iLevel <= num_levels; ++iLevel )
+    {
+        // visit the neighbors of the cells found at the previous level, adding any new ones
+        const size_t iLevelEnd = sphere_lists.size();
+        for( size_t iCell = iLevelStart; iCell < iLevelEnd; ++iCell )
+        {
+            for( int iF = 0; iF < num_faces; ++iF )
+            {
+                if( !sphere_lists[iCell].empty() && sphere_lists[iCell].back() == iF ) {
+                    // reflecting twice in the same sphere takes us back to where we came from
+                    face_neighbors[ iCell * num_faces + iF ] = parents[iCell];
+                    continue;
+                }
+                coords = reflected_coords[iF];
+                for(int iV = 0; iV < num_vertices; ++iV )
+                    for(int iS = (int)sphere_lists[iCell].size() - 1; iS >= 0; --iS )
+                        sphereInversion( &coords[iV][0], sphere_centers[ sphere_lists[iCell][iS] ], R, &coords[iV][0] );
+                GetCentroid( coords, centroid );
+                vtkIdType iNeighbor = found_centroids.Find( centroid );
+                if( iNeighbor < 0 && iLevel < num_levels )
+                {
+                    iNeighbor = InsertHyperbolicCell( coords, faces, cell_type, found_points, mesh );
+                    found_centroids.Insert( centroid, iNeighbor );
+                    vector<int> sphere_list( sphere_lists[iCell] );
+                    sphere_list.push_back( iF );
+                    sphere_lists.push_back( sphere_list );
+                    parents.push_back( (int)iCell );
+                    face_neighbors.resize( face_neighbors.size() + num_faces, -1 );
+                }
+                face_neighbors[ iCell * num_faces + iF ] = (int)iNeighbor;
+            }
+        }
+        iLevelStart = iLevelEnd;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+/// Stores the cell adjacency from AddHyperbolicCells in the field data of mesh, for MeshRD to pick up.
+void AddNeighborsArray(const vector<int>& neighbors,int num_per_cell,const char *name,vtkUnstructuredGrid *mesh)
+{
+    vtkSmartPointer<vtkIntArray> arr = vtkSmartPointer<vtkIntArray>::New();
+    arr->SetNumberOfComponents(num_per_cell);
+    arr->SetNumberOfTuples(mesh->GetNumberOfCells());
+    arr->SetName(name);
+    for(size_t i = 0; i < neighbors.size(); ++i )
+        arr->SetValue( (vtkIdType)i, neighbors[i] );
+    mesh->GetFieldData()->AddArray(arr);
+}
+
+// ---------------------------------------------------------------------
+
 void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
 {
     // define the central cell
     const double edge_length = 1.0;
     const int num_vertices = schlafli1;
     vector<vector<double> > vertex_coords(num_vertices,vector<double>(3));
-    vector<int> faces(num_vertices);
     double r1 = GetPolygonRadius( edge_length, schlafli1 );
     for( int i = 0; i < num_vertices; ++i )
     {
@@ -973,7 +1801,6 @@ void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int nu
         vertex_coords[i][0] = r1 * cos( angle );
         vertex_coords[i][1] = r1 * sin( angle );
         vertex_coords[i][2] = 0.0;
-        faces[i] = i;
     }
 
     // define the mirror spheres
@@ -992,72 +1819,15 @@ void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int nu
         sphere_centers[i][2] = n[2] * d / nl;
     }
 
-    // make a list of lists of sphere ids to use
-    vector< vector< int > > sphere_lists;
-    sphere_lists.push_back( vector<int>() );
-    size_t iList = 0;
-    for( int iLevel = 0; iLevel < num_levels; ++iLevel ) {
-        const size_t num_lists = sphere_lists.size();
-        for( ; iList < num_lists; ++iList ) {
-            for( int iExtraSphere = 0; iExtraSphere < num_spheres; ++iExtraSphere ) {
-                vector<int> extended_list( sphere_lists[iList] );
-                extended_list.push_back( iExtraSphere );
-                sphere_lists.push_back( extended_list );
-            }
-        }
-    }
-
-    vtkSmartPointer<vtkAppendFilter> append = vtkSmartPointer<vtkAppendFilter>::New();
-    append->MergePointsOn();
-
-    vtkSmartPointer<vtkPointLocator> point_locator = vtkSmartPointer<vtkPointLocator>::New();
-    vtkSmartPointer<vtkPoints> locator_points = vtkSmartPointer<vtkPoints>::New();
-    double bounds[6] = {-10,10,-10,10,-10,10};
-    point_locator->InitPointInsertion(locator_points,bounds);
-
-    for( size_t iSphereList = 0; iSphereList < sphere_lists.size(); ++iSphereList )
-    {
-		vector<int>& sphere_list = sphere_lists[iSphereList];
-        // make a cell by reflecting the starting cell in the order listed
-        vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
-        vector<vtkIdType> pointIds;
-        vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-        double centroid[3] = {0,0,0};
-        for(int iV = 0; iV < num_vertices; ++iV ) { 
-            double p[3] = { vertex_coords[iV][0], vertex_coords[iV][1], vertex_coords[iV][2] };
-            for( size_t iSphereEntry = 0; iSphereEntry < sphere_list.size(); ++iSphereEntry )
-            {
-				int iSphere = sphere_list[iSphereEntry];
-                sphereInversion( p, sphere_centers[iSphere], R, p );
-			}
-            pointIds.push_back( points->InsertNextPoint( p ) );
-            centroid[0]+=p[0];
-            centroid[1]+=p[1];
-            centroid[2]+=p[2];
-        }
-        // only add this cell if we haven't seen this centroid before
-        centroid[0] /= num_vertices;
-        centroid[1] /= num_vertices;
-        centroid[2] /= num_vertices;
-        if( point_locator->IsInsertedPoint( centroid ) < 0 )
-        {
-            vector<vtkIdType> faceStream;
-            faceStream.push_back( num_vertices );
-            for( int j = 0; j < num_vertices; ++j )
-                faceStream.push_back( faces[j] );
-            ug->InsertNextCell(VTK_POLYGON,num_vertices,&pointIds.front(),1,&faceStream.front());
-            ug->SetPoints(points);
-            #if VTK_MAJOR_VERSION >= 6
-                append->AddInputData(ug);
-            #else
-                append->AddInput(ug);
-            #endif
-            point_locator->InsertNextPoint( centroid );
-        }
+    // the mirror across each edge makes the neighbor on that side
+    vector<vector<int> > edges(num_vertices,vector<int>(2));
+    for( int i = 0; i < num_vertices; ++i ) {
+        edges[i][0] = i;
+        edges[i][1] = (i+1)%num_vertices;
     }
-
-    append->Update();
-    mesh->DeepCopy(append->GetOutput()); 
+    vector<int> edge_neighbors;
+    AddHyperbolicCells( vertex_coords, edges, sphere_centers, R, num_levels, VTK_POLYGON, 1e-6 * edge_length, mesh, edge_neighbors );
+    AddNeighborsArray( edge_neighbors, num_vertices, MeshGenerators::EDGE_NEIGHBORS_ARRAY, mesh );
 
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
@@ -1169,75 +1939,9 @@ void MeshGenerators::GetHyperbolicSpaceTessellation(int schlafli1,int schlafli2,
         sphere_centers.push_back( vector<double>( n, n+3 ) );
     }
 
-    // make a list of lists of sphere ids to use
-    vector< vector< int > > sphere_lists;
-    sphere_lists.push_back( vector<int>() );
-    size_t iList = 0;
-    for( int iLevel = 0; iLevel < num_levels; ++iLevel ) {
-        const size_t num_lists = sphere_lists.size();
-        for( ; iList < num_lists; ++iList ) {
-            for( int iExtraSphere = 0; iExtraSphere < num_faces; ++iExtraSphere ) {
-                vector<int> extended_list( sphere_lists[iList] );
-                extended_list.push_back( iExtraSphere );
-                sphere_lists.push_back( extended_list );
-            }
-        }
-    }
-
-    vtkSmartPointer<vtkAppendFilter> append = vtkSmartPointer<vtkAppendFilter>::New();
-    append->MergePointsOn();
-
-    vtkSmartPointer<vtkPointLocator> point_locator = vtkSmartPointer<vtkPointLocator>::New();
-    vtkSmartPointer<vtkPoints> locator_points = vtkSmartPointer<vtkPoints>::New();
-    double bounds[6] = {-10,10,-10,10,-10,10};
-    point_locator->InitPointInsertion(locator_points,bounds);
-
-    for( size_t iSphereList = 0; iSphereList < sphere_lists.size(); ++iSphereList )
-    {
-		vector<int>& sphere_list = sphere_lists[iSphereList];
-        // make a cell by reflecting the starting cell in the order listed
-        vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
-        vector<vtkIdType> pointIds;
-        vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-        double centroid[3] = {0,0,0};
-        for(int iV = 0; iV < num_vertices; ++iV ) { 
-            double p[3] = { vertex_coords[iV][0], vertex_coords[iV][1], vertex_coords[iV][2] };
-            for( size_t iSphereEntry = 0; iSphereEntry < sphere_list.size(); ++iSphereEntry )
-            {
-				int iSphere = sphere_list[iSphereEntry];
-                sphereInversion( p, sphere_centers[iSphere], R, p );
-			}
-            pointIds.push_back( points->InsertNextPoint( p ) );
-            centroid[0]+=p[0];
-            centroid[1]+=p[1];
-            centroid[2]+=p[2];
-        }
-        // only add this cell if we haven't seen this centroid before
-        centroid[0] /= num_vertices;
-        centroid[1] /= num_vertices;
-        centroid[2] /= num_vertices;
-        if( point_locator->IsInsertedPoint( centroid ) < 0 )
-        {
-            vector<vtkIdType> faceStream;
-            for(int iF = 0; iF < num_faces; ++iF ) 
-            {
-                faceStream.push_back( num_vertices_per_face );
-                for(int j = 0; j < num_vertices_per_face; ++j )
-                    faceStream.push_back( faces[iF][j] );
-            }
-            ug->InsertNextCell(VTK_POLYHEDRON,num_vertices,&pointIds.front(),num_faces,&faceStream.front());
-            ug->SetPoints(points);
-            #if VTK_MAJOR_VERSION >= 6
-                append->AddInputData(ug);
-            #else
-                append->AddInput(ug);
-            #endif
-            point_locator->InsertNextPoint( centroid );
-        }
-    }
-
-    append->Update();
-    mesh->DeepCopy(append->GetOutput()); 
+    vector<int> face_neighbors;
+    AddHyperbolicCells( vertex_coords, faces, sphere_centers, R, num_levels, VTK_POLYHEDRON, 1e-6 * edge_length, mesh, face_neighbors );
+    AddNeighborsArray( face_neighbors, num_faces, MeshGenerators::FACE_NEIGHBORS_ARRAY, mesh );
 
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
@@ -18,9 +18,15 @@
 // VTK:
 class vtkUnstructuredGrid;
 
+// stdlib:
+#include <stddef.h>
+
 /// Methods for generating meshes from scratch.
 namespace MeshGenerators 
 {
+    /// Called by the slower generators from time to time, with the fraction of the work done so far (0 to 1).
+    typedef void (*ProgressCallback)(double fraction_done,void* user_data);
+
     /// Subdivides an icosahedron to get a sphere evenly covered with triangles.
     void GetGeodesicSphere(int n_subdivisions,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
 
@@ -39,23 +45,36 @@ namespace MeshGenerators
     /// Make a planar Penrose tiling, using either rhombi (type=0) or darts and kites (type=1).
     void GetPenroseTiling(int n_subdivisions,int type,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
 
-    /// Make a 2D Delaunay triangulation from a random set of points
-    void GetRandomDelaunay2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
+    /// Make a 2D Delaunay triangulation from a random set of points (about n_points, no two too close together)
+    void GetRandomDelaunay2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+        ProgressCallback progress=NULL,void* progress_data=NULL);
 
-    /// Make a 2D Voronoi mesh from a random set of points
-    void GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
+    /// Make a 2D Voronoi mesh from a random set of points (about n_points, no two too close together)
+    void GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+        ProgressCallback progress=NULL,void* progress_data=NULL);
 
     /// Applies the Delaunay algorithm to scattered points to get a mesh of tetrahedra.
-    void GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
+    void GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid* mesh,int n_chems,int data_type,
+        ProgressCallback progress=NULL,void* progress_data=NULL);
 
     /// Make a honeycomb from truncated octahedra.
-    void GetBodyCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
+    void GetBodyCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type,
+        ProgressCallback progress=NULL,void* progress_data=NULL);
 
     /// Make a honeycomb from rhombic dodecahedra.
-    void GetFaceCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
+    void GetFaceCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type,
+        ProgressCallback progress=NULL,void* progress_data=NULL);
 
     /// Make triakis truncated tetrahedra - the Voronoi cells of the carbon atoms in a diamond lattice.
-    void GetDiamondCells(int side,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
+    void GetDiamondCells(int side,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+        ProgressCallback progress=NULL,void* progress_data=NULL);
+
+    /// Some generators record which cells share a vertex, edge or face with each cell, since they know this without having
+    /// to search the mesh. Each is an int array in the mesh's field data, with one tuple per cell padded with -1.
+    /// For the hyperbolic tilings component i is the cell across edge or face i.
+    const char* const VERTEX_NEIGHBORS_ARRAY = "vertex_neighbors";
+    const char* const EDGE_NEIGHBORS_ARRAY = "edge_neighbors";
+    const char* const FACE_NEIGHBORS_ARRAY = "face_neighbors";
 
     // Make a hyperbolic plane tiling such as {3,7} or {4,5} at the specified recursion level
     void GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
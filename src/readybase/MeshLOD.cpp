@@ -0,0 +1,401 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "MeshLOD.hpp"
+
+// VTK:
+#include <vtkAbstractMapper3D.h>
+#include <vtkCamera.h>
+#include <vtkCellArray.h>
+#include <vtkCellData.h>
+#include <vtkDataArray.h>
+#include <vtkFloatArray.h>
+#include <vtkGeometryFilter.h>
+#include <vtkImageData.h>
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkMapper.h>
+#include <vtkMath.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkPointLocator.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkProperty.h>
+#include <vtkQuadricClustering.h>
+#include <vtkRenderer.h>
+#include <vtkTriangleFilter.h>
+#include <vtkUnstructuredGrid.h>
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// stdlib:
+#include <float.h>
+#include <math.h>
+
+// --------------------------------------------------------------------------------
+
+vtkStandardNewMacro(ClusteredMeshFilter);
+vtkStandardNewMacro(MeshLODProp);
+
+// ================================================================================
+
+ClusteredMeshFilter::ClusteredMeshFilter()
+    : n_divisions(64)
+    , is_surface(true)
+    , cluster_size(0.0)
+    , built_geometry_time(0)
+    , built_number_of_cells(-1)
+{
+    this->SetNumberOfInputPorts(1);
+    this->contour_filter = vtkSmartPointer<BlockContourFilter>::New();
+}
+
+// --------------------------------------------------------------------------------
+
+void ClusteredMeshFilter::SetNumberOfDivisions(int n)
+{
+    n = max(1,n);
+    if(n==this->n_divisions) return;
+    this->n_divisions = n;
+    this->built_number_of_cells = -1; // force the clusters to be rebuilt
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+void ClusteredMeshFilter::SetArrayName(const string& name)
+{
+    if(name==this->array_name) return;
+    this->array_name = name;
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+void ClusteredMeshFilter::SetValue(double v)
+{
+    this->contour_filter->SetValue(v);
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+void ClusteredMeshFilter::SetGenerateCubes(bool b)
+{
+    this->contour_filter->SetGenerateCubes(b);
+    this->Modified();
+}
+
+// --------------------------------------------------------------------------------
+
+int ClusteredMeshFilter::FillInputPortInformation(int port, vtkInformation* info)
+{
+    info->Set(vtkAlgorithm::INPUT_REQUIRED_DATA_TYPE(), "vtkUnstructuredGrid");
+    return 1;
+}
+
+// --------------------------------------------------------------------------------
+
+int ClusteredMeshFilter::RequestData(vtkInformation* request, vtkInformationVector** inputVector, vtkInformationVector* outputVector)
+{
+    vtkUnstructuredGrid *input = vtkUnstructuredGrid::SafeDownCast( inputVector[0]->GetInformationObject(0)->Get(vtkDataObject::DATA_OBJECT()) );
+    vtkPolyData *output = vtkPolyData::SafeDownCast( outputVector->GetInformationObject(0)->Get(vtkDataObject::DATA_OBJECT()) );
+    if(!input || !output || input->GetNumberOfCells()==0) return 0;
+
+    // the values change every frame but the geometry hardly ever does
+    const unsigned long geometry_time = max( input->GetPoints()->GetMTime(), input->GetCells()->GetMTime() );
+    if(input->GetNumberOfCells()!=this->built_number_of_cells || geometry_time!=this->built_geometry_time)
+        this->BuildClusters(input);
+
+    vtkDataArray *values = input->GetCellData()->GetArray(this->array_name.c_str());
+    if(!values)
+        throw runtime_error("ClusteredMeshFilter::RequestData : named array not found: "+this->array_name);
+
+    // take the mean of the cells in each cluster
+    fill(this->cluster_mean.begin(),this->cluster_mean.end(),0.0f);
+    for(vtkIdType iCell=0;iCell<input->GetNumberOfCells();iCell++)
+        this->cluster_mean[ this->cell_cluster[iCell] ] += values->GetComponent(iCell,0);
+    float lowest = FLT_MAX;
+    for(size_t i=0;i<this->cluster_mean.size();i++)
+    {
+        if(this->cluster_cell_count[i]==0) continue;
+        this->cluster_mean[i] /= this->cluster_cell_count[i];
+        lowest = min(lowest,this->cluster_mean[i]);
+    }
+
+    if(this->is_surface)
+    {
+        vtkSmartPointer<vtkFloatArray> scalars = vtkSmartPointer<vtkFloatArray>::New();
+        scalars->SetName(this->array_name.c_str());
+        scalars->SetNumberOfComponents(1);
+        scalars->SetNumberOfTuples((vtkIdType)this->proxy_point_cluster.size());
+        for(size_t i=0;i<this->proxy_point_cluster.size();i++)
+            scalars->SetValue((vtkIdType)i,this->cluster_mean[ this->proxy_point_cluster[i] ]);
+        output->ShallowCopy(this->surface_proxy);
+        output->GetPointData()->SetScalars(scalars);
+    }
+    else
+    {
+        // clusters with no cells in them are outside the mesh, give them the lowest value
+        float *image_data = static_cast<float*>(this->cluster_image->GetScalarPointer());
+        for(size_t i=0;i<this->cluster_mean.size();i++)
+            image_data[i] = this->cluster_cell_count[i]>0 ? this->cluster_mean[i] : lowest;
+        this->cluster_image->Modified();
+        this->contour_filter->Update();
+        output->ShallowCopy(this->contour_filter->GetOutput());
+        if(this->contour_filter->GetGenerateCubes())
+            this->AddCubeScalars(output);
+    }
+    return 1;
+}
+
+// --------------------------------------------------------------------------------
+
+void ClusteredMeshFilter::AddCubeScalars(vtkPolyData* cubes) const
+{
+    const int *dims = this->cluster_image->GetDimensions();
+    const double *origin = this->cluster_image->GetOrigin();
+    vtkDataArray *normals = cubes->GetPointData()->GetNormals();
+    vtkSmartPointer<vtkFloatArray> scalars = vtkSmartPointer<vtkFloatArray>::New();
+    scalars->SetName(this->array_name.c_str());
+    scalars->SetNumberOfComponents(1);
+    scalars->SetNumberOfTuples(cubes->GetNumberOfPolys());
+    vtkCellArray *polys = cubes->GetPolys();
+    vtkIdType npts,*pts;
+    polys->InitTraversal();
+    for(vtkIdType iFace=0;polys->GetNextCell(npts,pts);iFace++)
+    {
+        // the cube is half a cluster behind the middle of its face
+        double center[3] = {0,0,0};
+        for(vtkIdType iPt=0;iPt<npts;iPt++)
+            for(int xyz=0;xyz<3;xyz++)
+                center[xyz] += cubes->GetPoint(pts[iPt])[xyz] / npts;
+        const double *normal = normals->GetTuple3(pts[0]);
+        int c[3];
+        for(int xyz=0;xyz<3;xyz++)
+        {
+            const double pos = center[xyz] - normal[xyz] * this->cluster_size / 2;
+            c[xyz] = min( dims[xyz]-1, max( 0, (int)floor( ( pos - origin[xyz] ) / this->cluster_size + 0.5 ) ) );
+        }
+        scalars->SetValue(iFace,this->cluster_mean[ ( c[2]*dims[1] + c[1] )*dims[0] + c[0] ]);
+    }
+    cubes->GetCellData()->SetScalars(scalars);
+}
+
+// --------------------------------------------------------------------------------
+
+double ClusteredMeshFilter::ComputeClusterSize(const double bounds[6],int n_divisions)
+{
+    double longest_side = 0.0;
+    for(int xyz=0;xyz<3;xyz++)
+        longest_side = max( longest_side, bounds[xyz*2+1] - bounds[xyz*2+0] );
+    if(longest_side <= 0.0) longest_side = 1.0;
+    return longest_side / max(1,n_divisions);
+}
+
+// --------------------------------------------------------------------------------
+
+void ClusteredMeshFilter::BuildClusters(vtkUnstructuredGrid* input)
+{
+    this->is_surface = ( input->GetCellType(0) == VTK_POLYGON );
+
+    // divide the bounding box into cubes
+    double bounds[6];
+    input->GetBounds(bounds);
+    this->cluster_size = ClusteredMeshFilter::ComputeClusterSize(bounds,this->n_divisions);
+    int dims[3];
+    for(int xyz=0;xyz<3;xyz++)
+        dims[xyz] = max( 1, (int)ceil( ( bounds[xyz*2+1] - bounds[xyz*2+0] ) / this->cluster_size ) );
+    const int n_clusters = dims[0]*dims[1]*dims[2];
+
+    // put each cell in the cube that contains its centroid
+    const vtkIdType n_cells = input->GetNumberOfCells();
+    this->cell_cluster.resize(n_cells);
+    this->cluster_cell_count.assign(n_clusters,0);
+    this->cluster_mean.assign(n_clusters,0.0f);
+    vtkSmartPointer<vtkPoints> centroids = vtkSmartPointer<vtkPoints>::New();
+    centroids->SetNumberOfPoints(n_cells);
+    vtkIdType npts,*pts;
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+    {
+        input->GetCellPoints(iCell,npts,pts);
+        double cp[3] = {0,0,0};
+        for(vtkIdType iPt=0;iPt<npts;iPt++)
+            for(int xyz=0;xyz<3;xyz++)
+                cp[xyz] += input->GetPoint(pts[iPt])[xyz];
+        int c[3];
+        for(int xyz=0;xyz<3;xyz++)
+        {
+            cp[xyz] /= max((vtkIdType)1,npts);
+            c[xyz] = min( dims[xyz]-1, max( 0, (int)floor( ( cp[xyz] - bounds[xyz*2+0] ) / this->cluster_size ) ) );
+        }
+        centroids->SetPoint(iCell,cp);
+        const int iCluster = ( c[2]*dims[1] + c[1] )*dims[0] + c[0];
+        this->cell_cluster[iCell] = iCluster;
+        this->cluster_cell_count[iCluster]++;
+    }
+
+    if(this->is_surface)
+    {
+        // decimate the surface on the same grid
+        vtkSmartPointer<vtkGeometryFilter> geom = vtkSmartPointer<vtkGeometryFilter>::New();
+        #if VTK_MAJOR_VERSION >= 6
+            geom->SetInputData(input);
+        #else
+            geom->SetInput(input);
+        #endif
+        vtkSmartPointer<vtkTriangleFilter> tris = vtkSmartPointer<vtkTriangleFilter>::New();
+        tris->SetInputConnection(geom->GetOutputPort());
+        vtkSmartPointer<vtkQuadricClustering> decimate = vtkSmartPointer<vtkQuadricClustering>::New();
+        decimate->SetInputConnection(tris->GetOutputPort());
+        decimate->AutoAdjustNumberOfDivisionsOff();
+        decimate->SetNumberOfDivisions(dims[0],dims[1],dims[2]);
+        decimate->UseInputPointsOn();
+        decimate->Update();
+        this->surface_proxy = vtkSmartPointer<vtkPolyData>::New();
+        this->surface_proxy->ShallowCopy(decimate->GetOutput());
+        this->surface_proxy->GetPointData()->Initialize();
+        this->surface_proxy->GetCellData()->Initialize();
+
+        // each point of the proxy takes the value of the cluster of the nearest cell
+        vtkSmartPointer<vtkPolyData> centroid_set = vtkSmartPointer<vtkPolyData>::New();
+        centroid_set->SetPoints(centroids);
+        vtkSmartPointer<vtkPointLocator> locator = vtkSmartPointer<vtkPointLocator>::New();
+        locator->SetDataSet(centroid_set);
+        locator->BuildLocator();
+        const vtkIdType n_proxy_points = this->surface_proxy->GetNumberOfPoints();
+        this->proxy_point_cluster.resize(n_proxy_points);
+        for(vtkIdType iPt=0;iPt<n_proxy_points;iPt++)
+            this->proxy_point_cluster[iPt] = this->cell_cluster[ locator->FindClosestPoint(this->surface_proxy->GetPoint(iPt)) ];
+        this->cluster_image = NULL;
+    }
+    else
+    {
+        // the clusters become the pixels of an image, centered in their cubes
+        this->cluster_image = vtkSmartPointer<vtkImageData>::New();
+        #if VTK_MAJOR_VERSION >= 6
+            this->cluster_image->SetDimensions(dims);
+            this->cluster_image->AllocateScalars(VTK_FLOAT,1);
+        #else
+            this->cluster_image->SetNumberOfScalarComponents(1);
+            this->cluster_image->SetScalarType(VTK_FLOAT);
+            this->cluster_image->SetDimensions(dims);
+            this->cluster_image->AllocateScalars();
+        #endif
+        this->cluster_image->SetSpacing(this->cluster_size,this->cluster_size,this->cluster_size);
+        this->cluster_image->SetOrigin(bounds[0]+this->cluster_size/2,bounds[2]+this->cluster_size/2,bounds[4]+this->cluster_size/2);
+        #if VTK_MAJOR_VERSION >= 6
+            this->contour_filter->SetInputData(this->cluster_image);
+        #else
+            this->contour_filter->SetInput(this->cluster_image);
+        #endif
+        this->surface_proxy = NULL;
+        this->proxy_point_cluster.clear();
+    }
+
+    this->built_number_of_cells = n_cells;
+    this->built_geometry_time = max( input->GetPoints()->GetMTime(), input->GetCells()->GetMTime() );
+}
+
+// ================================================================================
+
+MeshLODProp::MeshLODProp()
+    : full_detail_lod(-1)
+{
+    this->AutomaticLODSelectionOff();
+    this->AutomaticPickLODSelectionOff();
+}
+
+// --------------------------------------------------------------------------------
+
+int MeshLODProp::AddClusteredLOD(vtkMapper* mapper,vtkProperty* prop,double cluster_size)
+{
+    const int id = this->AddLOD(mapper,prop,0.0);
+    this->levels.push_back(make_pair(id,cluster_size));
+    return id;
+}
+
+// --------------------------------------------------------------------------------
+
+int MeshLODProp::AddFullDetailLOD(vtkMapper* mapper,vtkProperty* prop)
+{
+    this->full_detail_lod = this->AddLOD(mapper,prop,0.0);
+    this->SetSelectedLODID(this->full_detail_lod);
+    this->SetSelectedPickLODID(this->full_detail_lod);
+    return this->full_detail_lod;
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshLODProp::SetAllocatedRenderTime(double t, vtkViewport* vp)
+{
+    vtkRenderer *renderer = vtkRenderer::SafeDownCast(vp);
+    if(renderer && renderer->GetActiveCamera() && this->full_detail_lod>=0)
+    {
+        // how many pixels does one world unit cover, at the center of the prop?
+        vtkCamera *camera = renderer->GetActiveCamera();
+        const int viewport_height = max(1,renderer->GetSize()[1]);
+        double world_height;
+        if(camera->GetParallelProjection())
+            world_height = 2.0 * camera->GetParallelScale();
+        else
+        {
+            const double distance = sqrt( vtkMath::Distance2BetweenPoints( camera->GetPosition(), this->GetCenter() ) );
+            world_height = 2.0 * distance * tan( camera->GetViewAngle() * vtkMath::Pi() / 360.0 );
+        }
+        const double pixels_per_unit = viewport_height / max( world_height, 1e-12 );
+
+        // use the coarsest level that is fine enough, else the full mesh
+        int id = this->full_detail_lod;
+        for(size_t i=0;i<this->levels.size();i++)
+        {
+            if(this->levels[i].second * pixels_per_unit <= MAX_PIXELS_PER_CLUSTER)
+            {
+                id = this->levels[i].first;
+                break;
+            }
+        }
+        this->SetSelectedLODID(id);
+    }
+    vtkLODProp3D::SetAllocatedRenderTime(t,vp);
+}
+
+// --------------------------------------------------------------------------------
+
+double* MeshLODProp::GetBounds()
+{
+    if(this->full_detail_lod<0)
+        return vtkLODProp3D::GetBounds();
+    this->GetLODMapper(this->full_detail_lod)->GetBounds(this->Bounds);
+    // the cubes of the clusters can stick out of the mesh by up to a cluster
+    double padding = 0.0;
+    for(size_t i=0;i<this->levels.size();i++)
+        padding = max(padding,this->levels[i].second);
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        this->Bounds[xyz*2+0] -= padding;
+        this->Bounds[xyz*2+1] += padding;
+    }
+    return this->Bounds;
+}
+
+// --------------------------------------------------------------------------------
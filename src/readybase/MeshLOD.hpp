@@ -0,0 +1,156 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __MESHLOD__
+#define __MESHLOD__
+
+// local:
+#include "BlockContourFilter.hpp"
+
+// VTK:
+#include <vtkLODProp3D.h>
+#include <vtkPolyDataAlgorithm.h>
+#include <vtkSmartPointer.h>
+class vtkImageData;
+class vtkMapper;
+class vtkPolyData;
+class vtkProperty;
+class vtkUnstructuredGrid;
+class vtkViewport;
+
+// STL:
+#include <string>
+#include <utility>
+#include <vector>
+
+// -------------------------------------------------------------------
+
+/// Makes a coarse stand-in for a big mesh, for rendering, by clustering its cells on a regular grid.
+/**
+ * Each cell belongs to the grid box that contains its centroid, and each cluster takes the mean
+ * of the values of its cells. The clusters are worked out once for the mesh geometry and reused
+ * each time the values change.
+ *
+ * For a surface mesh the output is a decimated copy of the surface, with the cluster means as
+ * point scalars (named as the array). For a volumetric mesh the cluster means are treated as an
+ * image and the output is its surface at the contour level, or its cubes (see BlockContourFilter).
+ * The cubes take the cluster means as cell scalars (named as the array), so they can be colored
+ * like the cells they stand in for.
+ */
+class ClusteredMeshFilter : public vtkPolyDataAlgorithm
+{
+    public:
+
+        vtkTypeMacro(ClusteredMeshFilter, vtkPolyDataAlgorithm);
+        static ClusteredMeshFilter* New();
+
+        void SetNumberOfDivisions(int n);           ///< number of clusters along the longest side of the mesh
+        void SetArrayName(const std::string& name); ///< the cell data array to take the values from
+        void SetValue(double v);                    ///< for volumetric meshes, the contour level
+        void SetGenerateCubes(bool b);              ///< for volumetric meshes, show the clusters as cubes
+
+        /// Returns the width of a cluster in world space, available after the first update.
+        double GetClusterSize() const { return this->cluster_size; }
+        /// Returns the width of the clusters for a mesh with these bounds, without building them.
+        static double ComputeClusterSize(const double bounds[6],int n_divisions);
+
+    protected:
+
+        ClusteredMeshFilter();
+
+        virtual int FillInputPortInformation(int port, vtkInformation* info);
+        virtual int RequestData(vtkInformation* request, vtkInformationVector** inputVector, vtkInformationVector* outputVector);
+
+        /// Assigns the cells to clusters and builds the proxy geometry.
+        void BuildClusters(vtkUnstructuredGrid* input);
+        /// Gives each face of the cubes the mean of the cluster it belongs to.
+        void AddCubeScalars(vtkPolyData* cubes) const;
+
+    protected:
+
+        int n_divisions;
+        std::string array_name;
+
+        bool is_surface;
+        double cluster_size;
+        std::vector<int> cell_cluster;          ///< the cluster that each cell belongs to
+        std::vector<int> cluster_cell_count;    ///< the number of cells in each cluster
+        std::vector<float> cluster_mean;        ///< the mean value of the cells in each cluster
+
+        unsigned long built_geometry_time;      ///< the MTime of the mesh geometry when the clusters were built
+        vtkIdType built_number_of_cells;
+
+        // for surface meshes:
+        vtkSmartPointer<vtkPolyData> surface_proxy;
+        std::vector<int> proxy_point_cluster;   ///< the cluster that each point of the surface proxy takes its value from
+
+        // for volumetric meshes:
+        vtkSmartPointer<vtkImageData> cluster_image;
+        vtkSmartPointer<BlockContourFilter> contour_filter;
+
+    private: // deliberately not implemented, to prevent use
+
+        ClusteredMeshFilter(const ClusteredMeshFilter&);
+        void operator=(const ClusteredMeshFilter&);
+};
+
+// -------------------------------------------------------------------
+
+/// A vtkLODProp3D that chooses the coarsest level whose clusters would appear no bigger than a few pixels.
+/**
+ * The choice is made before each render, from the renderer's camera, so zooming in makes the
+ * clusters appear bigger and the finer levels get used, and finally the full mesh. The screen-space
+ * error allowed (MAX_PIXELS_PER_CLUSTER) is about the size of a cell of a big mesh seen whole, so
+ * the coarse levels are used at the usual zoom. Picking always uses the full mesh.
+ *
+ * A level is only built when it is first drawn: the bounds come from the full mesh alone, so that
+ * the renderer asking for them doesn't update every level.
+ */
+class MeshLODProp : public vtkLODProp3D
+{
+    public:
+
+        vtkTypeMacro(MeshLODProp, vtkLODProp3D);
+        static MeshLODProp* New();
+
+        /// Adds a level made by ClusteredMeshFilter, returns the LOD id. Add the coarsest levels first.
+        int AddClusteredLOD(vtkMapper* mapper,vtkProperty* prop,double cluster_size);
+        /// Adds the level that shows the mesh itself, returns the LOD id.
+        int AddFullDetailLOD(vtkMapper* mapper,vtkProperty* prop);
+
+        virtual void SetAllocatedRenderTime(double t, vtkViewport* vp);
+
+        /// Returns the bounds of the full mesh, padded by the coarsest cluster size, without updating the other levels.
+        virtual double *GetBounds();
+        void GetBounds(double bounds[6]) { this->vtkProp3D::GetBounds(bounds); }
+
+        static const int MAX_PIXELS_PER_CLUSTER = 8;    ///< the largest that a cluster may appear, on screen
+
+    protected:
+
+        MeshLODProp();
+
+        int full_detail_lod;
+        std::vector<std::pair<int,double> > levels;     ///< LOD id, cluster size
+
+    private: // deliberately not implemented, to prevent use
+
+        MeshLODProp(const MeshLODProp&);
+        void operator=(const MeshLODProp&);
+};
+
+#endif
@@ -16,7 +16,10 @@
     along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
     
 // local:
+#include "CellMemory.hpp"
 #include "IO_XML.hpp"
+#include "MeshGenerators.hpp"
+#include "MeshLOD.hpp"
 #include "MeshRD.hpp"
 #include "overlays.hpp"
 #include "Properties.hpp"
@@ -29,7 +32,6 @@
 #include <vtkCellArray.h>
 #include <vtkCellData.h>
 #include <vtkCellDataToPointData.h>
-#include <vtkCellLocator.h>
 #include <vtkContourFilter.h>
 #include <vtkCubeAxesActor2D.h>
 #include <vtkCubeSource.h>
@@ -37,9 +39,11 @@
 #include <vtkDataSetMapper.h>
 #include <vtkDataSetSurfaceFilter.h>
 #include <vtkExtractEdges.h>
+#include <vtkFieldData.h>
 #include <vtkGenericCell.h>
 #include <vtkGeometryFilter.h>
 #include <vtkIdList.h>
+#include <vtkIntArray.h>
 #include <vtkLookupTable.h>
 #include <vtkMath.h>
 #include <vtkMergeFilter.h>
@@ -66,6 +70,9 @@
 #include <algorithm>
 using namespace std;
 
+// stdlib:
+#include <math.h>
+
 // ---------------------------------------------------------------------
 
 MeshRD::MeshRD(int data_type)
@@ -75,7 +82,6 @@ MeshRD::MeshRD(int data_type)
     this->mesh = vtkUnstructuredGrid::New();
     this->cell_neighbor_indices = NULL;
     this->cell_neighbor_weights = NULL;
-    this->cell_locator = NULL;
 }
 
 // ---------------------------------------------------------------------
@@ -88,9 +94,6 @@ MeshRD::~MeshRD()
     this->mesh->Delete();
     this->starting_pattern->Delete();
     this->n_chemicals = 0;
-
-    if(this->cell_locator)
-        this->cell_locator->Delete();
 }
 
 // ---------------------------------------------------------------------
@@ -98,9 +101,7 @@ MeshRD::~MeshRD()
 void MeshRD::Update(int n_steps)
 {
     this->undo_stack.clear();
-    this->InternalUpdate(n_steps);
-
-    this->timesteps_taken += n_steps;
+    this->InternalUpdateAndRecordProbes(n_steps);
 
     this->mesh->Modified();
     this->is_modified = true;
@@ -117,10 +118,9 @@ void MeshRD::SetNumberOfChemicals(int n)
         while (this->mesh->GetCellData()->GetNumberOfArrays() < n) {
             vtkSmartPointer<vtkDataArray> scalars = vtkSmartPointer<vtkDataArray>::Take(vtkDataArray::CreateDataArray(this->data_type));
             scalars->SetNumberOfComponents(1);
-            scalars->SetNumberOfTuples(this->mesh->GetNumberOfCells());
+            CellMemory::Allocate(scalars, this->mesh->GetNumberOfCells()); // (zeroed)
             std::string cn = GetChemicalName(this->mesh->GetCellData()->GetNumberOfArrays());
             scalars->SetName(cn.c_str());
-            scalars->FillComponent(0, 0.0f);
             this->mesh->GetCellData()->AddArray(scalars);
         }
     }
@@ -131,6 +131,7 @@ void MeshRD::SetNumberOfChemicals(int n)
         }
     }
     this->n_chemicals = n;
+    this->need_resolve_probes = true;
     this->mesh->Modified();
     this->is_modified = true;
 }
@@ -242,12 +243,20 @@ void MeshRD::CopyFromMesh(vtkUnstructuredGrid* mesh2)
     this->is_modified = true;
     this->n_chemicals = this->mesh->GetCellData()->GetNumberOfArrays();
 
-    if(this->cell_locator)
+    // move the chemicals into memory spread over the NUMA nodes as the threads will use it
+    for(int iChem=0;iChem<this->n_chemicals;iChem++)
     {
-        this->cell_locator->Delete();
-        this->cell_locator = NULL;
+        vtkDataArray *copied = this->mesh->GetCellData()->GetArray(iChem);
+        vtkSmartPointer<vtkDataArray> scalars = vtkSmartPointer<vtkDataArray>::Take(vtkDataArray::CreateDataArray(copied->GetDataType()));
+        scalars->SetNumberOfComponents(1);
+        CellMemory::Allocate(scalars,copied->GetNumberOfTuples(),copied->GetVoidPointer(0));
+        scalars->SetName(copied->GetName());
+        this->mesh->GetCellData()->AddArray(scalars); // (replaces the copied array, which has the same name)
     }
 
+    this->cell_index.Clear();
+    this->need_resolve_probes = true;
+
     this->ComputeCellNeighbors(this->neighborhood_type,this->neighborhood_range,
         this->neighborhood_weight_type);
 }
@@ -355,7 +364,16 @@ void MeshRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& r
         mapper->SetLookupTable(lut);
         mapper->UseLookupTableScalarRangeOn();
 
-        pRenderer->AddActor(actor);
+        if(!use_wireframe && !slice_3D && this->mesh->GetNumberOfCells() >= MeshRD::MIN_CELLS_FOR_LOD)
+        {
+            // big meshes are slow to draw, so show a coarse version unless zoomed in close
+            vtkSmartPointer<MeshLODProp> lod = vtkSmartPointer<MeshLODProp>::New();
+            this->AddClusteredLODs(lod,activeChemical,contour_level,false,lut,actor->GetProperty());
+            lod->AddFullDetailLOD(mapper,actor->GetProperty());
+            pRenderer->AddViewProp(lod);
+        }
+        else
+            pRenderer->AddActor(actor);
     }
     else if(use_image_interpolation)
     {
@@ -391,8 +409,20 @@ void MeshRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& r
         bfprop->SetAmbient(0.3);
         bfprop->SetDiffuse(0.6);
         bfprop->SetSpecular(0.1);*/ // TODO: re-enable this if can get correct normals
-        actor->PickableOff();
-        pRenderer->AddActor(actor);
+        if(this->mesh->GetNumberOfCells() >= MeshRD::MIN_CELLS_FOR_LOD)
+        {
+            // big meshes are slow to contour, so contour a coarse version unless zoomed in close
+            vtkSmartPointer<MeshLODProp> lod = vtkSmartPointer<MeshLODProp>::New();
+            this->AddClusteredLODs(lod,activeChemical,contour_level,false,lut,actor->GetProperty());
+            lod->AddFullDetailLOD(mapper,actor->GetProperty());
+            lod->PickableOff();
+            pRenderer->AddViewProp(lod);
+        }
+        else
+        {
+            actor->PickableOff();
+            pRenderer->AddActor(actor);
+        }
     }
     else // visualise the cells
     {
@@ -418,8 +448,20 @@ void MeshRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& r
         }
         if(use_wireframe)
             actor->GetProperty()->SetRepresentationToWireframe();
-        actor->PickableOff();
-        pRenderer->AddActor(actor);
+        if(!use_wireframe && this->mesh->GetNumberOfCells() >= MeshRD::MIN_CELLS_FOR_LOD)
+        {
+            // big meshes have many cells above the level, so show the clusters above it as cubes unless zoomed in close
+            vtkSmartPointer<MeshLODProp> lod = vtkSmartPointer<MeshLODProp>::New();
+            this->AddClusteredLODs(lod,activeChemical,contour_level,true,lut,actor->GetProperty());
+            lod->AddFullDetailLOD(mapper,actor->GetProperty());
+            lod->PickableOff();
+            pRenderer->AddViewProp(lod);
+        }
+        else
+        {
+            actor->PickableOff();
+            pRenderer->AddActor(actor);
+        }
     }
 
     // add a slice
@@ -516,6 +558,41 @@ void MeshRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& r
 
 // ---------------------------------------------------------------------
 
+void MeshRD::AddClusteredLODs(MeshLODProp* lod,const string& chemical,float contour_level,bool generate_cubes,
+    vtkLookupTable* lut,vtkProperty* prop)
+{
+    const bool is_surface = ( this->mesh->GetCellType(0) == VTK_POLYGON );
+    const int dimensionality = is_surface ? 2 : 3;
+    // each level has twice the resolution of the last, stopping while there are still two cells per cluster
+    for(int n_divisions=16; 2 * pow((double)n_divisions,dimensionality) <= this->mesh->GetNumberOfCells(); n_divisions*=2)
+    {
+        vtkSmartPointer<ClusteredMeshFilter> clusters = vtkSmartPointer<ClusteredMeshFilter>::New();
+        #if VTK_MAJOR_VERSION >= 6
+            clusters->SetInputData(this->mesh);
+        #else
+            clusters->SetInput(this->mesh);
+        #endif
+        clusters->SetNumberOfDivisions(n_divisions);
+        clusters->SetArrayName(chemical);
+        clusters->SetValue(contour_level);
+        clusters->SetGenerateCubes(generate_cubes);
+        // (not updated here: the level is only built when it is first drawn)
+        vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+        mapper->SetInputConnection(clusters->GetOutputPort());
+        mapper->ImmediateModeRenderingOn();
+        if(is_surface || generate_cubes)
+        {
+            mapper->SetLookupTable(lut);
+            mapper->UseLookupTableScalarRangeOn();
+        }
+        else
+            mapper->ScalarVisibilityOff();
+        lod->AddClusteredLOD(mapper,prop,ClusteredMeshFilter::ComputeClusterSize(this->mesh->GetBounds(),n_divisions));
+    }
+}
+
+// ---------------------------------------------------------------------
+
 void MeshRD::AddPhasePlot(vtkRenderer* pRenderer,float scaling,float low,float high,float posX,float posY,float posZ,
     int iChemX,int iChemY,int iChemZ)
 {
@@ -710,6 +787,69 @@ bool IsEdgeNeighbor(vtkUnstructuredGrid *grid,vtkIdType iCell1,vtkIdType iCell2)
     return false;
 }
 
+/// Returns how many ids two sorted lists have in common.
+static int CountShared(const vector<vtkIdType>& a,const vector<vtkIdType>& b)
+{
+    int n = 0;
+    for(size_t i=0,j=0;i<a.size() && j<b.size();)
+    {
+        if(a[i]<b[j]) i++;
+        else if(b[j]<a[i]) j++;
+        else { n++; i++; j++; }
+    }
+    return n;
+}
+
+/// Puts the cells that share a vertex with a cell into the order that the search in ComputeCellNeighbors finds them in:
+/// a ring in which each cell shares an edge with the one before, where it can.
+/** The search meets the cells vertex by vertex, each in order of id. The generators that record the neighbors make
+ *  convex cells that meet face to face, so two of them share an edge exactly when they share two or more vertices. */
+static void OrderAsVertexRing(vtkUnstructuredGrid *grid,vtkIdList *cell_points,vector<vtkIdType>& cells)
+{
+    sort(cells.begin(),cells.end());
+    const size_t n = cells.size();
+    vector<vector<vtkIdType> > points(n); // sorted, for each cell
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    for(size_t i=0;i<n;i++)
+    {
+        grid->GetCellPoints(cells[i],ids);
+        points[i].assign(ids->GetPointer(0),ids->GetPointer(0)+ids->GetNumberOfIds());
+        sort(points[i].begin(),points[i].end());
+    }
+    vector<size_t> candidates;
+    for(vtkIdType iPt=0;iPt<cell_points->GetNumberOfIds();iPt++)
+        for(size_t i=0;i<n;i++)
+            if(binary_search(points[i].begin(),points[i].end(),cell_points->GetId(iPt)))
+                candidates.push_back(i);
+    vector<size_t> ring;
+    vector<bool> is_in_ring(n,false);
+    size_t n_previously;
+    do {
+        n_previously = ring.size();
+        for(size_t j=0;j<candidates.size();j++)
+        {
+            const size_t i = candidates[j];
+            if(!is_in_ring[i] && (ring.empty() || CountShared(points[ring.back()],points[i])>=2))
+            {
+                ring.push_back(i);
+                is_in_ring[i] = true;
+            }
+        }
+    } while(ring.size() > n_previously);
+    for(size_t j=0;j<candidates.size();j++)
+    {
+        if(!is_in_ring[candidates[j]])
+        {
+            ring.push_back(candidates[j]);
+            is_in_ring[candidates[j]] = true;
+        }
+    }
+    vector<vtkIdType> ordered;
+    for(size_t j=0;j<ring.size();j++)
+        ordered.push_back(cells[ring[j]]);
+    cells.swap(ordered);
+}
+
 // ---------------------------------------------------------------------
 
 void MeshRD::ComputeCellNeighbors(TNeighborhood neighborhood_type,int range,TWeight weight_type)
@@ -724,6 +864,17 @@ void MeshRD::ComputeCellNeighbors(TNeighborhood neighborhood_type,int range,TWei
     vtkSmartPointer<vtkIdList> cellIds = vtkSmartPointer<vtkIdList>::New();
     TNeighbor nbor;
 
+    // some of the mesh generators record the neighbors of each cell, which saves searching the topology
+    vtkIntArray *known_neighbors = NULL;
+    if(neighborhood_type==VERTEX_NEIGHBORS)
+        known_neighbors = vtkIntArray::SafeDownCast(this->mesh->GetFieldData()->GetArray(MeshGenerators::VERTEX_NEIGHBORS_ARRAY));
+    else if(neighborhood_type==EDGE_NEIGHBORS)
+        known_neighbors = vtkIntArray::SafeDownCast(this->mesh->GetFieldData()->GetArray(MeshGenerators::EDGE_NEIGHBORS_ARRAY));
+    else if(neighborhood_type==FACE_NEIGHBORS)
+        known_neighbors = vtkIntArray::SafeDownCast(this->mesh->GetFieldData()->GetArray(MeshGenerators::FACE_NEIGHBORS_ARRAY));
+    if(known_neighbors && known_neighbors->GetNumberOfTuples()!=this->mesh->GetNumberOfCells())
+        known_neighbors = NULL; // not for this mesh
+
     vector<vector<TNeighbor> > cell_neighbors; // the connectivity between cells; for each cell, what cells are its neighbors?
     this->max_neighbors = 0;
     for(vtkIdType iCell=0;iCell<this->mesh->GetNumberOfCells();iCell++)
@@ -731,7 +882,28 @@ void MeshRD::ComputeCellNeighbors(TNeighborhood neighborhood_type,int range,TWei
         vector<TNeighbor> neighbors;
         this->mesh->GetCellPoints(iCell,ptIds);
         vtkIdType npts = ptIds->GetNumberOfIds();
-        switch(neighborhood_type)
+        if(known_neighbors)
+        {
+            vector<vtkIdType> known;
+            for(int iN=0;iN<known_neighbors->GetNumberOfComponents();iN++)
+                if(known_neighbors->GetValue(iCell*known_neighbors->GetNumberOfComponents()+iN)>=0)
+                    known.push_back(known_neighbors->GetValue(iCell*known_neighbors->GetNumberOfComponents()+iN));
+            // the formula may depend on the order of the vertex neighbors, so give them the order that the search would
+            if(neighborhood_type==VERTEX_NEIGHBORS)
+                OrderAsVertexRing(this->mesh,ptIds,known);
+            for(size_t iN=0;iN<known.size();iN++)
+            {
+                nbor.iNeighbor = known[iN];
+                switch(weight_type)
+                {
+                    case EQUAL: nbor.weight = 1.0f; break;
+                    case LAPLACIAN: nbor.weight = 1.0f; break;
+                    default: throw runtime_error("MeshRD::ComputeCellNeighbors : unsupported weight type");
+                }
+                add_if_new(neighbors,nbor);
+            }
+        }
+        else switch(neighborhood_type)
         {
             case VERTEX_NEIGHBORS: // neighbors share a vertex
             {
@@ -868,6 +1040,16 @@ int MeshRD::GetNumberOfCells() const
 
 // ---------------------------------------------------------------------
 
+void MeshRD::ComputeStatistics(vector<ChemicalStatistics>& stats,int n_bins)
+{
+    stats.resize(this->GetNumberOfChemicals());
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+        ComputeStatisticsOfValues(this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str())->GetVoidPointer(0),
+            this->GetNumberOfCells(),this->data_type,n_bins,stats[ic]);
+}
+
+// ---------------------------------------------------------------------
+
 void MeshRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) const
 {
     bool use_image_interpolation = render_settings.GetProperty("use_image_interpolation").GetBool();
@@ -954,13 +1136,9 @@ void MeshRD::SetFrom2DImage(int iChemical, vtkImageData *im)
 
 float MeshRD::GetValue(float x, float y, float z, const Properties& render_settings)
 {
-    this->CreateCellLocatorIfNeeded();
+    const double p[3] = { x, y, z };
+    const vtkIdType iCell = this->GetCellIndex().FindClosestCell(p);
 
-    double p[3]={x,y,z},cp[3],dist2;
-    vtkIdType iCell;
-    int subId;
-    this->cell_locator->FindClosestPoint(p,cp,iCell,subId,dist2);
-    
     if(iCell<0)
         return 0.0f;
 
@@ -972,81 +1150,165 @@ float MeshRD::GetValue(float x, float y, float z, const Properties& render_setti
 
 void MeshRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
 {
-    this->CreateCellLocatorIfNeeded();
+    const double p[3] = { x, y, z };
+    const vtkIdType iCell = this->GetCellIndex().FindClosestCell(p);
 
-    double p[3]={x,y,z},cp[3],dist2;
-    vtkIdType iCell;
-    int subId;
-    this->cell_locator->FindClosestPoint(p,cp,iCell,subId,dist2);
-    
     if(iCell<0)
         return;
 
     int iChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
-    float old_val = this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->GetComponent( iCell, 0 );
-    this->StorePaintAction(iChemical,iCell,old_val);
-    this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->SetComponent( iCell, 0, val );
-    this->mesh->Modified();
-    this->is_modified = true;
+    const int box[6] = { int(iCell), int(iCell), 0, 0, 0, 0 };
+    vector<double> old_values, new_values(1,val);
+    this->GetRegionValues(iChemical,box,old_values);
+    this->SetRegionValues(iChemical,box,new_values);
+    this->StorePaintAction(iChemical,box,old_values,new_values);
+    this->PaintRegionChanged(iChemical,box);
 }
 
 // --------------------------------------------------------------------------------
 
 void MeshRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
 {
-    this->CreateCellLocatorIfNeeded();
+    this->SetValuesAlongLine(x,y,z,x,y,z,r,val,render_settings);
+}
+
+// --------------------------------------------------------------------------------
 
+void MeshRD::SetValuesAlongLine(float x0,float y0,float z0,float x1,float y1,float z1,float r,float val,
+    const Properties& render_settings)
+{
     double *dataset_bbox = this->mesh->GetBounds();
     r *= hypot3(dataset_bbox[1]-dataset_bbox[0],dataset_bbox[3]-dataset_bbox[2],dataset_bbox[5]-dataset_bbox[4]);
 
-    double bbox[6]={x-r,x+r,y-r,y+r,z-r,z+r};
-    vtkSmartPointer<vtkIdList> cells = vtkSmartPointer<vtkIdList>::New();
-    this->cell_locator->FindCellsWithinBounds(bbox,cells);
+    // stamp the brush along the line, at most half its radius apart, so that a fast stroke leaves no gaps
+    const double from[3] = { x0, y0, z0 };
+    const double to[3] = { x1, y1, z1 };
+    const double length = hypot3(to[0]-from[0],to[1]-from[1],to[2]-from[2]);
+    const int n_steps = r > 0 ? int(ceil(length / (r/2))) : 0;
+    vector<double> centers(3*(n_steps+1));
+    for(int i=0;i<=n_steps;i++)
+    {
+        const double t = n_steps ? double(i)/n_steps : 1.0;
+        for(int xyz=0;xyz<3;xyz++)
+            centers[3*i+xyz] = from[xyz] + t * (to[xyz] - from[xyz]);
+    }
 
-    double p[3] = {x,y,z};
+    // find the cells that have any of their points inside any of the stamps, all in one search
+    vector<int> cells;
+    this->GetCellIndex().FindCellsWithinRadius(&centers[0],n_steps+1,r,cells);
+    if(cells.empty())
+        return;
 
     int iChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
-    for(vtkIdType i=0;i<cells->GetNumberOfIds();i++)
+    this->PaintCells(iChemical,cells,val);
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshRD::PaintCells(int iChemical,const vector<int>& cells,float val)
+{
+    this->PaintCellRuns(iChemical,cells,val,false);
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshRD::PaintCellRuns(int iChemical,const vector<int>& cells,float val,bool only_in_mesh)
+{
+    // the cells of a brush can be spread over most of the ids (e.g. on a Delaunay mesh), so rather than one range
+    // that covers them all, store each run of nearby ids as its own action (they are undone together)
+    size_t i = 0;
+    while(i < cells.size())
     {
-        int iCell = cells->GetId(i);
-        vtkIdType npts,*pts;
-        this->mesh->GetCellPoints(iCell,npts,pts);
-        // set this cell if any of its points are inside
-        for(vtkIdType iPt=0;iPt<npts;iPt++)
-        {
-            if(vtkMath::Distance2BetweenPoints(this->mesh->GetPoint(pts[iPt]),p)<r*r)
-            {
-                float old_val = this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->GetComponent( iCell, 0 );
-                this->StorePaintAction(iChemical,iCell,old_val);
-                this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->SetComponent( iCell, 0, val );
-                break;
-            }
-        }
+        size_t end = i + 1;
+        while(end < cells.size() && cells[end] - cells[end-1] <= MAX_PAINT_GAP)
+            end++;
+        const int box[6] = { cells[i], cells[end-1], 0, 0, 0, 0 };
+        vector<double> old_values, new_values;
+        this->GetRegionValues(iChemical,box,old_values);
+        new_values = old_values;
+        for(;i<end;i++)
+            new_values[cells[i] - box[0]] = val;
+        this->SetRegionValues(iChemical,box,new_values);
+        this->StorePaintAction(iChemical,box,old_values,new_values);
+        if(only_in_mesh)
+            MeshRD::PaintRegionChanged(iChemical,box);
+        else
+            this->PaintRegionChanged(iChemical,box);
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshRD::FindCellsAtPositions(const vector<double>& positions,vector<int>& cells)
+{
+    // convert the proportional positions to points within the bounds of the mesh
+    const double *bounds = this->mesh->GetBounds();
+    const int n = (int)positions.size()/3;
+    vector<double> points(positions.size());
+    for(int i=0;i<n;i++)
+        for(int j=0;j<3;j++)
+            points[i*3+j] = bounds[j*2] + positions[i*3+j] * (bounds[j*2+1] - bounds[j*2]);
+    vector<vtkIdType> found(n);
+    if(n>0)
+        this->GetCellIndex().FindClosestCells(&points[0],n,&found[0]);
+    cells.resize(n);
+    for(int i=0;i<n;i++)
+    {
+        if(found[i]<0)
+            throw runtime_error("MeshRD::FindCellsAtPositions : the mesh has no cells");
+        cells[i] = (int)found[i];
     }
-    this->mesh->Modified();
-    this->is_modified = true;
 }
 
 // --------------------------------------------------------------------------------
 
-void MeshRD::CreateCellLocatorIfNeeded()
+double MeshRD::GetCellValue(int iChemical,int iCell) const
 {
-    if(this->cell_locator) return;
+    return this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->GetComponent(iCell,0);
+}
 
-    this->cell_locator = vtkCellLocator::New();
-    this->cell_locator->SetDataSet(this->mesh);
-    this->cell_locator->SetTolerance(0.0001);
-    this->cell_locator->BuildLocator();
+// --------------------------------------------------------------------------------
+
+const MeshCellIndex& MeshRD::GetCellIndex()
+{
+    this->cell_index.BuildIfNeeded(this->mesh);
+    return this->cell_index;
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshRD::GetRegionValues(int iChemical,const int box[6],vector<double>& values) const
+{
+    vtkDataArray *array = this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str());
+    values.resize(box[1] - box[0] + 1);
+    if(array->GetDataType()==VTK_DOUBLE)
+    {
+        const double *data = static_cast<double*>(array->GetVoidPointer(0)) + box[0];
+        copy(data, data + values.size(), values.begin());
+    }
+    else
+    {
+        const float *data = static_cast<float*>(array->GetVoidPointer(0)) + box[0];
+        copy(data, data + values.size(), values.begin());
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshRD::SetRegionValues(int iChemical,const int box[6],const vector<double>& values)
+{
+    vtkDataArray *array = this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str());
+    if(array->GetDataType()==VTK_DOUBLE)
+        copy(values.begin(), values.end(), static_cast<double*>(array->GetVoidPointer(0)) + box[0]);
+    else
+        copy(values.begin(), values.end(), static_cast<float*>(array->GetVoidPointer(0)) + box[0]);
 }
 
 // --------------------------------------------------------------------------------
 
-void MeshRD::FlipPaintAction(PaintAction& cca)
+void MeshRD::PaintRegionChanged(int iChemical,const int box[6])
 {
-    float old_val = this->mesh->GetCellData()->GetArray(GetChemicalName(cca.iChemical).c_str())->GetComponent( cca.iCell, 0 );
-    this->mesh->GetCellData()->GetArray(GetChemicalName(cca.iChemical).c_str())->SetComponent( cca.iCell, 0, cca.val );
-    cca.val = old_val;
-    cca.done = !cca.done;
+    this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->Modified();
     this->mesh->Modified();
     this->is_modified = true;
 }
@@ -20,11 +20,15 @@
 
 // local:
 #include "AbstractRD.hpp"
+#include "MeshCellIndex.hpp"
 
 // VTK:
 #include <vtkType.h>
 class vtkUnstructuredGrid;
-class vtkCellLocator;
+class vtkLookupTable;
+class vtkProperty;
+
+class MeshLODProp;
 
 /// Base class for mesh-based systems.
 class MeshRD : public AbstractRD
@@ -52,6 +56,8 @@ class MeshRD : public AbstractRD
         
         virtual int GetNumberOfCells() const;
 
+        virtual void ComputeStatistics(std::vector<ChemicalStatistics>& stats,int n_bins);
+
         virtual void GenerateInitialPattern();
         virtual void BlankImage(float value = 0.0f);
         virtual void CopyFromMesh(vtkUnstructuredGrid* mesh2);
@@ -72,6 +78,8 @@ class MeshRD : public AbstractRD
         virtual float GetValue(float x,float y,float z,const Properties& render_settings);
         virtual void SetValue(float x,float y,float z,float val,const Properties& render_settings);
         virtual void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings);
+        virtual void SetValuesAlongLine(float x0,float y0,float z0,float x1,float y1,float z1,float r,float val,
+            const Properties& render_settings);
 
         void GetMesh(vtkUnstructuredGrid* mesh) const;
 
@@ -83,9 +91,31 @@ class MeshRD : public AbstractRD
         /// advance the RD system by n timesteps
         virtual void InternalUpdate(int n_steps) =0;
 
-        void CreateCellLocatorIfNeeded();
+        /// Returns the spatial index of the cells, building it first if the mesh has changed.
+        const MeshCellIndex& GetCellIndex();
+
+        /// Sets the given cells (in increasing order) of a chemical, as one undo-able stroke.
+        virtual void PaintCells(int iChemical,const std::vector<int>& cells,float val);
+
+        /// Sets the given cells (in increasing order) in the mesh, storing an undo action for each run of nearby ids.
+        /** If only_in_mesh then the base PaintRegionChanged is called, e.g. when the device has been painted already. */
+        void PaintCellRuns(int iChemical,const std::vector<int>& cells,float val,bool only_in_mesh);
+
+        virtual void GetRegionValues(int iChemical,const int box[6],std::vector<double>& values) const;
+        virtual void SetRegionValues(int iChemical,const int box[6],const std::vector<double>& values);
+        virtual void PaintRegionChanged(int iChemical,const int box[6]);
+
+        virtual void FindCellsAtPositions(const std::vector<double>& positions,std::vector<int>& cells);
+        virtual double GetCellValue(int iChemical,int iCell) const;
+
+        /// Adds coarse versions of the mesh to the prop, for drawing big meshes quickly.
+        /** For volumetric meshes, if generate_cubes then the clusters at or above the level are shown as cubes, else
+         *  their contour is. */
+        void AddClusteredLODs(MeshLODProp* lod,const std::string& chemical,float contour_level,bool generate_cubes,
+            vtkLookupTable* lut,vtkProperty* prop);
 
-        virtual void FlipPaintAction(PaintAction& cca);
+        static const int MIN_CELLS_FOR_LOD = 100000; ///< smaller meshes than this are always drawn in full
+        static const int MAX_PAINT_GAP = 8; ///< painted cells closer in id than this share an undo action
 
     protected: // variables
 
@@ -96,7 +126,7 @@ class MeshRD : public AbstractRD
         int *cell_neighbor_indices;   ///< index of each neighbor of a cell
         float *cell_neighbor_weights; ///< diffusion coefficient between each cell and a neighbor
 
-        vtkCellLocator* cell_locator; ///< Returns a cell ID when given a 3D location
+        MeshCellIndex cell_index; ///< Returns the cells near a 3D location
 
     private: // deliberately not implemented, to prevent use
 
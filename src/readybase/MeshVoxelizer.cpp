@@ -0,0 +1,265 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "MeshVoxelizer.hpp"
+
+// VTK:
+#include <vtkCellArray.h>
+#include <vtkImageData.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// stdlib:
+#include <math.h>
+
+// --------------------------------------------------------------------------------
+
+MeshVoxelizer::MeshVoxelizer(vtkPolyData* surface,bool anti_alias)
+    : samples(anti_alias ? 4 : 1)
+    , is_flat(true)
+    , image(NULL)
+    , value_inside(1.0f)
+    , value_outside(0.0f)
+{
+    this->dims[0] = this->dims[1] = this->dims[2] = 0;
+
+    bool have_first_z = false;
+    double first_z = 0.0;
+    vtkIdType npts,*pts;
+    for(vtkIdType iCell=0;iCell<surface->GetNumberOfCells();iCell++)
+    {
+        if(surface->GetCellType(iCell)!=VTK_TRIANGLE)
+            continue;
+        surface->GetCellPoints(iCell,npts,pts);
+        Triangle t;
+        for(int i=0;i<3;i++)
+        {
+            surface->GetPoint(pts[i],t.p[i]);
+            if(!have_first_z)
+            {
+                first_z = t.p[i][2];
+                have_first_z = true;
+            }
+            else if(t.p[i][2]!=first_z)
+                this->is_flat = false;
+        }
+        t.area = EdgeFunction(t.p[0],t.p[1],t.p[2][0],t.p[2][1]);
+        if(t.area==0.0)
+            continue; // edge-on when seen from above, no ray can cross it
+        if(t.area<0.0)
+        {
+            swap(t.p[1],t.p[2]);
+            t.area = -t.area;
+        }
+        t.x_min = min(t.p[0][0],min(t.p[1][0],t.p[2][0]));
+        t.x_max = max(t.p[0][0],max(t.p[1][0],t.p[2][0]));
+        t.y_min = min(t.p[0][1],min(t.p[1][1],t.p[2][1]));
+        t.y_max = max(t.p[0][1],max(t.p[1][1],t.p[2][1]));
+        this->triangles.push_back(t);
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshVoxelizer::Voxelize(vtkImageData* image,float value_inside,float value_outside)
+{
+    if(image->GetScalarType()!=VTK_FLOAT && image->GetScalarType()!=VTK_DOUBLE)
+        throw runtime_error("MeshVoxelizer::Voxelize : unsupported data type");
+
+    this->image = image;
+    image->GetDimensions(this->dims);
+    this->value_inside = value_inside;
+    this->value_outside = value_outside;
+
+    // find which rows of the image each triangle might cover
+    this->row_triangles.assign(this->dims[1],vector<int>());
+    for(int iTri=0;iTri<(int)this->triangles.size();iTri++)
+    {
+        const Triangle& t = this->triangles[iTri];
+        const int y_lo = max(0,(int)floor(t.y_min + 0.5));
+        const int y_hi = min(this->dims[1]-1,(int)floor(t.y_max + 0.5));
+        for(int y=y_lo;y<=y_hi;y++)
+            this->row_triangles[y].push_back(iTri);
+    }
+
+    vtkSmartPointer<vtkMultiThreader> threader = vtkSmartPointer<vtkMultiThreader>::New();
+    threader->SetNumberOfThreads(max(1,min(threader->GetGlobalDefaultNumberOfThreads(),this->dims[1])));
+    threader->SetSingleMethod(MeshVoxelizer::ThreadedExecute, this);
+    threader->SingleMethodExecute();
+
+    this->row_triangles.clear();
+    this->image = NULL;
+}
+
+// --------------------------------------------------------------------------------
+
+/* static */ VTK_THREAD_RETURN_TYPE MeshVoxelizer::ThreadedExecute(void *arg)
+{
+    vtkMultiThreader::ThreadInfo *info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+    const MeshVoxelizer *self = static_cast<MeshVoxelizer*>(info->UserData);
+
+    vector<vector<double> > crossings;
+    vector<double> coverage;
+    for(int y=info->ThreadID;y<self->dims[1];y+=info->NumberOfThreads)
+    {
+        if(self->image->GetScalarType()==VTK_FLOAT)
+            self->VoxelizeRow(y,static_cast<float*>(self->image->GetScalarPointer()),crossings,coverage);
+        else
+            self->VoxelizeRow(y,static_cast<double*>(self->image->GetScalarPointer()),crossings,coverage);
+    }
+    return VTK_THREAD_RETURN_VALUE;
+}
+
+// --------------------------------------------------------------------------------
+
+template<typename T> void MeshVoxelizer::VoxelizeRow(int y,T* data,vector<vector<double> >& crossings,
+                                                     vector<double>& coverage) const
+{
+    const int X = this->dims[0];
+    const int Y = this->dims[1];
+    const int Z = this->dims[2];
+    const int s = this->samples;
+    const double weight = 1.0 / (s*s);
+
+    coverage.assign(X*Z,0.0);
+    crossings.resize(X*s);
+    const vector<int>& tris = this->row_triangles[y];
+    for(int b=0;b<s;b++)
+    {
+        // cast the rays at this y through each triangle that covers the row
+        const double py = y - 0.5 + (b + 0.5) / s;
+        for(int iRay=0;iRay<X*s;iRay++)
+            crossings[iRay].clear();
+        for(size_t iTri=0;iTri<tris.size();iTri++)
+        {
+            const Triangle& t = this->triangles[tris[iTri]];
+            if(py < t.y_min || py > t.y_max)
+                continue;
+            const int x_lo = max(0,(int)floor(t.x_min + 0.5));
+            const int x_hi = min(X-1,(int)floor(t.x_max + 0.5));
+            for(int x=x_lo;x<=x_hi;x++)
+            {
+                for(int a=0;a<s;a++)
+                {
+                    const double px = x - 0.5 + (a + 0.5) / s;
+                    double z;
+                    if(GetCrossing(t,px,py,z))
+                        crossings[x*s+a].push_back(z);
+                }
+            }
+        }
+
+        // add the inside parts of each ray to the coverage of the pixels along it
+        for(int x=0;x<X;x++)
+        {
+            double *column = &coverage[x*Z];
+            for(int a=0;a<s;a++)
+            {
+                vector<double>& c = crossings[x*s+a];
+                if(c.empty())
+                    continue;
+                if(this->is_flat)
+                {
+                    for(int z=0;z<Z;z++)
+                        column[z] += weight;
+                    continue;
+                }
+                sort(c.begin(),c.end());
+                for(size_t i=0;i+1<c.size();i+=2) // an odd crossing out means the surface wasn't closed, ignore it
+                {
+                    const double z_in = c[i];
+                    const double z_out = c[i+1];
+                    if(s==1)
+                    {
+                        // inside if the pixel centre is
+                        const int z_lo = max(0,(int)ceil(z_in));
+                        const int z_hi = min(Z-1,(int)ceil(z_out)-1);
+                        for(int z=z_lo;z<=z_hi;z++)
+                            column[z] += 1.0;
+                    }
+                    else
+                    {
+                        // the overlap of [z_in,z_out] with each pixel
+                        const int z_lo = max(0,(int)floor(z_in + 0.5));
+                        const int z_hi = min(Z-1,(int)floor(z_out + 0.5));
+                        for(int z=z_lo;z<=z_hi;z++)
+                        {
+                            const double overlap = min(z_out,z+0.5) - max(z_in,z-0.5);
+                            if(overlap>0.0)
+                                column[z] += overlap * weight;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // write the row
+    const int nc = this->image->GetNumberOfScalarComponents();
+    const double range = this->value_inside - this->value_outside;
+    for(int z=0;z<Z;z++)
+    {
+        T *p = data + nc * (X * (y + Y * z));
+        for(int x=0;x<X;x++)
+            p[nc*x] = static_cast<T>(this->value_outside + range * min(1.0,coverage[x*Z+z]));
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+/* static */ double MeshVoxelizer::EdgeFunction(const double* a,const double* b,double px,double py)
+{
+    // always compute from the lesser end of the edge, so that two triangles sharing it get exactly opposite values
+    if(a[0]>b[0] || (a[0]==b[0] && a[1]>b[1]))
+        return -EdgeFunction(b,a,px,py);
+    return (b[0]-a[0])*(py-a[1]) - (b[1]-a[1])*(px-a[0]);
+}
+
+// --------------------------------------------------------------------------------
+
+/* static */ bool MeshVoxelizer::GetCrossing(const Triangle& t,double px,double py,double& z)
+{
+    double e[3];
+    for(int i=0;i<3;i++)
+    {
+        const double *a = t.p[i];
+        const double *b = t.p[(i+1)%3];
+        e[i] = EdgeFunction(a,b,px,py);
+        if(e[i]<0.0)
+            return false;
+        if(e[i]==0.0)
+        {
+            // on the edge: only one of the two triangles that share it may count it
+            const double dx = b[0]-a[0];
+            const double dy = b[1]-a[1];
+            if(!(dy>0.0 || (dy==0.0 && dx<0.0)))
+                return false;
+        }
+    }
+    // the edge opposite each corner gives its weight
+    z = (e[1]*t.p[0][2] + e[2]*t.p[1][2] + e[0]*t.p[2][2]) / t.area;
+    return true;
+}
+
+// --------------------------------------------------------------------------------
@@ -0,0 +1,89 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __MESHVOXELIZER__
+#define __MESHVOXELIZER__
+
+// VTK:
+#include <vtkMultiThreader.h>
+class vtkImageData;
+class vtkPolyData;
+
+// STL:
+#include <vector>
+
+/// Fills an image with the inside of a closed surface, by casting rays along z through the pixel centres.
+/**
+ * The triangles covering each column of pixels are found with a top-left fill rule, so a ray that
+ * hits an edge shared by two triangles crosses exactly one of them. Along each ray, the pixels
+ * between the first and second crossings are inside, and so on. Crossing parity doesn't depend on
+ * how the triangles are oriented. The rows of the image are done in parallel.
+ *
+ * With anti-aliasing, each column is sampled by a grid of rays, and each pixel gets the fraction of
+ * its volume that is inside. Without it, a pixel is inside if its centre is.
+ *
+ * A flat surface (such as a 2D mesh) is taken to be a region: the rays that hit it fill their column.
+ */
+class MeshVoxelizer
+{
+    public:
+
+        /// The surface must be triangles, in the coordinates of the image's indices (pixel i centred at x=i).
+        MeshVoxelizer(vtkPolyData* surface,bool anti_alias);
+
+        /// Writes into the first component of the image, which must be float or double.
+        void Voxelize(vtkImageData* image,float value_inside,float value_outside);
+
+    protected:
+
+        struct Triangle
+        {
+            double p[3][3];             ///< the corners, counter-clockwise when seen from above
+            double area;                ///< twice the area seen from above
+            double x_min,x_max,y_min,y_max;
+        };
+
+        static VTK_THREAD_RETURN_TYPE ThreadedExecute(void *arg);
+        /// Fills one row (fixed y) of the image. The buffers are scratch space, one set per thread.
+        template<typename T> void VoxelizeRow(int y,T* data,std::vector<std::vector<double> >& crossings,
+                                              std::vector<double>& coverage) const;
+
+        /// Returns whether the point (px,py) is over the triangle, and if so the height of the triangle there.
+        static bool GetCrossing(const Triangle& t,double px,double py,double& z);
+
+        /// Returns the signed area of (a,b,p), computed the same way whichever way round the edge is given.
+        static double EdgeFunction(const double* a,const double* b,double px,double py);
+
+    protected:
+
+        int samples;                                ///< rays per pixel along x and y
+        bool is_flat;
+        std::vector<Triangle> triangles;
+
+        // while voxelizing:
+        vtkImageData *image;
+        int dims[3];
+        float value_inside,value_outside;
+        std::vector<std::vector<int> > row_triangles; ///< for each row of the image, the triangles that might cover it
+
+    private: // deliberately not implemented, to prevent use
+
+        MeshVoxelizer(const MeshVoxelizer&);
+        void operator=(const MeshVoxelizer&);
+};
+
+#endif
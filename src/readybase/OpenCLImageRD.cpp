@@ -26,10 +26,15 @@ using namespace OpenCL_utils;
 #include <stdexcept>
 #include <utility>
 #include <sstream>
+#include <iomanip>
 #include <cassert>
 #include <algorithm>
 using namespace std;
 
+// stdlib:
+#include <ctype.h>
+#include <math.h>
+
 // VTK:
 #include <vtkImageData.h>
 #include <vtkMath.h>
@@ -39,7 +44,117 @@ using namespace std;
 OpenCLImageRD::OpenCLImageRD(int opencl_platform,int opencl_device,int data_type)
     : ImageRD(data_type)
     , OpenCL_MixIn(opencl_platform,opencl_device)
+    , need_read_from_opencl_buffers(false)
+    , keep_cells_on_device(false)
+    , brush_program(NULL)
+    , brush_kernel(NULL)
+    , brush_centers(NULL)
+    , brush_centers_size(0)
+    , brush_old_values(NULL)
+    , brush_old_values_size(0)
+    , space_time_program(NULL)
+    , space_time_kernel(NULL)
+    , space_time_history_context(NULL)
+    , space_time_history(NULL)
+    , space_time_history_size(0)
+    , activity_kernel(NULL)
+    , activity_worklist(NULL)
+    , activity_counts(NULL)
+    , activity_changed(NULL)
+    , activity_parity(0)
+    , need_reset_activity(false)
+    , sat_column_kernel(NULL)
+    , slabs_by_numa(false)
+    , need_reload_slabs(true)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+OpenCLImageRD::~OpenCLImageRD()
+{
+    clReleaseKernel(this->brush_kernel);
+    clReleaseProgram(this->brush_program);
+    clReleaseMemObject(this->brush_centers);
+    clReleaseMemObject(this->brush_old_values);
+    clReleaseKernel(this->space_time_kernel);
+    clReleaseProgram(this->space_time_program);
+    clReleaseMemObject(this->space_time_history);
+    clReleaseKernel(this->activity_kernel);
+    clReleaseMemObject(this->activity_worklist);
+    clReleaseMemObject(this->activity_counts);
+    clReleaseMemObject(this->activity_changed);
+    for(size_t i=0;i<this->sat_row_kernels.size();i++)
+        clReleaseKernel(this->sat_row_kernels[i]);
+    clReleaseKernel(this->sat_column_kernel);
+    for(size_t i=0;i<this->sat_buffers.size();i++)
+        clReleaseMemObject(this->sat_buffers[i]);
+    for(int io=0;io<2;io++)
+        for(size_t i=0;i<this->auxiliary_mem[io].size();i++)
+            clReleaseMemObject(this->auxiliary_mem[io][i]);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update)
+{
+    ImageRD::InitializeFromXML(rd,warn_to_update);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found in file");
+
+    this->ReadAuxiliaryBuffersFromXML(rule);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReadAuxiliaryBuffersFromXML(vtkXMLDataElement* rule)
+{
+    this->auxiliary_buffers.clear();
+    for(int i=0;i<rule->GetNumberOfNestedElements();i++)
+    {
+        vtkXMLDataElement *node = rule->GetNestedElement(i);
+        if(string(node->GetName())!="auxiliary") continue;
+        AuxiliaryBuffer aux;
+        read_required_attribute(node,"name",aux.name);
+        bool is_identifier = !aux.name.empty() && !isdigit(aux.name[0]);
+        for(size_t j=0;j<aux.name.length();j++)
+            is_identifier &= ( isalnum(aux.name[j]) || aux.name[j]=='_' );
+        if(!is_identifier)
+            throw runtime_error("auxiliary : name must be letters, digits and underscores: "+aux.name);
+        for(size_t j=0;j<this->auxiliary_buffers.size();j++)
+            if(this->auxiliary_buffers[j].name==aux.name)
+                throw runtime_error("auxiliary : duplicate name: "+aux.name);
+        const char *s = node->GetAttribute("double_buffered");
+        if(!s || string(s)=="false") aux.double_buffered = false;
+        else if(string(s)=="true") aux.double_buffered = true;
+        else throw runtime_error("auxiliary : failed to read double_buffered");
+        this->auxiliary_buffers.push_back(aux);
+    }
+    if(!this->buffers[0].empty())
+        this->CreateAuxiliaryBuffers();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> OpenCLImageRD::GetAsXML(bool generate_initial_pattern_when_loading) const
 {
+    vtkSmartPointer<vtkXMLDataElement> rd = ImageRD::GetAsXML(generate_initial_pattern_when_loading);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found");
+
+    for(size_t i=0;i<this->auxiliary_buffers.size();i++)
+    {
+        vtkSmartPointer<vtkXMLDataElement> aux = vtkSmartPointer<vtkXMLDataElement>::New();
+        aux->SetName("auxiliary");
+        aux->SetAttribute("name",this->auxiliary_buffers[i].name.c_str());
+        if(this->auxiliary_buffers[i].double_buffered)
+            aux->SetAttribute("double_buffered","true");
+        rule->AddNestedElement(aux);
+    }
+
+    return rd;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -48,6 +163,42 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
 {
     if(!this->need_reload_formula) return;
 
+    this->BuildProgram();
+
+    // create the kernel
+    cl_int ret;
+    clReleaseKernel(this->kernel);
+    this->kernel = clCreateKernel(this->program,this->kernel_function_name.c_str(),&ret);
+    throwOnError(ret,"OpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+
+    this->global_range[0] = max(1,vtkMath::Round(this->GetX()) / this->GetBlockSizeX());
+    this->global_range[1] = max(1,vtkMath::Round(this->GetY()) / this->GetBlockSizeY());
+    this->global_range[2] = max(1,vtkMath::Round(this->GetZ()) / this->GetBlockSizeZ());
+    // (we let the local work group size be automatically decided, seems to be faster and more flexible that way)
+
+    this->CreateActivityTracking();
+    this->CreateSummedAreaTables();
+
+    if(this->refinement_threshold > 0.0f)
+    {
+        if(this->GetArenaDimensionality() != 2 || this->GetZ() != 1 || this->half_storage || this->interleaved_chemicals
+            || this->activity_tolerance > 0.0f || !this->sat_chemicals.empty() || !this->auxiliary_buffers.empty())
+            throw runtime_error("OpenCLImageRD::ReloadKernelIfNeeded : refinement needs a 2D image, with full storage, "
+                "separate chemicals, no activity tolerance, no neighborhood means and no auxiliary buffers");
+        this->refinement.Initialize(this->context,this->device_id,this->command_queue,this->AssembleRefinedKernelSource(),
+            this->GetX(),this->GetY(),this->GetNumberOfChemicals(),this->data_type==VTK_DOUBLE,this->wrap,this->refinement_threshold);
+    }
+    else
+        this->refinement.Release();
+
+    this->need_reload_formula = false;
+    this->need_reload_slabs = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::BuildProgram()
+{
     cl_int ret;
 
     // create the program
@@ -56,7 +207,7 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
     size_t source_size = this->kernel_source.length();
     clReleaseProgram(this->program);
     this->program = clCreateProgramWithSource(this->context,1,&source,&source_size,&ret);
-    throwOnError(ret,"OpenCLImageRD::ReloadKernelIfNeeded : Failed to create program with source: ");
+    throwOnError(ret,"OpenCLImageRD::BuildProgram : Failed to create program with source: ");
 
     // build the program
     ret = clBuildProgram(this->program,1,&this->device_id,"",NULL,NULL);
@@ -64,52 +215,538 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
     {
         size_t build_log_length = 0;
         cl_int ret2 = clGetProgramBuildInfo(this->program,this->device_id,CL_PROGRAM_BUILD_LOG,0,0,&build_log_length);
-        throwOnError(ret2,"OpenCLImageRD::ReloadKernelIfNeeded : retrieving length of program build log failed: ");
+        throwOnError(ret2,"OpenCLImageRD::BuildProgram : retrieving length of program build log failed: ");
         vector<char> build_log(build_log_length);
         cl_int ret3 = clGetProgramBuildInfo(this->program,this->device_id,CL_PROGRAM_BUILD_LOG,build_log_length,build_log.data(),0);
-        throwOnError(ret3,"OpenCLImageRD::ReloadKernelIfNeeded : retrieving program build log failed: ");
+        throwOnError(ret3,"OpenCLImageRD::BuildProgram : retrieving program build log failed: ");
         { ofstream out("kernel.txt"); out << kernel_source; }
         ostringstream oss;
-        oss << "OpenCLImageRD::ReloadKernelIfNeeded : build failed (kernel saved as kernel.txt):\n\n" << string( build_log.begin(), build_log.end() );
+        oss << "OpenCLImageRD::BuildProgram : build failed (kernel saved as kernel.txt):\n\n" << string( build_log.begin(), build_log.end() );
         throwOnError(ret,oss.str().c_str());
     }
+}
 
-    // create the kernel
-    clReleaseKernel(this->kernel);
-    this->kernel = clCreateKernel(this->program,this->kernel_function_name.c_str(),&ret);
-    throwOnError(ret,"OpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+// ----------------------------------------------------------------------------------------------------------------
 
-    this->global_range[0] = max(1,vtkMath::Round(this->GetX()) / this->GetBlockSizeX());
-    this->global_range[1] = max(1,vtkMath::Round(this->GetY()) / this->GetBlockSizeY());
-    this->global_range[2] = max(1,vtkMath::Round(this->GetZ()) / this->GetBlockSizeZ());
-    // (we let the local work group size be automatically decided, seems to be faster and more flexible that way)
+std::string OpenCLImageRD::AssembleRefinedKernelSource() const
+{
+    throw runtime_error("OpenCLImageRD::AssembleRefinedKernelSource : refinement is not supported for this rule type");
+}
 
-    this->need_reload_formula = false;
+// ----------------------------------------------------------------------------------------------------------------
+
+std::string OpenCLImageRD::AssembleSlabKernelSource() const
+{
+    throw runtime_error("OpenCLImageRD::AssembleSlabKernelSource : splitting into slabs is not supported for this rule type");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetSlabDevices(const vector<int>& devices,bool split_by_numa)
+{
+    this->ReadFromOpenCLBuffersIfNeeded(); // keep the current pattern
+    this->slab_devices = devices;
+    if(this->slab_devices.empty() && split_by_numa)
+        this->slab_devices.push_back(this->GetDevice());
+    this->slabs_by_numa = split_by_numa;
+    if(!this->IsSplitIntoSlabs())
+        this->slabs.Release();
+    this->need_reload_slabs = true;
+    if(!this->images.empty())
+        this->CreateOpenCLBuffers(); // (the values will be written again, to the slabs or to the one device)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::InternalUpdateOnSlabs(int n_steps)
+{
+    if(this->half_storage || this->interleaved_chemicals || this->activity_tolerance > 0.0f || this->refinement_threshold > 0.0f
+            || !this->sat_chemicals.empty() || !this->auxiliary_buffers.empty() || this->GetBlockSizeY() != 1 || this->GetBlockSizeZ() != 1)
+            throw runtime_error("OpenCLImageRD::InternalUpdateOnSlabs : splitting into slabs needs full storage, separate chemicals, "
+                "no activity tolerance, no refinement, no neighborhood means and no auxiliary buffers");
+    if(this->need_reload_slabs)
+    {
+        this->slabs.Initialize(this->GetPlatform(),this->slab_devices,this->slabs_by_numa,this->AssembleSlabKernelSource(),
+            this->GetX(),this->GetY(),this->GetZ(),this->GetNumberOfChemicals(),this->data_type_size,
+            this->global_range[0],this->global_range[1],this->wrap);
+        this->need_reload_slabs = false;
+        this->need_write_to_opencl_buffers = true;
+    }
+    if(this->need_write_to_opencl_buffers)
+    {
+        this->slabs.WriteCells(this->GetImagePointers());
+        this->need_write_to_opencl_buffers = false;
+    }
+    this->slabs.Step(n_steps);
+    this->slabs.ReadCells(this->GetImagePointers());
+    this->need_read_from_opencl_buffers = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+/// Returns the largest power of two that divides n, up to max.
+static int LargestPowerOfTwoDividing(int n,int max)
+{
+    int p = 1;
+    while(p < max && n % (p*2) == 0)
+        p *= 2;
+    return p;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CreateActivityTracking()
+{
+    clReleaseKernel(this->activity_kernel);
+    clReleaseMemObject(this->activity_worklist);
+    clReleaseMemObject(this->activity_counts);
+    clReleaseMemObject(this->activity_changed);
+    this->activity_kernel = NULL;
+    this->activity_worklist = NULL;
+    this->activity_counts = NULL;
+    this->activity_changed = NULL;
+    if(this->activity_tolerance <= 0.0f) return;
+
+    cl_int ret;
+
+    this->activity_kernel = clCreateKernel(this->program,"rd_update_activity",&ret);
+    throwOnError(ret,"OpenCLImageRD::CreateActivityTracking : kernel creation failed: ");
+
+    // the work group is the tile, so it must fit on the device as well as divide the range
+    size_t max_work_group_size;
+    ret = clGetKernelWorkGroupInfo(this->kernel,this->device_id,CL_KERNEL_WORK_GROUP_SIZE,sizeof(size_t),&max_work_group_size,NULL);
+    throwOnError(ret,"OpenCLImageRD::CreateActivityTracking : clGetKernelWorkGroupInfo failed: ");
+    int max_size[3] = { 256, 1, 1 };
+    if(this->global_range[2] > 1) { max_size[0] = 8; max_size[1] = 8; max_size[2] = 4; }
+    else if(this->global_range[1] > 1) { max_size[0] = 16; max_size[1] = 16; }
+    while(size_t(max_size[0] * max_size[1] * max_size[2]) > max_work_group_size)
+    {
+        int *largest = max_element(max_size,max_size+3);
+        *largest /= 2;
+    }
+    int n_tiles = 1;
+    for(int i=0;i<3;i++)
+    {
+        this->activity_tile_size[i] = LargestPowerOfTwoDividing((int)this->global_range[i],max_size[i]);
+        this->activity_n_tiles[i] = int(this->global_range[i] / this->activity_tile_size[i]);
+        n_tiles *= this->activity_n_tiles[i];
+    }
+
+    this->activity_worklist = clCreateBuffer(this->context, CL_MEM_READ_WRITE, sizeof(cl_int) * n_tiles, NULL, &ret);
+    throwOnError(ret,"OpenCLImageRD::CreateActivityTracking : buffer creation failed: ");
+    this->activity_counts = clCreateBuffer(this->context, CL_MEM_READ_WRITE, sizeof(cl_int) * 2, NULL, &ret);
+    throwOnError(ret,"OpenCLImageRD::CreateActivityTracking : buffer creation failed: ");
+    this->activity_changed = clCreateBuffer(this->context, CL_MEM_READ_WRITE, sizeof(cl_int) * 2 * n_tiles, NULL, &ret);
+    throwOnError(ret,"OpenCLImageRD::CreateActivityTracking : buffer creation failed: ");
+
+    const cl_int tiles_args[4] = { this->activity_n_tiles[0], this->activity_n_tiles[1], this->activity_n_tiles[2], this->wrap ? 1 : 0 };
+    ret = clSetKernelArg(this->activity_kernel, 0, sizeof(cl_mem), &this->activity_changed);
+    ret |= clSetKernelArg(this->activity_kernel, 1, sizeof(cl_mem), &this->activity_counts);
+    ret |= clSetKernelArg(this->activity_kernel, 2, sizeof(cl_mem), &this->activity_worklist);
+    for(int i=0;i<4;i++)
+        ret |= clSetKernelArg(this->activity_kernel, 4+i, sizeof(cl_int), &tiles_args[i]);
+    throwOnError(ret,"OpenCLImageRD::CreateActivityTracking : clSetKernelArg failed: ");
+
+    this->need_reset_activity = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ResetActivityIfNeeded()
+{
+    if(!this->need_reset_activity || !this->activity_kernel) return;
+
+    const int n_tiles = this->activity_n_tiles[0] * this->activity_n_tiles[1] * this->activity_n_tiles[2];
+    vector<cl_int> worklist(n_tiles);
+    for(int i=0;i<n_tiles;i++)
+        worklist[i] = i;
+    const cl_int counts[2] = { n_tiles, 0 };
+    const vector<cl_int> changed(2 * n_tiles, 0);
+
+    cl_int ret;
+    ret = clEnqueueWriteBuffer(this->command_queue,this->activity_worklist, CL_TRUE, 0, sizeof(cl_int) * n_tiles, &worklist[0], 0, NULL, NULL);
+    ret |= clEnqueueWriteBuffer(this->command_queue,this->activity_counts, CL_TRUE, 0, sizeof(cl_int) * 2, counts, 0, NULL, NULL);
+    ret |= clEnqueueWriteBuffer(this->command_queue,this->activity_changed, CL_TRUE, 0, sizeof(cl_int) * 2 * n_tiles, &changed[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLImageRD::ResetActivityIfNeeded : buffer writing failed: ");
+
+    this->activity_parity = 0;
+    this->need_reset_activity = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+std::string OpenCLImageRD::GetActivityKernelSource()
+{
+    // A tile needs computing on the next step if it or any of its neighbors changed on this one. A quiet tile that was
+    // computed on this one only needs copying, since otherwise the other buffer would keep its values from the step before
+    // (and after that copy both buffers agree, so it can be skipped). The worklist of the next step is built in any order,
+    // and the changed flags and the count of the step after that are cleared.
+    return "\n\
+__kernel void rd_update_activity(__global int *changed,__global int *counts,__global int *worklist,const int parity,\n\
+    const int tiles_x,const int tiles_y,const int tiles_z,const int wrap)\n\
+{\n\
+    const int t = get_global_id(0);\n\
+    const int n_tiles = tiles_x*tiles_y*tiles_z;\n\
+    const int tx = t % tiles_x;\n\
+    const int ty = (t / tiles_x) % tiles_y;\n\
+    const int tz = t / (tiles_x*tiles_y);\n\
+    int active = 0;\n\
+    for(int dz=-1;dz<=1;dz++)\n\
+    {\n\
+        for(int dy=-1;dy<=1;dy++)\n\
+        {\n\
+            for(int dx=-1;dx<=1;dx++)\n\
+            {\n\
+                int nx = tx+dx, ny = ty+dy, nz = tz+dz;\n\
+                if(wrap) { nx = (nx+tiles_x) % tiles_x; ny = (ny+tiles_y) % tiles_y; nz = (nz+tiles_z) % tiles_z; }\n\
+                else if(nx<0 || nx>=tiles_x || ny<0 || ny>=tiles_y || nz<0 || nz>=tiles_z) continue;\n\
+                active |= changed[parity*n_tiles + tiles_x*(tiles_y*nz + ny) + nx] & 2;\n\
+            }\n\
+        }\n\
+    }\n\
+    changed[(1-parity)*n_tiles + t] = 0;\n\
+    if(t==0) counts[parity] = 0;\n\
+    if(active) worklist[atomic_inc(&counts[1-parity])] = t;\n\
+    else if(changed[parity*n_tiles + t] & 1) worklist[atomic_inc(&counts[1-parity])] = -(t+1);\n\
+}\n";
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+static const int SAT_LIMIT_BITS = 20; // the values are clamped to +/-2^20 for the summed-area tables
+
+// ----------------------------------------------------------------------------------------------------------------
+
+int OpenCLImageRD::GetSummedAreaTableFractionBits() const
+{
+    // every entry of a table is at most the sum over the whole image, which must stay below 2^62
+    const double n_cells = double(this->GetX()) * this->GetY();
+    int bits = 24;
+    while(bits >= 0 && ldexp(n_cells,SAT_LIMIT_BITS + bits) > ldexp(1.0,62))
+        bits--;
+    return bits;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+std::string OpenCLImageRD::GetSummedAreaTableSource(const std::vector<int>& chemicals,bool wrap) const
+{
+    const string& real = this->data_type_string;
+    ostringstream scale_oss, limit_oss; // the values are clamped to +/-limit and rounded to multiples of 1/scale
+    scale_oss << scientific << setprecision(17) << ldexp(1.0,max(0,this->GetSummedAreaTableFractionBits())) << this->data_type_suffix;
+    limit_oss << scientific << setprecision(17) << ldexp(1.0,SAT_LIMIT_BITS) << this->data_type_suffix;
+    const string scale = scale_oss.str();
+    const string limit = limit_oss.str();
+    ostringstream oss;
+    oss << "\n\
+// sums over the box from cell (x0,y0) to cell (x1,y1) inclusive, which must lie within the image\n\
+long rd_sat_box(__global const long *sat,const int W,const int x0,const int y0,const int x1,const int y1)\n\
+{\n\
+    return sat[(y1+1)*(W+1)+x1+1] - sat[y0*(W+1)+x1+1] - sat[(y1+1)*(W+1)+x0] + sat[y0*(W+1)+x0];\n\
+}\n\n";
+    if(wrap)
+        oss << "\
+// sums over a box that may extend past the edges of the image, where it wraps around; adds its number of cells to count\n\
+long rd_sat_rect(__global const long *sat,const int W,const int H,const int x0,const int y0,int x1,int y1,int *count)\n\
+{\n\
+    x1 = min(x1,x0+W-1);\n\
+    y1 = min(y1,y0+H-1);\n\
+    if(x1<x0 || y1<y0) return 0;\n\
+    *count += (x1-x0+1)*(y1-y0+1);\n\
+    const int xa = (x0%W+W)%W, xb = xa+x1-x0;\n\
+    const int ya = (y0%H+H)%H, yb = ya+y1-y0;\n\
+    long sum = rd_sat_box(sat,W,xa,ya,min(xb,W-1),min(yb,H-1));\n\
+    if(xb>=W) sum += rd_sat_box(sat,W,0,ya,xb-W,min(yb,H-1));\n\
+    if(yb>=H) sum += rd_sat_box(sat,W,xa,0,min(xb,W-1),yb-H);\n\
+    if(xb>=W && yb>=H) sum += rd_sat_box(sat,W,0,0,xb-W,yb-H);\n\
+    return sum;\n\
+}\n\n";
+    else
+        oss << "\
+// sums over the part of a box that lies within the image; adds its number of cells to count\n\
+long rd_sat_rect(__global const long *sat,const int W,const int H,int x0,int y0,int x1,int y1,int *count)\n\
+{\n\
+    x0 = max(x0,0); y0 = max(y0,0);\n\
+    x1 = min(x1,W-1); y1 = min(y1,H-1);\n\
+    if(x1<x0 || y1<y0) return 0;\n\
+    *count += (x1-x0+1)*(y1-y0+1);\n\
+    return rd_sat_box(sat,W,x0,y0,x1,y1);\n\
+}\n\n";
+    oss << "\
+// sums over the cells within distance r of cell (x,y), one row at a time\n\
+long rd_sat_disc(__global const long *sat,const int W,const int H,const int x,const int y,const float r,int *count)\n\
+{\n\
+    long sum = 0;\n\
+    const int R = (int)r;\n\
+    for(int dy=-R;dy<=R;dy++)\n\
+    {\n\
+        const int w = (int)sqrt(r*r - (float)(dy*dy));\n\
+        sum += rd_sat_rect(sat,W,H,x-w,y+dy,x+w,y+dy,count);\n\
+    }\n\
+    return sum;\n\
+}\n\n";
+    oss << real << "4 rd_box_mean(__global const long *sat,const int W,const int H,const int x,const int y,const float r)\n\
+{\n\
+    const int R = (int)r;\n\
+    " << real << " m[4];\n\
+    for(int i=0;i<4;i++)\n\
+    {\n\
+        int count = 0;\n\
+        const long sum = rd_sat_rect(sat,W,H,x+i-R,y-R,x+i+R,y+R,&count);\n\
+        m[i] = (" << real << ")sum / (" << scale << " * count);\n\
+    }\n\
+    return (" << real << "4)(m[0],m[1],m[2],m[3]);\n\
+}\n\n";
+    oss << real << "4 rd_disc_mean(__global const long *sat,const int W,const int H,const int x,const int y,const float r)\n\
+{\n\
+    " << real << " m[4];\n\
+    for(int i=0;i<4;i++)\n\
+    {\n\
+        int count = 0;\n\
+        const long sum = rd_sat_disc(sat,W,H,x+i,y,r,&count);\n\
+        m[i] = (" << real << ")sum / (" << scale << " * count);\n\
+    }\n\
+    return (" << real << "4)(m[0],m[1],m[2],m[3]);\n\
+}\n\n";
+    oss << "// the mean over the cells further than r_inner from cell (x,y) but within r_outer of it\n" <<
+        real << "4 rd_annulus_mean(__global const long *sat,const int W,const int H,const int x,const int y,const float r_inner,const float r_outer)\n\
+{\n\
+    " << real << " m[4];\n\
+    for(int i=0;i<4;i++)\n\
+    {\n\
+        int count_inner = 0, count_outer = 0;\n\
+        const long sum = rd_sat_disc(sat,W,H,x+i,y,r_outer,&count_outer) - rd_sat_disc(sat,W,H,x+i,y,r_inner,&count_inner);\n\
+        m[i] = count_outer > count_inner ? (" << real << ")sum / (" << scale << " * (count_outer - count_inner)) : 0;\n\
+    }\n\
+    return (" << real << "4)(m[0],m[1],m[2],m[3]);\n\
+}\n\n";
+    oss << "\
+__kernel void rd_sat_columns(__global long *sat,const int W,const int H)\n\
+{\n\
+    const int x = get_global_id(0);\n\
+    long sum = 0;\n\
+    sat[x] = 0;\n\
+    for(int y=1;y<=H;y++)\n\
+    {\n\
+        sum += sat[y*(W+1)+x];\n\
+        sat[y*(W+1)+x] = sum;\n\
+    }\n\
+}\n";
+    // the row kernels read the values in whatever layout the buffers have
+    const int NC = this->GetNumberOfChemicals();
+    const int interleave_width = this->interleaved_chemicals ? this->GetBlockSizeX() : 0;
+    for(size_t i=0;i<chemicals.size();i++)
+    {
+        const int ic = chemicals[i];
+        string index = "W*y+x";
+        if(interleave_width)
+            index = "((W*y+x)/" + to_string(interleave_width) + "*" + to_string(NC) + "+" + to_string(ic) + ")*"
+                + to_string(interleave_width) + "+(W*y+x)%" + to_string(interleave_width);
+        const string value = this->half_storage ? "vload_half(" + index + ",in)" : "in[" + index + "]";
+        oss << "\n__kernel void rd_sat_rows_" << GetChemicalName(ic) << "(__global const "
+            << (this->half_storage ? "half" : real) << " *in,__global long *sat,const int W)\n\
+{\n\
+    const int y = get_global_id(0);\n\
+    __global long *row = sat + (y+1)*(W+1);\n\
+    long sum = 0;\n\
+    row[0] = 0;\n\
+    for(int x=0;x<W;x++)\n\
+    {\n\
+        sum += convert_long_rte(clamp((" << real << ")" << value << ",-" << limit << "," << limit << ") * " << scale << ");\n\
+        row[x+1] = sum;\n\
+    }\n\
+}\n";
+    }
+    return oss.str();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CreateSummedAreaTables()
+{
+    for(size_t i=0;i<this->sat_row_kernels.size();i++)
+        clReleaseKernel(this->sat_row_kernels[i]);
+    this->sat_row_kernels.clear();
+    clReleaseKernel(this->sat_column_kernel);
+    this->sat_column_kernel = NULL;
+    for(size_t i=0;i<this->sat_buffers.size();i++)
+        clReleaseMemObject(this->sat_buffers[i]);
+    this->sat_buffers.clear();
+    this->sat_chemicals = this->GetSummedAreaTableChemicals();
+    if(this->sat_chemicals.empty()) return;
+
+    if(this->GetZ() != 1)
+        throw runtime_error("OpenCLImageRD::CreateSummedAreaTables : neighborhood means need a 1D or 2D image");
+    if(this->activity_tolerance > 0.0f)
+        throw runtime_error("OpenCLImageRD::CreateSummedAreaTables : neighborhood means can't be used with an activity tolerance");
+    if(this->GetSummedAreaTableFractionBits() < 0)
+        throw runtime_error("OpenCLImageRD::CreateSummedAreaTables : the image is too large for neighborhood means");
+
+    cl_int ret;
+    const cl_int W = this->GetX();
+    const cl_int H = this->GetY();
+
+    this->sat_column_kernel = clCreateKernel(this->program,"rd_sat_columns",&ret);
+    throwOnError(ret,"OpenCLImageRD::CreateSummedAreaTables : kernel creation failed: ");
+    ret = clSetKernelArg(this->sat_column_kernel, 1, sizeof(cl_int), &W);
+    ret |= clSetKernelArg(this->sat_column_kernel, 2, sizeof(cl_int), &H);
+    throwOnError(ret,"OpenCLImageRD::CreateSummedAreaTables : clSetKernelArg failed: ");
+
+    for(size_t i=0;i<this->sat_chemicals.size();i++)
+    {
+        const string name = "rd_sat_rows_" + GetChemicalName(this->sat_chemicals[i]);
+        this->sat_row_kernels.push_back(clCreateKernel(this->program,name.c_str(),&ret));
+        throwOnError(ret,"OpenCLImageRD::CreateSummedAreaTables : kernel creation failed: ");
+        this->sat_buffers.push_back(clCreateBuffer(this->context, CL_MEM_READ_WRITE, sizeof(cl_long) * (W+1) * (H+1), NULL, &ret));
+        throwOnError(ret,"OpenCLImageRD::CreateSummedAreaTables : buffer creation failed: ");
+        ret = clSetKernelArg(this->sat_row_kernels[i], 1, sizeof(cl_mem), &this->sat_buffers[i]);
+        ret |= clSetKernelArg(this->sat_row_kernels[i], 2, sizeof(cl_int), &W);
+        throwOnError(ret,"OpenCLImageRD::CreateSummedAreaTables : clSetKernelArg failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ComputeSummedAreaTables()
+{
+    cl_int ret;
+    const size_t rows = this->GetY();
+    const size_t columns = this->GetX() + 1;
+    for(size_t i=0;i<this->sat_buffers.size();i++)
+    {
+        const int ic = this->interleave_width ? 0 : this->sat_chemicals[i];
+        ret = clSetKernelArg(this->sat_row_kernels[i], 0, sizeof(cl_mem), &this->buffers[this->iCurrentBuffer][ic]);
+        ret |= clSetKernelArg(this->sat_column_kernel, 0, sizeof(cl_mem), &this->sat_buffers[i]);
+        throwOnError(ret,"OpenCLImageRD::ComputeSummedAreaTables : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->sat_row_kernels[i], 1, NULL, &rows, NULL, 0, NULL, NULL);
+        throwOnError(ret,"OpenCLImageRD::ComputeSummedAreaTables : clEnqueueNDRangeKernel failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->sat_column_kernel, 1, NULL, &columns, NULL, 0, NULL, NULL);
+        throwOnError(ret,"OpenCLImageRD::ComputeSummedAreaTables : clEnqueueNDRangeKernel failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CreateAuxiliaryBuffers()
+{
+    this->ReadFromOpenCLBuffersIfNeeded(); // (all the values will be written again, so the image must be up to date)
+    for(int io=0;io<2;io++)
+    {
+        for(size_t i=0;i<this->auxiliary_mem[io].size();i++)
+            clReleaseMemObject(this->auxiliary_mem[io][i]);
+        this->auxiliary_mem[io].assign(this->auxiliary_buffers.size(),NULL);
+    }
+
+    cl_int ret;
+    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ(); // (always at full precision)
+    for(size_t i=0;i<this->auxiliary_buffers.size();i++)
+    {
+        for(int io=0;io<(this->auxiliary_buffers[i].double_buffered?2:1);io++)
+        {
+            this->auxiliary_mem[io][i] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+            throwOnError(ret,"OpenCLImageRD::CreateAuxiliaryBuffers : buffer creation failed: ");
+        }
+    }
+
+    this->need_write_to_opencl_buffers = true; // (the auxiliary values are zeroed along with it)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ZeroAuxiliaryBuffers()
+{
+    if(this->auxiliary_buffers.empty()) return;
+
+    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const vector<char> zeros(MEM_SIZE,0); // (all-zero bytes are zero for both float and double)
+    cl_int ret;
+    for(int io=0;io<2;io++)
+    {
+        for(size_t i=0;i<this->auxiliary_mem[io].size();i++)
+        {
+            if(!this->auxiliary_mem[io][i]) continue;
+            ret = clEnqueueWriteBuffer(this->command_queue,this->auxiliary_mem[io][i], CL_TRUE, 0, MEM_SIZE, &zeros[0], 0, NULL, NULL);
+            throwOnError(ret,"OpenCLImageRD::ZeroAuxiliaryBuffers : buffer writing failed: ");
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<string> OpenCLImageRD::GetAuxiliaryArgumentNames() const
+{
+    vector<string> names;
+    for(size_t i=0;i<this->auxiliary_buffers.size();i++)
+    {
+        if(this->auxiliary_buffers[i].double_buffered)
+        {
+            names.push_back(this->auxiliary_buffers[i].name + "_in");
+            names.push_back(this->auxiliary_buffers[i].name + "_out");
+        }
+        else
+            names.push_back(this->auxiliary_buffers[i].name);
+    }
+    return names;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<cl_mem> OpenCLImageRD::GetAuxiliaryArgumentBuffers() const
+{
+    vector<cl_mem> mems;
+    for(size_t i=0;i<this->auxiliary_buffers.size();i++)
+    {
+        if(this->auxiliary_buffers[i].double_buffered)
+        {
+            mems.push_back(this->auxiliary_mem[this->iCurrentBuffer][i]);
+            mems.push_back(this->auxiliary_mem[1-this->iCurrentBuffer][i]);
+        }
+        else
+            mems.push_back(this->auxiliary_mem[0][i]);
+    }
+    return mems;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
 void OpenCLImageRD::CreateOpenCLBuffers()
 {
+    this->ReadFromOpenCLBuffersIfNeeded(); // keep the current pattern, since the buffers are about to go
     this->ReloadContextIfNeeded();
 
-    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    if(this->IsSplitIntoSlabs())
+    {
+        // the slabs have buffers of their own; with none here the functions that work on the device use the image instead
+        this->ReleaseOpenCLBuffers();
+        this->buffers[0].clear();
+        this->buffers[1].clear();
+        this->need_reload_slabs = true;
+        this->need_write_to_opencl_buffers = true;
+        return;
+    }
+
     const int NC = this->GetNumberOfChemicals();
+    this->interleave_width = this->interleaved_chemicals ? this->GetBlockSizeX() : 0; // (each chemical takes one float4 in turn)
+    const int n_buffers = this->interleave_width ? 1 : NC;
+    const size_t value_size = this->half_storage ? sizeof(cl_half) : this->data_type_size;
+    const size_t MEM_SIZE = value_size * this->GetX() * this->GetY() * this->GetZ() * ( NC / n_buffers );
 
     this->ReleaseOpenCLBuffers();
 
     cl_int ret;
 
-    for(int io=0;io<2;io++) // we create two buffers for each chemical, and switch between them
+    for(int io=0;io<2;io++) // we create two buffers for each chemical (or for all of them if interleaved), and switch between them
     {
-        this->buffers[io].resize(NC);
-        for(int ic=0;ic<NC;ic++)
+        this->buffers[io].resize(n_buffers);
+        for(int ic=0;ic<n_buffers;ic++)
         {
             this->buffers[io][ic] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
             throwOnError(ret,"OpenCLImageRD::CreateOpenCLBuffers : buffer creation failed: ");
         }
     }
 
+    this->CreateAuxiliaryBuffers();
+
     this->need_write_to_opencl_buffers = true;
 }
 
@@ -119,17 +756,15 @@ void OpenCLImageRD::WriteToOpenCLBuffersIfNeeded()
 {
     if(!this->need_write_to_opencl_buffers) return;
 
-    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const size_t N = this->GetX() * this->GetY() * this->GetZ();
 
     this->iCurrentBuffer = 0;
-    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
-    {
-        void* data = this->images[ic]->GetScalarPointer();
-        cl_int ret = clEnqueueWriteBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLImageRD::WriteToOpenCLBuffers : buffer writing failed: ");
-    }
+    this->WriteCellsToBuffers(this->GetImagePointers(),-1,0,N,this->data_type_size,this->half_storage);
+    this->ZeroAuxiliaryBuffers(); // (whatever they held belonged to the old values)
 
     this->need_write_to_opencl_buffers = false;
+    this->need_reset_activity = true;
+    this->refinement.Reset(); // (the patches are made again from the image)
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -138,12 +773,14 @@ void OpenCLImageRD::CopyFromImage(vtkImageData* im)
 {
     ImageRD::CopyFromImage(im);
     this->need_write_to_opencl_buffers = true;
+    this->need_read_from_opencl_buffers = false; // (every chemical was overwritten)
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
 void OpenCLImageRD::SetFrom2DImage(int iChemical, vtkImageData *im)
 {
+    this->ReadFromOpenCLBuffersIfNeeded();
     ImageRD::SetFrom2DImage(iChemical, im);
     this->need_write_to_opencl_buffers = true;
 }
@@ -152,6 +789,7 @@ void OpenCLImageRD::SetFrom2DImage(int iChemical, vtkImageData *im)
 
 void OpenCLImageRD::GenerateInitialPattern()
 {
+    this->ReadFromOpenCLBuffersIfNeeded(); // (the overlays might only change some of the chemicals)
     ImageRD::GenerateInitialPattern();
     this->need_write_to_opencl_buffers = true;
 }
@@ -162,6 +800,7 @@ void OpenCLImageRD::BlankImage()
 {
     ImageRD::BlankImage();
     this->need_write_to_opencl_buffers = true;
+    this->need_read_from_opencl_buffers = false; // (every chemical was overwritten)
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -169,6 +808,7 @@ void OpenCLImageRD::BlankImage()
 void OpenCLImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
 {
     ImageRD::AllocateImages(x,y,z,nc,data_type);
+    this->need_read_from_opencl_buffers = false; // (the images are new, and no longer match the buffers)
     this->need_reload_formula = true;
     this->ReloadContextIfNeeded();
     this->ReloadKernelIfNeeded();
@@ -179,6 +819,7 @@ void OpenCLImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
 
 void OpenCLImageRD::SetNumberOfChemicals(int n)
 {
+    this->ReadFromOpenCLBuffersIfNeeded(); // keep the chemicals that stay
     ImageRD::SetNumberOfChemicals(n);
     this->need_reload_formula = true;
     this->ReloadContextIfNeeded();
@@ -192,27 +833,84 @@ void OpenCLImageRD::InternalUpdate(int n_steps)
 {
     this->ReloadContextIfNeeded();
     this->ReloadKernelIfNeeded();
+    if(this->IsSplitIntoSlabs())
+    {
+        this->InternalUpdateOnSlabs(n_steps);
+        return;
+    }
     this->WriteToOpenCLBuffersIfNeeded();
+    this->ResetActivityIfNeeded();
+    this->SetProbesOnDeviceIfNeeded();
+    this->SetSpaceTimeHistoryOnDeviceIfNeeded();
 
     cl_int ret;
     int iBuffer;
-    const int NC = this->GetNumberOfChemicals();
+    const int NB = (int)this->buffers[0].size(); // one per chemical, or one for all if interleaved
+    const int NA = (int)this->GetAuxiliaryArgumentNames().size();
+    const int NS = (int)this->sat_buffers.size();
+    const int n_tiles = this->activity_n_tiles[0] * this->activity_n_tiles[1] * this->activity_n_tiles[2];
+
+    for(int i=0;i<NS;i++)
+    {
+        // sat_a, ... (after the input, output and auxiliary buffers)
+        ret = clSetKernelArg(this->kernel, 2*NB+NA+i, sizeof(cl_mem), &this->sat_buffers[i]);
+        throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
+    }
+    if(this->activity_kernel)
+    {
+        // worklist, counts, changed (the parity changes each step)
+        ret = clSetKernelArg(this->kernel, 2*NB+NA+NS+0, sizeof(cl_mem), &this->activity_worklist);
+        ret |= clSetKernelArg(this->kernel, 2*NB+NA+NS+1, sizeof(cl_mem), &this->activity_counts);
+        ret |= clSetKernelArg(this->kernel, 2*NB+NA+NS+2, sizeof(cl_mem), &this->activity_changed);
+        throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
+    }
 
     for(int it=0;it<n_steps;it++)
     {
         for(int io=0;io<2;io++) // first input buffers (io=0) then output buffers (io=1)
         {
             iBuffer = (this->iCurrentBuffer+io)%2;
-            for(int ic=0;ic<NC;ic++)
+            for(int ic=0;ic<NB;ic++)
             {
                 // a_in, b_in, ... a_out, b_out ...
-                ret = clSetKernelArg(this->kernel, io*NC+ic, sizeof(cl_mem), (void *)&this->buffers[iBuffer][ic]);
+                ret = clSetKernelArg(this->kernel, io*NB+ic, sizeof(cl_mem), (void *)&this->buffers[iBuffer][ic]);
                 throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
             }
         }
-        ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range, NULL, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLImageRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
+        const vector<cl_mem> auxiliary_args = this->GetAuxiliaryArgumentBuffers();
+        for(int i=0;i<NA;i++)
+        {
+            // h, ... or h_in, h_out, ... (they switch with the chemicals)
+            ret = clSetKernelArg(this->kernel, 2*NB+i, sizeof(cl_mem), &auxiliary_args[i]);
+            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
+        }
+        this->ComputeSummedAreaTables();
+        if(this->activity_kernel)
+        {
+            // the work groups past the end of the worklist return at once (OpenCL 1.x can't take the range from the device)
+            const cl_int parity = this->activity_parity;
+            ret = clSetKernelArg(this->kernel, 2*NB+NA+NS+3, sizeof(cl_int), &parity);
+            ret |= clSetKernelArg(this->activity_kernel, 3, sizeof(cl_int), &parity);
+            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
+            ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range, this->activity_tile_size, 0, NULL, NULL);
+            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
+            const size_t activity_range = n_tiles;
+            ret = clEnqueueNDRangeKernel(this->command_queue,this->activity_kernel, 1, NULL, &activity_range, NULL, 0, NULL, NULL);
+            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
+            this->activity_parity = 1 - this->activity_parity;
+        }
+        else
+        {
+            ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range, NULL, 0, NULL, NULL);
+            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
+        }
         this->iCurrentBuffer = 1 - this->iCurrentBuffer;
+        if(this->refinement_threshold > 0.0f)
+            this->refinement.Step(this->buffers[1-this->iCurrentBuffer],this->buffers[this->iCurrentBuffer]);
+        if(this->HasProbes() && (this->timesteps_taken+it+1) % this->probe_set.GetInterval() == 0)
+            this->GatherProbesOnDevice(this->timesteps_taken+it+1,this->probe_record_timesteps,this->probe_record_values);
+        if(this->space_time_rows > 0)
+            this->RecordSpaceTimeRowOnDevice();
     }
 
     this->ReadFromOpenCLBuffers();
@@ -222,18 +920,217 @@ void OpenCLImageRD::InternalUpdate(int n_steps)
 
 void OpenCLImageRD::ReadFromOpenCLBuffers()
 {
+    if(this->keep_cells_on_device)
+    {
+        this->need_read_from_opencl_buffers = true; // (read them all when they are needed)
+        return;
+    }
     // read from opencl buffers into our image
-    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const size_t N = this->GetX() * this->GetY() * this->GetZ();
+    // when only one chemical is being rendered we leave the others on the device until they are needed
+    // (unless they are interleaved, when they all have to be read anyway)
+    const int iChemical = this->interleave_width ? -1 : this->iDisplayedChemical;
+    this->ReadCellsFromBuffers(this->GetImagePointers(),iChemical,0,N,this->data_type_size,this->half_storage);
+    this->need_read_from_opencl_buffers = ( iChemical!=-1 && this->GetNumberOfChemicals()>1 );
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReadFromOpenCLBuffersIfNeeded() const
+{
+    if(!this->need_read_from_opencl_buffers) return;
+
+    // (anything that changes the images while this is set either reads them first, overwrites them all and clears it,
+    // or writes the box it changed to the device as well, so here the buffers always hold the newer values, even if
+    // the images are also due to be written back)
+    this->need_read_from_opencl_buffers = false;
+    if(this->buffers[this->iCurrentBuffer].empty()) return;
+
+    const size_t N = this->GetX() * this->GetY() * this->GetZ();
+    const vector<void*> arrays = this->GetImagePointers();
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
     {
-        void* data = this->images[ic]->GetScalarPointer();
-        cl_int ret = clEnqueueReadBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLImageRD::ReadFromOpenCLBuffers : buffer reading failed: ");
+        if(ic==this->iDisplayedChemical && !this->keep_cells_on_device)
+            continue;
+        this->ReadCellsFromBuffers(arrays,ic,0,N,this->data_type_size,this->half_storage);
+        this->images[ic]->Modified();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ComputeStatistics(vector<ChemicalStatistics>& stats,int n_bins)
+{
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty())
+    {
+        ImageRD::ComputeStatistics(stats,n_bins); // the image is more recent than the device
+        return;
+    }
+    this->ComputeStatisticsOnDevice(this->GetNumberOfChemicals(),this->GetNumberOfCells(),this->data_type==VTK_DOUBLE,
+        this->half_storage,n_bins,stats);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool OpenCLImageRD::ComputeChangeOverLastStep(vector<double>& max_change,vector<double>& rms_change)
+{
+    // the buffers from before the last step are only there if we've taken a step since they were last written
+    if(this->need_write_to_opencl_buffers || this->timesteps_taken==0)
+        return false;
+    if(this->IsSplitIntoSlabs())
+        return this->slabs.ComputeChange(max_change,rms_change);
+    if(this->buffers[this->iCurrentBuffer].empty())
+        return false;
+    this->ComputeChangeOnDevice(this->GetNumberOfChemicals(),this->GetNumberOfCells(),this->data_type==VTK_DOUBLE,
+        this->half_storage,max_change,rms_change);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::TakeProbeRecords(vector<string>& column_names,vector<int>& timesteps,vector<double>& values)
+{
+    this->ReadProbesFromDevice(this->probe_record_timesteps,this->probe_record_values);
+    ImageRD::TakeProbeRecords(column_names,timesteps,values);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetProbesOnDeviceIfNeeded()
+{
+    if(!this->HasProbes()) return;
+    const bool is_double = this->data_type==VTK_DOUBLE;
+    if(!this->need_resolve_probes && !this->ProbesNeedSettingOnDevice(is_double,this->half_storage)) return;
+    // the rows already gathered belong to the old probes, so read them back first
+    this->ReadProbesFromDevice(this->probe_record_timesteps,this->probe_record_values);
+    this->ResolveProbesIfNeeded();
+    this->SetProbesOnDevice(this->GetNumberOfChemicals(),this->probe_cells,this->probe_chemicals,this->probe_set.GetCapacity(),
+        is_double,this->half_storage);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetSpaceTimeHistoryOnDeviceIfNeeded()
+{
+    if(this->space_time_rows == 0) return;
+
+    const KernelKey key = this->GetKernelKey(this->data_type==VTK_DOUBLE,this->half_storage);
+    if(!this->space_time_kernel || this->space_time_key!=key)
+    {
+        // each work item copies one cell
+        ostringstream source;
+        const string& T = this->data_type_string;
+        const string S = this->half_storage ? "half" : T;
+        source << "__kernel void record_row(__global const " << S << " *data,__global " << T << " *history,\n"
+            << "    const int n_chemicals,const int chemical,const int row)\n"
+            << "{\n"
+            << "    const int cell = get_global_id(0);\n";
+        if(this->interleave_width)
+            source << "    const int W = " << this->interleave_width << ";\n"
+                << "    const int i = ((cell / W) * n_chemicals + chemical) * W + cell % W;\n";
+        else
+            source << "    const int i = cell;\n";
+        source << "    history[row * get_global_size(0) + cell] = " << (this->half_storage ? "vload_half(i,data)" : "data[i]") << ";\n"
+            << "}\n";
+
+        cl_int ret;
+        clReleaseKernel(this->space_time_kernel);
+        clReleaseProgram(this->space_time_program);
+        this->space_time_kernel = NULL;
+        this->space_time_program = NULL;
+        this->space_time_program = BuildProgramFromSource(this->context,1,&this->device_id,source.str(),key.is_double,
+            "OpenCLImageRD::SetSpaceTimeHistoryOnDeviceIfNeeded");
+        this->space_time_kernel = clCreateKernel(this->space_time_program,"record_row",&ret);
+        throwOnError(ret,"OpenCLImageRD::SetSpaceTimeHistoryOnDeviceIfNeeded : kernel creation failed: ");
+        this->space_time_key = key;
+    }
+
+    // (the size changes with the data type too)
+    const size_t size = this->data_type_size * this->space_time_ring.size();
+    if(!this->space_time_history || this->space_time_history_context!=this->context || this->space_time_history_size!=size)
+    {
+        // the rows kept so far were in the old ring, so start again
+        cl_int ret;
+        clReleaseMemObject(this->space_time_history);
+        this->space_time_history = clCreateBuffer(this->context, CL_MEM_READ_WRITE, size, NULL, &ret);
+        throwOnError(ret,"OpenCLImageRD::SetSpaceTimeHistoryOnDeviceIfNeeded : buffer creation failed: ");
+        this->space_time_history_size = size;
+        this->space_time_history_context = this->context;
+        this->ResetSpaceTimeHistory();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::RecordSpaceTimeRowOnDevice()
+{
+    const cl_int layout_args[3] = { this->GetNumberOfChemicals(), this->space_time_chemical, this->space_time_next_row };
+    const int iBuffer = this->interleave_width ? 0 : this->space_time_chemical;
+    cl_int ret = clSetKernelArg(this->space_time_kernel, 0, sizeof(cl_mem), &this->buffers[this->iCurrentBuffer][iBuffer]);
+    ret |= clSetKernelArg(this->space_time_kernel, 1, sizeof(cl_mem), &this->space_time_history);
+    for(int i=0;i<3;i++)
+        ret |= clSetKernelArg(this->space_time_kernel, 2+i, sizeof(cl_int), &layout_args[i]);
+    throwOnError(ret,"OpenCLImageRD::RecordSpaceTimeRowOnDevice : clSetKernelArg failed: ");
+    const size_t range = this->GetNumberOfCells();
+    ret = clEnqueueNDRangeKernel(this->command_queue,this->space_time_kernel, 1, NULL, &range, NULL, 0, NULL, NULL);
+    throwOnError(ret,"OpenCLImageRD::RecordSpaceTimeRowOnDevice : clEnqueueNDRangeKernel failed: ");
+    this->space_time_next_row = (this->space_time_next_row+1) % this->space_time_rows;
+    this->space_time_n_rows = min(this->space_time_rows,this->space_time_n_rows+1);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReadSpaceTimeRing()
+{
+    if(this->space_time_n_rows == 0 || !this->space_time_history) return;
+
+    // the ring is small next to the steps that filled it, so we read all of it at once
+    vector<char> data(this->space_time_history_size);
+    cl_int ret = clEnqueueReadBuffer(this->command_queue,this->space_time_history, CL_TRUE, 0, data.size(), &data[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLImageRD::ReadSpaceTimeRing : buffer reading failed: ");
+    for(size_t i=0;i<this->space_time_ring.size();i++)
+    {
+        if(this->data_type==VTK_DOUBLE)
+            this->space_time_ring[i] = reinterpret_cast<const double*>(&data[0])[i];
+        else
+            this->space_time_ring[i] = reinterpret_cast<const float*>(&data[0])[i];
     }
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
+void OpenCLImageRD::SetHalfStorage(bool b)
+{
+    if(b == this->half_storage) return;
+    this->ReadFromOpenCLBuffersIfNeeded(); // keep the current pattern
+    ImageRD::SetHalfStorage(b);
+    if(!this->buffers[0].empty())
+        this->CreateOpenCLBuffers(); // (the values will be written again, in the new format)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetInterleavedChemicals(bool b)
+{
+    if(b == this->interleaved_chemicals) return;
+    this->ReadFromOpenCLBuffersIfNeeded(); // keep the current pattern
+    ImageRD::SetInterleavedChemicals(b);
+    if(!this->buffers[0].empty())
+        this->CreateOpenCLBuffers(); // (the values will be written again, in the new layout)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<void*> OpenCLImageRD::GetImagePointers() const
+{
+    vector<void*> arrays(this->GetNumberOfChemicals());
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+        arrays[ic] = this->images[ic]->GetScalarPointer();
+    return arrays;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 void OpenCLImageRD::TestFormula(std::string program_string)
 {
     this->TestKernel(this->AssembleKernelSourceFromFormula(program_string));
@@ -241,34 +1138,280 @@ void OpenCLImageRD::TestFormula(std::string program_string)
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
+void OpenCLImageRD::SaveFile(const char* filename,const Properties& render_settings,bool generate_initial_pattern_when_loading) const
 {
-    ImageRD::SetValue(x,y,z,val,render_settings);
-    this->need_write_to_opencl_buffers = true;
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::SaveFile(filename,render_settings,generate_initial_pattern_when_loading);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
+void OpenCLImageRD::SaveStartingPattern()
 {
-    ImageRD::SetValuesInRadius(x,y,z,r,val,render_settings);
-    this->need_write_to_opencl_buffers = true;
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::SaveStartingPattern();
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::Undo()
+void OpenCLImageRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& render_settings)
 {
-    ImageRD::Undo();
-    this->need_write_to_opencl_buffers = true;
+    this->ReadFromOpenCLBuffersIfNeeded(); // the new pipeline might show any of the chemicals
+    ImageRD::InitializeRenderPipeline(pRenderer,render_settings);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::Redo()
+void OpenCLImageRD::GetAsMesh(vtkPolyData *out,const Properties& render_settings) const
 {
-    ImageRD::Redo();
-    this->need_write_to_opencl_buffers = true;
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::GetAsMesh(out,render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings) const
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::GetAs2DImage(out,render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+float OpenCLImageRD::GetValue(float x,float y,float z,const Properties& render_settings)
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    return ImageRD::GetValue(x,y,z,render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::PaintRegionChanged(int iChemical,const int box[6])
+{
+    ImageRD::PaintRegionChanged(iChemical,box);
+
+    if(this->IsSplitIntoSlabs())
+        this->need_write_to_opencl_buffers = true; // (the slabs are only ever written whole)
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty())
+        return; // the whole image will be written before the next update anyway
+
+    // write just the cells of the box (the rest of the image may be older than the device, see SetRegionValues)
+    const size_t X = this->GetX();
+    const size_t Y = this->GetY();
+    const vector<void*> arrays = this->GetImagePointers();
+    if(!this->interleave_width)
+        this->WriteBoxToBuffer(this->buffers[this->iCurrentBuffer][iChemical],(int)X,(int)Y,box,arrays[iChemical],
+            this->data_type_size,this->half_storage);
+    else
+    {
+        // one row at a time, taking the whole blocks of all the chemicals that each row touches
+        for(int z=box[4];z<=box[5];z++)
+            for(int y=box[2];y<=box[3];y++)
+                this->WriteCellsToBuffers(arrays,iChemical,X * (y + Y * z) + box[0],box[1] - box[0] + 1,
+                    this->data_type_size,this->half_storage);
+    }
+    this->need_reset_activity = true; // (quiet tiles may have been painted)
+    this->refinement.Reset();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::GetRegionValues(int iChemical,const int box[6],vector<double>& values) const
+{
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty() || this->interleave_width)
+    {
+        // the image is more recent than the device, or as recent once read back (if interleaved)
+        this->ReadFromOpenCLBuffersIfNeeded();
+        ImageRD::GetRegionValues(iChemical,box,values);
+        return;
+    }
+
+    // read just the cells of the box
+    const size_t n = (box[1]-box[0]+1) * (box[3]-box[2]+1) * (box[5]-box[4]+1);
+    vector<char> box_values(this->data_type_size * n);
+    this->ReadBoxFromBuffer(this->buffers[this->iCurrentBuffer][iChemical],(int)this->GetX(),(int)this->GetY(),box,
+        &box_values[0],this->data_type_size,this->half_storage);
+    values.resize(n);
+    for(size_t i=0;i<n;i++)
+    {
+        if(this->data_type==VTK_DOUBLE)
+            values[i] = reinterpret_cast<const double*>(&box_values[0])[i];
+        else
+            values[i] = reinterpret_cast<const float*>(&box_values[0])[i];
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetRegionValues(int iChemical,const int box[6],const vector<double>& values)
+{
+    // PaintRegionChanged only writes the box to the device, so the rest of the image must be current first: e.g. undo
+    // and redo paint through here while only the displayed chemical has been read back. If the cells are being kept on
+    // the device then the image can stay behind, since the box is all that is written (unless the blocks are interleaved).
+    if(!this->keep_cells_on_device || this->interleave_width)
+        this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::SetRegionValues(iChemical,box,values);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetKeepCellsOnDevice(bool b)
+{
+    if(!b)
+        this->ReadFromOpenCLBuffersIfNeeded(); // (while the flag still says that none of the chemicals were read)
+    this->keep_cells_on_device = b;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::BuildBrushKernelIfNeeded()
+{
+    const KernelKey key = this->GetKernelKey(this->data_type==VTK_DOUBLE,this->half_storage);
+    if(this->brush_kernel && this->brush_key==key)
+        return;
+
+    // each work item handles one cell of the box around the stamps, saving the old value and painting if inside any of them
+    ostringstream source;
+    const string& T = this->data_type_string;
+    const string S = this->half_storage ? "half" : T; // (halves can only be loaded and stored, with vload_half and vstore_half)
+    source << "__kernel void paint_spheres(__global " << S << " *data,__global " << T << " *old_values,const int X,const int Y,\n"
+        << "    const int x0,const int y0,const int z0,__global const int4 *centers,const int n_centers,const float r2,const " << T << " val,\n"
+        << "    const int n_chemicals,const int chemical)\n"
+        << "{\n"
+        << "    const int bx = get_global_id(0);\n"
+        << "    const int by = get_global_id(1);\n"
+        << "    const int bz = get_global_id(2);\n"
+        << "    const int x = x0 + bx, y = y0 + by, z = z0 + bz;\n"
+        << "    const int cell = x + X * (y + Y * z);\n";
+    if(this->interleave_width)
+        source << "    const int W = " << this->interleave_width << ";\n"
+            << "    const int i = ((cell / W) * n_chemicals + chemical) * W + cell % W; // the chemicals take turns in blocks of W cells\n";
+    else
+        source << "    const int i = cell;\n";
+    source << "    old_values[bx + get_global_size(0) * (by + get_global_size(1) * bz)] = "
+        << (this->half_storage ? "vload_half(i,data)" : "data[i]") << ";\n"
+        << "    for(int k = 0; k < n_centers; k++)\n"
+        << "    {\n"
+        << "        const int dx = x - centers[k].x, dy = y - centers[k].y, dz = z - centers[k].z;\n"
+        << "        if((float)(dx*dx + dy*dy + dz*dz) < r2)\n"
+        << "        {\n"
+        << (this->half_storage ? "            vstore_half(val,i,data);\n" : "            data[i] = val;\n")
+        << "            return;\n"
+        << "        }\n"
+        << "    }\n"
+        << "}\n";
+
+    cl_int ret;
+    clReleaseKernel(this->brush_kernel);
+    clReleaseProgram(this->brush_program);
+    clReleaseMemObject(this->brush_centers);
+    clReleaseMemObject(this->brush_old_values);
+    this->brush_kernel = NULL;
+    this->brush_program = NULL;
+    this->brush_centers = NULL;
+    this->brush_centers_size = 0;
+    this->brush_old_values = NULL;
+    this->brush_old_values_size = 0;
+    this->brush_program = BuildProgramFromSource(this->context,1,&this->device_id,source.str(),key.is_double,
+        "OpenCLImageRD::BuildBrushKernelIfNeeded");
+    this->brush_kernel = clCreateKernel(this->brush_program,"paint_spheres",&ret);
+    throwOnError(ret,"OpenCLImageRD::BuildBrushKernelIfNeeded : kernel creation failed: ");
+    this->brush_key = key;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::PaintSpheres(int iChemical,const vector<int>& centers,float r,float val)
+{
+    if(this->half_storage)
+        val = HalfToFloat(FloatToHalf(val)); // what the device will hold, so that the image and the undo record match it
+
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty())
+    {
+        ImageRD::PaintSpheres(iChemical,centers,r,val); // the image is more recent than the device
+        return;
+    }
+
+    this->BuildBrushKernelIfNeeded();
+
+    int box[6];
+    this->GetSpheresBox(centers,r,box);
+    const size_t box_range[3] = { size_t(box[1]-box[0]+1), size_t(box[3]-box[2]+1), size_t(box[5]-box[4]+1) };
+    const size_t n_cells = box_range[0] * box_range[1] * box_range[2];
+    const cl_int n_centers = (cl_int)centers.size() / 3;
+
+    cl_int ret;
+    if(this->data_type_size * n_cells > this->brush_old_values_size)
+    {
+        clReleaseMemObject(this->brush_old_values);
+        this->brush_old_values_size = this->data_type_size * n_cells;
+        this->brush_old_values = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->brush_old_values_size, NULL, &ret);
+        throwOnError(ret,"OpenCLImageRD::PaintSpheres : buffer creation failed: ");
+    }
+    if(sizeof(cl_int) * 4 * n_centers > this->brush_centers_size)
+    {
+        clReleaseMemObject(this->brush_centers);
+        this->brush_centers_size = sizeof(cl_int) * 4 * n_centers;
+        this->brush_centers = clCreateBuffer(this->context, CL_MEM_READ_ONLY, this->brush_centers_size, NULL, &ret);
+        throwOnError(ret,"OpenCLImageRD::PaintSpheres : buffer creation failed: ");
+    }
+    vector<cl_int> centers4(4 * n_centers, 0);
+    for(int k=0;k<n_centers;k++)
+        copy(centers.begin() + 3*k, centers.begin() + 3*k + 3, centers4.begin() + 4*k);
+    // (non-blocking, since the readback below waits for the queue, and centers4 lasts until then)
+    ret = clEnqueueWriteBuffer(this->command_queue,this->brush_centers, CL_FALSE, 0, sizeof(cl_int) * centers4.size(), &centers4[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLImageRD::PaintSpheres : buffer writing failed: ");
+
+    // stamp the brush on the device, all the stamps at once
+    const cl_int X = this->GetX();
+    const cl_int Y = this->GetY();
+    const cl_int box_args[5] = { X, Y, box[0], box[2], box[4] };
+    const cl_float r2 = r*r;
+    const cl_float val_float = val;
+    const cl_double val_double = val;
+    const cl_int layout_args[2] = { this->GetNumberOfChemicals(), iChemical };
+    const int iBuffer = this->interleave_width ? 0 : iChemical;
+    ret = clSetKernelArg(this->brush_kernel, 0, sizeof(cl_mem), &this->buffers[this->iCurrentBuffer][iBuffer]);
+    ret |= clSetKernelArg(this->brush_kernel, 1, sizeof(cl_mem), &this->brush_old_values);
+    for(int i=0;i<5;i++)
+        ret |= clSetKernelArg(this->brush_kernel, 2+i, sizeof(cl_int), &box_args[i]);
+    ret |= clSetKernelArg(this->brush_kernel, 7, sizeof(cl_mem), &this->brush_centers);
+    ret |= clSetKernelArg(this->brush_kernel, 8, sizeof(cl_int), &n_centers);
+    ret |= clSetKernelArg(this->brush_kernel, 9, sizeof(cl_float), &r2);
+    if(this->data_type==VTK_DOUBLE)
+        ret |= clSetKernelArg(this->brush_kernel, 10, sizeof(cl_double), &val_double);
+    else
+        ret |= clSetKernelArg(this->brush_kernel, 10, sizeof(cl_float), &val_float);
+    for(int i=0;i<2;i++)
+        ret |= clSetKernelArg(this->brush_kernel, 11+i, sizeof(cl_int), &layout_args[i]);
+    throwOnError(ret,"OpenCLImageRD::PaintSpheres : clSetKernelArg failed: ");
+    ret = clEnqueueNDRangeKernel(this->command_queue,this->brush_kernel, 3, NULL, box_range, NULL, 0, NULL, NULL);
+    throwOnError(ret,"OpenCLImageRD::PaintSpheres : clEnqueueNDRangeKernel failed: ");
+
+    // bring back the old values, for undo
+    vector<char> old_data(this->data_type_size * n_cells);
+    ret = clEnqueueReadBuffer(this->command_queue,this->brush_old_values, CL_TRUE, 0, old_data.size(), &old_data[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLImageRD::PaintSpheres : buffer reading failed: ");
+    vector<double> old_values(n_cells), new_values(n_cells);
+    for(size_t i=0;i<n_cells;i++)
+    {
+        if(this->data_type==VTK_DOUBLE)
+            old_values[i] = reinterpret_cast<const double*>(&old_data[0])[i];
+        else
+            old_values[i] = reinterpret_cast<const float*>(&old_data[0])[i];
+    }
+
+    // make the same change to the image, without writing it back to the device
+    size_t i = 0;
+    for(int tz=box[4];tz<=box[5];tz++)
+        for(int ty=box[2];ty<=box[3];ty++)
+            for(int tx=box[0];tx<=box[1];tx++,i++)
+                new_values[i] = IsInAnySphere(centers,r2,tx,ty,tz) ? val : old_values[i];
+    this->SetRegionValues(iChemical,box,new_values);
+    this->StorePaintAction(iChemical,box,old_values,new_values);
+    ImageRD::PaintRegionChanged(iChemical,box);
+    this->need_reset_activity = true;
+    this->refinement.Reset();
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -21,6 +21,8 @@
 // local:
 #include "ImageRD.hpp"
 #include "OpenCL_MixIn.hpp"
+#include "PatchRefinement.hpp"
+#include "SlabDecomposition.hpp"
 
 /// Base class for implementations that use OpenCL.
 class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
@@ -28,6 +30,10 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
     public:
 
         OpenCLImageRD(int opencl_platform,int opencl_device,int data_type);
+        virtual ~OpenCLImageRD();
+
+        virtual void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update);
+        virtual vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const;
 
         virtual bool HasEditableFormula() const { return true; }
 
@@ -38,13 +44,39 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
 
         virtual std::string GetKernel() const { return this->AssembleKernelSourceFromFormula(this->formula); } 
 
+        virtual void SaveFile(const char* filename,const Properties& render_settings,
+            bool generate_initial_pattern_when_loading) const;
+
+        virtual void SaveStartingPattern();
+
+        virtual void InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& render_settings);
+
+        virtual void GetAsMesh(vtkPolyData *out,const Properties& render_settings) const;
+        virtual void GetAs2DImage(vtkImageData *out,const Properties& render_settings) const;
         virtual void SetFrom2DImage(int iChemical, vtkImageData *im);
 
-        virtual void SetValue(float x,float y,float z,float val,const Properties& render_settings);
-        virtual void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings);
+        virtual float GetValue(float x,float y,float z,const Properties& render_settings);
+
+        /// Computes the statistics on the device, unless the image is more recent.
+        virtual void ComputeStatistics(std::vector<ChemicalStatistics>& stats,int n_bins);
+
+        /// Compares the buffers from before and after the last step, on the device.
+        virtual bool ComputeChangeOverLastStep(std::vector<double>& max_change,std::vector<double>& rms_change);
+
+        /// Reads back the probe records still waiting on the device first.
+        virtual void TakeProbeRecords(std::vector<std::string>& column_names,std::vector<int>& timesteps,std::vector<double>& values);
+
+        virtual void SetHalfStorage(bool b);
+        virtual void SetInterleavedChemicals(bool b);
+
+        /// Splits the image along z between these devices of our platform (see SlabDecomposition), or stops if there are none.
+        /** If split_by_numa then each device is split by NUMA node too; with no devices given, this is done to our device. */
+        void SetSlabDevices(const std::vector<int>& devices,bool split_by_numa);
+        bool IsSplitIntoSlabs() const { return !this->slab_devices.empty(); }
 
-        virtual void Undo();
-        virtual void Redo();
+        virtual bool UsesNeighborhoodMeans() const { return !this->GetSummedAreaTableChemicals().empty(); }
+
+        virtual void SetKeepCellsOnDevice(bool b);
 
     protected:
 
@@ -55,11 +87,149 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
 
         virtual void InternalUpdate(int n_steps);
 
+        virtual bool RecordsProbesOnDevice() const { return !this->IsSplitIntoSlabs(); }
+        /// Finds the probes and sends them to the device, if they or the layout of the buffers have changed.
+        void SetProbesOnDeviceIfNeeded();
+
+        virtual bool RecordsSpaceTimeOnDevice() const { return !this->IsSplitIntoSlabs(); }
+        /// Makes the kernel and the device ring for the space-time history, if they are wanted and have changed.
+        void SetSpaceTimeHistoryOnDeviceIfNeeded();
+        /// Copies the current values of the chemical into the next row of the device ring, without reading anything back.
+        void RecordSpaceTimeRowOnDevice();
+        /// Downloads the device ring, only when the plot is about to be drawn.
+        virtual void ReadSpaceTimeRing();
+
         virtual void ReloadKernelIfNeeded();
 
+        /// Builds the program from the formula, throwing with the build log on failure.
+        void BuildProgram();
+
         virtual void CreateOpenCLBuffers();
         virtual void WriteToOpenCLBuffersIfNeeded();
         virtual void ReadFromOpenCLBuffers();
+
+        /// Reads the cells from the device, unless the image is more recent.
+        virtual void GetRegionValues(int iChemical,const int box[6],std::vector<double>& values) const;
+        /// Reads the other cells back from the device first, if they are newer than the image.
+        virtual void SetRegionValues(int iChemical,const int box[6],const std::vector<double>& values);
+        /// Writes just the painted cells to the device, rather than marking all the buffers as needing to be written.
+        virtual void PaintRegionChanged(int iChemical,const int box[6]);
+
+        /// Paints all the stamps on the device with one launch of the brush kernel, which also gives back the old values for undo.
+        virtual void PaintSpheres(int iChemical,const std::vector<int>& centers,float r,float val);
+
+        void BuildBrushKernelIfNeeded();
+
+        /// Brings in any chemicals that ReadFromOpenCLBuffers() left on the device.
+        void ReadFromOpenCLBuffersIfNeeded() const;
+
+        /// Returns the scalar pointer of the image of each chemical.
+        std::vector<void*> GetImagePointers() const;
+
+        /// Returns the kernel that builds the list of tiles to compute next, for subclasses to add to their program when activity tracking is on.
+        /** The kernel must mark each tile it computes in bit 0 of its changed flag, and in bit 1 if it changed by more than the
+         *  activity tolerance. It must skip the work groups beyond the list, and for a negative entry -(tile+1) copy the tile from
+         *  the input buffers to the output buffers instead of computing it. */
+        static std::string GetActivityKernelSource();
+
+        /// Chooses a tile size that divides the global range, and makes the activity kernel and buffers to go with it.
+        void CreateActivityTracking();
+        /// Marks every tile as active, e.g. after the device buffers were written from the image.
+        void ResetActivityIfNeeded();
+
+        /// Returns the kernel for the refined patches, for subclasses that support refinement (see PatchRefinement).
+        virtual std::string AssembleRefinedKernelSource() const;
+
+        /// Returns the kernel for one slab, for subclasses that support splitting into slabs (see SlabDecomposition).
+        virtual std::string AssembleSlabKernelSource() const;
+        /// Runs the steps on the slabs, then reads the whole image back; the other device buffers are left empty meanwhile.
+        void InternalUpdateOnSlabs(int n_steps);
+
+        /// Returns the chemicals whose neighborhood means the kernel uses, each needing a summed-area table.
+        virtual std::vector<int> GetSummedAreaTableChemicals() const { return std::vector<int>(); }
+
+        /// Returns the functions for neighborhood means and the kernels that build the summed-area tables of the chemicals.
+        /**
+         * The tables hold 64-bit fixed-point sums: each value is clamped to +/-2^20 and rounded to a multiple of
+         * 2^-GetSummedAreaTableFractionBits(), and then the sums are exact, so the means are as accurate for a large box as
+         * for a small one. rd_box_mean(), rd_disc_mean() and rd_annulus_mean() take the table of a chemical, the size of the
+         * image in cells and the first cell of a block of four along x, and return the mean for each cell of the block.
+         */
+        std::string GetSummedAreaTableSource(const std::vector<int>& chemicals,bool wrap) const;
+        /// Returns the number of fractional bits of the fixed-point values: 24, or fewer for images so large that the sum
+        /// of all their cells could otherwise overflow. Returns -1 if the image is too large for the tables at all.
+        int GetSummedAreaTableFractionBits() const;
+
+        /// Makes the kernels and buffers for the summed-area tables that the kernel needs.
+        void CreateSummedAreaTables();
+        /// Enqueues the building of the summed-area tables from the current buffers.
+        void ComputeSummedAreaTables();
+
+        /// Reads the auxiliary elements of the rule, replacing any auxiliary buffers.
+        void ReadAuxiliaryBuffersFromXML(vtkXMLDataElement* rule);
+        /// Makes the device buffers for the auxiliary values declared by the rule.
+        void CreateAuxiliaryBuffers();
+        /// Fills the auxiliary buffers with zeros, e.g. when the chemicals were written from the image.
+        void ZeroAuxiliaryBuffers();
+        /// Returns the names of the kernel arguments for the auxiliary buffers: h for each one, or h_in and h_out if it is double-buffered.
+        std::vector<std::string> GetAuxiliaryArgumentNames() const;
+        /// Returns the buffers that go with GetAuxiliaryArgumentNames() for the current step.
+        std::vector<cl_mem> GetAuxiliaryArgumentBuffers() const;
+
+    protected:
+
+        mutable bool need_read_from_opencl_buffers; ///< true if only iDisplayedChemical was read back after the last update
+                                                    ///< (or none of the chemicals, if keep_cells_on_device)
+        bool keep_cells_on_device;      ///< whether to skip reading the image back after each update (see SetKeepCellsOnDevice)
+
+        cl_program brush_program;
+        cl_kernel brush_kernel;
+        KernelKey brush_key;            ///< what the brush kernel was built for
+        cl_mem brush_centers;           ///< the center of each stamp of the brush, as int4s
+        size_t brush_centers_size;      ///< in bytes
+        cl_mem brush_old_values;        ///< the values that the last stamps of the brush overwrote, for their box of cells
+        size_t brush_old_values_size;   ///< in bytes
+
+        // the space-time history of a 1D arena, kept on the device (see ImageRD::space_time_ring)
+        cl_program space_time_program;
+        cl_kernel space_time_kernel;        ///< copies the cells of a chemical into a row of space_time_history
+        KernelKey space_time_key;           ///< what the kernel was built for
+        cl_context space_time_history_context; ///< the context that the ring was made in
+        cl_mem space_time_history;          ///< the ring of rows, in the data type (never halves)
+        size_t space_time_history_size;     ///< in bytes
+
+        // activity tracking (when activity_tolerance > 0): only the tiles in the worklist are computed
+        cl_kernel activity_kernel;      ///< rebuilds the worklist from the tiles that changed, NULL if activity tracking is off
+        cl_mem activity_worklist;       ///< the indices of the tiles to compute, or -(index+1) for those that only need copying
+        cl_mem activity_counts;         ///< the length of the worklist, for each parity
+        cl_mem activity_changed;        ///< for each parity, whether each tile was computed (bit 0) and changed (bit 1) on the last step
+        size_t activity_tile_size[3];   ///< work items per tile along each axis, also the local work group size
+        int activity_n_tiles[3];
+        int activity_parity;
+        bool need_reset_activity;
+
+        PatchRefinement refinement;     ///< the finer grid over the steep parts of the image, when refinement_threshold > 0
+
+        std::vector<int> slab_devices;  ///< the devices that the image is split between, or empty if it isn't
+        bool slabs_by_numa;             ///< whether the devices are split by NUMA node too
+        SlabDecomposition slabs;
+        bool need_reload_slabs;
+
+        /// A device buffer of one value per cell that the kernel keeps from one step to the next, e.g. for multi-step schemes.
+        /** Unlike a chemical it isn't rendered, saved or read back from the device, and starts at zero. */
+        struct AuxiliaryBuffer
+        {
+            std::string name;
+            bool double_buffered;   ///< if true then the kernel reads from name_in and writes to name_out, as for chemicals
+        };
+        std::vector<AuxiliaryBuffer> auxiliary_buffers;
+        std::vector<cl_mem> auxiliary_mem[2];   ///< the second is only used by the double-buffered ones
+
+        // summed-area tables, for the means over large neighborhoods
+        std::vector<int> sat_chemicals;             ///< the chemicals that have a table
+        std::vector<cl_kernel> sat_row_kernels;     ///< for each table, sums along the rows of its chemical
+        cl_kernel sat_column_kernel;                ///< then sums down the columns
+        std::vector<cl_mem> sat_buffers;            ///< (X+1)*(Y+1) sums each, with a row and column of zeros first
 };
 
 #endif
@@ -39,6 +39,10 @@ OpenCLMeshRD::OpenCLMeshRD(int opencl_platform,int opencl_device,int data_type)
 {
     this->clBuffer_cell_neighbor_indices = NULL;
     this->clBuffer_cell_neighbor_weights = NULL;
+    this->paint_program = NULL;
+    this->paint_kernel = NULL;
+    this->paint_cells_buffer = NULL;
+    this->paint_cells_buffer_size = 0;
 }
 
 // -------------------------------------------------------------------------
@@ -47,6 +51,9 @@ OpenCLMeshRD::~OpenCLMeshRD()
 {
     clReleaseMemObject(this->clBuffer_cell_neighbor_indices);
     clReleaseMemObject(this->clBuffer_cell_neighbor_weights);
+    clReleaseKernel(this->paint_kernel);
+    clReleaseProgram(this->paint_program);
+    clReleaseMemObject(this->paint_cells_buffer);
 }
 
 // -------------------------------------------------------------------------
@@ -107,17 +114,18 @@ void OpenCLMeshRD::InternalUpdate(int n_steps)
     this->ReloadContextIfNeeded();
     this->ReloadKernelIfNeeded();
     this->WriteToOpenCLBuffersIfNeeded();
+    this->SetProbesOnDeviceIfNeeded();
 
     cl_int ret;
     int iBuffer;
-    const int NC = this->GetNumberOfChemicals();
+    const int NB = (int)this->buffers[0].size(); // one per chemical, or one for all if interleaved
 
     // pass the neighbor indices and weights as parameters for the kernel
-    ret = clSetKernelArg(this->kernel, 2*NC + 0, sizeof(cl_mem), (void *)&this->clBuffer_cell_neighbor_indices);
+    ret = clSetKernelArg(this->kernel, 2*NB + 0, sizeof(cl_mem), (void *)&this->clBuffer_cell_neighbor_indices);
     throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on indices array: ");
-    ret = clSetKernelArg(this->kernel, 2*NC + 1, sizeof(cl_mem), (void *)&this->clBuffer_cell_neighbor_weights);
+    ret = clSetKernelArg(this->kernel, 2*NB + 1, sizeof(cl_mem), (void *)&this->clBuffer_cell_neighbor_weights);
     throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on weights array: ");
-    ret = clSetKernelArg(this->kernel, 2*NC + 2, sizeof(int), &this->max_neighbors);
+    ret = clSetKernelArg(this->kernel, 2*NB + 2, sizeof(int), &this->max_neighbors);
     throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on max_neighbors parameter: ");
 
     for(int it=0;it<n_steps;it++)
@@ -125,16 +133,18 @@ void OpenCLMeshRD::InternalUpdate(int n_steps)
         for(int io=0;io<2;io++) // first input buffers (io=0) then output buffers (io=1)
         {
             iBuffer = (this->iCurrentBuffer+io)%2;
-            for(int ic=0;ic<NC;ic++)
+            for(int ic=0;ic<NB;ic++)
             {
                 // a_in, b_in, ... a_out, b_out ...
-                ret = clSetKernelArg(this->kernel, io*NC+ic, sizeof(cl_mem), &this->buffers[iBuffer][ic]);
+                ret = clSetKernelArg(this->kernel, io*NB+ic, sizeof(cl_mem), &this->buffers[iBuffer][ic]);
                 throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on buffer: ");
             }
         }
         ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range, NULL, 0, NULL, NULL);
         throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
         this->iCurrentBuffer = 1 - this->iCurrentBuffer;
+        if(this->HasProbes() && (this->timesteps_taken+it+1) % this->probe_set.GetInterval() == 0)
+            this->GatherProbesOnDevice(this->timesteps_taken+it+1,this->probe_record_timesteps,this->probe_record_values);
     }
 
     this->ReadFromOpenCLBuffers();
@@ -199,13 +209,16 @@ void OpenCLMeshRD::CreateOpenCLBuffers()
 
     cl_int ret;
 
-    // create two buffers for each chemical (we will switch between them)
-    const size_t MEM_SIZE = this->data_type_size * this->mesh->GetNumberOfCells();
+    // create two buffers for each chemical, or for all of them if interleaved (we will switch between them)
     const int NC = this->GetNumberOfChemicals();
+    this->interleave_width = this->interleaved_chemicals ? 1 : 0; // (the chemicals of each cell are next to each other)
+    const int n_buffers = this->interleave_width ? 1 : NC;
+    const size_t value_size = this->half_storage ? sizeof(cl_half) : this->data_type_size;
+    const size_t MEM_SIZE = value_size * this->mesh->GetNumberOfCells() * ( NC / n_buffers );
     for(int io=0;io<2;io++)
     {
-        this->buffers[io].resize(NC);
-        for(int ic=0;ic<NC;ic++)
+        this->buffers[io].resize(n_buffers);
+        for(int ic=0;ic<n_buffers;ic++)
         {
             this->buffers[io][ic] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
             throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : data buffer creation failed: ");
@@ -235,14 +248,9 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
         this->CreateOpenCLBuffers();
 
     cl_int ret;
-    const size_t MEM_SIZE = this->data_type_size * this->mesh->GetNumberOfCells();
+    const size_t N = this->mesh->GetNumberOfCells();
     this->iCurrentBuffer = 0;
-    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
-    {
-        const void* data = this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str())->WriteVoidPointer(0,0);
-        ret = clEnqueueWriteBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : data buffer writing failed: ");
-    }
+    this->WriteCellsToBuffers(this->GetArrayPointers(),-1,0,N,this->data_type_size,this->half_storage);
 
     // fill indices buffer
     const size_t NBORS_INDICES_SIZE = sizeof(int) * this->mesh->GetNumberOfCells() * this->max_neighbors;
@@ -262,15 +270,8 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
 void OpenCLMeshRD::ReadFromOpenCLBuffers()
 {
     // read from opencl buffers into our mesh data
-    const size_t MEM_SIZE = this->data_type_size * this->mesh->GetNumberOfCells();
-    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
-    {
-        vtkDataArray *array = this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str());
-        if( !array ) throw runtime_error( "OpenCLMeshRD::ReadFromOpenCLBuffers : named array not found" );
-        void* data = array->WriteVoidPointer(0,0);
-        cl_int ret = clEnqueueReadBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLMeshRD::ReadFromOpenCLBuffers : data buffer reading failed: ");
-    }
+    const size_t N = this->mesh->GetNumberOfCells();
+    this->ReadCellsFromBuffers(this->GetArrayPointers(),-1,0,N,this->data_type_size,this->half_storage);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -283,6 +284,87 @@ void OpenCLMeshRD::CopyFromMesh(vtkUnstructuredGrid* mesh2)
 
 // ----------------------------------------------------------------------------------------------------------------
 
+void OpenCLMeshRD::ComputeStatistics(vector<ChemicalStatistics>& stats,int n_bins)
+{
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty())
+    {
+        MeshRD::ComputeStatistics(stats,n_bins); // the mesh is more recent than the device
+        return;
+    }
+    this->ComputeStatisticsOnDevice(this->GetNumberOfChemicals(),this->GetNumberOfCells(),this->data_type==VTK_DOUBLE,
+        this->half_storage,n_bins,stats);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool OpenCLMeshRD::ComputeChangeOverLastStep(vector<double>& max_change,vector<double>& rms_change)
+{
+    // the buffers from before the last step are only there if we've taken a step since they were last written
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty() || this->timesteps_taken==0)
+        return false;
+    this->ComputeChangeOnDevice(this->GetNumberOfChemicals(),this->GetNumberOfCells(),this->data_type==VTK_DOUBLE,
+        this->half_storage,max_change,rms_change);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLMeshRD::TakeProbeRecords(vector<string>& column_names,vector<int>& timesteps,vector<double>& values)
+{
+    this->ReadProbesFromDevice(this->probe_record_timesteps,this->probe_record_values);
+    MeshRD::TakeProbeRecords(column_names,timesteps,values);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLMeshRD::SetProbesOnDeviceIfNeeded()
+{
+    if(!this->HasProbes()) return;
+    const bool is_double = this->data_type==VTK_DOUBLE;
+    if(!this->need_resolve_probes && !this->ProbesNeedSettingOnDevice(is_double,this->half_storage)) return;
+    // the rows already gathered belong to the old probes, so read them back first
+    this->ReadProbesFromDevice(this->probe_record_timesteps,this->probe_record_values);
+    this->ResolveProbesIfNeeded();
+    this->SetProbesOnDevice(this->GetNumberOfChemicals(),this->probe_cells,this->probe_chemicals,this->probe_set.GetCapacity(),
+        is_double,this->half_storage);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLMeshRD::SetHalfStorage(bool b)
+{
+    if(b == this->half_storage) return;
+    MeshRD::SetHalfStorage(b);
+    if(!this->buffers[0].empty())
+        this->CreateOpenCLBuffers(); // (the values will be written again, in the new format)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLMeshRD::SetInterleavedChemicals(bool b)
+{
+    if(b == this->interleaved_chemicals) return;
+    MeshRD::SetInterleavedChemicals(b);
+    if(!this->buffers[0].empty())
+        this->CreateOpenCLBuffers(); // (the values will be written again, in the new layout)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<void*> OpenCLMeshRD::GetArrayPointers() const
+{
+    vector<void*> arrays(this->GetNumberOfChemicals());
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+    {
+        vtkDataArray *array = this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str());
+        if( !array ) throw runtime_error( "OpenCLMeshRD::GetArrayPointers : named array not found" );
+        arrays[ic] = array->WriteVoidPointer(0,0);
+    }
+    return arrays;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 void OpenCLMeshRD::TestFormula(std::string program_string)
 {
     this->TestKernel(this->AssembleKernelSourceFromFormula(program_string));
@@ -315,34 +397,97 @@ void OpenCLMeshRD::ReleaseOpenCLBuffers()
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
+void OpenCLMeshRD::PaintRegionChanged(int iChemical,const int box[6])
 {
-    MeshRD::SetValue(x,y,z,val,render_settings);
-    this->need_write_to_opencl_buffers = true;
-}
+    MeshRD::PaintRegionChanged(iChemical,box);
 
-// ----------------------------------------------------------------------------------------------------------------
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty())
+        return; // everything will be written before the next update anyway
 
-void OpenCLMeshRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
-{
-    MeshRD::SetValuesInRadius(x,y,z,r,val,render_settings);
-    this->need_write_to_opencl_buffers = true;
+    // write just the changed range of cells
+    this->WriteCellsToBuffers(this->GetArrayPointers(),iChemical,box[0],box[1] - box[0] + 1,this->data_type_size,this->half_storage);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::Undo()
+void OpenCLMeshRD::BuildPaintKernelIfNeeded()
 {
-    MeshRD::Undo();
-    this->need_write_to_opencl_buffers = true;
+    const KernelKey key = this->GetKernelKey(this->data_type==VTK_DOUBLE,this->half_storage);
+    if(this->paint_kernel && this->paint_key==key)
+        return;
+
+    // each work item sets one of the listed cells
+    ostringstream source;
+    const string& T = this->data_type_string;
+    const string S = this->half_storage ? "half" : T; // (halves can only be stored, with vstore_half)
+    source << "__kernel void paint_cells(__global " << S << " *data,__global const int *cells,const " << T << " val,\n"
+        << "    const int n_chemicals,const int chemical)\n"
+        << "{\n"
+        << "    const int i = " << (this->interleave_width ? "cells[get_global_id(0)] * n_chemicals + chemical" : "cells[get_global_id(0)]") << ";\n"
+        << (this->half_storage ? "    vstore_half(val,i,data);\n" : "    data[i] = val;\n")
+        << "}\n";
+
+    cl_int ret;
+    clReleaseKernel(this->paint_kernel);
+    clReleaseProgram(this->paint_program);
+    clReleaseMemObject(this->paint_cells_buffer);
+    this->paint_kernel = NULL;
+    this->paint_program = NULL;
+    this->paint_cells_buffer = NULL;
+    this->paint_cells_buffer_size = 0;
+    this->paint_program = BuildProgramFromSource(this->context,1,&this->device_id,source.str(),key.is_double,
+        "OpenCLMeshRD::BuildPaintKernelIfNeeded");
+    this->paint_kernel = clCreateKernel(this->paint_program,"paint_cells",&ret);
+    throwOnError(ret,"OpenCLMeshRD::BuildPaintKernelIfNeeded : kernel creation failed: ");
+    this->paint_key = key;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::Redo()
+void OpenCLMeshRD::PaintCells(int iChemical,const vector<int>& cells,float val)
 {
-    MeshRD::Redo();
-    this->need_write_to_opencl_buffers = true;
+    if(this->half_storage)
+        val = HalfToFloat(FloatToHalf(val)); // what the device will hold, so that the mesh and the undo record match it
+
+    if(this->need_write_to_opencl_buffers || this->buffers[this->iCurrentBuffer].empty())
+    {
+        MeshRD::PaintCells(iChemical,cells,val); // the mesh is more recent than the device
+        return;
+    }
+
+    this->BuildPaintKernelIfNeeded();
+
+    // send the list of cells and set them on the device
+    cl_int ret;
+    const size_t CELLS_SIZE = sizeof(cl_int) * cells.size();
+    if(CELLS_SIZE > this->paint_cells_buffer_size)
+    {
+        clReleaseMemObject(this->paint_cells_buffer);
+        this->paint_cells_buffer_size = CELLS_SIZE;
+        this->paint_cells_buffer = clCreateBuffer(this->context, CL_MEM_READ_ONLY, CELLS_SIZE, NULL, &ret);
+        throwOnError(ret,"OpenCLMeshRD::PaintCells : buffer creation failed: ");
+    }
+    ret = clEnqueueWriteBuffer(this->command_queue,this->paint_cells_buffer, CL_TRUE, 0, CELLS_SIZE, &cells[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::PaintCells : buffer writing failed: ");
+    const cl_float val_float = val;
+    const cl_double val_double = val;
+    const cl_int layout_args[2] = { this->GetNumberOfChemicals(), iChemical };
+    const int iBuffer = this->interleave_width ? 0 : iChemical;
+    ret = clSetKernelArg(this->paint_kernel, 0, sizeof(cl_mem), &this->buffers[this->iCurrentBuffer][iBuffer]);
+    ret |= clSetKernelArg(this->paint_kernel, 1, sizeof(cl_mem), &this->paint_cells_buffer);
+    if(this->data_type==VTK_DOUBLE)
+        ret |= clSetKernelArg(this->paint_kernel, 2, sizeof(cl_double), &val_double);
+    else
+        ret |= clSetKernelArg(this->paint_kernel, 2, sizeof(cl_float), &val_float);
+    for(int i=0;i<2;i++)
+        ret |= clSetKernelArg(this->paint_kernel, 3+i, sizeof(cl_int), &layout_args[i]);
+    throwOnError(ret,"OpenCLMeshRD::PaintCells : clSetKernelArg failed: ");
+    const size_t n_cells = cells.size();
+    ret = clEnqueueNDRangeKernel(this->command_queue,this->paint_kernel, 1, NULL, &n_cells, NULL, 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::PaintCells : clEnqueueNDRangeKernel failed: ");
+
+    // make the same change to the mesh, without writing it back to the device
+    this->PaintCellRuns(iChemical,cells,val,true);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -46,19 +46,29 @@ class OpenCLMeshRD : public MeshRD, public OpenCL_MixIn
         virtual void GenerateInitialPattern();
         virtual void BlankImage();
 
-        virtual void TestFormula(std::string program_string);
-        virtual std::string GetKernel() const { return this->AssembleKernelSourceFromFormula(this->formula); } 
+        /// Computes the statistics on the device, unless the mesh is more recent.
+        virtual void ComputeStatistics(std::vector<ChemicalStatistics>& stats,int n_bins);
+
+        /// Compares the buffers from before and after the last step, on the device.
+        virtual bool ComputeChangeOverLastStep(std::vector<double>& max_change,std::vector<double>& rms_change);
 
-        virtual void SetValue(float x,float y,float z,float val,const Properties& render_settings);
-        virtual void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings);
+        /// Reads back the probe records still waiting on the device first.
+        virtual void TakeProbeRecords(std::vector<std::string>& column_names,std::vector<int>& timesteps,std::vector<double>& values);
 
-        virtual void Undo();
-        virtual void Redo();
+        virtual void SetHalfStorage(bool b);
+        virtual void SetInterleavedChemicals(bool b);
+
+        virtual void TestFormula(std::string program_string);
+        virtual std::string GetKernel() const { return this->AssembleKernelSourceFromFormula(this->formula); } 
 
     protected:
 
         virtual void InternalUpdate(int n_steps);
 
+        virtual bool RecordsProbesOnDevice() const { return true; }
+        /// Finds the probes and sends them to the device, if they or the layout of the buffers have changed.
+        void SetProbesOnDeviceIfNeeded();
+
         virtual void ReloadKernelIfNeeded();
 
         virtual void CreateOpenCLBuffers();
@@ -66,10 +76,27 @@ class OpenCLMeshRD : public MeshRD, public OpenCL_MixIn
         virtual void ReadFromOpenCLBuffers();
         virtual void ReleaseOpenCLBuffers();
 
+        /// Writes just the painted cells to the device, rather than marking all the buffers as needing to be written.
+        virtual void PaintRegionChanged(int iChemical,const int box[6]);
+
+        /// Sets the cells on the device with a small kernel, so only the list of cells is sent.
+        virtual void PaintCells(int iChemical,const std::vector<int>& cells,float val);
+
+        void BuildPaintKernelIfNeeded();
+
+        /// Returns the data pointer of the cell data array of each chemical.
+        std::vector<void*> GetArrayPointers() const;
+
     private:
 
         cl_mem clBuffer_cell_neighbor_indices;
         cl_mem clBuffer_cell_neighbor_weights;
+
+        cl_program paint_program;
+        cl_kernel paint_kernel;
+        KernelKey paint_key;            ///< what the paint kernel was built for
+        cl_mem paint_cells_buffer;      ///< the cells to be painted
+        size_t paint_cells_buffer_size; ///< in bytes
 };
 
 #endif
@@ -88,6 +88,10 @@ __clEnqueueWaitForEvents             *clEnqueueWaitForEvents;
 __clEnqueueBarrier                   *clEnqueueBarrier;
 __clGetExtensionFunctionAddress      *clGetExtensionFunctionAddress;
 
+/* OpenCL 1.2 stuff, only loaded if present */
+__clCreateSubDevices                 *clCreateSubDevices;
+__clReleaseDevice                    *clReleaseDevice;
+
 /* OpenCL 1.1 stuff */
 /* TJH commented this out, to avoid requiring 1.1
 __clCreateSubBuffer                  *clCreateSubBuffer;
@@ -126,6 +130,9 @@ cl_int CL_LOAD_LIBRARY(CL_LIBRARY *pInstance)
         name = (__##name *)GetProcAddress(ClLib, #name);        \
         if (name == NULL) return CL_DEVICE_NOT_AVAILABLE
 
+#define GET_OPTIONAL_PROC(name)                                 \
+        name = (__##name *)GetProcAddress(ClLib, #name)
+
 #elif defined(__unix__) || defined(__APPLE__) || defined(__MACOSX)
 
 #include <dlfcn.h>
@@ -152,6 +159,9 @@ cl_int CL_LOAD_LIBRARY(CL_LIBRARY *pInstance)
         name = (__##name *)(size_t)dlsym(ClLib, #name);                 \
         if (name == NULL) return CL_DEVICE_NOT_AVAILABLE
 
+#define GET_OPTIONAL_PROC(name)                                 \
+        name = (__##name *)(size_t)dlsym(ClLib, #name)
+
 #endif
 
 
@@ -241,6 +251,10 @@ cl_int CL_API_CALL clLibLoad()
     //GET_PROC(clEnqueueWriteBufferRect           );
     //GET_PROC(clEnqueueCopyBufferRect            );
 
+    /* Load OpenCL 1.2 stuff, if it's there (it's only needed for splitting devices) */
+    GET_OPTIONAL_PROC(clCreateSubDevices        );
+    GET_OPTIONAL_PROC(clReleaseDevice           );
+
     return CL_SUCCESS;
 }
 
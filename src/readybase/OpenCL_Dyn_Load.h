@@ -58,6 +58,7 @@ extern "C" {
     typedef cl_uint             cl_channel_order;
     typedef cl_uint             cl_channel_type;
     typedef cl_bitfield         cl_mem_flags;
+    typedef intptr_t            cl_device_partition_property; /* OpenCL 1.2 */
     typedef cl_uint             cl_mem_object_type;
     typedef cl_uint             cl_mem_info;
     typedef cl_uint             cl_image_info;
@@ -104,6 +105,7 @@ extern "C" {
 #define CL_MAP_FAILURE                              -12
 #define CL_MISALIGNED_SUB_BUFFER_OFFSET             -13
 #define CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST -14
+#define CL_DEVICE_PARTITION_FAILED                  -18
 
 #define CL_INVALID_VALUE                            -30
 #define CL_INVALID_DEVICE_TYPE                      -31
@@ -228,6 +230,14 @@ extern "C" {
 #define CL_DEVICE_NATIVE_VECTOR_WIDTH_HALF          0x103C
 #define CL_DEVICE_OPENCL_C_VERSION                  0x103D
 
+    /* cl_device_partition_property (OpenCL 1.2) */
+#define CL_DEVICE_PARTITION_EQUALLY                 0x1086
+#define CL_DEVICE_PARTITION_BY_COUNTS               0x1087
+#define CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN      0x1088
+
+    /* cl_device_affinity_domain (OpenCL 1.2) */
+#define CL_DEVICE_AFFINITY_DOMAIN_NUMA              (1 << 0)
+
     /* cl_device_fp_config - bitfield */
 #define CL_FP_DENORM                                (1 << 0)
 #define CL_FP_INF_NAN                               (1 << 1)
@@ -978,6 +988,17 @@ extern "C" {
 //
     typedef CL_API_ENTRY void * CL_API_CALL __clGetExtensionFunctionAddress(const char * /* func_name */) CL_API_SUFFIX__VERSION_1_0;
 
+    /* OpenCL 1.2 (these are NULL if the library doesn't have them) */
+    typedef CL_API_ENTRY cl_int CL_API_CALL
+    __clCreateSubDevices(cl_device_id                         /* in_device */,
+                         const cl_device_partition_property * /* properties */,
+                         cl_uint                              /* num_devices */,
+                         cl_device_id *                       /* out_devices */,
+                         cl_uint *                            /* num_devices_ret */);
+
+    typedef CL_API_ENTRY cl_int CL_API_CALL
+    __clReleaseDevice(cl_device_id /* device */);
+
 
     extern __clGetPlatformIDs                   *clGetPlatformIDs;
     extern __clGetPlatformInfo                  *clGetPlatformInfo;
@@ -1052,6 +1073,8 @@ extern "C" {
     extern __clEnqueueWaitForEvents             *clEnqueueWaitForEvents;
     extern __clEnqueueBarrier                   *clEnqueueBarrier;
     extern __clGetExtensionFunctionAddress      *clGetExtensionFunctionAddress;
+    extern __clCreateSubDevices                 *clCreateSubDevices;
+    extern __clReleaseDevice                    *clReleaseDevice;
 
 /// Loads the OpenCL library if available
 ///
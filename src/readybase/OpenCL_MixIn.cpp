@@ -24,8 +24,14 @@ using namespace OpenCL_utils;
 #include <stdexcept>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 using namespace std;
 
+// stdlib:
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
 // ---------------------------------------------------------------------------
 
 OpenCL_MixIn::OpenCL_MixIn(int opencl_platform,int opencl_device)
@@ -42,11 +48,23 @@ OpenCL_MixIn::OpenCL_MixIn(int opencl_platform,int opencl_device)
     this->command_queue = NULL;
     this->kernel = NULL;
     this->program = NULL;
+    this->statistics_program = NULL;
+    this->statistics_kernel = NULL;
+    this->histogram_kernel = NULL;
+    this->change_kernel = NULL;
+    this->statistics_results = NULL;
+    this->statistics_results_size = 0;
+    this->probe_program = NULL;
+    this->probe_kernel = NULL;
+    this->probe_samples = NULL;
+    this->probe_ring = NULL;
+    this->probe_capacity = 0;
 
     if(LinkOpenCL()!= CL_SUCCESS)
         throw runtime_error("Failed to load dynamic library for OpenCL");
 
     this->iCurrentBuffer = 0;
+    this->interleave_width = 0;
 }
 
 // ---------------------------------------------------------------------------
@@ -57,6 +75,15 @@ OpenCL_MixIn::~OpenCL_MixIn()
     clFinish(this->command_queue);
     clReleaseKernel(this->kernel);
     clReleaseProgram(this->program);
+    clReleaseKernel(this->statistics_kernel);
+    clReleaseKernel(this->histogram_kernel);
+    clReleaseKernel(this->change_kernel);
+    clReleaseProgram(this->statistics_program);
+    clReleaseMemObject(this->statistics_results);
+    clReleaseKernel(this->probe_kernel);
+    clReleaseProgram(this->probe_program);
+    clReleaseMemObject(this->probe_samples);
+    clReleaseMemObject(this->probe_ring);
     for(int i=0;i<2;i++)
         for(vector<cl_mem>::const_iterator it = this->buffers[i].begin();it!=this->buffers[i].end();it++)
             clReleaseMemObject(*it);
@@ -98,6 +125,53 @@ int OpenCL_MixIn::GetDevice() const
 
 // ---------------------------------------------------------------------------
 
+cl_program OpenCL_MixIn::BuildProgramFromSource(cl_context context,cl_uint n_devices,const cl_device_id* devices,
+    const string& source,bool is_double,const string& caller)
+{
+    string full_source;
+    if(is_double)
+        full_source = "\
+#ifdef cl_khr_fp64\n\
+    #pragma OPENCL EXTENSION cl_khr_fp64 : enable\n\
+#elif defined(cl_amd_fp64)\n\
+    #pragma OPENCL EXTENSION cl_amd_fp64 : enable\n\
+#endif\n\n";
+    full_source += source;
+    const char *source_chars = full_source.c_str();
+    size_t source_size = full_source.length();
+
+    cl_int ret;
+    cl_program program = clCreateProgramWithSource(context,1,&source_chars,&source_size,&ret);
+    throwOnError(ret,(caller + " : Failed to create program with source: ").c_str());
+    ret = clBuildProgram(program,n_devices,devices,"",NULL,NULL);
+    if(ret != CL_SUCCESS)
+    {
+        size_t build_log_length = 0;
+        clGetProgramBuildInfo(program,devices[0],CL_PROGRAM_BUILD_LOG,0,0,&build_log_length);
+        vector<char> build_log(build_log_length+1,'\0');
+        clGetProgramBuildInfo(program,devices[0],CL_PROGRAM_BUILD_LOG,build_log_length,&build_log[0],0);
+        clReleaseProgram(program);
+        ostringstream oss;
+        oss << caller << " : build failed:\n\n" << &build_log[0];
+        throwOnError(ret,oss.str().c_str());
+    }
+    return program;
+}
+
+// ---------------------------------------------------------------------------
+
+OpenCL_MixIn::KernelKey OpenCL_MixIn::GetKernelKey(bool is_double,bool as_half) const
+{
+    KernelKey key;
+    key.context = this->context;
+    key.is_double = is_double;
+    key.as_half = as_half;
+    key.interleave_width = this->interleave_width;
+    return key;
+}
+
+// ---------------------------------------------------------------------------
+
 void OpenCL_MixIn::ReloadContextIfNeeded()
 {
     if(!this->need_reload_context) return;
@@ -196,3 +270,607 @@ void OpenCL_MixIn::ReleaseOpenCLBuffers()
 }
 
 // -----------------------------------------------------------------------
+
+void OpenCL_MixIn::WriteValuesToBuffer(cl_mem buffer,size_t first,size_t n,const void* values,size_t host_value_size,bool as_half)
+{
+    cl_int ret;
+    if(!as_half)
+    {
+        ret = clEnqueueWriteBuffer(this->command_queue,buffer, CL_TRUE, host_value_size * first, host_value_size * n, values, 0, NULL, NULL);
+        throwOnError(ret,"OpenCL_MixIn::WriteValuesToBuffer : buffer writing failed: ");
+        return;
+    }
+    vector<cl_half> halves(n);
+    if(host_value_size == sizeof(double))
+        for(size_t i=0;i<n;i++)
+            halves[i] = FloatToHalf(float(static_cast<const double*>(values)[i]));
+    else
+        for(size_t i=0;i<n;i++)
+            halves[i] = FloatToHalf(static_cast<const float*>(values)[i]);
+    ret = clEnqueueWriteBuffer(this->command_queue,buffer, CL_TRUE, sizeof(cl_half) * first, sizeof(cl_half) * n, &halves[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCL_MixIn::WriteValuesToBuffer : buffer writing failed: ");
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ReadValuesFromBuffer(cl_mem buffer,size_t first,size_t n,void* values,size_t host_value_size,bool as_half) const
+{
+    cl_int ret;
+    if(!as_half)
+    {
+        ret = clEnqueueReadBuffer(this->command_queue,buffer, CL_TRUE, host_value_size * first, host_value_size * n, values, 0, NULL, NULL);
+        throwOnError(ret,"OpenCL_MixIn::ReadValuesFromBuffer : buffer reading failed: ");
+        return;
+    }
+    vector<cl_half> halves(n);
+    ret = clEnqueueReadBuffer(this->command_queue,buffer, CL_TRUE, sizeof(cl_half) * first, sizeof(cl_half) * n, &halves[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCL_MixIn::ReadValuesFromBuffer : buffer reading failed: ");
+    if(host_value_size == sizeof(double))
+        for(size_t i=0;i<n;i++)
+            static_cast<double*>(values)[i] = HalfToFloat(halves[i]);
+    else
+        for(size_t i=0;i<n;i++)
+            static_cast<float*>(values)[i] = HalfToFloat(halves[i]);
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::WriteCellsToBuffers(const vector<void*>& arrays,int iChemical,size_t first,size_t n,size_t host_value_size,bool as_half)
+{
+    const int NC = (int)arrays.size();
+    if(!this->interleave_width)
+    {
+        for(int ic=0;ic<NC;ic++)
+            if(iChemical==-1 || ic==iChemical)
+                this->WriteValuesToBuffer(this->buffers[this->iCurrentBuffer][ic],first,n,
+                    static_cast<const char*>(arrays[ic]) + host_value_size * first,host_value_size,as_half);
+        return;
+    }
+
+    // gather the blocks of each chemical into the interleaved layout
+    const size_t W = this->interleave_width;
+    const size_t first_block = first / W;
+    const size_t n_blocks = (first + n + W - 1) / W - first_block;
+    const size_t block_size = host_value_size * W;
+    vector<char> interleaved(block_size * NC * n_blocks);
+    for(size_t b=0;b<n_blocks;b++)
+        for(int ic=0;ic<NC;ic++)
+            memcpy(&interleaved[block_size * (b * NC + ic)],static_cast<const char*>(arrays[ic]) + block_size * (first_block + b),block_size);
+    this->WriteValuesToBuffer(this->buffers[this->iCurrentBuffer][0],W * NC * first_block,W * NC * n_blocks,&interleaved[0],host_value_size,as_half);
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ReadCellsFromBuffers(const vector<void*>& arrays,int iChemical,size_t first,size_t n,size_t host_value_size,bool as_half) const
+{
+    const int NC = (int)arrays.size();
+    if(!this->interleave_width)
+    {
+        for(int ic=0;ic<NC;ic++)
+            if(iChemical==-1 || ic==iChemical)
+                this->ReadValuesFromBuffer(this->buffers[this->iCurrentBuffer][ic],first,n,
+                    static_cast<char*>(arrays[ic]) + host_value_size * first,host_value_size,as_half);
+        return;
+    }
+
+    // read the blocks that the cells touch, and scatter the values of each chemical back to its array
+    const size_t W = this->interleave_width;
+    const size_t first_block = first / W;
+    const size_t n_blocks = (first + n + W - 1) / W - first_block;
+    vector<char> interleaved(host_value_size * W * NC * n_blocks);
+    this->ReadValuesFromBuffer(this->buffers[this->iCurrentBuffer][0],W * NC * first_block,W * NC * n_blocks,&interleaved[0],host_value_size,as_half);
+    for(size_t b=0;b<n_blocks;b++)
+    {
+        const size_t block_start = W * (first_block + b);
+        const size_t c0 = max(first,block_start);
+        const size_t c1 = min(first + n,block_start + W);
+        for(int ic=0;ic<NC;ic++)
+            if(iChemical==-1 || ic==iChemical)
+                memcpy(static_cast<char*>(arrays[ic]) + host_value_size * c0,
+                    &interleaved[host_value_size * (W * (b * NC + ic) + c0 - block_start)],host_value_size * (c1 - c0));
+    }
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::WriteBoxToBuffer(cl_mem buffer,int X,int Y,const int box[6],const void* image,size_t host_value_size,bool as_half)
+{
+    const size_t w = box[1]-box[0]+1, h = box[3]-box[2]+1, d = box[5]-box[4]+1;
+    const size_t S = as_half ? sizeof(cl_half) : host_value_size;
+    const size_t buffer_origin[3] = { S * box[0], (size_t)box[2], (size_t)box[4] };
+    const size_t region[3] = { S * w, h, d };
+    cl_int ret;
+    if(!as_half)
+    {
+        ret = clEnqueueWriteBufferRect(this->command_queue,buffer, CL_TRUE, buffer_origin, buffer_origin, region,
+            S * X, S * X * Y, S * X, S * X * Y, image, 0, NULL, NULL);
+        throwOnError(ret,"OpenCL_MixIn::WriteBoxToBuffer : buffer writing failed: ");
+        return;
+    }
+    // convert just the box, packed
+    vector<cl_half> halves(w * h * d);
+    size_t i = 0;
+    for(int z=box[4];z<=box[5];z++)
+    {
+        for(int y=box[2];y<=box[3];y++)
+        {
+            const size_t row = ((size_t)z * Y + y) * X;
+            for(int x=box[0];x<=box[1];x++)
+            {
+                if(host_value_size == sizeof(double))
+                    halves[i++] = FloatToHalf(float(static_cast<const double*>(image)[row + x]));
+                else
+                    halves[i++] = FloatToHalf(static_cast<const float*>(image)[row + x]);
+            }
+        }
+    }
+    const size_t host_origin[3] = { 0, 0, 0 };
+    ret = clEnqueueWriteBufferRect(this->command_queue,buffer, CL_TRUE, buffer_origin, host_origin, region,
+        S * X, S * X * Y, S * w, S * w * h, &halves[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCL_MixIn::WriteBoxToBuffer : buffer writing failed: ");
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ReadBoxFromBuffer(cl_mem buffer,int X,int Y,const int box[6],void* values,size_t host_value_size,bool as_half) const
+{
+    const size_t w = box[1]-box[0]+1, h = box[3]-box[2]+1, d = box[5]-box[4]+1;
+    const size_t S = as_half ? sizeof(cl_half) : host_value_size;
+    const size_t buffer_origin[3] = { S * box[0], (size_t)box[2], (size_t)box[4] };
+    const size_t host_origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { S * w, h, d };
+    cl_int ret;
+    if(!as_half)
+    {
+        ret = clEnqueueReadBufferRect(this->command_queue,buffer, CL_TRUE, buffer_origin, host_origin, region,
+            S * X, S * X * Y, S * w, S * w * h, values, 0, NULL, NULL);
+        throwOnError(ret,"OpenCL_MixIn::ReadBoxFromBuffer : buffer reading failed: ");
+        return;
+    }
+    vector<cl_half> halves(w * h * d);
+    ret = clEnqueueReadBufferRect(this->command_queue,buffer, CL_TRUE, buffer_origin, host_origin, region,
+        S * X, S * X * Y, S * w, S * w * h, &halves[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCL_MixIn::ReadBoxFromBuffer : buffer reading failed: ");
+    if(host_value_size == sizeof(double))
+        for(size_t i=0;i<halves.size();i++)
+            static_cast<double*>(values)[i] = HalfToFloat(halves[i]);
+    else
+        for(size_t i=0;i<halves.size();i++)
+            static_cast<float*>(values)[i] = HalfToFloat(halves[i]);
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::BuildStatisticsKernelsIfNeeded(bool is_double,bool as_half)
+{
+    const KernelKey key = this->GetKernelKey(is_double,as_half);
+    if(this->statistics_kernel && this->statistics_key==key)
+        return;
+
+    const string T = is_double ? "double" : "float";
+    const string S = as_half ? "half" : T; // (halves can only be loaded, with vload_half)
+    const string load = as_half ? "vload_half(i,data)" : "data[i]";
+    const string load_previous = as_half ? "vload_half(i,previous)" : "previous[i]";
+    ostringstream source;
+    source << "\
+#ifdef cl_khr_local_int32_base_atomics\n\
+    #pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable\n\
+#endif\n\n";
+    // if interleaved then the chemicals take turns in blocks of W cells, else there is one buffer per chemical
+    // and the host passes n_chemicals=1, chemical=0
+    source << "#define W " << max(1,this->interleave_width) << "\n\n";
+    source << "__kernel void rd_statistics(__global const " << S << " *data,const int n_cells,const int n_chemicals,const int chemical,\n"
+        << "    __global " << T << " *results,__local " << T << " *reduction)\n"
+        << "{\n"
+        << "    // each work item summarizes its share of the cells (Welford's method)\n"
+        << "    " << T << " minimum = INFINITY, maximum = -INFINITY, count = 0, mean = 0, m2 = 0;\n"
+        << "    for(int cell = get_global_id(0); cell < n_cells; cell += get_global_size(0))\n"
+        << "    {\n"
+        << "        const int i = ((cell / W) * n_chemicals + chemical) * W + cell % W;\n"
+        << "        const " << T << " v = " << load << ";\n"
+        << "        minimum = fmin(minimum,v);\n"
+        << "        maximum = fmax(maximum,v);\n"
+        << "        count += 1;\n"
+        << "        const " << T << " d = v - mean;\n"
+        << "        mean += d / count;\n"
+        << "        m2 += d * (v - mean);\n"
+        << "    }\n"
+        << "    // then the work-group combines them in pairs (Chan et al.)\n"
+        << "    const int lid = get_local_id(0);\n"
+        << "    __local " << T << " *r = reduction + 5 * lid;\n"
+        << "    r[0] = minimum; r[1] = maximum; r[2] = count; r[3] = mean; r[4] = m2;\n"
+        << "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    for(int s = get_local_size(0) / 2; s > 0; s /= 2)\n"
+        << "    {\n"
+        << "        if(lid < s)\n"
+        << "        {\n"
+        << "            __local " << T << " *o = reduction + 5 * (lid + s);\n"
+        << "            r[0] = fmin(r[0],o[0]);\n"
+        << "            r[1] = fmax(r[1],o[1]);\n"
+        << "            const " << T << " n = r[2] + o[2];\n"
+        << "            if(n > 0)\n"
+        << "            {\n"
+        << "                const " << T << " d = o[3] - r[3];\n"
+        << "                r[3] += d * o[2] / n;\n"
+        << "                r[4] += o[4] + d * d * r[2] * o[2] / n;\n"
+        << "                r[2] = n;\n"
+        << "            }\n"
+        << "        }\n"
+        << "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    }\n"
+        << "    if(lid == 0)\n"
+        << "        for(int k = 0; k < 5; k++)\n"
+        << "            results[5 * get_group_id(0) + k] = reduction[k];\n"
+        << "}\n\n";
+    source << "__kernel void rd_histogram(__global const " << S << " *data,const int n_cells,const int n_chemicals,const int chemical,\n"
+        << "    const " << T << " low,const " << T << " high,const int n_bins,__global int *results,__local int *bins)\n"
+        << "{\n"
+        << "    const int lid = get_local_id(0);\n"
+        << "    for(int b = lid; b < n_bins; b += get_local_size(0))\n"
+        << "        bins[b] = 0;\n"
+        << "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    const " << T << " scale = high > low ? n_bins / (high - low) : 0;\n"
+        << "    for(int cell = get_global_id(0); cell < n_cells; cell += get_global_size(0))\n"
+        << "    {\n"
+        << "        const int i = ((cell / W) * n_chemicals + chemical) * W + cell % W;\n"
+        << "        const " << T << " x = (" << load << " - low) * scale;\n"
+        << "        atomic_inc(&bins[ x > 0 ? min((int)x,n_bins-1) : 0 ]);\n"
+        << "    }\n"
+        << "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    for(int b = lid; b < n_bins; b += get_local_size(0))\n"
+        << "        results[n_bins * get_group_id(0) + b] = bins[b];\n"
+        << "}\n\n";
+    source << "__kernel void rd_change(__global const " << S << " *data,__global const " << S << " *previous,const int n_cells,\n"
+        << "    const int n_chemicals,const int chemical,__global " << T << " *results,__local " << T << " *reduction)\n"
+        << "{\n"
+        << "    " << T << " max_change = 0, sum_squares = 0;\n"
+        << "    for(int cell = get_global_id(0); cell < n_cells; cell += get_global_size(0))\n"
+        << "    {\n"
+        << "        const int i = ((cell / W) * n_chemicals + chemical) * W + cell % W;\n"
+        << "        const " << T << " d = fabs(" << load << " - " << load_previous << ");\n"
+        << "        max_change = fmax(max_change,d);\n"
+        << "        sum_squares += d * d;\n"
+        << "    }\n"
+        << "    const int lid = get_local_id(0);\n"
+        << "    reduction[2 * lid] = max_change;\n"
+        << "    reduction[2 * lid + 1] = sum_squares;\n"
+        << "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    for(int s = get_local_size(0) / 2; s > 0; s /= 2)\n"
+        << "    {\n"
+        << "        if(lid < s)\n"
+        << "        {\n"
+        << "            reduction[2 * lid] = fmax(reduction[2 * lid],reduction[2 * (lid + s)]);\n"
+        << "            reduction[2 * lid + 1] += reduction[2 * (lid + s) + 1];\n"
+        << "        }\n"
+        << "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    }\n"
+        << "    if(lid == 0)\n"
+        << "    {\n"
+        << "        results[2 * get_group_id(0)] = reduction[0];\n"
+        << "        results[2 * get_group_id(0) + 1] = reduction[1];\n"
+        << "    }\n"
+        << "}\n";
+
+    cl_int ret;
+    clReleaseKernel(this->statistics_kernel);
+    clReleaseKernel(this->histogram_kernel);
+    clReleaseKernel(this->change_kernel);
+    clReleaseProgram(this->statistics_program);
+    clReleaseMemObject(this->statistics_results);
+    this->statistics_program = NULL;
+    this->statistics_kernel = NULL;
+    this->histogram_kernel = NULL;
+    this->change_kernel = NULL;
+    this->statistics_results = NULL;
+    this->statistics_results_size = 0;
+    this->statistics_program = BuildProgramFromSource(this->context,1,&this->device_id,source.str(),is_double,
+        "OpenCL_MixIn::BuildStatisticsKernelsIfNeeded");
+    this->statistics_kernel = clCreateKernel(this->statistics_program,"rd_statistics",&ret);
+    throwOnError(ret,"OpenCL_MixIn::BuildStatisticsKernelsIfNeeded : kernel creation failed: ");
+    this->histogram_kernel = clCreateKernel(this->statistics_program,"rd_histogram",&ret);
+    throwOnError(ret,"OpenCL_MixIn::BuildStatisticsKernelsIfNeeded : kernel creation failed: ");
+    this->change_kernel = clCreateKernel(this->statistics_program,"rd_change",&ret);
+    throwOnError(ret,"OpenCL_MixIn::BuildStatisticsKernelsIfNeeded : kernel creation failed: ");
+    this->statistics_key = key;
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::GetStatisticsLaunchSize(size_t n_cells,size_t& local_size,size_t& n_groups) const
+{
+    // the reductions need a power of two for the work-group size; a few dozen work-groups keep the device busy
+    cl_int ret;
+    size_t max_local_size = 64, kernel_max;
+    const cl_kernel kernels[3] = { this->statistics_kernel, this->histogram_kernel, this->change_kernel };
+    for(int i=0;i<3;i++)
+    {
+        ret = clGetKernelWorkGroupInfo(kernels[i],this->device_id,CL_KERNEL_WORK_GROUP_SIZE,sizeof(size_t),&kernel_max,NULL);
+        throwOnError(ret,"OpenCL_MixIn::GetStatisticsLaunchSize : clGetKernelWorkGroupInfo failed: ");
+        max_local_size = min(max_local_size,kernel_max);
+    }
+    local_size = 1;
+    while(local_size * 2 <= max_local_size)
+        local_size *= 2;
+    const size_t MAX_GROUPS = 64;
+    n_groups = max((size_t)1,min(MAX_GROUPS,(n_cells + local_size - 1) / local_size));
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ReserveStatisticsResults(size_t size)
+{
+    if(size <= this->statistics_results_size) return;
+    cl_int ret;
+    clReleaseMemObject(this->statistics_results);
+    this->statistics_results = clCreateBuffer(this->context,CL_MEM_WRITE_ONLY,size,NULL,&ret);
+    throwOnError(ret,"OpenCL_MixIn::ReserveStatisticsResults : buffer creation failed: ");
+    this->statistics_results_size = size;
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ComputeStatisticsOnDevice(int NC,size_t n_cells,bool is_double,bool as_half,int n_bins,
+    vector<AbstractRD::ChemicalStatistics>& stats)
+{
+    const int MAX_BINS = 1024; // (the histogram of a work-group is kept in local memory)
+    if(n_bins > MAX_BINS)
+        throw runtime_error("OpenCL_MixIn::ComputeStatisticsOnDevice : too many histogram bins");
+    n_bins = max(0,n_bins);
+
+    this->BuildStatisticsKernelsIfNeeded(is_double,as_half);
+
+    cl_int ret;
+    size_t local_size,n_groups;
+    this->GetStatisticsLaunchSize(n_cells,local_size,n_groups);
+    const size_t global_size = n_groups * local_size;
+    const size_t value_size = is_double ? sizeof(double) : sizeof(float);
+    const size_t results_size = max(5 * n_groups * value_size,n_groups * n_bins * sizeof(cl_int));
+    this->ReserveStatisticsResults(results_size);
+    vector<char> results(results_size);
+
+    const cl_int n = (cl_int)n_cells;
+    const cl_int n_chemicals = this->interleave_width ? NC : 1;
+    const cl_int bins = n_bins;
+    stats.resize(NC);
+    for(int ic=0;ic<NC;ic++)
+    {
+        const cl_mem data = this->buffers[this->iCurrentBuffer][this->interleave_width ? 0 : ic];
+        const cl_int chemical = this->interleave_width ? ic : 0;
+        AbstractRD::ChemicalStatistics& s = stats[ic];
+
+        ret = clSetKernelArg(this->statistics_kernel,0,sizeof(cl_mem),&data);
+        ret |= clSetKernelArg(this->statistics_kernel,1,sizeof(cl_int),&n);
+        ret |= clSetKernelArg(this->statistics_kernel,2,sizeof(cl_int),&n_chemicals);
+        ret |= clSetKernelArg(this->statistics_kernel,3,sizeof(cl_int),&chemical);
+        ret |= clSetKernelArg(this->statistics_kernel,4,sizeof(cl_mem),&this->statistics_results);
+        ret |= clSetKernelArg(this->statistics_kernel,5,5 * local_size * value_size,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeStatisticsOnDevice : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->statistics_kernel,1,NULL,&global_size,&local_size,0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeStatisticsOnDevice : clEnqueueNDRangeKernel failed: ");
+        ret = clEnqueueReadBuffer(this->command_queue,this->statistics_results,CL_TRUE,0,5 * n_groups * value_size,&results[0],0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeStatisticsOnDevice : buffer reading failed: ");
+
+        // combine the work-groups in double precision, in the same way as the work items were combined
+        double count = 0.0, m2 = 0.0;
+        s.minimum = DBL_MAX;
+        s.maximum = -DBL_MAX;
+        s.mean = 0.0;
+        for(size_t g=0;g<n_groups;g++)
+        {
+            double r[5];
+            for(int k=0;k<5;k++)
+                r[k] = is_double ? reinterpret_cast<const double*>(&results[0])[5*g+k] : reinterpret_cast<const float*>(&results[0])[5*g+k];
+            if(r[2] == 0.0) continue; // (a work-group with no cells)
+            s.minimum = min(s.minimum,r[0]);
+            s.maximum = max(s.maximum,r[1]);
+            const double total = count + r[2];
+            const double d = r[3] - s.mean;
+            s.mean += d * r[2] / total;
+            m2 += r[4] + d * d * count * r[2] / total;
+            count = total;
+        }
+        s.histogram.assign(n_bins,0);
+        if(count == 0.0)
+        {
+            s.minimum = s.maximum = s.variance = 0.0;
+            continue;
+        }
+        s.variance = m2 / count;
+        if(n_bins == 0) continue;
+
+        // with the range known we can count the values in each bin
+        const double low_d = s.minimum, high_d = s.maximum;
+        const float low_f = (float)s.minimum, high_f = (float)s.maximum;
+        ret = clSetKernelArg(this->histogram_kernel,0,sizeof(cl_mem),&data);
+        ret |= clSetKernelArg(this->histogram_kernel,1,sizeof(cl_int),&n);
+        ret |= clSetKernelArg(this->histogram_kernel,2,sizeof(cl_int),&n_chemicals);
+        ret |= clSetKernelArg(this->histogram_kernel,3,sizeof(cl_int),&chemical);
+        ret |= clSetKernelArg(this->histogram_kernel,4,value_size,is_double ? (const void*)&low_d : (const void*)&low_f);
+        ret |= clSetKernelArg(this->histogram_kernel,5,value_size,is_double ? (const void*)&high_d : (const void*)&high_f);
+        ret |= clSetKernelArg(this->histogram_kernel,6,sizeof(cl_int),&bins);
+        ret |= clSetKernelArg(this->histogram_kernel,7,sizeof(cl_mem),&this->statistics_results);
+        ret |= clSetKernelArg(this->histogram_kernel,8,n_bins * sizeof(cl_int),NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeStatisticsOnDevice : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->histogram_kernel,1,NULL,&global_size,&local_size,0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeStatisticsOnDevice : clEnqueueNDRangeKernel failed: ");
+        ret = clEnqueueReadBuffer(this->command_queue,this->statistics_results,CL_TRUE,0,n_groups * n_bins * sizeof(cl_int),&results[0],0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeStatisticsOnDevice : buffer reading failed: ");
+        const cl_int *group_bins = reinterpret_cast<const cl_int*>(&results[0]);
+        for(size_t g=0;g<n_groups;g++)
+            for(int b=0;b<n_bins;b++)
+                s.histogram[b] += group_bins[g * n_bins + b];
+    }
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ComputeChangeOnDevice(int NC,size_t n_cells,bool is_double,bool as_half,
+    vector<double>& max_change,vector<double>& rms_change)
+{
+    this->BuildStatisticsKernelsIfNeeded(is_double,as_half);
+
+    cl_int ret;
+    size_t local_size,n_groups;
+    this->GetStatisticsLaunchSize(n_cells,local_size,n_groups);
+    const size_t global_size = n_groups * local_size;
+    const size_t value_size = is_double ? sizeof(double) : sizeof(float);
+    this->ReserveStatisticsResults(2 * n_groups * value_size);
+    vector<char> results(2 * n_groups * value_size);
+
+    const cl_int n = (cl_int)n_cells;
+    const cl_int n_chemicals = this->interleave_width ? NC : 1;
+    max_change.assign(NC,0.0);
+    rms_change.assign(NC,0.0);
+    for(int ic=0;ic<NC;ic++)
+    {
+        // the buffers swap after each step, so the other ones still hold the values from before the last step
+        const int iBuffer = this->interleave_width ? 0 : ic;
+        const cl_mem data = this->buffers[this->iCurrentBuffer][iBuffer];
+        const cl_mem previous = this->buffers[1-this->iCurrentBuffer][iBuffer];
+        const cl_int chemical = this->interleave_width ? ic : 0;
+        ret = clSetKernelArg(this->change_kernel,0,sizeof(cl_mem),&data);
+        ret |= clSetKernelArg(this->change_kernel,1,sizeof(cl_mem),&previous);
+        ret |= clSetKernelArg(this->change_kernel,2,sizeof(cl_int),&n);
+        ret |= clSetKernelArg(this->change_kernel,3,sizeof(cl_int),&n_chemicals);
+        ret |= clSetKernelArg(this->change_kernel,4,sizeof(cl_int),&chemical);
+        ret |= clSetKernelArg(this->change_kernel,5,sizeof(cl_mem),&this->statistics_results);
+        ret |= clSetKernelArg(this->change_kernel,6,2 * local_size * value_size,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeChangeOnDevice : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->change_kernel,1,NULL,&global_size,&local_size,0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeChangeOnDevice : clEnqueueNDRangeKernel failed: ");
+        ret = clEnqueueReadBuffer(this->command_queue,this->statistics_results,CL_TRUE,0,results.size(),&results[0],0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ComputeChangeOnDevice : buffer reading failed: ");
+        double sum_squares = 0.0;
+        for(size_t g=0;g<n_groups;g++)
+        {
+            const double group_max = is_double ? reinterpret_cast<const double*>(&results[0])[2*g] : reinterpret_cast<const float*>(&results[0])[2*g];
+            const double group_sum = is_double ? reinterpret_cast<const double*>(&results[0])[2*g+1] : reinterpret_cast<const float*>(&results[0])[2*g+1];
+            max_change[ic] = max(max_change[ic],group_max);
+            sum_squares += group_sum;
+        }
+        rms_change[ic] = n_cells ? sqrt(sum_squares / n_cells) : 0.0;
+    }
+}
+
+// -----------------------------------------------------------------------
+
+bool OpenCL_MixIn::ProbesNeedSettingOnDevice(bool is_double,bool as_half) const
+{
+    return !this->probe_kernel || this->probe_key!=this->GetKernelKey(is_double,as_half);
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::SetProbesOnDevice(int NC,const vector<int>& cells,const vector<int>& chemicals,int capacity,bool is_double,bool as_half)
+{
+    cl_int ret;
+    const KernelKey key = this->GetKernelKey(is_double,as_half);
+    if(!this->probe_kernel || this->probe_key!=key)
+    {
+        const string T = is_double ? "double" : "float";
+        const string S = as_half ? "half" : T;
+        const string load = as_half ? "vload_half(s.x,data)" : "data[s.x]";
+        ostringstream source;
+        source << "__kernel void rd_probe(__global const " << S << " *data,__global const int2 *samples,const int first,const int n,\n"
+            << "    __global " << T << " *ring,const int row_offset)\n"
+            << "{\n"
+            << "    const int k = get_global_id(0);\n"
+            << "    if(k >= n) return;\n"
+            << "    const int2 s = samples[first + k]; // (index in data, column in the row)\n"
+            << "    ring[row_offset + s.y] = " << load << ";\n"
+            << "}\n";
+
+        clReleaseKernel(this->probe_kernel);
+        clReleaseProgram(this->probe_program);
+        this->probe_kernel = NULL;
+        this->probe_program = NULL;
+        this->probe_program = BuildProgramFromSource(this->context,1,&this->device_id,source.str(),is_double,
+            "OpenCL_MixIn::SetProbesOnDevice");
+        this->probe_kernel = clCreateKernel(this->probe_program,"rd_probe",&ret);
+        throwOnError(ret,"OpenCL_MixIn::SetProbesOnDevice : kernel creation failed: ");
+    }
+
+    // group the samples by the buffer they come from, so each buffer needs only one launch
+    const int NB = this->interleave_width ? 1 : NC;
+    const int W = this->interleave_width;
+    vector<cl_int> samples;
+    this->probe_buffer_first.assign(1,0);
+    for(int ib=0;ib<NB;ib++)
+    {
+        for(size_t i=0;i<cells.size();i++)
+        {
+            if(W==0 && chemicals[i]!=ib) continue;
+            const int index = W ? ((cells[i]/W)*NC + chemicals[i])*W + cells[i]%W : cells[i];
+            samples.push_back(index);
+            samples.push_back((cl_int)i);
+        }
+        this->probe_buffer_first.push_back((int)samples.size()/2);
+    }
+
+    clReleaseMemObject(this->probe_samples);
+    clReleaseMemObject(this->probe_ring);
+    this->probe_samples = NULL;
+    this->probe_ring = NULL;
+    this->probe_ring_timesteps.clear();
+    this->probe_capacity = capacity;
+    this->probe_key = key;
+    if(cells.empty()) return;
+    this->probe_samples = clCreateBuffer(this->context,CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,samples.size()*sizeof(cl_int),&samples[0],&ret);
+    throwOnError(ret,"OpenCL_MixIn::SetProbesOnDevice : buffer creation failed: ");
+    const size_t value_size = is_double ? sizeof(double) : sizeof(float);
+    this->probe_ring = clCreateBuffer(this->context,CL_MEM_WRITE_ONLY,capacity*cells.size()*value_size,NULL,&ret);
+    throwOnError(ret,"OpenCL_MixIn::SetProbesOnDevice : buffer creation failed: ");
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::GatherProbesOnDevice(int timestep,vector<int>& timesteps,vector<double>& values)
+{
+    if(!this->probe_ring) return;
+
+    cl_int ret;
+    const int n_samples = this->probe_buffer_first.back();
+    const cl_int row_offset = (cl_int)(this->probe_ring_timesteps.size() * n_samples);
+    for(size_t ib=0;ib+1<this->probe_buffer_first.size();ib++)
+    {
+        const cl_int first = this->probe_buffer_first[ib];
+        const cl_int n = this->probe_buffer_first[ib+1] - first;
+        if(n==0) continue;
+        ret = clSetKernelArg(this->probe_kernel,0,sizeof(cl_mem),&this->buffers[this->iCurrentBuffer][ib]);
+        ret |= clSetKernelArg(this->probe_kernel,1,sizeof(cl_mem),&this->probe_samples);
+        ret |= clSetKernelArg(this->probe_kernel,2,sizeof(cl_int),&first);
+        ret |= clSetKernelArg(this->probe_kernel,3,sizeof(cl_int),&n);
+        ret |= clSetKernelArg(this->probe_kernel,4,sizeof(cl_mem),&this->probe_ring);
+        ret |= clSetKernelArg(this->probe_kernel,5,sizeof(cl_int),&row_offset);
+        throwOnError(ret,"OpenCL_MixIn::GatherProbesOnDevice : clSetKernelArg failed: ");
+        const size_t global_size = n;
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->probe_kernel,1,NULL,&global_size,NULL,0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::GatherProbesOnDevice : clEnqueueNDRangeKernel failed: ");
+    }
+    this->probe_ring_timesteps.push_back(timestep);
+    if((int)this->probe_ring_timesteps.size() >= this->probe_capacity)
+        this->ReadProbesFromDevice(timesteps,values);
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ReadProbesFromDevice(vector<int>& timesteps,vector<double>& values)
+{
+    if(this->probe_ring_timesteps.empty()) return;
+
+    // if the context has changed since they were gathered then the rows are lost with it
+    if(this->probe_ring && this->probe_key.context==this->context)
+    {
+        const size_t n_values = this->probe_ring_timesteps.size() * this->probe_buffer_first.back();
+        const size_t value_size = this->probe_key.is_double ? sizeof(double) : sizeof(float);
+        vector<char> rows(n_values * value_size);
+        cl_int ret = clEnqueueReadBuffer(this->command_queue,this->probe_ring,CL_TRUE,0,rows.size(),&rows[0],0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ReadProbesFromDevice : buffer reading failed: ");
+        timesteps.insert(timesteps.end(),this->probe_ring_timesteps.begin(),this->probe_ring_timesteps.end());
+        if(this->probe_key.is_double)
+            values.insert(values.end(),reinterpret_cast<const double*>(&rows[0]),reinterpret_cast<const double*>(&rows[0])+n_values);
+        else
+            values.insert(values.end(),reinterpret_cast<const float*>(&rows[0]),reinterpret_cast<const float*>(&rows[0])+n_values);
+    }
+    this->probe_ring_timesteps.clear();
+}
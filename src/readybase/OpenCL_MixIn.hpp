@@ -27,6 +27,9 @@
     #include "OpenCL_Dyn_Load.h"
 #endif
 
+// local:
+#include "AbstractRD.hpp"
+
 // STL:
 #include <vector>
 #include <string>
@@ -44,8 +47,28 @@ class OpenCL_MixIn
         int GetPlatform() const;
         int GetDevice() const;
 
+        /// Builds a program for the given devices, releasing it and throwing with the build log if that fails.
+        /** If is_double then the source is prefixed with the pragma that enables doubles. caller begins the error messages. */
+        static cl_program BuildProgramFromSource(cl_context context,cl_uint n_devices,const cl_device_id* devices,
+            const std::string& source,bool is_double,const std::string& caller);
+
     protected:
 
+        /// What a helper kernel was built for: it needs building again if any of these change.
+        struct KernelKey
+        {
+            cl_context context;
+            bool is_double,as_half;
+            int interleave_width;
+
+            KernelKey() : context(NULL), is_double(false), as_half(false), interleave_width(0) {}
+            bool operator==(const KernelKey& k) const { return context==k.context && is_double==k.is_double
+                && as_half==k.as_half && interleave_width==k.interleave_width; }
+            bool operator!=(const KernelKey& k) const { return !(*this==k); }
+        };
+        /// Returns the key for a helper kernel on the current context and layout.
+        KernelKey GetKernelKey(bool is_double,bool as_half) const;
+
         virtual std::string AssembleKernelSourceFromFormula(std::string formula) const =0;
 
         void ReloadContextIfNeeded();
@@ -59,6 +82,55 @@ class OpenCL_MixIn
         /// Test a kernel string for errors on the current device.
         void TestKernel(std::string s);
 
+        /// Writes n values to a device buffer, starting at value index first. On the host each value takes host_value_size bytes
+        /// (a float or a double); if as_half then on the device they are stored as 16-bit halves.
+        void WriteValuesToBuffer(cl_mem buffer,size_t first,size_t n,const void* values,size_t host_value_size,bool as_half);
+        /// Reads n values from a device buffer, starting at value index first, converting from halves if as_half.
+        void ReadValuesFromBuffer(cl_mem buffer,size_t first,size_t n,void* values,size_t host_value_size,bool as_half) const;
+
+        /// Writes cells first to first+n-1 of chemical iChemical (or of all of them if -1) from the host arrays (one per chemical) to the current buffers.
+        /// If the chemicals are interleaved then all of them are written, for the whole blocks that the cells touch.
+        void WriteCellsToBuffers(const std::vector<void*>& arrays,int iChemical,size_t first,size_t n,size_t host_value_size,bool as_half);
+        /// Reads cells first to first+n-1 of chemical iChemical (or of all of them if -1) from the current buffers into the host arrays.
+        void ReadCellsFromBuffers(const std::vector<void*>& arrays,int iChemical,size_t first,size_t n,size_t host_value_size,bool as_half) const;
+
+        /// Writes the box {x0,x1,y0,y1,z0,z1} (inclusive) of an image X cells wide and Y high from the host array of the
+        /// whole image to a device buffer of it, in one rectangular transfer that touches no other cells.
+        void WriteBoxToBuffer(cl_mem buffer,int X,int Y,const int box[6],const void* image,size_t host_value_size,bool as_half);
+        /// Reads the box {x0,x1,y0,y1,z0,z1} (inclusive) of an image X cells wide and Y high from a device buffer, in one
+        /// rectangular transfer, into values packed in x-fastest order.
+        void ReadBoxFromBuffer(cl_mem buffer,int X,int Y,const int box[6],void* values,size_t host_value_size,bool as_half) const;
+
+        /// Computes the statistics of each of NC chemicals over the first n_cells cells of the current buffers, on the device.
+        /**
+         * Each work-group reduces its share of the cells to a minimum, maximum, count, mean and sum of squared deviations,
+         * and only these (and the histogram of each work-group, if n_bins>0) are read back and combined.
+         */
+        void ComputeStatisticsOnDevice(int NC,size_t n_cells,bool is_double,bool as_half,int n_bins,
+            std::vector<AbstractRD::ChemicalStatistics>& stats);
+
+        /// Computes the largest and root-mean-square change of each chemical between the other buffers and the current ones.
+        /**
+         * Straight after a step the other buffers hold the values from before it, so this measures the change over the last
+         * step without copying anything more than a few values per work-group back from the device.
+         */
+        void ComputeChangeOnDevice(int NC,size_t n_cells,bool is_double,bool as_half,
+            std::vector<double>& max_change,std::vector<double>& rms_change);
+
+        void BuildStatisticsKernelsIfNeeded(bool is_double,bool as_half);
+
+        /// Gets ready to gather the given cells of the given chemicals from the current buffers, into a ring of capacity rows on the device.
+        /** Each gather is one small kernel launch per buffer; the rows stay on the device until the ring is full or they are read. */
+        void SetProbesOnDevice(int NC,const std::vector<int>& cells,const std::vector<int>& chemicals,int capacity,bool is_double,bool as_half);
+        /// Returns true if SetProbesOnDevice hasn't been called for the current context, data type and layout.
+        bool ProbesNeedSettingOnDevice(bool is_double,bool as_half) const;
+        /// Gathers the probes into the next row of the ring. If the ring is then full it is read and appended to timesteps and values.
+        void GatherProbesOnDevice(int timestep,std::vector<int>& timesteps,std::vector<double>& values);
+        /// Appends the rows waiting in the ring to timesteps and values, and empties it.
+        void ReadProbesFromDevice(std::vector<int>& timesteps,std::vector<double>& values);
+        void GetStatisticsLaunchSize(size_t n_cells,size_t& local_size,size_t& n_groups) const;
+        void ReserveStatisticsResults(size_t size);
+
     protected:
 
         cl_context context;
@@ -74,9 +146,25 @@ class OpenCL_MixIn
 
         std::vector<cl_mem> buffers[2];
         int iCurrentBuffer;
+        int interleave_width; ///< if non-zero then buffers[i] has a single buffer for all the chemicals, taking turns in blocks of this many cells
 
         std::string kernel_source;
 
+        cl_program statistics_program;
+        cl_kernel statistics_kernel,histogram_kernel,change_kernel;
+        KernelKey statistics_key;           ///< what the statistics kernels were built for
+        cl_mem statistics_results;          ///< the partial results of each work-group
+        size_t statistics_results_size;     ///< in bytes
+
+        cl_program probe_program;
+        cl_kernel probe_kernel;
+        KernelKey probe_key;                ///< what the probe kernel and buffers were made for
+        cl_mem probe_samples;               ///< the index within its buffer and the column of each sample, grouped by buffer
+        cl_mem probe_ring;                  ///< rows of gathered values waiting to be read back
+        std::vector<int> probe_buffer_first;///< where the samples of each buffer start in probe_samples, and where the last ones end
+        int probe_capacity;                 ///< the number of rows in the ring
+        std::vector<int> probe_ring_timesteps; ///< the timestep of each row in the ring
+
     private:
 
         int iPlatform,iDevice;
@@ -24,6 +24,9 @@ using namespace OpenCL_utils;
 #include <stdexcept>
 using namespace std;
 
+// stdlib:
+#include <string.h>
+
 // SSE:
 #if (defined(_WIN32) || defined(_WIN64))
   #include <intrin.h>
@@ -621,3 +624,65 @@ const char* OpenCL_utils::GetOpenCLInstallationHints()
 }
 // -------------------------------------------------------------------------------------------------------------
 
+cl_half OpenCL_utils::FloatToHalf(float f)
+{
+    unsigned int x;
+    memcpy(&x,&f,sizeof(x));
+    const unsigned int sign = (x >> 16) & 0x8000;
+    const unsigned int abs_x = x & 0x7fffffff;
+    if(abs_x >= 0x7f800000) // infinity or NaN
+        return cl_half(sign | 0x7c00 | (abs_x > 0x7f800000 ? 0x200 : 0));
+    if(abs_x >= 0x477ff000) // too big, rounds to infinity
+        return cl_half(sign | 0x7c00);
+    if(abs_x < 0x38800000) // too small for a normal half, so make a subnormal one (or zero)
+    {
+        const int shift = 126 - int(abs_x >> 23);
+        if(shift > 24)
+            return cl_half(sign);
+        const unsigned int m = (abs_x & 0x7fffff) | 0x800000;
+        unsigned int h = m >> shift;
+        const unsigned int remainder = m & ((1u << shift) - 1);
+        const unsigned int halfway = 1u << (shift - 1);
+        if(remainder > halfway || (remainder == halfway && (h & 1)))
+            h++;
+        return cl_half(sign | h);
+    }
+    // rebias the exponent and round the mantissa to 10 bits (a carry correctly moves into the exponent)
+    unsigned int h = (abs_x - 0x38000000) >> 13;
+    const unsigned int remainder = abs_x & 0x1fff;
+    if(remainder > 0x1000 || (remainder == 0x1000 && (h & 1)))
+        h++;
+    return cl_half(sign | h);
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+float OpenCL_utils::HalfToFloat(cl_half h)
+{
+    const unsigned int sign = (h & 0x8000u) << 16;
+    const unsigned int exponent = (h >> 10) & 0x1f;
+    unsigned int m = h & 0x3ff;
+    unsigned int x;
+    if(exponent == 0x1f) // infinity or NaN
+        x = sign | 0x7f800000 | (m << 13);
+    else if(exponent != 0)
+        x = sign | ((exponent + 112) << 23) | (m << 13);
+    else if(m == 0)
+        x = sign;
+    else
+    {
+        // subnormal half, becomes a normal float
+        int shift = 0;
+        while(!(m & 0x400))
+        {
+            m <<= 1;
+            shift++;
+        }
+        x = sign | ((113 - shift) << 23) | ((m & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f,&x,sizeof(f));
+    return f;
+}
+
+// -------------------------------------------------------------------------------------------------------------
@@ -79,4 +79,10 @@ namespace OpenCL_utils
     void throwOnError(cl_int ret,const char* message);
 
     const char* GetOpenCLInstallationHints();
+
+    /// Converts a float to a 16-bit half float, rounding to nearest even as vstore_half does.
+    cl_half FloatToHalf(float f);
+
+    /// Converts a 16-bit half float to a float, as vload_half does.
+    float HalfToFloat(cl_half h);
 }
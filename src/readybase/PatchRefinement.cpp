@@ -0,0 +1,518 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "PatchRefinement.hpp"
+#include "OpenCL_MixIn.hpp"
+using namespace OpenCL_utils;
+
+// STL:
+#include <stdexcept>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// ----------------------------------------------------------------------------------------------------------------
+
+static const int GHOST_X = 4;           // ghost cells on the left and right of a patch (one block of four, for the float4 kernels)
+static const int GHOST_Y = 1;           // ghost cells above and below a patch
+static const int SLOT_WIDTH = PatchRefinement::PATCH_SIZE * PatchRefinement::RATIO + 2 * GHOST_X;
+static const int SLOT_HEIGHT = PatchRefinement::PATCH_SIZE * PatchRefinement::RATIO + 2 * GHOST_Y;
+static const int REGRID_INTERVAL = 8;   // steps of the base grid between choosing the patches again
+
+// ----------------------------------------------------------------------------------------------------------------
+
+/// Returns the source of the kernels that tag patches and move values between the base grid and the atlas.
+static string GetHelperKernelSource(bool is_double)
+{
+    ostringstream source;
+    source << "typedef " << (is_double ? "double" : "float") << " T;\n"
+        << "#define P " << PatchRefinement::PATCH_SIZE << "\n"
+        << "#define R " << PatchRefinement::RATIO << "\n"
+        << "#define GX " << GHOST_X << "\n"
+        << "#define GY " << GHOST_Y << "\n"
+        << "#define SW " << SLOT_WIDTH << "\n"
+        << "#define SH " << SLOT_HEIGHT << "\n";
+    source << "\n\
+int wrap_or_clamp(int i,int n,int wrap) { return wrap ? (i%n+n)%n : clamp(i,0,n-1); }\n\
+\n\
+T base_at(__global const T *b,int x,int y,int X,int Y,int wrap) { return b[X*wrap_or_clamp(y,Y,wrap) + wrap_or_clamp(x,X,wrap)]; }\n\
+\n\
+T base_at_time(__global const T *b0,__global const T *b1,T alpha,int x,int y,int X,int Y,int wrap)\n\
+{\n\
+    return (1.0f-alpha)*base_at(b0,x,y,X,Y,wrap) + alpha*base_at(b1,x,y,X,Y,wrap);\n\
+}\n\
+\n\
+T minmod(T a,T b) { return a*b <= 0.0f ? 0.0f : ( fabs(a) < fabs(b) ? a : b ); }\n\
+\n\
+// the value at fine cell (fx,fy), by linear interpolation of the base grid with limited slopes (the four fine cells average to the base cell)\n\
+T prolong(__global const T *b0,__global const T *b1,T alpha,int fx,int fy,int X,int Y,int wrap)\n\
+{\n\
+    const int x = fx / R, y = fy / R;\n\
+    const T c = base_at_time(b0,b1,alpha,x,y,X,Y,wrap);\n\
+    const T sx = minmod(base_at_time(b0,b1,alpha,x+1,y,X,Y,wrap) - c, c - base_at_time(b0,b1,alpha,x-1,y,X,Y,wrap));\n\
+    const T sy = minmod(base_at_time(b0,b1,alpha,x,y+1,X,Y,wrap) - c, c - base_at_time(b0,b1,alpha,x,y-1,X,Y,wrap));\n\
+    return c + ((fx%R)+0.5f-R/2.0f)/R*sx + ((fy%R)+0.5f-R/2.0f)/R*sy;\n\
+}\n\
+\n\
+// one work item per patch: flags the patch if neighboring cells differ by more than the threshold anywhere in it\n\
+__kernel void amr_tag(__global const T *b,__global int *flags,const T threshold,const int X,const int Y,const int wrap)\n\
+{\n\
+    const int px = get_global_id(0), py = get_global_id(1);\n\
+    T d = 0.0f;\n\
+    for(int y=py*P;y<(py+1)*P;y++)\n\
+    {\n\
+        for(int x=px*P;x<(px+1)*P;x++)\n\
+        {\n\
+            const T c = b[X*y+x];\n\
+            d = fmax(d,fabs(base_at(b,x+1,y,X,Y,wrap) - c));\n\
+            d = fmax(d,fabs(base_at(b,x,y+1,X,Y,wrap) - c));\n\
+        }\n\
+    }\n\
+    if(d > threshold)\n\
+        flags[get_global_size(0)*py + px] = 1;\n\
+}\n\
+\n\
+// one work item per cell of the new atlas: copies the cell from the old atlas if the patch was refined before, else makes it from the base grid\n\
+__kernel void amr_regrid(__global const T *b,__global const T *old_atlas,__global T *atlas,__global const int *slot_patch,\n\
+    __global const int *old_slot,const int old_AX,const int AX,const int n_slots,const int X,const int Y,const int wrap)\n\
+{\n\
+    const int ax = get_global_id(0), ay = get_global_id(1);\n\
+    const int slot = (ay/SH)*(AX/SW) + ax/SW;\n\
+    if(slot >= n_slots) return;\n\
+    const int lx = ax%SW, ly = ay%SH;\n\
+    const int os = old_slot[slot];\n\
+    if(os >= 0)\n\
+    {\n\
+        const int old_SX = old_AX/SW;\n\
+        atlas[AX*ay+ax] = old_atlas[old_AX*((os/old_SX)*SH + ly) + (os%old_SX)*SW + lx];\n\
+        return;\n\
+    }\n\
+    const int patch = slot_patch[slot];\n\
+    const int fx = wrap_or_clamp((patch%(X/P))*P*R + lx - GX,R*X,wrap);\n\
+    const int fy = wrap_or_clamp((patch/(X/P))*P*R + ly - GY,R*Y,wrap);\n\
+    atlas[AX*ay+ax] = prolong(b,b,0.0f,fx,fy,X,Y,wrap);\n\
+}\n\
+\n\
+// one work item per cell of the atlas: fills the ghost cells from the neighboring fine patch, or else from the base grid at time alpha\n\
+__kernel void amr_ghosts(__global const T *b0,__global const T *b1,const T alpha,__global T *atlas,__global const int *slot_patch,\n\
+    __global const int *patch_slot,const int AX,const int n_slots,const int X,const int Y,const int wrap)\n\
+{\n\
+    const int ax = get_global_id(0), ay = get_global_id(1);\n\
+    const int SX = AX/SW;\n\
+    const int slot = (ay/SH)*SX + ax/SW;\n\
+    if(slot >= n_slots) return;\n\
+    const int lx = ax%SW, ly = ay%SH;\n\
+    if(lx>=GX && lx<SW-GX && ly>=GY && ly<SH-GY) return; // not a ghost cell\n\
+    const int patch = slot_patch[slot];\n\
+    int fx = (patch%(X/P))*P*R + lx - GX;\n\
+    int fy = (patch/(X/P))*P*R + ly - GY;\n\
+    if(!wrap && (fx<0 || fx>=R*X || fy<0 || fy>=R*Y))\n\
+    {\n\
+        // beyond the edge of the arena: copy the nearest cell of the patch, as the base grid's kernel does\n\
+        atlas[AX*ay+ax] = atlas[AX*(ay-ly+clamp(ly,GY,SH-GY-1)) + ax-lx+clamp(lx,GX,SW-GX-1)];\n\
+        return;\n\
+    }\n\
+    fx = wrap_or_clamp(fx,R*X,wrap);\n\
+    fy = wrap_or_clamp(fy,R*Y,wrap);\n\
+    const int s = patch_slot[(X/P)*(fy/(P*R)) + fx/(P*R)];\n\
+    if(s >= 0)\n\
+        atlas[AX*ay+ax] = atlas[AX*((s/SX)*SH + GY + fy%(P*R)) + (s%SX)*SW + GX + fx%(P*R)];\n\
+    else\n\
+        atlas[AX*ay+ax] = prolong(b0,b1,alpha,fx,fy,X,Y,wrap);\n\
+}\n\
+\n\
+// one work item per base cell of each slot: replaces the base cell with the average of its fine cells\n\
+__kernel void amr_restrict(__global T *b,__global const T *atlas,__global const int *slot_patch,const int AX,const int n_slots,const int X)\n\
+{\n\
+    const int i = get_global_id(0), j = get_global_id(1);\n\
+    const int SX = AX/SW;\n\
+    const int slot = (j/P)*SX + i/P;\n\
+    if(slot >= n_slots) return;\n\
+    const int cx = i%P, cy = j%P;\n\
+    const int patch = slot_patch[slot];\n\
+    const int ax = (slot%SX)*SW + GX + R*cx, ay = (slot/SX)*SH + GY + R*cy;\n\
+    T sum = 0.0f;\n\
+    for(int v=0;v<R;v++)\n\
+        for(int u=0;u<R;u++)\n\
+            sum += atlas[AX*(ay+v) + ax+u];\n\
+    b[X*((patch/(X/P))*P + cy) + (patch%(X/P))*P + cx] = sum / (R*R);\n\
+}\n";
+    return source.str();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+PatchRefinement::PatchRefinement()
+    : context(NULL)
+    , device_id(NULL)
+    , command_queue(NULL)
+    , is_double(false)
+    , fine_program(NULL)
+    , fine_kernel(NULL)
+    , helper_program(NULL)
+    , tag_kernel(NULL)
+    , regrid_kernel(NULL)
+    , ghost_kernel(NULL)
+    , restrict_kernel(NULL)
+    , X(0), Y(0), NC(0)
+    , patches_x(0), patches_y(0)
+    , wrap(false)
+    , threshold(0.0f)
+    , slots_x(0), slots_y(0)
+    , iCurrentAtlas(0)
+    , slot_patch_buffer(NULL)
+    , patch_slot_buffer(NULL)
+    , flags_buffer(NULL)
+    , steps_until_regrid(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+PatchRefinement::~PatchRefinement()
+{
+    this->Release();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::Release()
+{
+    this->ReleaseAtlas();
+    clReleaseMemObject(this->patch_slot_buffer);
+    clReleaseMemObject(this->flags_buffer);
+    clReleaseKernel(this->fine_kernel);
+    clReleaseKernel(this->tag_kernel);
+    clReleaseKernel(this->regrid_kernel);
+    clReleaseKernel(this->ghost_kernel);
+    clReleaseKernel(this->restrict_kernel);
+    clReleaseProgram(this->fine_program);
+    clReleaseProgram(this->helper_program);
+    this->patch_slot_buffer = NULL;
+    this->flags_buffer = NULL;
+    this->fine_kernel = NULL;
+    this->tag_kernel = NULL;
+    this->regrid_kernel = NULL;
+    this->ghost_kernel = NULL;
+    this->restrict_kernel = NULL;
+    this->fine_program = NULL;
+    this->helper_program = NULL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::ReleaseAtlas()
+{
+    for(int io=0;io<2;io++)
+    {
+        for(int ic=0;ic<(int)this->atlas[io].size();ic++)
+            clReleaseMemObject(this->atlas[io][ic]);
+        this->atlas[io].clear();
+    }
+    clReleaseMemObject(this->slot_patch_buffer);
+    this->slot_patch_buffer = NULL;
+    this->slot_patch.clear();
+    this->slots_x = this->slots_y = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::CreateKernel(cl_kernel& kernel,cl_program program,const char* name)
+{
+    cl_int ret;
+    kernel = clCreateKernel(program,name,&ret);
+    throwOnError(ret,"PatchRefinement::CreateKernel : kernel creation failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::CreateBuffer(cl_mem& buffer,size_t size)
+{
+    cl_int ret;
+    buffer = clCreateBuffer(this->context, CL_MEM_READ_WRITE, size, NULL, &ret);
+    throwOnError(ret,"PatchRefinement::CreateBuffer : buffer creation failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::Initialize(cl_context context,cl_device_id device_id,cl_command_queue command_queue,
+    const string& fine_kernel_source,int X,int Y,int NC,bool is_double,bool wrap,float threshold)
+{
+    this->Release();
+
+    if(X % PATCH_SIZE || Y % PATCH_SIZE)
+    {
+        ostringstream oss;
+        oss << "Refinement needs the width and height of the image to be multiples of " << PATCH_SIZE;
+        throw runtime_error(oss.str().c_str());
+    }
+
+    this->context = context;
+    this->device_id = device_id;
+    this->command_queue = command_queue;
+    this->X = X;
+    this->Y = Y;
+    this->NC = NC;
+    this->is_double = is_double;
+    this->wrap = wrap;
+    this->threshold = threshold;
+    this->patches_x = X / PATCH_SIZE;
+    this->patches_y = Y / PATCH_SIZE;
+
+    // (the fine kernel is assembled like the base one, so it already enables doubles if it needs them)
+    this->fine_program = OpenCL_MixIn::BuildProgramFromSource(context,1,&device_id,fine_kernel_source,false,
+        "PatchRefinement::Initialize (fine level kernel)");
+    this->CreateKernel(this->fine_kernel,this->fine_program,"rd_compute");
+    this->helper_program = OpenCL_MixIn::BuildProgramFromSource(context,1,&device_id,GetHelperKernelSource(is_double),is_double,
+        "PatchRefinement::Initialize (refinement kernels)");
+    this->CreateKernel(this->tag_kernel,this->helper_program,"amr_tag");
+    this->CreateKernel(this->regrid_kernel,this->helper_program,"amr_regrid");
+    this->CreateKernel(this->ghost_kernel,this->helper_program,"amr_ghosts");
+    this->CreateKernel(this->restrict_kernel,this->helper_program,"amr_restrict");
+
+    const int n_patches = this->patches_x * this->patches_y;
+    this->CreateBuffer(this->flags_buffer,sizeof(cl_int) * n_patches);
+    this->CreateBuffer(this->patch_slot_buffer,sizeof(cl_int) * n_patches);
+
+    this->Reset();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::Reset()
+{
+    this->ReleaseAtlas();
+    this->patch_slot.assign(this->patches_x * this->patches_y,-1);
+    this->steps_until_regrid = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::Regrid(const vector<cl_mem>& buffers)
+{
+    const int n_patches = this->patches_x * this->patches_y;
+    const cl_int int_wrap = this->wrap ? 1 : 0;
+    const cl_float float_threshold = this->threshold;
+    const cl_double double_threshold = this->threshold;
+    cl_int ret;
+
+    // flag the patches where any chemical changes steeply
+    vector<cl_int> flags(n_patches,0);
+    ret = clEnqueueWriteBuffer(this->command_queue,this->flags_buffer, CL_TRUE, 0, sizeof(cl_int) * n_patches, &flags[0], 0, NULL, NULL);
+    throwOnError(ret,"PatchRefinement::Regrid : buffer writing failed: ");
+    const size_t tag_range[2] = { size_t(this->patches_x), size_t(this->patches_y) };
+    for(int ic=0;ic<this->NC;ic++)
+    {
+        ret = clSetKernelArg(this->tag_kernel, 0, sizeof(cl_mem), &buffers[ic]);
+        ret |= clSetKernelArg(this->tag_kernel, 1, sizeof(cl_mem), &this->flags_buffer);
+        if(this->is_double)
+            ret |= clSetKernelArg(this->tag_kernel, 2, sizeof(cl_double), &double_threshold);
+        else
+            ret |= clSetKernelArg(this->tag_kernel, 2, sizeof(cl_float), &float_threshold);
+        ret |= clSetKernelArg(this->tag_kernel, 3, sizeof(cl_int), &this->X);
+        ret |= clSetKernelArg(this->tag_kernel, 4, sizeof(cl_int), &this->Y);
+        ret |= clSetKernelArg(this->tag_kernel, 5, sizeof(cl_int), &int_wrap);
+        throwOnError(ret,"PatchRefinement::Regrid : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->tag_kernel, 2, NULL, tag_range, NULL, 0, NULL, NULL);
+        throwOnError(ret,"PatchRefinement::Regrid : clEnqueueNDRangeKernel failed: ");
+    }
+    ret = clEnqueueReadBuffer(this->command_queue,this->flags_buffer, CL_TRUE, 0, sizeof(cl_int) * n_patches, &flags[0], 0, NULL, NULL);
+    throwOnError(ret,"PatchRefinement::Regrid : buffer reading failed: ");
+
+    // refine the flagged patches and their neighbors, so that a front stays inside the fine level until the next regrid
+    vector<int> new_slot_patch;
+    for(int py=0;py<this->patches_y;py++)
+    {
+        for(int px=0;px<this->patches_x;px++)
+        {
+            bool refine = false;
+            for(int dy=-1;dy<=1 && !refine;dy++)
+            {
+                for(int dx=-1;dx<=1 && !refine;dx++)
+                {
+                    int nx = px+dx, ny = py+dy;
+                    if(this->wrap) { nx = (nx + this->patches_x) % this->patches_x; ny = (ny + this->patches_y) % this->patches_y; }
+                    else if(nx<0 || nx>=this->patches_x || ny<0 || ny>=this->patches_y) continue;
+                    refine = flags[this->patches_x * ny + nx] != 0;
+                }
+            }
+            if(refine)
+                new_slot_patch.push_back(this->patches_x * py + px);
+        }
+    }
+    if(new_slot_patch == this->slot_patch)
+        return;
+
+    const int n_slots = (int)new_slot_patch.size();
+    if(n_slots == 0)
+    {
+        this->Reset();
+        return;
+    }
+
+    // lay out the slots in a roughly square atlas
+    const int new_slots_x = (int)ceil(sqrt((double)n_slots));
+    const int new_slots_y = (n_slots + new_slots_x - 1) / new_slots_x;
+    const cl_int AX = new_slots_x * SLOT_WIDTH;
+    const cl_int AY = new_slots_y * SLOT_HEIGHT;
+    const cl_int old_AX = max(1,this->slots_x * SLOT_WIDTH);
+    vector<cl_int> old_slot(n_slots);
+    for(int s=0;s<n_slots;s++)
+        old_slot[s] = this->patch_slot[new_slot_patch[s]];
+
+    vector<cl_mem> new_atlas[2];
+    const size_t value_size = this->is_double ? sizeof(cl_double) : sizeof(cl_float);
+    for(int io=0;io<2;io++)
+    {
+        new_atlas[io].resize(this->NC);
+        for(int ic=0;ic<this->NC;ic++)
+            this->CreateBuffer(new_atlas[io][ic],value_size * AX * AY);
+    }
+    cl_mem new_slot_patch_buffer, old_slot_buffer;
+    this->CreateBuffer(new_slot_patch_buffer,sizeof(cl_int) * n_slots);
+    this->CreateBuffer(old_slot_buffer,sizeof(cl_int) * n_slots);
+    ret = clEnqueueWriteBuffer(this->command_queue,new_slot_patch_buffer, CL_TRUE, 0, sizeof(cl_int) * n_slots, &new_slot_patch[0], 0, NULL, NULL);
+    ret |= clEnqueueWriteBuffer(this->command_queue,old_slot_buffer, CL_TRUE, 0, sizeof(cl_int) * n_slots, &old_slot[0], 0, NULL, NULL);
+    throwOnError(ret,"PatchRefinement::Regrid : buffer writing failed: ");
+
+    // move the fine values over to the new atlas, or make them from the base grid for the newly refined patches
+    const size_t regrid_range[2] = { size_t(AX), size_t(AY) };
+    const cl_int int_n_slots = n_slots;
+    const cl_mem no_buffer = NULL;
+    for(int ic=0;ic<this->NC;ic++)
+    {
+        ret = clSetKernelArg(this->regrid_kernel, 0, sizeof(cl_mem), &buffers[ic]);
+        ret |= clSetKernelArg(this->regrid_kernel, 1, sizeof(cl_mem), this->atlas[this->iCurrentAtlas].empty() ? &no_buffer : &this->atlas[this->iCurrentAtlas][ic]);
+        ret |= clSetKernelArg(this->regrid_kernel, 2, sizeof(cl_mem), &new_atlas[0][ic]);
+        ret |= clSetKernelArg(this->regrid_kernel, 3, sizeof(cl_mem), &new_slot_patch_buffer);
+        ret |= clSetKernelArg(this->regrid_kernel, 4, sizeof(cl_mem), &old_slot_buffer);
+        ret |= clSetKernelArg(this->regrid_kernel, 5, sizeof(cl_int), &old_AX);
+        ret |= clSetKernelArg(this->regrid_kernel, 6, sizeof(cl_int), &AX);
+        ret |= clSetKernelArg(this->regrid_kernel, 7, sizeof(cl_int), &int_n_slots);
+        ret |= clSetKernelArg(this->regrid_kernel, 8, sizeof(cl_int), &this->X);
+        ret |= clSetKernelArg(this->regrid_kernel, 9, sizeof(cl_int), &this->Y);
+        ret |= clSetKernelArg(this->regrid_kernel, 10, sizeof(cl_int), &int_wrap);
+        throwOnError(ret,"PatchRefinement::Regrid : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->regrid_kernel, 2, NULL, regrid_range, NULL, 0, NULL, NULL);
+        throwOnError(ret,"PatchRefinement::Regrid : clEnqueueNDRangeKernel failed: ");
+    }
+    clReleaseMemObject(old_slot_buffer); // (OpenCL keeps the buffers until the queued kernels are done with them)
+
+    this->ReleaseAtlas();
+    this->atlas[0] = new_atlas[0];
+    this->atlas[1] = new_atlas[1];
+    this->iCurrentAtlas = 0;
+    this->slot_patch = new_slot_patch;
+    this->slot_patch_buffer = new_slot_patch_buffer;
+    this->slots_x = new_slots_x;
+    this->slots_y = new_slots_y;
+    this->patch_slot.assign(n_patches,-1);
+    for(int s=0;s<n_slots;s++)
+        this->patch_slot[new_slot_patch[s]] = s;
+    ret = clEnqueueWriteBuffer(this->command_queue,this->patch_slot_buffer, CL_TRUE, 0, sizeof(cl_int) * n_patches, &this->patch_slot[0], 0, NULL, NULL);
+    throwOnError(ret,"PatchRefinement::Regrid : buffer writing failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::FillGhostCells(const vector<cl_mem>& old_buffers,const vector<cl_mem>& new_buffers,float alpha)
+{
+    const cl_int AX = this->slots_x * SLOT_WIDTH;
+    const size_t range[2] = { size_t(AX), size_t(this->slots_y * SLOT_HEIGHT) };
+    const cl_int n_slots = (int)this->slot_patch.size();
+    const cl_int int_wrap = this->wrap ? 1 : 0;
+    const cl_float float_alpha = alpha;
+    const cl_double double_alpha = alpha;
+    cl_int ret;
+    for(int ic=0;ic<this->NC;ic++)
+    {
+        ret = clSetKernelArg(this->ghost_kernel, 0, sizeof(cl_mem), &old_buffers[ic]);
+        ret |= clSetKernelArg(this->ghost_kernel, 1, sizeof(cl_mem), &new_buffers[ic]);
+        if(this->is_double)
+            ret |= clSetKernelArg(this->ghost_kernel, 2, sizeof(cl_double), &double_alpha);
+        else
+            ret |= clSetKernelArg(this->ghost_kernel, 2, sizeof(cl_float), &float_alpha);
+        ret |= clSetKernelArg(this->ghost_kernel, 3, sizeof(cl_mem), &this->atlas[this->iCurrentAtlas][ic]);
+        ret |= clSetKernelArg(this->ghost_kernel, 4, sizeof(cl_mem), &this->slot_patch_buffer);
+        ret |= clSetKernelArg(this->ghost_kernel, 5, sizeof(cl_mem), &this->patch_slot_buffer);
+        ret |= clSetKernelArg(this->ghost_kernel, 6, sizeof(cl_int), &AX);
+        ret |= clSetKernelArg(this->ghost_kernel, 7, sizeof(cl_int), &n_slots);
+        ret |= clSetKernelArg(this->ghost_kernel, 8, sizeof(cl_int), &this->X);
+        ret |= clSetKernelArg(this->ghost_kernel, 9, sizeof(cl_int), &this->Y);
+        ret |= clSetKernelArg(this->ghost_kernel, 10, sizeof(cl_int), &int_wrap);
+        throwOnError(ret,"PatchRefinement::FillGhostCells : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->ghost_kernel, 2, NULL, range, NULL, 0, NULL, NULL);
+        throwOnError(ret,"PatchRefinement::FillGhostCells : clEnqueueNDRangeKernel failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void PatchRefinement::Step(const vector<cl_mem>& old_buffers,const vector<cl_mem>& new_buffers)
+{
+    // the patches are chosen to match the base grid before the step
+    if(this->steps_until_regrid <= 0)
+    {
+        this->Regrid(old_buffers);
+        this->steps_until_regrid = REGRID_INTERVAL;
+    }
+    this->steps_until_regrid--;
+    if(this->slot_patch.empty())
+        return;
+
+    cl_int ret;
+
+    // advance the fine level in substeps, with its ghost cells following the base grid
+    const cl_int AX = this->slots_x * SLOT_WIDTH;
+    const size_t fine_range[3] = { size_t(AX / 4), size_t(this->slots_y * SLOT_HEIGHT), 1 }; // (the formula kernel works on blocks of four)
+    for(int substep=0;substep<SUBSTEPS;substep++)
+    {
+        this->FillGhostCells(old_buffers,new_buffers,substep / float(SUBSTEPS));
+        for(int io=0;io<2;io++)
+        {
+            const int iAtlas = (this->iCurrentAtlas+io)%2;
+            for(int ic=0;ic<this->NC;ic++)
+            {
+                ret = clSetKernelArg(this->fine_kernel, io*this->NC+ic, sizeof(cl_mem), &this->atlas[iAtlas][ic]);
+                throwOnError(ret,"PatchRefinement::Step : clSetKernelArg failed: ");
+            }
+        }
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->fine_kernel, 3, NULL, fine_range, NULL, 0, NULL, NULL);
+        throwOnError(ret,"PatchRefinement::Step : clEnqueueNDRangeKernel failed: ");
+        this->iCurrentAtlas = 1 - this->iCurrentAtlas;
+    }
+
+    // average the fine cells back into the base grid
+    const size_t restrict_range[2] = { size_t(this->slots_x * PATCH_SIZE), size_t(this->slots_y * PATCH_SIZE) };
+    const cl_int n_slots = (int)this->slot_patch.size();
+    for(int ic=0;ic<this->NC;ic++)
+    {
+        ret = clSetKernelArg(this->restrict_kernel, 0, sizeof(cl_mem), &new_buffers[ic]);
+        ret |= clSetKernelArg(this->restrict_kernel, 1, sizeof(cl_mem), &this->atlas[this->iCurrentAtlas][ic]);
+        ret |= clSetKernelArg(this->restrict_kernel, 2, sizeof(cl_mem), &this->slot_patch_buffer);
+        ret |= clSetKernelArg(this->restrict_kernel, 3, sizeof(cl_int), &AX);
+        ret |= clSetKernelArg(this->restrict_kernel, 4, sizeof(cl_int), &n_slots);
+        ret |= clSetKernelArg(this->restrict_kernel, 5, sizeof(cl_int), &this->X);
+        throwOnError(ret,"PatchRefinement::Step : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->restrict_kernel, 2, NULL, restrict_range, NULL, 0, NULL, NULL);
+        throwOnError(ret,"PatchRefinement::Step : clEnqueueNDRangeKernel failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
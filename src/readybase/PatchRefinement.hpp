@@ -0,0 +1,114 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __PATCHREFINEMENT__
+#define __PATCHREFINEMENT__
+
+// local:
+#include "OpenCL_utils.hpp"
+
+// STL:
+#include <string>
+#include <vector>
+
+/// A level of finer patches over the parts of a 2D OpenCL image where the values change steeply, e.g. at wavefronts.
+/**
+ * The image (the base grid) is split into square patches of PATCH_SIZE cells. A patch is refined if the difference
+ * between neighboring cells of any chemical exceeds the threshold somewhere in it, or in a patch next to it. The
+ * refined patches are kept side by side on the device in one atlas image per chemical, each with a border of ghost
+ * cells, so that the formula kernel of the fine level can compute all of them in one launch.
+ *
+ * Each step of the base grid is followed by SUBSTEPS steps of the fine level (one for each halving of the timestep
+ * that keeps diffusion stable at half the spacing). Before each substep the ghost cells are filled from the neighboring
+ * fine patch if there is one, or otherwise from the base grid, interpolated in time between the old and new values.
+ * Afterwards the fine cells are averaged back into the base grid. New patches are made from the base grid with
+ * limited linear interpolation. Both transfers are conservative: the fine cells of a base cell average to its value.
+ */
+class PatchRefinement
+{
+    public:
+
+        PatchRefinement();
+        ~PatchRefinement();
+
+        static const int PATCH_SIZE = 16;   ///< the side of a patch, in cells of the base grid
+        static const int RATIO = 2;         ///< the number of fine cells along each side of a cell of the base grid
+        static const int SUBSTEPS = 4;      ///< steps of the fine level for each step of the base grid (RATIO squared)
+
+        /// Gets ready to refine an X by Y image of NC chemicals, forgetting any patches. Throws on failure.
+        /**
+         * fine_kernel_source must be the formula kernel for the fine level, with the spacing and timestep scaled to
+         * suit, no wrap-around and the chemicals in separate buffers of blocks of four values.
+         */
+        void Initialize(cl_context context,cl_device_id device_id,cl_command_queue command_queue,
+            const std::string& fine_kernel_source,int X,int Y,int NC,bool is_double,bool wrap,float threshold);
+
+        /// Advances the fine level to match a step of the base grid, and averages it into the base grid.
+        /**
+         * old_buffers and new_buffers are the buffers of each chemical of the base grid, before and after the step.
+         */
+        void Step(const std::vector<cl_mem>& old_buffers,const std::vector<cl_mem>& new_buffers);
+
+        /// Forgets the patches, e.g. when the base grid was changed from outside; they will be made again from it.
+        void Reset();
+
+        /// Releases all the OpenCL objects.
+        void Release();
+
+        int GetNumberOfRefinedPatches() const { return (int)this->slot_patch.size(); }
+
+    protected:
+
+        /// Chooses the patches to refine from the base grid, and moves the fine values over to the new atlas.
+        void Regrid(const std::vector<cl_mem>& buffers);
+
+        /// Fills the ghost cells of the current fine buffers, at time alpha between the old and new base grids.
+        void FillGhostCells(const std::vector<cl_mem>& old_buffers,const std::vector<cl_mem>& new_buffers,float alpha);
+
+        void CreateKernel(cl_kernel& kernel,cl_program program,const char* name);
+        void CreateBuffer(cl_mem& buffer,size_t size);
+
+        void ReleaseAtlas();
+
+    protected:
+
+        cl_context context;
+        cl_device_id device_id;
+        cl_command_queue command_queue;
+        bool is_double;
+
+        cl_program fine_program;
+        cl_kernel fine_kernel;      ///< the formula kernel, run over the whole atlas
+        cl_program helper_program;
+        cl_kernel tag_kernel,regrid_kernel,ghost_kernel,restrict_kernel;
+
+        int X,Y,NC;                 ///< the size of the base grid, and the number of chemicals
+        int patches_x,patches_y;    ///< the number of patches across the base grid
+        bool wrap;
+        float threshold;            ///< the difference between neighboring cells above which a patch is refined
+
+        std::vector<int> slot_patch;    ///< the patch held in each slot of the atlas
+        std::vector<int> patch_slot;    ///< the slot of each patch of the base grid, or -1 if it isn't refined
+        int slots_x,slots_y;            ///< the number of slots across the atlas
+        std::vector<cl_mem> atlas[2];   ///< the fine values of each chemical, in slots with ghost cells; we switch between them
+        int iCurrentAtlas;
+        cl_mem slot_patch_buffer,patch_slot_buffer,flags_buffer;
+
+        int steps_until_regrid;
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "ProbeSet.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <stdexcept>
+using namespace std;
+
+// VTK:
+#include <vtkXMLDataElement.h>
+
+// ---------------------------------------------------------------------
+
+static void read_optional_attribute(vtkXMLDataElement* e,const string& name,double& val,double default_val)
+{
+    if(!e->GetAttribute(name.c_str())) val = default_val;
+    else read_required_attribute(e,name,val);
+}
+
+// ---------------------------------------------------------------------
+
+ProbeSet::ProbeSet()
+    : interval(1), capacity(256)
+{
+}
+
+// ---------------------------------------------------------------------
+
+void ProbeSet::ReadFromXML(vtkXMLDataElement* node)
+{
+    this->probes.clear();
+    this->interval = 1;
+    this->capacity = 256;
+    if(!node) return; // probes are optional in the XML, default is none
+
+    if(node->GetAttribute("every"))
+        read_required_attribute(node,"every",this->interval);
+    if(node->GetAttribute("capacity"))
+        read_required_attribute(node,"capacity",this->capacity);
+    if(this->interval<1) throw runtime_error("probes : every must be at least 1");
+    if(this->capacity<1) throw runtime_error("probes : capacity must be at least 1");
+
+    const char* axis_names[3] = { "x", "y", "z" };
+    for(int i=0;i<node->GetNumberOfNestedElements();i++)
+    {
+        vtkXMLDataElement* e = node->GetNestedElement(i);
+        const string type = e->GetName();
+        Probe probe;
+        read_required_attribute(e,"name",probe.name);
+        read_required_attribute(e,"chemical",probe.chemical);
+        probe.axis = 2;
+        probe.position = 0.5;
+        probe.n_samples = 1;
+        if(type=="point")
+        {
+            probe.type = POINT;
+            for(int j=0;j<3;j++)
+            {
+                // (coordinates can be left out for arenas with fewer dimensions)
+                read_optional_attribute(e,axis_names[j],probe.start[j],0.5);
+                probe.end[j] = probe.start[j];
+            }
+        }
+        else if(type=="line")
+        {
+            probe.type = LINE;
+            for(int j=0;j<3;j++)
+            {
+                read_optional_attribute(e,string(axis_names[j])+"1",probe.start[j],0.5);
+                read_optional_attribute(e,string(axis_names[j])+"2",probe.end[j],0.5);
+            }
+            read_required_attribute(e,"samples",probe.n_samples);
+        }
+        else if(type=="plane")
+        {
+            probe.type = PLANE;
+            string axis;
+            read_required_attribute(e,"axis",axis);
+            if(axis=="x") probe.axis = 0;
+            else if(axis=="y") probe.axis = 1;
+            else if(axis=="z") probe.axis = 2;
+            else throw runtime_error("plane : axis must be x, y or z");
+            read_optional_attribute(e,"position",probe.position,0.5);
+            read_required_attribute(e,"samples",probe.n_samples);
+            for(int j=0;j<3;j++)
+                probe.start[j] = probe.end[j] = 0.0;
+        }
+        else throw runtime_error("probes : unknown probe type: "+type);
+        if(probe.n_samples<1) throw runtime_error(type+" : samples must be at least 1");
+        this->probes.push_back(probe);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> ProbeSet::GetAsXML() const
+{
+    vtkSmartPointer<vtkXMLDataElement> node = vtkSmartPointer<vtkXMLDataElement>::New();
+    node->SetName("probes");
+    node->SetIntAttribute("every",this->interval);
+    node->SetIntAttribute("capacity",this->capacity);
+    const char* axis_names[3] = { "x", "y", "z" };
+    for(size_t i=0;i<this->probes.size();i++)
+    {
+        const Probe& probe = this->probes[i];
+        vtkSmartPointer<vtkXMLDataElement> e = vtkSmartPointer<vtkXMLDataElement>::New();
+        e->SetAttribute("name",probe.name.c_str());
+        e->SetAttribute("chemical",probe.chemical.c_str());
+        switch(probe.type)
+        {
+            case POINT:
+                e->SetName("point");
+                for(int j=0;j<3;j++)
+                    e->SetDoubleAttribute(axis_names[j],probe.start[j]);
+                break;
+            case LINE:
+                e->SetName("line");
+                for(int j=0;j<3;j++)
+                {
+                    e->SetDoubleAttribute((string(axis_names[j])+"1").c_str(),probe.start[j]);
+                    e->SetDoubleAttribute((string(axis_names[j])+"2").c_str(),probe.end[j]);
+                }
+                e->SetIntAttribute("samples",probe.n_samples);
+                break;
+            case PLANE:
+                e->SetName("plane");
+                e->SetAttribute("axis",axis_names[probe.axis]);
+                e->SetDoubleAttribute("position",probe.position);
+                e->SetIntAttribute("samples",probe.n_samples);
+                break;
+        }
+        node->AddNestedElement(e);
+    }
+    return node;
+}
+
+// ---------------------------------------------------------------------
+
+void ProbeSet::GetSamples(vector<double>& positions,vector<int>& chemicals,vector<string>& column_names) const
+{
+    positions.clear();
+    chemicals.clear();
+    column_names.clear();
+    for(size_t i=0;i<this->probes.size();i++)
+    {
+        const Probe& probe = this->probes[i];
+        const int iChemical = IndexFromChemicalName(probe.chemical);
+        if(probe.type==POINT)
+        {
+            positions.insert(positions.end(),probe.start,probe.start+3);
+            chemicals.push_back(iChemical);
+            column_names.push_back(probe.name);
+        }
+        else if(probe.type==LINE)
+        {
+            for(int k=0;k<probe.n_samples;k++)
+            {
+                // include both ends, unless there is only one sample, which goes in the middle
+                const double t = probe.n_samples>1 ? k / double(probe.n_samples-1) : 0.5;
+                for(int j=0;j<3;j++)
+                    positions.push_back(probe.start[j] + t * (probe.end[j] - probe.start[j]));
+                chemicals.push_back(iChemical);
+                column_names.push_back(probe.name+"_"+to_string(k));
+            }
+        }
+        else
+        {
+            // the samples are at the centers of a grid of squares over the plane, with the first in-plane axis changing fastest
+            const int u = probe.axis==0 ? 1 : 0;
+            const int v = probe.axis==2 ? 1 : 2;
+            for(int kv=0;kv<probe.n_samples;kv++)
+            {
+                for(int ku=0;ku<probe.n_samples;ku++)
+                {
+                    double p[3];
+                    p[probe.axis] = probe.position;
+                    p[u] = (ku + 0.5) / probe.n_samples;
+                    p[v] = (kv + 0.5) / probe.n_samples;
+                    positions.insert(positions.end(),p,p+3);
+                    chemicals.push_back(iChemical);
+                    column_names.push_back(probe.name+"_"+to_string(ku)+"_"+to_string(kv));
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __PROBESET__
+#define __PROBESET__
+
+// VTK:
+#include <vtkSmartPointer.h>
+class vtkXMLDataElement;
+
+// STL:
+#include <string>
+#include <vector>
+
+/// Points, lines and planes in the arena where the value of a chemical is recorded every few timesteps.
+/**
+ * Positions are proportional (0-1) within the bounds of the arena, like those of the overlays. A line probe
+ * has a number of sample points spread evenly from one end to the other, and a plane probe has a square grid
+ * of them across the arena, perpendicular to one axis. Each sample point gives one column of the records.
+ */
+class ProbeSet
+{
+    public:
+
+        ProbeSet();
+
+        void ReadFromXML(vtkXMLDataElement* node); ///< node may be NULL, for no probes
+        vtkSmartPointer<vtkXMLDataElement> GetAsXML() const;
+
+        bool IsEmpty() const { return this->probes.empty(); }
+        int GetInterval() const { return this->interval; }  ///< the probes are recorded on each multiple of this many timesteps
+        int GetCapacity() const { return this->capacity; }  ///< the number of records that implementations may hold before reading them back
+
+        /// Gets the proportional position of every sample point (as xyz triples), the chemical it records, and the name of its column.
+        void GetSamples(std::vector<double>& positions,std::vector<int>& chemicals,std::vector<std::string>& column_names) const;
+
+    protected:
+
+        enum ProbeType { POINT, LINE, PLANE };
+
+        struct Probe
+        {
+            ProbeType type;
+            std::string name;
+            std::string chemical;
+            double start[3];    ///< the point, or the first end of the line
+            double end[3];      ///< the other end of the line
+            int axis;           ///< the axis that the plane is perpendicular to (0,1,2 for x,y,z)
+            double position;    ///< where the plane crosses its axis
+            int n_samples;      ///< along the line, or along each side of the plane
+        };
+
+        std::vector<Probe> probes;
+        int interval,capacity;
+};
+
+#endif
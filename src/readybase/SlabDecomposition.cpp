@@ -0,0 +1,516 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "SlabDecomposition.hpp"
+#include "OpenCL_MixIn.hpp"
+using namespace OpenCL_utils;
+
+// STL:
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+using namespace std;
+
+// stdlib:
+#include <math.h>
+
+static const size_t CHANGE_GROUPS = 32;       // work-groups for reducing the change over a slab
+
+/// Returns the kernel that reduces the change between two buffers of a slab, over the n values from first.
+static string GetChangeKernelSource(size_t value_size)
+{
+    const string T = value_size == sizeof(double) ? "double" : "float";
+    ostringstream source;
+    source << "\n__kernel void rd_slab_change(__global const " << T << " *data,__global const " << T << " *previous,const int first,\n"
+        << "    const int n,__global " << T << " *results,__local " << T << " *reduction)\n"
+        << "{\n"
+        << "    " << T << " max_change = 0, sum_squares = 0;\n"
+        << "    for(int i = first + get_global_id(0); i < first + n; i += get_global_size(0))\n"
+        << "    {\n"
+        << "        const " << T << " d = fabs(data[i] - previous[i]);\n"
+        << "        max_change = fmax(max_change,d);\n"
+        << "        sum_squares += d * d;\n"
+        << "    }\n"
+        << "    const int lid = get_local_id(0);\n"
+        << "    reduction[2 * lid] = max_change;\n"
+        << "    reduction[2 * lid + 1] = sum_squares;\n"
+        << "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    for(int s = get_local_size(0) / 2; s > 0; s /= 2)\n"
+        << "    {\n"
+        << "        if(lid < s)\n"
+        << "        {\n"
+        << "            reduction[2 * lid] = fmax(reduction[2 * lid],reduction[2 * (lid + s)]);\n"
+        << "            reduction[2 * lid + 1] += reduction[2 * (lid + s) + 1];\n"
+        << "        }\n"
+        << "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+        << "    }\n"
+        << "    if(lid == 0)\n"
+        << "    {\n"
+        << "        results[2 * get_group_id(0)] = reduction[0];\n"
+        << "        results[2 * get_group_id(0) + 1] = reduction[1];\n"
+        << "    }\n"
+        << "}\n";
+    return source.str();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+SlabDecomposition::SlabDecomposition()
+    : context(NULL)
+    , program(NULL)
+    , iCurrentBuffer(0)
+    , has_stepped(false)
+    , X(0), Y(0), Z(0), NC(0)
+    , value_size(0)
+    , plane_size(0)
+    , global_x(0), global_y(0)
+    , wrap(false)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+SlabDecomposition::~SlabDecomposition()
+{
+    this->Release();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void SlabDecomposition::Release()
+{
+    for(size_t is=0;is<this->slabs.size();is++)
+    {
+        Slab& slab = this->slabs[is];
+        if(slab.command_queue) clFinish(slab.command_queue);
+        if(slab.transfer_queue) clFinish(slab.transfer_queue);
+    }
+    this->ReleaseHaloEvents();
+    for(size_t is=0;is<this->slabs.size();is++)
+    {
+        Slab& slab = this->slabs[is];
+        for(int io=0;io<2;io++)
+            for(size_t ic=0;ic<slab.buffers[io].size();ic++)
+                clReleaseMemObject(slab.buffers[io][ic]);
+        clReleaseKernel(slab.kernel);
+        clReleaseKernel(slab.change_kernel);
+        clReleaseMemObject(slab.change_results);
+        clReleaseCommandQueue(slab.command_queue);
+        clReleaseCommandQueue(slab.transfer_queue);
+    }
+    this->slabs.clear();
+    clReleaseProgram(this->program);
+    clReleaseContext(this->context);
+    this->program = NULL;
+    this->context = NULL;
+    for(size_t i=0;i<this->sub_devices.size();i++)
+    {
+        #ifdef __APPLE__
+            clReleaseDevice(this->sub_devices[i]);
+        #else
+            if(clReleaseDevice) clReleaseDevice(this->sub_devices[i]);
+        #endif
+    }
+    this->sub_devices.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void SlabDecomposition::ReleaseHaloEvents()
+{
+    for(size_t i=0;i<this->halo_events.size();i++)
+        clReleaseEvent(this->halo_events[i]);
+    this->halo_events.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<cl_device_id> SlabDecomposition::GetDevices(int iPlatform,const vector<int>& devices,bool split_by_numa)
+{
+    cl_int ret;
+
+    cl_uint num_platforms = 0;
+    ret = clGetPlatformIDs(0,NULL,&num_platforms);
+    if(ret != CL_SUCCESS || iPlatform >= (int)num_platforms)
+        throw runtime_error("SlabDecomposition::GetDevices : too few platforms available");
+    vector<cl_platform_id> platforms_available(num_platforms);
+    ret = clGetPlatformIDs(num_platforms,&platforms_available[0],NULL);
+    throwOnError(ret,"SlabDecomposition::GetDevices : Failed to retrieve platforms: ");
+
+    cl_uint num_devices = 0;
+    ret = clGetDeviceIDs(platforms_available[iPlatform],CL_DEVICE_TYPE_ALL,0,NULL,&num_devices);
+    throwOnError(ret,"SlabDecomposition::GetDevices : Failed to retrieve number of device IDs: ");
+    vector<cl_device_id> devices_available(num_devices);
+    ret = clGetDeviceIDs(platforms_available[iPlatform],CL_DEVICE_TYPE_ALL,num_devices,&devices_available[0],NULL);
+    throwOnError(ret,"SlabDecomposition::GetDevices : Failed to retrieve device IDs: ");
+
+    vector<cl_device_id> result;
+    for(size_t i=0;i<devices.size();i++)
+    {
+        if(devices[i] < 0 || devices[i] >= (int)num_devices)
+            throw runtime_error("SlabDecomposition::GetDevices : too few devices available");
+        cl_device_id device_id = devices_available[devices[i]];
+        if(!split_by_numa)
+        {
+            result.push_back(device_id);
+            continue;
+        }
+        #if defined(__APPLE__) && !defined(CL_VERSION_1_2)
+            throw runtime_error("SlabDecomposition::GetDevices : splitting devices by NUMA node needs OpenCL 1.2");
+        #else
+            #ifndef __APPLE__
+                if(!clCreateSubDevices)
+                    throw runtime_error("SlabDecomposition::GetDevices : splitting devices by NUMA node needs OpenCL 1.2");
+            #endif
+            const cl_device_partition_property properties[3] = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0 };
+            cl_uint n_parts = 0;
+            ret = clCreateSubDevices(device_id,properties,0,NULL,&n_parts);
+            if(ret != CL_SUCCESS || n_parts < 2)
+            {
+                // e.g. a GPU, or a machine with one NUMA node: there's nothing to gain, so use the device whole
+                result.push_back(device_id);
+                continue;
+            }
+            vector<cl_device_id> parts(n_parts);
+            ret = clCreateSubDevices(device_id,properties,n_parts,&parts[0],NULL);
+            throwOnError(ret,"SlabDecomposition::GetDevices : Failed to create sub-devices: ");
+            this->sub_devices.insert(this->sub_devices.end(),parts.begin(),parts.end());
+            result.insert(result.end(),parts.begin(),parts.end());
+        #endif
+    }
+    if(result.empty())
+        throw runtime_error("SlabDecomposition::GetDevices : no devices given");
+    return result;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void SlabDecomposition::Initialize(int iPlatform,const vector<int>& devices,bool split_by_numa,const string& kernel_source,
+    int X,int Y,int Z,int NC,size_t value_size,size_t global_x,size_t global_y,bool wrap)
+{
+    this->Release();
+
+    this->X = X;
+    this->Y = Y;
+    this->Z = Z;
+    this->NC = NC;
+    this->value_size = value_size;
+    this->plane_size = value_size * X * Y;
+    this->global_x = global_x;
+    this->global_y = global_y;
+    this->wrap = wrap;
+    this->iCurrentBuffer = 0;
+    this->has_stepped = false;
+
+    const vector<cl_device_id> device_ids = this->GetDevices(iPlatform,devices,split_by_numa);
+    const int NS = (int)device_ids.size();
+    if(Z < NS)
+    {
+        ostringstream oss;
+        oss << "SlabDecomposition::Initialize : the image has " << Z << " planes along z, too few to split between " << NS << " devices";
+        throw runtime_error(oss.str().c_str());
+    }
+
+    cl_int ret;
+    this->context = clCreateContext(NULL,NS,&device_ids[0],NULL,NULL,&ret);
+    throwOnError(ret,"SlabDecomposition::Initialize : Failed to create context: ");
+
+    // (the kernel source already enables doubles if it needs them)
+    this->program = OpenCL_MixIn::BuildProgramFromSource(this->context,NS,&device_ids[0],kernel_source + GetChangeKernelSource(value_size),
+        false,"SlabDecomposition::Initialize");
+
+    // the planes are shared out as evenly as possible
+    this->slabs.resize(NS);
+    int z0 = 0;
+    for(int is=0;is<NS;is++)
+    {
+        Slab& slab = this->slabs[is];
+        slab.device_id = device_ids[is];
+        slab.command_queue = NULL;
+        slab.transfer_queue = NULL;
+        slab.kernel = NULL;
+        slab.change_kernel = NULL;
+        slab.change_results = NULL;
+        slab.z0 = z0;
+        slab.depth = Z / NS + ( is < Z % NS ? 1 : 0 );
+        z0 += slab.depth;
+
+        slab.command_queue = clCreateCommandQueue(this->context,slab.device_id,0,&ret);
+        throwOnError(ret,"SlabDecomposition::Initialize : Failed to create command queue: ");
+        slab.transfer_queue = clCreateCommandQueue(this->context,slab.device_id,0,&ret);
+        throwOnError(ret,"SlabDecomposition::Initialize : Failed to create command queue: ");
+        slab.kernel = clCreateKernel(this->program,"rd_compute",&ret);
+        throwOnError(ret,"SlabDecomposition::Initialize : kernel creation failed: ");
+        slab.change_kernel = clCreateKernel(this->program,"rd_slab_change",&ret);
+        throwOnError(ret,"SlabDecomposition::Initialize : kernel creation failed: ");
+        slab.change_results = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, 2 * CHANGE_GROUPS * value_size, NULL, &ret);
+        throwOnError(ret,"SlabDecomposition::Initialize : buffer creation failed: ");
+        for(int io=0;io<2;io++)
+        {
+            slab.buffers[io].assign(NC,(cl_mem)NULL);
+            for(int ic=0;ic<NC;ic++)
+            {
+                slab.buffers[io][ic] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->plane_size * (slab.depth+2), NULL, &ret);
+                throwOnError(ret,"SlabDecomposition::Initialize : buffer creation failed: ");
+            }
+        }
+        slab.first_planes.resize(this->plane_size * NC);
+        slab.last_planes.resize(this->plane_size * NC);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void SlabDecomposition::WriteCells(const vector<void*>& arrays)
+{
+    for(size_t is=0;is<this->slabs.size();is++)
+    {
+        clFinish(this->slabs[is].command_queue);
+        clFinish(this->slabs[is].transfer_queue);
+    }
+    this->ReleaseHaloEvents();
+    this->iCurrentBuffer = 0;
+    this->has_stepped = false;
+
+    cl_int ret;
+    for(size_t is=0;is<this->slabs.size();is++)
+    {
+        const Slab& slab = this->slabs[is];
+        // the halo planes come from beyond the slab: wrapped around or clamped at the edges of the arena
+        int z_below = slab.z0 - 1, z_above = slab.z0 + slab.depth;
+        if(this->wrap)
+        {
+            z_below = (z_below + this->Z) % this->Z;
+            z_above = z_above % this->Z;
+        }
+        else
+        {
+            z_below = max(0,z_below);
+            z_above = min(this->Z-1,z_above);
+        }
+        for(int ic=0;ic<this->NC;ic++)
+        {
+            const char *image = static_cast<const char*>(arrays[ic]);
+            cl_mem buffer = slab.buffers[this->iCurrentBuffer][ic];
+            ret = clEnqueueWriteBuffer(slab.command_queue, buffer, CL_TRUE, 0, this->plane_size,
+                image + this->plane_size * z_below, 0, NULL, NULL);
+            ret |= clEnqueueWriteBuffer(slab.command_queue, buffer, CL_TRUE, this->plane_size, this->plane_size * slab.depth,
+                image + this->plane_size * slab.z0, 0, NULL, NULL);
+            ret |= clEnqueueWriteBuffer(slab.command_queue, buffer, CL_TRUE, this->plane_size * (slab.depth+1), this->plane_size,
+                image + this->plane_size * z_above, 0, NULL, NULL);
+            throwOnError(ret,"SlabDecomposition::WriteCells : buffer writing failed: ");
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void SlabDecomposition::ReadCells(const vector<void*>& arrays)
+{
+    cl_int ret;
+    for(size_t is=0;is<this->slabs.size();is++)
+    {
+        const Slab& slab = this->slabs[is];
+        clFinish(slab.transfer_queue);
+        for(int ic=0;ic<this->NC;ic++)
+        {
+            char *image = static_cast<char*>(arrays[ic]);
+            ret = clEnqueueReadBuffer(slab.command_queue, slab.buffers[this->iCurrentBuffer][ic], CL_TRUE, this->plane_size,
+                this->plane_size * slab.depth, image + this->plane_size * slab.z0, 0, NULL, NULL);
+            throwOnError(ret,"SlabDecomposition::ReadCells : buffer reading failed: ");
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool SlabDecomposition::ComputeChange(vector<double>& max_change,vector<double>& rms_change)
+{
+    if(!this->has_stepped)
+        return false;
+    max_change.assign(this->NC,0.0);
+    vector<double> sum_squares(this->NC,0.0);
+    vector<char> results(2 * CHANGE_GROUPS * this->value_size);
+    const cl_int first = this->X * this->Y;    // skip the halo plane
+    cl_int ret;
+    for(size_t is=0;is<this->slabs.size();is++)
+    {
+        const Slab& slab = this->slabs[is];
+        size_t max_local;
+        ret = clGetKernelWorkGroupInfo(slab.change_kernel, slab.device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+        throwOnError(ret,"SlabDecomposition::ComputeChange : clGetKernelWorkGroupInfo failed: ");
+        size_t local = 1;
+        while(local * 2 <= min(max_local,size_t(64)))
+            local *= 2; // the reduction needs a power of two
+        const size_t global = local * CHANGE_GROUPS;
+        const cl_int n = slab.depth * this->X * this->Y;
+        for(int ic=0;ic<this->NC;ic++)
+        {
+            ret = clSetKernelArg(slab.change_kernel, 0, sizeof(cl_mem), &slab.buffers[this->iCurrentBuffer][ic]);
+            ret |= clSetKernelArg(slab.change_kernel, 1, sizeof(cl_mem), &slab.buffers[1-this->iCurrentBuffer][ic]);
+            ret |= clSetKernelArg(slab.change_kernel, 2, sizeof(cl_int), &first);
+            ret |= clSetKernelArg(slab.change_kernel, 3, sizeof(cl_int), &n);
+            ret |= clSetKernelArg(slab.change_kernel, 4, sizeof(cl_mem), &slab.change_results);
+            ret |= clSetKernelArg(slab.change_kernel, 5, 2 * local * this->value_size, NULL);
+            throwOnError(ret,"SlabDecomposition::ComputeChange : clSetKernelArg failed: ");
+            ret = clEnqueueNDRangeKernel(slab.command_queue, slab.change_kernel, 1, NULL, &global, &local, 0, NULL, NULL);
+            throwOnError(ret,"SlabDecomposition::ComputeChange : kernel enqueue failed: ");
+            ret = clEnqueueReadBuffer(slab.command_queue, slab.change_results, CL_TRUE, 0, results.size(), &results[0], 0, NULL, NULL);
+            throwOnError(ret,"SlabDecomposition::ComputeChange : buffer reading failed: ");
+            for(size_t ig=0;ig<CHANGE_GROUPS;ig++)
+            {
+                double group_max,group_sum;
+                if(this->value_size == sizeof(double))
+                {
+                    group_max = reinterpret_cast<const double*>(&results[0])[2*ig];
+                    group_sum = reinterpret_cast<const double*>(&results[0])[2*ig+1];
+                }
+                else
+                {
+                    group_max = reinterpret_cast<const float*>(&results[0])[2*ig];
+                    group_sum = reinterpret_cast<const float*>(&results[0])[2*ig+1];
+                }
+                max_change[ic] = max(max_change[ic],group_max);
+                sum_squares[ic] += group_sum;
+            }
+        }
+    }
+    rms_change.resize(this->NC);
+    const double n_cells = double(this->X) * this->Y * this->Z;
+    for(int ic=0;ic<this->NC;ic++)
+        rms_change[ic] = sqrt(sum_squares[ic] / n_cells);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void SlabDecomposition::EnqueuePlanes(int iSlab,int first,int n,cl_uint n_wait,const cl_event* wait,cl_event* event)
+{
+    const Slab& slab = this->slabs[iSlab];
+    const size_t offset[3] = { 0, 0, size_t(first) }; // (the kernel takes index_z from get_global_id, which includes the offset)
+    const size_t range[3] = { this->global_x, this->global_y, size_t(n) };
+    cl_int ret = clEnqueueNDRangeKernel(slab.command_queue, slab.kernel, 3, offset, range, NULL, n_wait, wait, event);
+    throwOnError(ret,"SlabDecomposition::EnqueuePlanes : clEnqueueNDRangeKernel failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void SlabDecomposition::Step(int n_steps)
+{
+    const int NS = (int)this->slabs.size();
+    cl_int ret;
+    vector<cl_event> edges_done(NS),edges_read(NS),inner_done(NS);
+    for(int it=0;it<n_steps;it++)
+    {
+        const int iIn = this->iCurrentBuffer, iOut = 1 - this->iCurrentBuffer;
+
+        // compute the edge planes of each slab first, once its halos from the last step have arrived
+        for(int is=0;is<NS;is++)
+        {
+            Slab& slab = this->slabs[is];
+            for(int io=0;io<2;io++)
+            {
+                for(int ic=0;ic<this->NC;ic++)
+                {
+                    ret = clSetKernelArg(slab.kernel, io*this->NC+ic, sizeof(cl_mem), &slab.buffers[io ? iOut : iIn][ic]);
+                    throwOnError(ret,"SlabDecomposition::Step : clSetKernelArg failed: ");
+                }
+            }
+            const cl_uint n_wait = this->halo_events.empty() ? 0 : 1;
+            const cl_event *wait = n_wait ? &this->halo_events[is] : NULL;
+            if(slab.depth == 1)
+                this->EnqueuePlanes(is,1,1,n_wait,wait,&edges_done[is]);
+            else
+            {
+                this->EnqueuePlanes(is,1,1,n_wait,wait,NULL);
+                this->EnqueuePlanes(is,slab.depth,1,0,NULL,&edges_done[is]); // (the queue is in-order)
+            }
+            clFlush(slab.command_queue);
+        }
+
+        // bring the edge planes back to the host on the transfer queues; the neighbors must have finished with them from the last step
+        for(int is=0;is<NS;is++)
+        {
+            Slab& slab = this->slabs[is];
+            vector<cl_event> wait(1,edges_done[is]);
+            if(!this->halo_events.empty())
+            {
+                wait.push_back(this->halo_events[(is+NS-1)%NS]);
+                wait.push_back(this->halo_events[(is+1)%NS]);
+            }
+            for(int ic=0;ic<this->NC;ic++)
+            {
+                const bool is_last = ic == this->NC-1;
+                ret = clEnqueueReadBuffer(slab.transfer_queue, slab.buffers[iOut][ic], CL_FALSE, this->plane_size, this->plane_size,
+                    &slab.first_planes[this->plane_size * ic], ic==0 ? (cl_uint)wait.size() : 0, ic==0 ? &wait[0] : NULL, NULL);
+                ret |= clEnqueueReadBuffer(slab.transfer_queue, slab.buffers[iOut][ic], CL_FALSE, this->plane_size * slab.depth,
+                    this->plane_size, &slab.last_planes[this->plane_size * ic], 0, NULL, is_last ? &edges_read[is] : NULL);
+                throwOnError(ret,"SlabDecomposition::Step : buffer reading failed: ");
+            }
+            clFlush(slab.transfer_queue);
+        }
+        this->ReleaseHaloEvents();
+
+        // compute the inner planes while that happens
+        for(int is=0;is<NS;is++)
+        {
+            Slab& slab = this->slabs[is];
+            if(slab.depth > 2)
+                this->EnqueuePlanes(is,2,slab.depth-2,0,NULL,&inner_done[is]);
+            else
+            {
+                ret = clEnqueueMarker(slab.command_queue,&inner_done[is]);
+                throwOnError(ret,"SlabDecomposition::Step : clEnqueueMarker failed: ");
+            }
+            clFlush(slab.command_queue);
+        }
+
+        // fill the halos of each slab from the edge planes of its neighbors, once its kernels have finished
+        this->halo_events.resize(NS);
+        for(int is=0;is<NS;is++)
+        {
+            Slab& slab = this->slabs[is];
+            // at the edges of the arena we either wrap around or repeat the edge plane (as the kernel clamps along x and y)
+            const bool clamp_below = is==0 && !this->wrap, clamp_above = is==NS-1 && !this->wrap;
+            const int iBelow = clamp_below ? is : (is+NS-1)%NS;
+            const int iAbove = clamp_above ? is : (is+1)%NS;
+            const vector<char>& below = clamp_below ? slab.first_planes : this->slabs[iBelow].last_planes;
+            const vector<char>& above = clamp_above ? slab.last_planes : this->slabs[iAbove].first_planes;
+            const cl_event wait[3] = { inner_done[is], edges_read[iBelow], edges_read[iAbove] };
+            for(int ic=0;ic<this->NC;ic++)
+            {
+                const bool is_last = ic == this->NC-1;
+                ret = clEnqueueWriteBuffer(slab.transfer_queue, slab.buffers[iOut][ic], CL_FALSE, 0, this->plane_size,
+                    &below[this->plane_size * ic], ic==0 ? 3 : 0, ic==0 ? wait : NULL, NULL);
+                ret |= clEnqueueWriteBuffer(slab.transfer_queue, slab.buffers[iOut][ic], CL_FALSE, this->plane_size * (slab.depth+1),
+                    this->plane_size, &above[this->plane_size * ic], 0, NULL, is_last ? &this->halo_events[is] : NULL);
+                throwOnError(ret,"SlabDecomposition::Step : buffer writing failed: ");
+            }
+            clFlush(slab.transfer_queue);
+        }
+
+        for(int is=0;is<NS;is++)
+        {
+            clReleaseEvent(edges_done[is]);
+            clReleaseEvent(edges_read[is]);
+            clReleaseEvent(inner_done[is]);
+        }
+        this->iCurrentBuffer = iOut;
+        this->has_stepped = true;
+    }
+}
@@ -0,0 +1,116 @@
+/*  Copyright 2011-2017 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __SLABDECOMPOSITION__
+#define __SLABDECOMPOSITION__
+
+// local:
+#include "OpenCL_utils.hpp"
+
+// STL:
+#include <string>
+#include <vector>
+
+/// Splits an OpenCL image into slabs along z, one for each of several devices, for images too big for one device.
+/**
+ * The devices share one context. Each slab is held on its device with a halo plane either side, which holds a copy of
+ * the neighboring plane of the next slab (or, at the edges of the arena, of the other end if it wraps around, or else
+ * of its own edge plane). The formula kernel computes each slab in three launches: its first and last planes, then the
+ * planes in between. As soon as the edge planes are done they are copied through the host into the halos of the
+ * neighboring slabs, on a second command queue, so the transfers overlap the computation of the inner planes.
+ *
+ * With split_by_numa each device is first partitioned into sub-devices by NUMA node (OpenCL 1.2), so that the cores
+ * working on a slab use the memory nearest to them.
+ */
+class SlabDecomposition
+{
+    public:
+
+        SlabDecomposition();
+        ~SlabDecomposition();
+
+        /// Gets ready to compute an X by Y by Z image of NC chemicals on the given devices of a platform. Throws on failure.
+        /**
+         * kernel_source must be the formula kernel for one slab (see FormulaOpenCLImageRD::AssembleSlabKernelSource),
+         * with the chemicals in separate buffers of values of value_size bytes. The kernel is run over global_x by
+         * global_y work items for each plane.
+         */
+        void Initialize(int iPlatform,const std::vector<int>& devices,bool split_by_numa,const std::string& kernel_source,
+            int X,int Y,int Z,int NC,size_t value_size,size_t global_x,size_t global_y,bool wrap);
+
+        /// Copies the image of each chemical into the slabs, including their halos.
+        void WriteCells(const std::vector<void*>& arrays);
+
+        /// Advances every slab by n_steps, exchanging the halos after each step.
+        void Step(int n_steps);
+
+        /// Waits for the slabs to finish and copies them into the image of each chemical.
+        void ReadCells(const std::vector<void*>& arrays);
+
+        /// Computes the largest and root-mean-square change of each chemical over the last step, from both buffers of each slab.
+        /** Only a few values per work-group come back from each device. Returns false if there hasn't been a step since the
+         *  cells were written, when there is nothing to compare with. */
+        bool ComputeChange(std::vector<double>& max_change,std::vector<double>& rms_change);
+
+        /// Releases all the OpenCL objects.
+        void Release();
+
+        int GetNumberOfSlabs() const { return (int)this->slabs.size(); }
+
+    protected:
+
+        /// Returns the devices to use, partitioning each into sub-devices if split_by_numa.
+        std::vector<cl_device_id> GetDevices(int iPlatform,const std::vector<int>& devices,bool split_by_numa);
+
+        /// Enqueues the kernel for the given planes of a slab (1 being its first plane after the halo).
+        void EnqueuePlanes(int iSlab,int first,int n,cl_uint n_wait,const cl_event* wait,cl_event* event);
+
+        /// Releases the halo events of the last step.
+        void ReleaseHaloEvents();
+
+    protected:
+
+        struct Slab
+        {
+            cl_device_id device_id;
+            cl_command_queue command_queue;     ///< for the kernel launches
+            cl_command_queue transfer_queue;    ///< for the halo transfers, so that they can run alongside the kernels
+            cl_kernel kernel;
+            cl_kernel change_kernel;            ///< reduces the change over the planes of the slab to a few values per work-group
+            cl_mem change_results;              ///< the maximum and sum of squares of each work-group
+            int z0,depth;                       ///< the first plane of the image in the slab, and the number of planes
+            std::vector<cl_mem> buffers[2];     ///< for each chemical, the planes of the slab with a halo plane either side
+            std::vector<char> first_planes;     ///< the first plane of each chemical after the last step, on its way to the slab before
+            std::vector<char> last_planes;      ///< the last plane of each chemical after the last step, on its way to the slab after
+        };
+
+        cl_context context;
+        cl_program program;
+        std::vector<cl_device_id> sub_devices; ///< the sub-devices that we made, if any, to be released with the context
+        std::vector<Slab> slabs;
+        std::vector<cl_event> halo_events;  ///< for each slab, the writing of its halos on the last step, or empty
+        int iCurrentBuffer;
+        bool has_stepped;                   ///< whether the other buffers hold the values from before the last step
+
+        int X,Y,Z,NC;
+        size_t value_size;
+        size_t plane_size;                  ///< in bytes
+        size_t global_x,global_y;
+        bool wrap;
+};
+
+#endif